@@ -14,8 +14,10 @@
 //*********************************************************************
 // #includes.
 //*********************************************************************
-#include <BLEDevice.h>
+#include <algorithm>
 #include "co_bmec_ble.h"
+#include "modules/memory/co_bmec_boot_arena.h"
+#include "modules/memory/co_bmec_memory_monitor.h"
 
 //*********************************************************************
 // defines.
@@ -28,81 +30,213 @@
 //*********************************************************************
 // definitions.
 //*********************************************************************
-void *CoBmecBle::ref_;
-
-void (*CoBmecBle::onConnectionStateChanged_)(bool connected);
-
 BLEServer *CoBmecBle::bleServer_;
 BleServiceWifi *CoBmecBle::bleServiceWifi_;
+BleServiceBulk *CoBmecBle::bleServiceBulk_;
+BleServiceDisplay *CoBmecBle::bleServiceDisplay_;
+BleServiceDfu *CoBmecBle::bleServiceDfu_;
+
+CoBmecBleAdvertiser *CoBmecBle::advertiser_;
+CoBmecBleLink *CoBmecBle::link_;
+CoBmecBleBulk *CoBmecBle::bulk_;
+CoBmecBleDfu *CoBmecBle::dfu_;
+
+CoBmecBle::Lifecycle CoBmecBle::lifecycle_ = CoBmecBle::Lifecycle::ALWAYS;
+volatile bool CoBmecBle::connected_ = false;
+SemaphoreHandle_t CoBmecBle::windowMutex_ = nullptr;
+uint32_t CoBmecBle::windowTMs_ = 0;
+uint32_t CoBmecBle::windowMs_ = CO_BMEC_BLE_BOOT_WINDOW_MS;
+bool CoBmecBle::released_ = false;
 
 //*********************************************************************
 // implementations.
 //*********************************************************************
 
 /// Initialises the ble module.
-/// @param ref global reference for callbacks.
-/// @param onConnectionStateChanged callback for connection state changes.
-void CoBmecBle::init(void *ref, void (*onConnectionStateChanged)(bool)) {
+/// @param flashMutex Global flash mutex.
+/// @param lifecycle when the BLE stack is resident.
+void CoBmecBle::init(SemaphoreHandle_t flashMutex,
+                     Lifecycle lifecycle) {
   log_i("BLE init.");
 
-  // Set the reference.
-  ref_ = ref;
-
-  // Set the callback.
-  onConnectionStateChanged_ = onConnectionStateChanged;
+  uint32_t freeHeap = esp_get_free_heap_size();
+  CoBmecMemoryMonitor::setPhase(CoBmecMemoryMonitor::Phase::BLE_INIT,
+                                true);
 
-  // Frees some extra stack.
-  esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
+  // Open the boot window. It is extended from the BLE task and from the loops.
+  lifecycle_ = lifecycle;
+  windowTMs_ = millis();
+  windowMs_ = CO_BMEC_BLE_BOOT_WINDOW_MS;
+  windowMutex_ = CoBmecBootArena::createMutex();
 
-  // Create the BLE Device.
-  BLEDevice::init("");
+  // Start the host, offering the largest MTU. The client picks the smaller of the two.
+  BleGatt::init(CO_BMEC_BLE_BULK_MAX_MTU,
+                ESP_PWR_LVL_P9);
 
-  // Set the power level to max.
-  BLEDevice::setPower(ESP_PWR_LVL_P9);
+  // Bonded clients keep their attribute cache between connections.
+  BleGatt::enableBonding();
 
   // Create the BLE Server.
   bleServer_ = BLEDevice::createServer();
 
   // Create the callback class
-  class BmeBleServerCallbacks : public BLEServerCallbacks {
+  class BmeBleServerCallbacks : public BleGattServerCallbacks {
 
    private:
 
-    void onConnect(BLEServer *pServer) override {
-      onConnectionStateChanged_(true);
+    void onPeerConnect(BLEServer *pServer, const BleGattPeer &peer) override {
+      connected_ = true;
+      advertiser_->onConnect();
+      link_->onConnect(peer);
+      bulk_->onConnect(peer);
+      dfu_->onConnect(peer);
+      CoBmecBus<ConnectionEvent>::publish({true});
+    }
+
+    void onPeerDisconnect(BLEServer *pServer) override {
+      connected_ = false;
+      keepAlive();
+      link_->onDisconnect();
+      bulk_->onDisconnect();
+      dfu_->onDisconnect();
+      advertiser_->onDisconnect();
+      CoBmecBus<ConnectionEvent>::publish({false});
     }
 
-    void onDisconnect(BLEServer *pServer) override {
-      pServer->getAdvertising()->start();
-      onConnectionStateChanged_(false);
+    void onPeerMtu(uint16_t mtu) override {
+      link_->onMtu(mtu);
     }
 
   };
 
   // Set the callback.
-  bleServer_->setCallbacks(new BmeBleServerCallbacks());
+  BleGatt::setServerCallbacks(bleServer_,
+                              CoBmecBootArena::make<BmeBleServerCallbacks>());
 
   // Create services.
-  bleServiceWifi_ = new BleServiceWifi(bleServer_);
+  bleServiceWifi_ = CoBmecBootArena::make<BleServiceWifi>(bleServer_);
+  bleServiceBulk_ = CoBmecBootArena::make<BleServiceBulk>(bleServer_);
+  bleServiceDisplay_ = CoBmecBootArena::make<BleServiceDisplay>(bleServer_);
+  bleServiceDfu_ = CoBmecBootArena::make<BleServiceDfu>(bleServer_);
+
+  // Create the advertiser, started by startAdvertising.
+  advertiser_ = CoBmecBootArena::make<CoBmecBleAdvertiser>(bleServer_);
+
+  // Create the link, timing reconnects on the AP state the client reads first.
+  link_ = CoBmecBootArena::make<CoBmecBleLink>(bleServer_,
+                                               flashMutex);
+  link_->timeFirstRead(bleServiceWifi_->charApState_);
+
+  // Create the bulk transfer engine.
+  bulk_ = CoBmecBootArena::make<CoBmecBleBulk>(bleServer_,
+                                               bleServiceBulk_,
+                                               link_);
+
+  // Create the firmware update engine.
+  dfu_ = CoBmecBootArena::make<CoBmecBleDfu>(bleServer_,
+                                             bleServiceDfu_,
+                                             link_);
 
   // Start services.
   bleServiceWifi_->bleService_->start();
-
-  log_i("BLE initialised.");
+  bleServiceBulk_->bleService_->start();
+  bleServiceDisplay_->bleService_->start();
+  bleServiceDfu_->bleService_->start();
+
+  CoBmecMemoryMonitor::setPhase(CoBmecMemoryMonitor::Phase::BLE_INIT,
+                                false);
+  log_i("BLE initialised, host %s, free heap %lu -> %lu bytes",
+        BLE_GATT_BACKEND,
+        (unsigned long) freeHeap,
+        (unsigned long) esp_get_free_heap_size());
 }
 
-/// Sets the device name and starts advertising.
-/// @param advertisingName advertising name for the device.
+/// Sets the device name and starts advertising, on the fast interval. Advertising is run by loop.
+/// @param advertisingName advertising name for the device, kept.
 void CoBmecBle::startAdvertising(const char *advertisingName) {
 
   log_i("Starting advertising as %s", advertisingName);
 
   // Set the device name.
-  esp_ble_gap_set_device_name(advertisingName);
+  advertiser_->setName(advertisingName);
 
   // Start advertising
-  bleServer_->getAdvertising()->start();
+  advertiser_->boost();
+}
+
+/// Runs the advertising, the link setup and the firmware update, and releases the BLE stack
+/// once it is no longer needed. Called periodically.
+/// @param provisioned true if the device has a wifi profile.
+void CoBmecBle::loop(bool provisioned) {
+  if (!released_) {
+    advertiser_->loop();
+    link_->loop();
+    dfu_->loop();
+  }
+
+  if (lifecycle_ != Lifecycle::ON_DEMAND || released_) {
+    return;
+  }
+
+  // Provisioning, connected clients and a firmware update in progress keep the window open.
+  if (!provisioned || connected_ || dfu_->isActive()) {
+    keepAlive();
+    return;
+  }
+
+  if (!isWindowOpen()) {
+    release();
+  }
+}
+
+/// Keeps the BLE up for CO_BMEC_BLE_IDLE_WINDOW_MS from now, e.g. on a button press.
+/// Once released the BLE can only be restarted by a reset. Callable from any task.
+void CoBmecBle::keepAlive() {
+  if (!windowMutex_) {
+    return;
+  }
+
+  xSemaphoreTake(windowMutex_,
+                 portMAX_DELAY);
+  uint32_t nowMs = millis();
+  uint32_t remainingMs = windowMs_ - std::min(uint32_t(nowMs - windowTMs_),
+                                              uint32_t(windowMs_));
+
+  // Never shorten the boot window.
+  if (remainingMs < CO_BMEC_BLE_IDLE_WINDOW_MS) {
+    windowTMs_ = nowMs;
+    windowMs_ = CO_BMEC_BLE_IDLE_WINDOW_MS;
+  }
+  while (!xSemaphoreGive(windowMutex_)) log_e("Failed to give windowMutex_.");
+}
+
+/// @returns true until the window has elapsed.
+bool CoBmecBle::isWindowOpen() {
+  xSemaphoreTake(windowMutex_,
+                 portMAX_DELAY);
+  bool open = millis() - windowTMs_ < windowMs_;
+  while (!xSemaphoreGive(windowMutex_)) log_e("Failed to give windowMutex_.");
+  return open;
+}
+
+/// Stops the BLE stack and returns the controller and host memory to the heap.
+void CoBmecBle::release() {
+  uint32_t freeHeap = esp_get_free_heap_size();
+
+  log_i("BLE release.");
+
+  advertiser_->stop();
+
+  // Stop the host and the controller, whose memory is released with
+  // esp_bt_controller_mem_release(ESP_BT_MODE_BTDM) so it cannot be restarted.
+  // The server, service and characteristic objects remain on both hosts so that modules
+  // can keep writing values, BleGatt::notify drops the notifications.
+  BleGatt::release();
+  released_ = true;
 
+  log_i("BLE released, free heap %lu -> %lu bytes",
+        (unsigned long) freeHeap,
+        (unsigned long) esp_get_free_heap_size());
 }
 
 /// @}
\ No newline at end of file
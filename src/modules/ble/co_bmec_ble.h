@@ -18,11 +18,22 @@
 // #includes.
 //*********************************************************************
 #include "Arduino.h"
+#include "gatt/ble_gatt.h"
 #include "services/wifi/ble_wifi_service.h"
+#include "services/bulk/ble_bulk_service.h"
+#include "services/display/ble_display_service.h"
+#include "services/dfu/ble_dfu_service.h"
+#include "co_bmec_ble_bulk.h"
+#include "co_bmec_ble_dfu.h"
+#include "co_bmec_ble_link.h"
+#include "co_bmec_ble_advertiser.h"
+#include "modules/bus/co_bmec_bus.h"
 
 //*********************************************************************
 // #defines
 //*********************************************************************
+#define CO_BMEC_BLE_BOOT_WINDOW_MS         300000  ///< Time BLE stays up after boot when on demand.
+#define CO_BMEC_BLE_IDLE_WINDOW_MS         60000  ///< Time BLE stays up after a disconnect or keep alive.
 
 //*********************************************************************
 // #forward declarations
@@ -35,17 +46,51 @@
 class CoBmecBle {
  public:
 
-  static void *ref_;
+  /// When the BLE stack is resident.
+  enum class Lifecycle : uint8_t {
+    ALWAYS,  ///< From boot until reset.
+    ON_DEMAND,  ///< While unprovisioned, connected or within a window, then released until reset.
+  };
+
+  /// Published on CoBmecBus by the BLE task when a client connects or disconnects.
+  struct ConnectionEvent {
+    bool connected;
+  };
 
   static BLEServer *bleServer_;
   static BleServiceWifi *bleServiceWifi_;
+  static BleServiceBulk *bleServiceBulk_;
+  static BleServiceDisplay *bleServiceDisplay_;
+  static BleServiceDfu *bleServiceDfu_;
+
+  static CoBmecBleAdvertiser *advertiser_;
+  static CoBmecBleLink *link_;
+  static CoBmecBleBulk *bulk_;
+  static CoBmecBleDfu *dfu_;
 
-  static void init(void *ref, void (*onConnectionStateChanged)(bool));
+  static void init(SemaphoreHandle_t flashMutex,
+                   Lifecycle lifecycle = Lifecycle::ALWAYS);
   static void startAdvertising(const char* advertisingName);
+  static void loop(bool provisioned);
+  static void keepAlive();
+
+  /// @returns true once the controller memory has been returned to the heap.
+  static bool isReleased() {
+    return released_;
+  };
 
  private:
 
-  static void (*onConnectionStateChanged_)(bool connected);
+  static Lifecycle lifecycle_;
+  static volatile bool connected_;
+  static SemaphoreHandle_t windowMutex_;  ///< Guards the window, nullptr until init.
+  static uint32_t windowTMs_;  ///< Start of the window.
+  static uint32_t windowMs_;  ///< Length of the window.
+  static bool released_;
+
+  static bool isWindowOpen();
+
+  static void release();
 };
 
 /// @}
\ No newline at end of file
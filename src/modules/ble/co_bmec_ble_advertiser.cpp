@@ -0,0 +1,138 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file co_bmec_ble_advertiser.cpp
+/// @brief Advertising schedule and the device status carried in the advertisements.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "co_bmec_ble_advertiser.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define FAST_INTERVAL_MIN           32  /// 20 ms, in 0.625 ms units.
+#define FAST_INTERVAL_MAX           48  /// 30 ms.
+#define SLOW_INTERVAL_MIN           1600  /// 1 s.
+#define SLOW_INTERVAL_MAX           2056  /// 1.285 s.
+#define UNPROVISIONED_POWER         ESP_PWR_LVL_P9
+#define PROVISIONED_POWER           ESP_PWR_LVL_N0
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Constructors.
+
+/// @param bleServer server.
+CoBmecBleAdvertiser::CoBmecBleAdvertiser(BLEServer *bleServer)
+    : bleServer_(bleServer),
+      boostTMs_(millis()) {}
+
+// Public methods.
+
+/// Sets the advertised name, applied by the next loop.
+/// @param name device name, kept.
+void CoBmecBleAdvertiser::setName(const char *name) {
+  name_ = name;
+  BleGatt::setDeviceName(name);
+  phase_ = Phase::STOPPED;
+}
+
+/// Sets the status advertised, applied by the next loop.
+/// @param apState CoBmecWifi::ApState.
+/// @param provisioned true if the device has a Wi-Fi profile.
+/// @param timeSynced true once the time has been synced.
+void CoBmecBleAdvertiser::setStatus(uint8_t apState, bool provisioned, bool timeSynced) {
+  data_.apState = apState;
+  data_.flags = (provisioned ? static_cast<uint8_t>(Flag::PROVISIONED) : 0)
+      | (timeSynced ? static_cast<uint8_t>(Flag::TIME_SYNCED) : 0);
+}
+
+/// Advertises on the fast interval for CO_BMEC_BLE_ADV_FAST_WINDOW_MS from now.
+void CoBmecBleAdvertiser::boost() {
+  boostTMs_ = millis();
+}
+
+/// The host stops advertising on a connection. Called from the BLE task.
+void CoBmecBleAdvertiser::onConnect() {
+  connected_ = true;
+}
+
+/// Called from the BLE task.
+void CoBmecBleAdvertiser::onDisconnect() {
+  boost();
+  connected_ = false;
+}
+
+/// Runs the schedule. Called periodically from a single task.
+void CoBmecBleAdvertiser::loop() {
+  if (connected_) {
+    phase_ = Phase::STOPPED;
+    return;
+  }
+
+  uint32_t nowMs = millis();
+  Phase phase = nowMs - boostTMs_ < CO_BMEC_BLE_ADV_FAST_WINDOW_MS ? Phase::FAST : Phase::SLOW;
+
+  // Status changes are rate limited, phase changes are not.
+  bool changed = memcmp(&data_,
+                        &advertised_,
+                        sizeof(data_)) && nowMs - updateTMs_ >= CO_BMEC_BLE_ADV_UPDATE_MS;
+  if (phase != phase_ || changed) {
+    start(phase);
+  }
+}
+
+/// Stops advertising, e.g. before the stack is released.
+void CoBmecBleAdvertiser::stop() {
+  bleServer_->getAdvertising()->stop();
+  phase_ = Phase::STOPPED;
+}
+
+// Private methods.
+
+/// Rebuilds the advertisement and restarts advertising.
+/// @param phase phase.
+void CoBmecBleAdvertiser::start(Phase phase) {
+  BLEAdvertising *advertising = bleServer_->getAdvertising();
+  advertising->stop();
+
+  // Scale the power down once provisioned.
+  bool provisioned = data_.flags & static_cast<uint8_t>(Flag::PROVISIONED);
+  if (provisioned != provisioned_ || phase_ == Phase::STOPPED) {
+    BleGatt::setAdvertisingPower(provisioned ? PROVISIONED_POWER : UNPROVISIONED_POWER);
+    provisioned_ = provisioned;
+  }
+
+  BLEAdvertisementData advertisementData;
+  advertisementData.setFlags(BLE_GATT_ADV_FLAGS);
+  advertisementData.setName(name_);
+  advertisementData.setManufacturerData(std::string(reinterpret_cast<const char *>(&data_),
+                                                    sizeof(data_)));
+  advertising->setAdvertisementData(advertisementData);
+
+  advertising->setMinInterval(phase == Phase::FAST ? FAST_INTERVAL_MIN : SLOW_INTERVAL_MIN);
+  advertising->setMaxInterval(phase == Phase::FAST ? FAST_INTERVAL_MAX : SLOW_INTERVAL_MAX);
+  advertising->start();
+
+  if (phase != phase_) {
+    log_i("BLE advertising %s, power %s",
+          phase == Phase::FAST ? "fast" : "slow",
+          provisioned ? "low" : "high");
+  }
+
+  phase_ = phase;
+  advertised_ = data_;
+  updateTMs_ = millis();
+}
+
+/// @}
@@ -0,0 +1,106 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file co_bmec_ble_advertiser.h
+/// @brief Advertising schedule and the device status carried in the advertisements.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "Arduino.h"
+#include "gatt/ble_gatt.h"
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+#define CO_BMEC_BLE_ADV_FAST_WINDOW_MS     30000  ///< Time on the fast interval after boot or a user action.
+#define CO_BMEC_BLE_ADV_UPDATE_MS          1000  ///< Shortest time between status updates.
+#define CO_BMEC_BLE_ADV_COMPANY_ID         0xffff  ///< Bluetooth SIG test company id.
+#define CO_BMEC_BLE_ADV_VERSION            1  ///< Bumped whenever ManufacturerData changes layout.
+
+//*********************************************************************
+// #forward declarations
+//*********************************************************************
+
+//*********************************************************************
+// class declarations
+//*********************************************************************
+/// Advertises on a fast interval for CO_BMEC_BLE_ADV_FAST_WINDOW_MS after boot, a disconnect
+/// or a user action, so that the device is found promptly, then backs off to the slow interval.
+/// Once provisioned the advertising power is scaled down, the phone is only needed nearby
+/// for maintenance.
+///
+/// The device status is carried in the manufacturer data, so a scanner can check it without
+/// connecting. The advertisement is only rebuilt when the phase or the status changes.
+///
+/// Advertising is only driven from loop(), the BLE task just flags connections.
+class CoBmecBleAdvertiser {
+ public:
+
+  enum class Phase : uint8_t {
+    STOPPED,  ///< Connected, or released.
+    FAST,
+    SLOW,
+  };
+
+  enum class Flag : uint8_t {
+    PROVISIONED = 1 << 0,  ///< Has a Wi-Fi profile.
+    TIME_SYNCED = 1 << 1,  ///< The time has been synced.
+  };
+
+  /// Manufacturer data, little endian.
+  struct __attribute__((packed)) ManufacturerData {
+    uint16_t companyId = CO_BMEC_BLE_ADV_COMPANY_ID;
+    uint8_t version = CO_BMEC_BLE_ADV_VERSION;
+    uint8_t apState = 0;  ///< CoBmecWifi::ApState.
+    uint8_t flags = 0;  ///< Flag bits.
+  };
+
+  explicit CoBmecBleAdvertiser(BLEServer *bleServer);
+
+  void setName(const char *name);
+
+  void setStatus(uint8_t apState, bool provisioned, bool timeSynced);
+
+  void boost();
+
+  void onConnect();
+
+  void onDisconnect();
+
+  void loop();
+
+  void stop();
+
+  /// @returns the phase.
+  Phase getPhase() const {
+    return phase_;
+  };
+
+ private:
+
+  BLEServer *bleServer_;
+  const char *name_ = "";
+
+  volatile bool connected_ = false;
+  volatile uint32_t boostTMs_ = 0;  ///< Start of the fast window.
+
+  Phase phase_ = Phase::STOPPED;
+  ManufacturerData data_;  ///< Status to advertise.
+  ManufacturerData advertised_;  ///< Status being advertised.
+  bool provisioned_ = false;
+  uint32_t updateTMs_ = 0;
+
+  void start(Phase phase);
+};
+
+/// @}
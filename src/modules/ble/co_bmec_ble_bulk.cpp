@@ -0,0 +1,338 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file co_bmec_ble_bulk.cpp
+/// @brief Credit flow controlled bulk transfers over BLE notifications.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include <memory>
+#include "co_bmec_ble_bulk.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define ATT_NOTIFY_OVERHEAD         3  /// Opcode and handle of a notification.
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Constructors.
+
+/// @param bleServer server, for the negotiated MTU.
+/// @param bleServiceBulk bulk service.
+/// @param link link, for the connection parameters.
+CoBmecBleBulk::CoBmecBleBulk(BLEServer *bleServer, BleServiceBulk *bleServiceBulk, CoBmecBleLink *link)
+    : bleServer_(bleServer),
+      bleServiceBulk_(bleServiceBulk),
+      link_(link) {
+
+  bleServiceBulk_->charControl_->setCallbacks(this);
+  bleServiceBulk_->charStats_->setCallbacks(this);
+
+  // Start the sender.
+  (void) CoBmecBootArena::createTask(
+      [](void *bulkRef) {
+        static_cast<CoBmecBleBulk *>(bulkRef)->run();
+      }, // Function to implement the task
+      "ble_bulk", // Name of the task
+      CO_BMEC_BLE_BULK_TASK_STACK_SIZE,  // Stack size.
+      this,  // Task input parameter
+      CO_BMEC_BLE_BULK_TASK_PRIORITY,  // Priority of the task
+      CO_BMEC_BLE_BULK_TASK_CORE); // Core where the task should run
+}
+
+// Public methods.
+
+/// Registers the payload sent when the client sends REQUEST with the channel.
+/// @param channel payload type.
+/// @param source formats the payload, run by the bulk task.
+void CoBmecBleBulk::setSource(Channel channel, const Source &source) {
+  if (static_cast<uint8_t>(channel) < sizeof(sources_) / sizeof(sources_[0])) {
+    sources_[static_cast<uint8_t>(channel)] = source;
+  }
+}
+
+/// Queues a copy of a payload for the bulk task. Does not block, callable from any task.
+/// @param channel payload type.
+/// @param data payload.
+/// @param length length of the payload.
+/// @returns false if no client is connected, or the queue or heap is full.
+bool CoBmecBleBulk::post(Channel channel, const uint8_t *data, size_t length) {
+  if (!connected_ || !length) {
+    return false;
+  }
+
+  Transfer transfer;
+  transfer.channel = channel;
+  transfer.data = new(std::nothrow) uint8_t[length];
+  transfer.length = length;
+  if (!transfer.data) {
+    return false;
+  }
+  memcpy(transfer.data,
+         data,
+         length);
+  if (xQueueSend(transfers_,
+                 &transfer,
+                 0) != pdTRUE) {
+    log_w("BLE bulk queue full, channel %u dropped.",
+          static_cast<uint8_t>(channel));
+    delete[] transfer.data;
+    return false;
+  }
+  return true;
+}
+
+/// Sends a payload, blocking until every frame is sent. Not to be called from the BLE task,
+/// which delivers the credits.
+/// @param channel payload type.
+/// @param data payload.
+/// @param length length of the payload.
+/// @param creditTimeoutMs time to wait for each credit.
+/// @returns true if the payload was sent.
+bool CoBmecBleBulk::send(Channel channel, const uint8_t *data, size_t length, uint32_t creditTimeoutMs) {
+  if (!connected_) {
+    return false;
+  }
+
+  xSemaphoreTake(sendMutex_, portMAX_DELAY);
+
+  uint16_t mtu = std::min(BleGatt::peerMtu(bleServer_,
+                                            peer_),
+                          uint16_t(CO_BMEC_BLE_BULK_MAX_MTU));
+  size_t frameLength = mtu - ATT_NOTIFY_OVERHEAD;
+  if (frameLength <= sizeof(FrameHeader) + sizeof(uint32_t)) {
+    xSemaphoreGive(sendMutex_);
+    return false;
+  }
+
+  aborted_ = false;
+  sending_ = true;
+  link_->setProfile(CoBmecBleLink::Profile::BULK);
+
+  log_i("BLE bulk transfer of %u bytes, mtu %u",
+        length,
+        mtu);
+
+  uint32_t startMs = millis();
+  uint32_t frames = 0;
+  size_t offset = 0;
+  bool sent = true;
+  FrameHeader header;
+  header.channel = static_cast<uint8_t>(channel);
+
+  do {
+    // Wait for the client to accept another frame.
+    if (xSemaphoreTake(credits_, pdMS_TO_TICKS(creditTimeoutMs)) != pdTRUE) {
+      log_w("BLE bulk transfer timed out waiting for credit.");
+      stats_.timeouts++;
+      sent = false;
+      break;
+    }
+    if (aborted_ || !connected_) {
+      log_w("BLE bulk transfer aborted.");
+      stats_.aborts++;
+      sent = false;
+      break;
+    }
+
+    size_t position = sizeof(FrameHeader);
+    header.flags = 0;
+    if (!offset) {
+      header.flags |= static_cast<uint8_t>(FrameFlag::FIRST);
+      uint32_t total = length;
+      memcpy(&frame_[position],
+             &total,
+             sizeof(total));
+      position += sizeof(total);
+    }
+
+    size_t chunk = std::min(length - offset,
+                            frameLength - position);
+    memcpy(&frame_[position],
+           &data[offset],
+           chunk);
+    position += chunk;
+    offset += chunk;
+
+    if (offset == length) {
+      header.flags |= static_cast<uint8_t>(FrameFlag::LAST);
+    }
+    memcpy(frame_,
+           &header,
+           sizeof(header));
+
+    bleServiceBulk_->charData_->setValue(frame_,
+                                         position);
+    BleGatt::notify(bleServiceBulk_->charData_);
+
+    header.sequence++;
+    frames++;
+  } while (offset < length);
+
+  sending_ = false;
+  link_->setProfile(CoBmecBleLink::Profile::IDLE);
+
+  if (sent) {
+    uint32_t elapsedMs = std::max(millis() - startMs,
+                                  1ul);
+    stats_.mtu = mtu;
+    stats_.transfers++;
+    stats_.bytes += length;
+    stats_.frames += frames;
+    stats_.bytesPerS = uint32_t(uint64_t(length) * 1000 / elapsedMs);
+
+    log_i("BLE bulk transfer done, %lu frames in %lu ms, %lu.%02lu KB/s",
+          (unsigned long) frames,
+          (unsigned long) elapsedMs,
+          (unsigned long) (stats_.bytesPerS / 1024),
+          (unsigned long) (stats_.bytesPerS % 1024 * 100 / 1024));
+  }
+
+  xSemaphoreGive(sendMutex_);
+  return sent;
+}
+
+/// Requests data length extension so a full MTU frame fits in few link layer packets.
+/// @param peer client.
+void CoBmecBleBulk::onConnect(const BleGattPeer &peer) {
+  peer_ = peer;
+  clearCredits();
+  connected_ = true;
+
+  BleGatt::setDataLength(peer_,
+                         CO_BMEC_BLE_BULK_DATA_LENGTH);
+}
+
+/// Ends a transfer in progress, credits do not carry over to the next connection.
+void CoBmecBleBulk::onDisconnect() {
+  connected_ = false;
+  clearCredits();
+
+  // Wake a sender waiting for credit.
+  xSemaphoreGive(credits_);
+}
+
+// Private methods.
+
+/// Sends the queued transfers, one at a time. Run by the bulk task.
+void CoBmecBleBulk::run() {
+  Transfer transfer;
+  for (;;) {
+    if (xQueueReceive(transfers_,
+                      &transfer,
+                      portMAX_DELAY) == pdTRUE) {
+      sendTransfer(transfer);
+      delete[] transfer.data;
+    }
+  }
+}
+
+/// Sends a posted payload, or formats and sends the channel's source.
+/// @param transfer transfer, its data is freed by the caller.
+void CoBmecBleBulk::sendTransfer(const Transfer &transfer) {
+  if (transfer.data) {
+    (void) send(transfer.channel,
+                transfer.data,
+                transfer.length,
+                CO_BMEC_BLE_BULK_CREDIT_TIMEOUT_MS);
+    return;
+  }
+
+  const Source &source = sources_[static_cast<uint8_t>(transfer.channel)];
+  if (!source) {
+    log_w("BLE bulk channel %u has no source.",
+          static_cast<uint8_t>(transfer.channel));
+    return;
+  }
+  std::unique_ptr<char[]> buffer(new(std::nothrow) char[CO_BMEC_BLE_BULK_SOURCE_LEN]);
+  if (!buffer) {
+    return;
+  }
+  size_t length = std::min(source(buffer.get(),
+                                  CO_BMEC_BLE_BULK_SOURCE_LEN),
+                           size_t(CO_BMEC_BLE_BULK_SOURCE_LEN));
+  if (length) {
+    (void) send(transfer.channel,
+                reinterpret_cast<uint8_t *>(buffer.get()),
+                length,
+                CO_BMEC_BLE_BULK_CREDIT_TIMEOUT_MS);
+  }
+}
+
+/// Discards any outstanding credits.
+void CoBmecBleBulk::clearCredits() {
+  while (xSemaphoreTake(credits_, 0) == pdTRUE) {
+  }
+}
+
+/// Publishes the statistics.
+/// @param characteristic stats characteristic.
+void CoBmecBleBulk::onRead(BLECharacteristic *characteristic) {
+  if (characteristic == bleServiceBulk_->charStats_) {
+    Stats stats = stats_;
+    characteristic->setValue(reinterpret_cast<uint8_t *>(&stats),
+                             sizeof(stats));
+  }
+}
+
+/// Handles the client commands.
+/// @param characteristic control characteristic.
+void CoBmecBleBulk::onWrite(BLECharacteristic *characteristic) {
+  if (characteristic != bleServiceBulk_->charControl_) {
+    return;
+  }
+
+  std::string data = characteristic->getValue();
+  if (data.empty()) {
+    return;
+  }
+
+  switch (static_cast<Command>(data[0])) {
+    case Command::CREDIT: {
+      if (data.length() >= 2) {
+        // Credits beyond the semaphore's count are dropped.
+        for (uint8_t i = 0; i < uint8_t(data[1]); i++) {
+          if (xSemaphoreGive(credits_) != pdTRUE) {
+            break;
+          }
+        }
+      }
+    }
+      break;
+    case Command::ABORT: {
+      aborted_ = true;
+      clearCredits();
+
+      // Wake a sender waiting for credit. While idle the credit would carry into the next transfer.
+      if (sending_) {
+        xSemaphoreGive(credits_);
+      }
+    }
+      break;
+    case Command::REQUEST: {
+      Transfer transfer;
+      transfer.channel = data.length() >= 2 ? static_cast<Channel>(data[1]) : Channel::UNDEFINED;
+      if (static_cast<uint8_t>(transfer.channel) < sizeof(sources_) / sizeof(sources_[0])) {
+        (void) xQueueSend(transfers_,
+                          &transfer,
+                          0);
+      }
+    }
+      break;
+    default:break;
+  }
+}
+
+/// @}
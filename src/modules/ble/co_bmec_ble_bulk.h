@@ -0,0 +1,152 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file co_bmec_ble_bulk.h
+/// @brief Credit flow controlled bulk transfers over BLE notifications.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <functional>
+#include "Arduino.h"
+#include "services/bulk/ble_bulk_service.h"
+#include "co_bmec_ble_link.h"
+#include "modules/memory/co_bmec_boot_arena.h"
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+#define CO_BMEC_BLE_BULK_MAX_MTU           517  ///< Largest ATT MTU, requested from the client.
+#define CO_BMEC_BLE_BULK_MAX_CREDITS       64  ///< Frames the client may grant ahead.
+#define CO_BMEC_BLE_BULK_DATA_LENGTH       251  ///< Link layer payload with data length extension.
+#define CO_BMEC_BLE_BULK_QUEUE_LENGTH      4  ///< Transfers waiting for the sender task.
+#define CO_BMEC_BLE_BULK_SOURCE_LEN        4096  ///< Buffer a requested payload is formatted into.
+#define CO_BMEC_BLE_BULK_CREDIT_TIMEOUT_MS 5000  ///< Time the sender task waits for each credit.
+#define CO_BMEC_BLE_BULK_TASK_STACK_SIZE   3072
+#define CO_BMEC_BLE_BULK_TASK_PRIORITY     1  ///< Below the application loops.
+#define CO_BMEC_BLE_BULK_TASK_CORE         0
+
+//*********************************************************************
+// #forward declarations
+//*********************************************************************
+
+//*********************************************************************
+// class declarations
+//*********************************************************************
+/// Streams payloads larger than one attribute as framed, sequence numbered notifications.
+///
+/// Each frame is a FrameHeader followed by as much payload as the negotiated MTU allows.
+/// The first frame's payload starts with the total length as a uint32. The client grants
+/// credits on the control characteristic and every frame consumes one, so the client
+/// sets the pace and frames are never dropped by a full BLE queue.
+///
+/// Producers post() a payload, or register a Source that the client asks for with REQUEST.
+/// Both are sent one at a time by the bulk task, so no producer waits on the client.
+class CoBmecBleBulk : public BLECharacteristicCallbacks {
+ public:
+
+  /// Payload types, so one client can tell transfers apart.
+  enum class Channel : uint8_t {
+    UNDEFINED, SCAN, LOG, TRACE, TELEMETRY,
+  };
+
+  /// Client commands on the control characteristic.
+  enum class Command : uint8_t {
+    UNDEFINED,
+    CREDIT,  ///< Followed by the number of frames granted (uint8).
+    ABORT,  ///< Abandons the transfer in progress.
+    REQUEST,  ///< Followed by the Channel whose Source is to be sent.
+  };
+
+  enum class FrameFlag : uint8_t {
+    FIRST = 1 << 0,
+    LAST = 1 << 1,
+  };
+
+  struct __attribute__((packed)) FrameHeader {
+    uint16_t sequence = 0;  ///< From 0 in each transfer.
+    uint8_t channel = 0;
+    uint8_t flags = 0;
+  };
+
+  /// Published on the stats characteristic.
+  struct __attribute__((packed)) Stats {
+    uint16_t mtu = 0;  ///< MTU of the last transfer.
+    uint32_t transfers = 0;  ///< Completed transfers.
+    uint32_t bytes = 0;  ///< Payload bytes of completed transfers.
+    uint32_t frames = 0;
+    uint16_t timeouts = 0;  ///< Transfers abandoned waiting for credits.
+    uint16_t aborts = 0;  ///< Transfers abandoned by the client.
+    uint32_t bytesPerS = 0;  ///< Throughput of the last transfer.
+  };
+
+  /// Formats a payload on request, run by the bulk task.
+  /// @returns the length written, at most the length given.
+  using Source = std::function<size_t(char *buffer, size_t length)>;
+
+  CoBmecBleBulk(BLEServer *bleServer, BleServiceBulk *bleServiceBulk, CoBmecBleLink *link);
+
+  void setSource(Channel channel, const Source &source);
+
+  bool post(Channel channel, const uint8_t *data, size_t length);
+
+  bool send(Channel channel, const uint8_t *data, size_t length, uint32_t creditTimeoutMs);
+
+  void onConnect(const BleGattPeer &peer);
+
+  void onDisconnect();
+
+  Stats getStats() const {
+    return stats_;
+  };
+
+ private:
+
+  BLEServer *bleServer_;
+  BleServiceBulk *bleServiceBulk_;
+  CoBmecBleLink *link_;
+
+  /// A payload waiting for the bulk task. Plain data so that it can be queued.
+  struct Transfer {
+    Channel channel = Channel::UNDEFINED;
+    uint8_t *data = nullptr;  ///< Heap copy, freed once sent. nullptr to send the channel's Source.
+    size_t length = 0;
+  };
+
+  SemaphoreHandle_t sendMutex_ = CoBmecBootArena::createMutex();  ///< One transfer at a time.
+  SemaphoreHandle_t credits_ = CoBmecBootArena::createCounting(CO_BMEC_BLE_BULK_MAX_CREDITS, 0);
+  QueueHandle_t transfers_ = CoBmecBootArena::createQueue(CO_BMEC_BLE_BULK_QUEUE_LENGTH, sizeof(Transfer));
+
+  /// Indexed by Channel. Set before the client connects.
+  Source sources_[static_cast<uint8_t>(Channel::TELEMETRY) + 1];
+
+  BleGattPeer peer_;
+  volatile bool connected_ = false;
+  volatile bool sending_ = false;  ///< A sender may be waiting for credit.
+  volatile bool aborted_ = false;
+
+  uint8_t frame_[CO_BMEC_BLE_BULK_MAX_MTU]{};  ///< Frame being sent. Guarded by sendMutex_.
+  Stats stats_;
+
+  void clearCredits();
+
+  void run();
+
+  void sendTransfer(const Transfer &transfer);
+
+  // Overrides.
+  void onRead(BLECharacteristic *characteristic) override;
+
+  void onWrite(BLECharacteristic *characteristic) override;
+};
+
+/// @}
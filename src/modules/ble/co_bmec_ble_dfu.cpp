@@ -0,0 +1,424 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file co_bmec_ble_dfu.cpp
+/// @brief Firmware update over BLE, with a windowed transfer.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include <Update.h>
+#include "co_bmec_ble_dfu.h"
+#include "modules/memory/co_bmec_memory_monitor.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Constructors.
+
+/// @param bleServer server, for the negotiated MTU.
+/// @param bleServiceDfu firmware update service.
+/// @param link link, for the connection parameters.
+CoBmecBleDfu::CoBmecBleDfu(BLEServer *bleServer, BleServiceDfu *bleServiceDfu, CoBmecBleLink *link)
+    : bleServer_(bleServer),
+      bleServiceDfu_(bleServiceDfu),
+      link_(link) {
+
+  bleServiceDfu_->charData_->setCallbacks(this);
+  bleServiceDfu_->charControl_->setCallbacks(this);
+  bleServiceDfu_->charStatus_->setCallbacks(this);
+}
+
+// Public methods.
+
+/// @param peer client.
+void CoBmecBleDfu::onConnect(const BleGattPeer &peer) {
+  peer_ = peer;
+  connected_ = true;
+}
+
+/// Ends the session, the client starts over once reconnected.
+void CoBmecBleDfu::onDisconnect() {
+  connected_ = false;
+  disconnected_ = true;
+}
+
+/// Starts the session task once the client starts a session. Called periodically.
+void CoBmecBleDfu::loop() {
+  if (running_ || pendingCommand_ != Command::START) {
+    return;
+  }
+
+  running_ = true;
+  if (xTaskCreatePinnedToCore(
+      [](void *dfuRef) {
+        static_cast<CoBmecBleDfu *>(dfuRef)->run();
+        vTaskDelete(nullptr);
+      }, // Function to implement the task
+      "dfu", // Name of the task
+      CO_BMEC_BLE_DFU_TASK_STACK_SIZE,  // Stack size.
+      this,  // Task input parameter
+      CO_BMEC_OTA_TASK_PRIORITY,  // Priority of the task
+      nullptr,  // Task handle.
+      xPortGetCoreID()) != pdPASS) {  // Core where the task should run
+    log_e("BLE DFU task could not be created.");
+    running_ = false;
+    pendingCommand_ = Command::UNDEFINED;
+    result_ = CoBmecOta::Result::NO_MEMORY;
+    state_ = State::FAILED;
+    notifyStatus();
+  }
+}
+
+// Private methods.
+
+/// Runs the session until it ends. Run by the session task.
+void CoBmecBleDfu::run() {
+  watchdogId_ = CoBmecWatchdog::add("dfu",
+                                    CO_BMEC_BLE_DFU_TASK_DEADLINE_MS);
+  do {
+    CoBmecWatchdog::beat(watchdogId_);
+    step();
+    vTaskDelay(std::max(uint32_t(CO_BMEC_BLE_DFU_PERIOD_MS / portTICK_PERIOD_MS),
+                        uint32_t(1)));
+  } while (state_ == State::RECEIVING || state_ == State::DONE || pendingCommand_ == Command::START);
+
+  CoBmecWatchdog::remove(watchdogId_);
+  watchdogId_ = -1;
+  running_ = false;
+}
+
+/// Runs the commands, decodes the queued chunks and acknowledges them.
+void CoBmecBleDfu::step() {
+  if (disconnected_) {
+    disconnected_ = false;
+    if (state_ == State::RECEIVING) {
+      log_w("BLE DFU interrupted by the disconnect at %lu of %lu bytes.",
+            (unsigned long) decoded_,
+            (unsigned long) manifest_.payloadSize);
+      stop(State::IDLE,
+           CoBmecOta::Result::INTERRUPTED);
+    }
+  }
+
+  Command command = pendingCommand_;
+  pendingCommand_ = Command::UNDEFINED;
+  if (command == Command::START) {
+    CoBmecWatchdog::trace(watchdogId_,
+                          "start");
+    start();
+  }
+  else if (command == Command::ABORT && state_ == State::RECEIVING) {
+    log_w("BLE DFU aborted by the client.");
+    stop(State::IDLE,
+         CoBmecOta::Result::INTERRUPTED);
+    notifyStatus();
+  }
+
+  if (state_ == State::DONE && millis() - doneTMs_ >= CO_BMEC_BLE_DFU_RESTART_MS) {
+    log_w("BLE DFU complete. Restarting to new firmware...");
+    ESP.restart();
+  }
+
+  if (state_ != State::RECEIVING) {
+    return;
+  }
+
+  CoBmecWatchdog::trace(watchdogId_,
+                        "decode",
+                        decoded_);
+  decode();
+  if (state_ != State::RECEIVING) {
+    return;
+  }
+
+  if (decoded_ == manifest_.payloadSize) {
+    CoBmecWatchdog::trace(watchdogId_,
+                          "finish");
+    finish();
+    return;
+  }
+
+  uint32_t nowMs = millis();
+  if (resend_ || decoded_ - acknowledged_ >= CO_BMEC_BLE_DFU_ACK_BYTES
+      || (decoded_ != acknowledged_ && nowMs - ackTMs_ >= CO_BMEC_BLE_DFU_ACK_MS)) {
+    notifyStatus();
+  }
+
+  // Free the decoder if the client stays connected but never sends.
+  if (nowMs - dataTMs_ >= CO_BMEC_BLE_DFU_TIMEOUT_MS) {
+    log_w("BLE DFU timed out at %lu of %lu bytes.",
+          (unsigned long) decoded_,
+          (unsigned long) manifest_.payloadSize);
+    stop(State::IDLE,
+         CoBmecOta::Result::INTERRUPTED);
+  }
+}
+
+/// Starts a session with the pending manifest, or resumes the one in progress.
+void CoBmecBleDfu::start() {
+  CoBmecOta::Manifest manifest;
+  xSemaphoreTake(dataMutex_, portMAX_DELAY);
+  manifest = pendingManifest_;
+  xSemaphoreGive(dataMutex_);
+
+  uint32_t nowMs = millis();
+
+  // Resume.
+  if (state_ == State::RECEIVING && !memcmp(&manifest,
+                                            &manifest_,
+                                            sizeof(manifest))) {
+    log_i("BLE DFU resuming at %lu of %lu bytes",
+          (unsigned long) offset_,
+          (unsigned long) manifest_.payloadSize);
+    startTMs_ = nowMs;
+    startOffset_ = offset_;
+    link_->setProfile(CoBmecBleLink::Profile::BULK);
+    notifyStatus();
+    return;
+  }
+
+  if (state_ == State::RECEIVING) {
+    log_w("BLE DFU restarted with another image.");
+    stop(State::IDLE,
+         CoBmecOta::Result::INTERRUPTED);
+  }
+
+  CoBmecOta::Result result = CoBmecOta::check(manifest);
+  if (result == CoBmecOta::Result::OK) {
+    result = CoBmecOta::begin(manifest,
+                              decoder_);
+  }
+
+  // Created once, reused by the next sessions.
+  if (result == CoBmecOta::Result::OK && !stream_) {
+    stream_ = CoBmecBootArena::createStreamBuffer(CO_BMEC_BLE_DFU_WINDOW,
+                                                  1);
+    if (!stream_) {
+      result = CoBmecOta::Result::NO_MEMORY;
+    }
+  }
+
+  if (result != CoBmecOta::Result::OK) {
+    stop(State::FAILED,
+         result);
+    notifyStatus();
+    return;
+  }
+
+  xSemaphoreTake(dataMutex_, portMAX_DELAY);
+  manifest_ = manifest;
+  xStreamBufferReset(stream_);
+  offset_ = 0;
+  resend_ = false;
+  state_ = State::RECEIVING;
+  xSemaphoreGive(dataMutex_);
+
+  result_ = CoBmecOta::Result::OK;
+  decoded_ = 0;
+  acknowledged_ = 0;
+  startOffset_ = 0;
+  startTMs_ = nowMs;
+  ackTMs_ = nowMs;
+  dataTMs_ = nowMs;
+
+  link_->setProfile(CoBmecBleLink::Profile::BULK);
+  CoBmecMemoryMonitor::setPhase(CoBmecMemoryMonitor::Phase::OTA,
+                                true);
+
+  log_i("BLE DFU of %lu bytes, encoding %u, image %lu bytes, mtu %u",
+        (unsigned long) manifest_.payloadSize,
+        manifest_.encoding,
+        (unsigned long) manifest_.imageSize,
+        getStatus().mtu);
+  notifyStatus();
+}
+
+/// Ends the session, abandoning the update in progress.
+/// @param state IDLE or FAILED.
+/// @param result result to report.
+void CoBmecBleDfu::stop(State state, CoBmecOta::Result result) {
+  xSemaphoreTake(dataMutex_, portMAX_DELAY);
+  state_ = state;
+  xSemaphoreGive(dataMutex_);
+
+  result_ = result;
+  if (decoder_) {
+    Update.abort();
+    decoder_.reset();
+  }
+  link_->setProfile(CoBmecBleLink::Profile::IDLE);
+  CoBmecMemoryMonitor::setPhase(CoBmecMemoryMonitor::Phase::OTA,
+                                false);
+}
+
+/// Writes the queued chunks into the update partition.
+void CoBmecBleDfu::decode() {
+  size_t length;
+  while (decoded_ < offset_ && (length = xStreamBufferReceive(stream_,
+                                                              input_,
+                                                              sizeof(input_),
+                                                              0))) {
+    CoBmecOta::Result result = CoBmecOta::toResult(decoder_->write(input_,
+                                                                   length));
+    if (result != CoBmecOta::Result::OK) {
+      log_e("BLE DFU failed at %lu bytes with error %u",
+            (unsigned long) decoded_,
+            static_cast<uint8_t>(result));
+      stop(State::FAILED,
+           result);
+      notifyStatus();
+      return;
+    }
+    decoded_ += length;
+  }
+}
+
+/// Checks and activates the image once the whole payload is decoded.
+void CoBmecBleDfu::finish() {
+  uint32_t elapsedMs = std::max(millis() - startTMs_,
+                                1ul);
+  bytesPerS_ = uint32_t(uint64_t(decoded_ - startOffset_) * 1000 / elapsedMs);
+
+  CoBmecOta::Result result = CoBmecOta::end(manifest_,
+                                            *decoder_,
+                                            CoBmecOta::Result::OK);
+  decoder_.reset();
+
+  if (result != CoBmecOta::Result::OK) {
+    stop(State::FAILED,
+         result);
+    notifyStatus();
+    return;
+  }
+
+  log_i("BLE DFU done, %lu bytes in %lu ms, %lu.%02lu KB/s, mtu %u",
+        (unsigned long) (decoded_ - startOffset_),
+        (unsigned long) elapsedMs,
+        (unsigned long) (bytesPerS_ / 1024),
+        (unsigned long) (bytesPerS_ % 1024 * 100 / 1024),
+        getStatus().mtu);
+
+  result_ = result;
+  state_ = State::DONE;
+  doneTMs_ = millis();
+  link_->setProfile(CoBmecBleLink::Profile::IDLE);
+  notifyStatus();
+}
+
+/// @returns the status. Called from loop and the BLE task.
+CoBmecBleDfu::Status CoBmecBleDfu::getStatus() {
+  Status status;
+  status.state = static_cast<uint8_t>(state_);
+  status.result = static_cast<uint8_t>(result_);
+  status.mtu = connected_ ? BleGatt::peerMtu(bleServer_,
+                                             peer_) : 0;
+  status.offset = offset_;
+  status.acknowledged = decoded_;
+  status.bytesPerS = bytesPerS_;
+
+  // Live throughput while receiving.
+  uint32_t elapsedMs = millis() - startTMs_;
+  if (state_ == State::RECEIVING && elapsedMs) {
+    status.bytesPerS = uint32_t(uint64_t(decoded_ - startOffset_) * 1000 / elapsedMs);
+  }
+  return status;
+}
+
+/// Acknowledges the decoded bytes and tells the client where to send from.
+void CoBmecBleDfu::notifyStatus() {
+  Status status = getStatus();
+  acknowledged_ = status.acknowledged;
+  ackTMs_ = millis();
+  resend_ = false;
+
+  bleServiceDfu_->charStatus_->setValue(reinterpret_cast<uint8_t *>(&status),
+                                        sizeof(status));
+  if (connected_) {
+    BleGatt::notify(bleServiceDfu_->charStatus_);
+  }
+}
+
+/// Publishes the status.
+/// @param characteristic status characteristic.
+void CoBmecBleDfu::onRead(BLECharacteristic *characteristic) {
+  if (characteristic == bleServiceDfu_->charStatus_) {
+    Status status = getStatus();
+    characteristic->setValue(reinterpret_cast<uint8_t *>(&status),
+                             sizeof(status));
+  }
+}
+
+/// Queues the chunks and the client commands, for loop.
+/// @param characteristic data or control characteristic.
+void CoBmecBleDfu::onWrite(BLECharacteristic *characteristic) {
+  std::string data = characteristic->getValue();
+
+  if (characteristic == bleServiceDfu_->charData_) {
+    DataHeader header;
+    if (data.length() <= sizeof(header)) {
+      return;
+    }
+    memcpy(&header,
+           data.data(),
+           sizeof(header));
+    size_t length = data.length() - sizeof(header);
+
+    xSemaphoreTake(dataMutex_, portMAX_DELAY);
+    if (state_ == State::RECEIVING) {
+      if (header.offset == offset_ && length <= manifest_.payloadSize - offset_
+          && xStreamBufferSpacesAvailable(stream_) >= length) {
+        xStreamBufferSend(stream_,
+                          &data[sizeof(header)],
+                          length,
+                          0);
+        offset_ += length;
+        dataTMs_ = millis();
+      }
+      else if (header.offset >= offset_) {
+        // A gap or an overrun, duplicates after a rewind are dropped silently.
+        resend_ = true;
+      }
+    }
+    xSemaphoreGive(dataMutex_);
+    return;
+  }
+
+  if (characteristic != bleServiceDfu_->charControl_ || data.empty()) {
+    return;
+  }
+
+  switch (static_cast<Command>(data[0])) {
+    case Command::START: {
+      if (data.length() == 1 + sizeof(CoBmecOta::Manifest)) {
+        xSemaphoreTake(dataMutex_, portMAX_DELAY);
+        memcpy(&pendingManifest_,
+               &data[1],
+               sizeof(pendingManifest_));
+        xSemaphoreGive(dataMutex_);
+        pendingCommand_ = Command::START;
+      }
+    }
+      break;
+    case Command::ABORT: {
+      pendingCommand_ = Command::ABORT;
+    }
+      break;
+    default:break;
+  }
+}
+
+/// @}
@@ -0,0 +1,182 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file co_bmec_ble_dfu.h
+/// @brief Firmware update over BLE, with a windowed transfer.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <memory>
+#include "Arduino.h"
+#include "freertos/stream_buffer.h"
+#include "modules/ota/co_bmec_ota.h"
+#include "services/dfu/ble_dfu_service.h"
+#include "co_bmec_ble_link.h"
+#include "modules/memory/co_bmec_boot_arena.h"
+#include "modules/watchdog/co_bmec_watchdog.h"
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+#define CO_BMEC_BLE_DFU_WINDOW             8192  ///< Unacknowledged bytes the client may send.
+#define CO_BMEC_BLE_DFU_ACK_BYTES          2048  ///< Decoded bytes between acknowledgements.
+#define CO_BMEC_BLE_DFU_ACK_MS             250  ///< Longest time between acknowledgements while data flows.
+#define CO_BMEC_BLE_DFU_TIMEOUT_MS         300000  ///< Time without data after which a session is dropped.
+#define CO_BMEC_BLE_DFU_RESTART_MS         1000  ///< Time for the final status to go out before restarting.
+#define CO_BMEC_BLE_DFU_INPUT_SIZE         512  ///< Bytes decoded per stream buffer read.
+#define CO_BMEC_BLE_DFU_PERIOD_MS          10  ///< Period of the session task.
+#define CO_BMEC_BLE_DFU_TASK_STACK_SIZE    8192  ///< The signature check and the delta base hash, freed when the session ends.
+#define CO_BMEC_BLE_DFU_TASK_DEADLINE_MS   30000  ///< Longest time between watchdog beats, the delta base hash included.
+
+//*********************************************************************
+// #forward declarations
+//*********************************************************************
+
+//*********************************************************************
+// class declarations
+//*********************************************************************
+/// Writes a firmware payload received over BLE straight into the update partition, for devices
+/// that never get Wi-Fi. The payload and its signed manifest are the ones served for HTTPS, see
+/// CoBmecOta, so a delta or deflated payload cuts the transfer time just as much.
+///
+/// The client starts a session with the manifest, then writes DataHeader prefixed chunks
+/// without response, each as large as the MTU allows. It keeps at most `window` bytes past the
+/// acknowledged offset in flight. The device acknowledges every CO_BMEC_BLE_DFU_ACK_BYTES
+/// decoded, or CO_BMEC_BLE_DFU_ACK_MS, with a Status notification. A chunk that is not at the
+/// expected offset, or that does not fit, is dropped and the status is sent at once, the client
+/// then resends from `offset`.
+///
+/// Starting again with the same manifest resumes from `offset`. A disconnect ends the session,
+/// the client starts over once reconnected. The image is hashed as it is written and only
+/// activated if it matches.
+///
+/// Chunks are queued by the BLE task. The session runs in its own low priority task, started
+/// by loop() and ended with the session, which does the flash writes, the inflating, the delta
+/// base hash and the signature check. The BLE task never waits on a sector erase, and the
+/// application loop stack needs no room for the check. The stack is sized from the OTA phase
+/// of the CoBmecMemoryMonitor report.
+class CoBmecBleDfu : public BLECharacteristicCallbacks {
+ public:
+
+  enum class State : uint8_t {
+    IDLE,
+    RECEIVING,
+    DONE,  ///< Restarting into the new image.
+    FAILED,  ///< See result.
+  };
+
+  /// Client commands on the control characteristic.
+  enum class Command : uint8_t {
+    UNDEFINED,
+    START,  ///< Followed by the CoBmecOta::Manifest. Resumes a session with the same manifest.
+    ABORT,  ///< Abandons the session.
+  };
+
+  /// Prefix of a chunk on the data characteristic.
+  struct __attribute__((packed)) DataHeader {
+    uint32_t offset = 0;  ///< Payload offset of the chunk.
+  };
+
+  /// Published on the status characteristic.
+  struct __attribute__((packed)) Status {
+    uint8_t state = 0;  ///< State.
+    uint8_t result = 0;  ///< CoBmecOta::Result of the session.
+    uint16_t mtu = 0;  ///< Chunks carry up to mtu - 3 - sizeof(DataHeader) bytes.
+    uint32_t offset = 0;  ///< Next payload byte expected.
+    uint32_t acknowledged = 0;  ///< Payload bytes written.
+    uint32_t window = CO_BMEC_BLE_DFU_WINDOW;
+    uint32_t bytesPerS = 0;  ///< Throughput of the session.
+  };
+
+  CoBmecBleDfu(BLEServer *bleServer, BleServiceDfu *bleServiceDfu, CoBmecBleLink *link);
+
+  void onConnect(const BleGattPeer &peer);
+
+  void onDisconnect();
+
+  void loop();
+
+  /// @returns true while a session is open, until the restart into the new image.
+  bool isActive() const {
+    return state_ == State::RECEIVING || state_ == State::DONE;
+  };
+
+  /// @param done output, payload bytes written.
+  /// @param total output, payload size.
+  void getProgress(size_t &done, size_t &total) const {
+    done = decoded_;
+    total = manifest_.payloadSize;
+  };
+
+ private:
+
+  BLEServer *bleServer_;
+  BleServiceDfu *bleServiceDfu_;
+  CoBmecBleLink *link_;
+
+  SemaphoreHandle_t dataMutex_ = CoBmecBootArena::createMutex();  ///< Guards stream_ against a session change.
+  StreamBufferHandle_t stream_ = nullptr;  ///< Chunks in order, written by the BLE task.
+
+  BleGattPeer peer_;
+  volatile bool connected_ = false;
+
+  /// Set by the BLE task, handled by the session task.
+  CoBmecOta::Manifest pendingManifest_;
+  volatile Command pendingCommand_ = Command::UNDEFINED;
+  volatile bool resend_ = false;  ///< A chunk was dropped, the client is to be told at once.
+  volatile bool disconnected_ = false;  ///< The client disconnected, the session is to end.
+
+  /// Session task.
+  volatile bool running_ = false;
+  CoBmecWatchdog::Id watchdogId_ = -1;
+
+  /// Session.
+  volatile State state_ = State::IDLE;
+  CoBmecOta::Result result_ = CoBmecOta::Result::OK;
+  CoBmecOta::Manifest manifest_;
+  std::unique_ptr<CoBmecOtaDecoder> decoder_;
+  volatile uint32_t offset_ = 0;  ///< Received. Written by the BLE task.
+  volatile uint32_t decoded_ = 0;  ///< Read by the loops.
+  uint32_t acknowledged_ = 0;
+  uint32_t ackTMs_ = 0;
+  uint32_t startTMs_ = 0;
+  uint32_t startOffset_ = 0;  ///< Offset the session (re)started from, for the throughput.
+  uint32_t bytesPerS_ = 0;  ///< Throughput of the last session.
+  volatile uint32_t dataTMs_ = 0;
+  uint32_t doneTMs_ = 0;
+
+  uint8_t input_[CO_BMEC_BLE_DFU_INPUT_SIZE]{};
+
+  void run();
+
+  void step();
+
+  void start();
+
+  void stop(State state, CoBmecOta::Result result);
+
+  void decode();
+
+  void finish();
+
+  Status getStatus();
+
+  void notifyStatus();
+
+  // Overrides.
+  void onRead(BLECharacteristic *characteristic) override;
+
+  void onWrite(BLECharacteristic *characteristic) override;
+};
+
+/// @}
@@ -0,0 +1,200 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file co_bmec_ble_link.cpp
+/// @brief Connection parameters and attribute caching of the connected client.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <esp_ota_ops.h>
+#include "co_bmec_ble_link.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define PREF_NS_BLE                 "BLE"
+#define PREF_KEY_HASH               "fw_hash"
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+/// Connection parameters, intervals in 1.25 ms and the timeout in 10 ms units.
+struct ConnParams {
+  uint16_t minInterval;
+  uint16_t maxInterval;
+  uint16_t latency;
+  uint16_t timeout;
+};
+
+/// Indexed by Profile.
+static const ConnParams PROFILE_PARAMS[] = {
+    {6, 12, 0, 400},  // SETUP: 7.5 - 15 ms.
+    {6, 12, 0, 400},  // BULK: 7.5 - 15 ms.
+    {80, 160, 4, 600},  // IDLE: 100 - 200 ms, up to 4 events skipped.
+};
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Constructors.
+
+/// @param bleServer server.
+/// @param flashMutex Global flash mutex.
+CoBmecBleLink::CoBmecBleLink(BLEServer *bleServer, SemaphoreHandle_t flashMutex)
+    : bleServer_(bleServer),
+      flashMutex_(flashMutex) {
+
+  loadHash();
+}
+
+// Public methods.
+
+/// Logs the latency from connecting to the first read of a characteristic, which with a
+/// cached attribute table is the client's first request.
+/// @param characteristic characteristic the client reads first, without other callbacks.
+void CoBmecBleLink::timeFirstRead(BLECharacteristic *characteristic) {
+  characteristic->setCallbacks(this);
+}
+
+/// Starts the setup. Called from the BLE task.
+/// @param peer client.
+void CoBmecBleLink::onConnect(const BleGattPeer &peer) {
+  peer_ = peer;
+  connectTMs_ = millis();
+  firstRead_ = true;
+  connected_ = true;
+  setProfile(Profile::SETUP);
+}
+
+/// Called from the BLE task.
+void CoBmecBleLink::onDisconnect() {
+  connected_ = false;
+}
+
+/// Called from the BLE task.
+/// @param mtu MTU agreed with the client.
+void CoBmecBleLink::onMtu(uint16_t mtu) {
+  // Connection set up latency, for comparing the hosts.
+  log_i("BLE link set up in %lu ms, mtu %u, host %s",
+        (unsigned long) (millis() - connectTMs_),
+        mtu,
+        BLE_GATT_BACKEND);
+}
+
+/// Ends the setup. Called periodically from a single task.
+void CoBmecBleLink::loop() {
+  if (!connected_ || profile_ != Profile::SETUP || millis() - connectTMs_ < CO_BMEC_BLE_LINK_SETUP_MS) {
+    return;
+  }
+
+  // The client is subscribed by now, including a bonded client that skipped discovery.
+  if (servicesChanged_) {
+    log_i("BLE attribute table may have changed, indicating.");
+    BleGatt::indicateServicesChanged(bleServer_,
+                                     peer_);
+    saveHash();
+    servicesChanged_ = false;
+  }
+
+  setProfile(Profile::IDLE);
+}
+
+/// Requests the connection parameters of a profile.
+/// @param profile profile.
+void CoBmecBleLink::setProfile(Profile profile) {
+  if (!connected_) {
+    return;
+  }
+
+  profile_ = profile;
+  const ConnParams &params = PROFILE_PARAMS[static_cast<uint8_t>(profile)];
+  BleGatt::updateConnParams(bleServer_,
+                            peer_,
+                            params.minInterval,
+                            params.maxInterval,
+                            params.latency,
+                            params.timeout);
+}
+
+// Private methods.
+
+/// Compares the hash of the running firmware with that of the last client indication.
+void CoBmecBleLink::loadHash() {
+  memcpy(hash_,
+         esp_ota_get_app_description()->app_elf_sha256,
+         sizeof(hash_));
+
+  uint8_t saved[CO_BMEC_BLE_LINK_HASH_LEN]{};
+
+  // Take the mutex.
+  xSemaphoreTake(flashMutex_,
+                 portMAX_DELAY);
+
+  // Set namespace.
+  if (!preferences_.begin(PREF_NS_BLE)) {
+    log_e("Could not init BLE NVS.");
+  }
+
+  (void) preferences_.getBytes(PREF_KEY_HASH,
+                               saved,
+                               sizeof(saved));
+
+  preferences_.end();
+
+  // Release the mutex.
+  while (!xSemaphoreGive(flashMutex_)) {
+    log_e("Failed to give flashMutex_.");
+  }
+
+  servicesChanged_ = memcmp(hash_,
+                            saved,
+                            sizeof(hash_)) != 0;
+}
+
+/// Saves the hash of the running firmware.
+void CoBmecBleLink::saveHash() {
+
+  // Take the mutex.
+  xSemaphoreTake(flashMutex_,
+                 portMAX_DELAY);
+
+  // Set namespace.
+  if (!preferences_.begin(PREF_NS_BLE)) {
+    log_e("Could not init BLE NVS.");
+  }
+
+  if (preferences_.putBytes(PREF_KEY_HASH,
+                            hash_,
+                            sizeof(hash_)) != sizeof(hash_)) {
+    log_e("Failed to save the firmware hash to NVS");
+  }
+
+  // Commit.
+  preferences_.end();
+
+  // Release the mutex.
+  while (!xSemaphoreGive(flashMutex_)) {
+    log_e("Failed to give flashMutex_.");
+  }
+}
+
+/// Logs the reconnect latency on the first read of the connection.
+/// @param characteristic timed characteristic.
+void CoBmecBleLink::onRead(BLECharacteristic *characteristic) {
+  if (firstRead_) {
+    firstRead_ = false;
+    log_i("BLE first read %lu ms after connecting",
+          (unsigned long) (millis() - connectTMs_));
+  }
+}
+
+/// @}
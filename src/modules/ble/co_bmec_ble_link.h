@@ -0,0 +1,89 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file co_bmec_ble_link.h
+/// @brief Connection parameters and attribute caching of the connected client.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "Arduino.h"
+#include <Preferences.h>
+#include "gatt/ble_gatt.h"
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+#define CO_BMEC_BLE_LINK_SETUP_MS          3000  ///< Time on the setup parameters after connecting.
+#define CO_BMEC_BLE_LINK_HASH_LEN          8  ///< Bytes of the firmware hash kept to detect table changes.
+
+//*********************************************************************
+// #forward declarations
+//*********************************************************************
+
+//*********************************************************************
+// class declarations
+//*********************************************************************
+/// Tunes the connection to what it is used for and keeps bonded clients' attribute caches valid.
+///
+/// A client connects on the SETUP parameters for discovery and its first reads, then drops to
+/// IDLE after CO_BMEC_BLE_LINK_SETUP_MS. Bulk transfers switch to BULK for their duration.
+/// Bonded clients cache the attribute table and skip discovery on reconnect. When the
+/// firmware changes, the table may have too, so the first client to finish setup afterwards
+/// is sent a Service Changed indication and rediscovers once.
+class CoBmecBleLink : public BLECharacteristicCallbacks {
+ public:
+
+  enum class Profile : uint8_t {
+    SETUP,  ///< Discovery and the first reads.
+    BULK,  ///< Bulk transfers, shortest interval.
+    IDLE,  ///< Notifications only, long interval with peripheral latency.
+  };
+
+  CoBmecBleLink(BLEServer *bleServer, SemaphoreHandle_t flashMutex);
+
+  void timeFirstRead(BLECharacteristic *characteristic);
+
+  void onConnect(const BleGattPeer &peer);
+
+  void onDisconnect();
+
+  void onMtu(uint16_t mtu);
+
+  void loop();
+
+  void setProfile(Profile profile);
+
+ private:
+
+  BLEServer *bleServer_;
+  SemaphoreHandle_t flashMutex_;
+  Preferences preferences_{};
+
+  BleGattPeer peer_;
+  volatile bool connected_ = false;
+  volatile Profile profile_ = Profile::IDLE;
+  volatile uint32_t connectTMs_ = 0;
+  volatile bool firstRead_ = false;  ///< The first read of the connection is still to come.
+
+  uint8_t hash_[CO_BMEC_BLE_LINK_HASH_LEN]{};  ///< Hash of the running firmware.
+  bool servicesChanged_ = false;  ///< The firmware changed since a client was last told.
+
+  void loadHash();
+
+  void saveHash();
+
+  // Overrides.
+  void onRead(BLECharacteristic *characteristic) override;
+};
+
+/// @}
@@ -0,0 +1,149 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file co_bmec_ble_status_publisher.h
+/// @brief Change detecting, rate limited publishing of a status snapshot on BLE characteristics.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include <cstring>
+#include "modules/ble/gatt/ble_gatt.h"
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+#define CO_BMEC_BLE_STATUS_MAX_FIELDS      32  ///< Fields in the change mask.
+
+/// Field of a status snapshot published on a characteristic.
+#define CO_BMEC_BLE_STATUS_FIELD(Snapshot, member, characteristic) \
+  {offsetof(Snapshot, member), sizeof(Snapshot::member), (characteristic)}
+
+//*********************************************************************
+// #forward declarations
+//*********************************************************************
+
+//*********************************************************************
+// class declarations
+//*********************************************************************
+/// Publishes a packed snapshot of module state, one characteristic per field.
+///
+/// The module writes the snapshot as often as its state changes. At most once per interval
+/// the snapshot is compared with the last one published and only the changed fields are
+/// written to their characteristics. The batch is then announced with a single notification:
+/// on the new data characteristic if there is one, which toggles and carries the change mask,
+/// otherwise on each changed characteristic. States that come and go within an interval are
+/// never published, so the notification rate is bounded however fast the state churns.
+///
+/// Not thread safe, the snapshot and loop must be used from a single task.
+/// @tparam Snapshot packed struct of the published fields.
+/// @tparam FIELDS number of fields.
+template<typename Snapshot, size_t FIELDS>
+class CoBmecBleStatusPublisher {
+ public:
+
+  static_assert(FIELDS <= CO_BMEC_BLE_STATUS_MAX_FIELDS, "Too many fields for the change mask.");
+
+  /// Location of a field in the snapshot, see CO_BMEC_BLE_STATUS_FIELD.
+  struct Field {
+    size_t offset_;
+    size_t size_;
+    BLECharacteristic *characteristic_;
+  };
+
+  /// Value of the new data characteristic.
+  struct __attribute__((packed)) Batch {
+    uint8_t toggle = 0;  ///< Inverted on every batch.
+    uint32_t changed = 0;  ///< Bit n set if field n changed.
+  };
+
+  /// @param fields field table, in change mask order.
+  /// @param newDataChar characteristic notified once per batch, or nullptr to notify the fields.
+  /// @param intervalMs minimum time between batches.
+  CoBmecBleStatusPublisher(const Field (&fields)[FIELDS], BLECharacteristic *newDataChar, uint32_t intervalMs)
+      : newDataChar_(newDataChar),
+        intervalMs_(intervalMs) {
+    memcpy(fields_,
+           fields,
+           sizeof(fields_));
+  }
+
+  /// @returns the snapshot to update. Published by the next loop after the interval.
+  Snapshot &snapshot() {
+    return pending_;
+  };
+
+  /// Publishes the changed fields once the interval has elapsed.
+  /// @param tMs current time.
+  /// @returns true if a batch was published.
+  bool loop(uint32_t tMs) {
+    if (!first_ && tMs - publishTMs_ < intervalMs_) {
+      return false;
+    }
+
+    auto *pending = reinterpret_cast<const uint8_t *>(&pending_);
+    auto *published = reinterpret_cast<uint8_t *>(&published_);
+
+    uint32_t changed = 0;
+    for (size_t field = 0; field < FIELDS; field++) {
+      const Field &entry = fields_[field];
+      if (first_ || memcmp(&pending[entry.offset_],
+                           &published[entry.offset_],
+                           entry.size_)) {
+        memcpy(&published[entry.offset_],
+               &pending[entry.offset_],
+               entry.size_);
+        entry.characteristic_->setValue(&published[entry.offset_],
+                                        entry.size_);
+        changed |= 1ul << field;
+      }
+    }
+    if (!changed) {
+      return false;
+    }
+
+    first_ = false;
+    publishTMs_ = tMs;
+
+    // Announce the batch.
+    if (newDataChar_) {
+      batch_.toggle ^= 1;
+      batch_.changed = changed;
+      newDataChar_->setValue(reinterpret_cast<uint8_t *>(&batch_),
+                             sizeof(batch_));
+      BleGatt::notify(newDataChar_);
+    }
+    else {
+      for (size_t field = 0; field < FIELDS; field++) {
+        if (changed & (1ul << field)) {
+          BleGatt::notify(fields_[field].characteristic_);
+        }
+      }
+    }
+    return true;
+  }
+
+ private:
+
+  Field fields_[FIELDS];
+  BLECharacteristic *newDataChar_;
+  uint32_t intervalMs_;
+
+  Snapshot pending_{};  ///< Latest state.
+  Snapshot published_{};  ///< State last written to the characteristics.
+  Batch batch_;
+  uint32_t publishTMs_ = 0;
+  bool first_ = true;  ///< Every field is written on the first batch.
+};
+
+/// @}
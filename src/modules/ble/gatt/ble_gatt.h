@@ -0,0 +1,180 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file ble_gatt.h
+/// @brief Thin GATT layer over the Bluedroid or NimBLE host, chosen at compile time.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+///
+/// The only place the BLE host headers are included. The modules keep using the Bluedroid
+/// class names (BLEServer, BLECharacteristic, ...) which the NimBLE backend maps onto its
+/// own classes. Everything the two hosts do differently goes through BleGatt.
+///
+/// Build with -DCO_BMEC_BLE_NIMBLE for the NimBLE host (see the esp32dev-nimble environment).
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <string>
+#ifdef CO_BMEC_BLE_NIMBLE
+#include <NimBLEDevice.h>
+#else
+#include <BLEDevice.h>
+#include <BLE2902.h>
+#include <BLE2904.h>
+#endif
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+#ifdef CO_BMEC_BLE_NIMBLE
+#define BLE_GATT_BACKEND              "NimBLE"
+#define BLE_GATT_MAX_ATTR_LEN         BLE_ATT_ATTR_MAX_LEN  ///< Longest characteristic value.
+#else
+#define BLE_GATT_BACKEND              "Bluedroid"
+#define BLE_GATT_MAX_ATTR_LEN         ESP_GATT_MAX_ATTR_LEN  ///< Longest characteristic value.
+#endif
+
+#define BLE_GATT_ADDRESS_LEN          6
+#define BLE_GATT_ADV_FLAGS            0x06  ///< General discoverable, BR/EDR not supported.
+
+//*********************************************************************
+// #forward declarations
+//*********************************************************************
+
+//*********************************************************************
+// class declarations
+//*********************************************************************
+#ifdef CO_BMEC_BLE_NIMBLE
+// Bluedroid class names, for hosts that do not already map them.
+#ifndef BLEDevice
+using BLEDevice = NimBLEDevice;
+using BLEServer = NimBLEServer;
+using BLEService = NimBLEService;
+using BLECharacteristic = NimBLECharacteristic;
+using BLEServerCallbacks = NimBLEServerCallbacks;
+using BLECharacteristicCallbacks = NimBLECharacteristicCallbacks;
+using BLEAdvertising = NimBLEAdvertising;
+using BLEAdvertisementData = NimBLEAdvertisementData;
+using BLEUUID = NimBLEUUID;
+#endif
+#endif
+
+/// Characteristic properties of the selected host.
+struct BleGattProperty {
+#ifdef CO_BMEC_BLE_NIMBLE
+  static constexpr uint32_t READ = NIMBLE_PROPERTY::READ;
+  static constexpr uint32_t WRITE = NIMBLE_PROPERTY::WRITE;
+  static constexpr uint32_t WRITE_NR = NIMBLE_PROPERTY::WRITE_NR;
+  static constexpr uint32_t NOTIFY = NIMBLE_PROPERTY::NOTIFY;
+  static constexpr uint32_t INDICATE = NIMBLE_PROPERTY::INDICATE;
+  static constexpr uint32_t WRITE_ENC = NIMBLE_PROPERTY::WRITE_ENC;  ///< Writes need an encrypted link.
+#else
+  static constexpr uint32_t READ = BLECharacteristic::PROPERTY_READ;
+  static constexpr uint32_t WRITE = BLECharacteristic::PROPERTY_WRITE;
+  static constexpr uint32_t WRITE_NR = BLECharacteristic::PROPERTY_WRITE_NR;
+  static constexpr uint32_t NOTIFY = BLECharacteristic::PROPERTY_NOTIFY;
+  static constexpr uint32_t INDICATE = BLECharacteristic::PROPERTY_INDICATE;
+  static constexpr uint32_t WRITE_ENC = 0;  ///< A permission on Bluedroid, see BleGatt::encryptWrites.
+#endif
+};
+
+/// Storage of a client characteristic configuration descriptor, see BleGatt::addCccd.
+#ifdef CO_BMEC_BLE_NIMBLE
+struct BleGattCccd {};
+#else
+using BleGattCccd = BLE2902;
+#endif
+
+/// Connected client.
+struct BleGattPeer {
+  uint8_t address_[BLE_GATT_ADDRESS_LEN]{};
+  uint16_t connId_ = 0;  ///< Connection id (Bluedroid) or handle (NimBLE).
+};
+
+/// Server connection events with the host specific parameters reduced to a BleGattPeer.
+class BleGattServerCallbacks : public BLEServerCallbacks {
+ public:
+
+  virtual void onPeerConnect(BLEServer *server, const BleGattPeer &peer) {};
+
+  virtual void onPeerDisconnect(BLEServer *server) {};
+
+  /// @param mtu MTU agreed with the client.
+  virtual void onPeerMtu(uint16_t mtu) {};
+
+ private:
+
+  // Overrides.
+#ifdef CO_BMEC_BLE_NIMBLE
+  void onConnect(BLEServer *server, ble_gap_conn_desc *desc) override;
+
+  void onDisconnect(BLEServer *server) override;
+
+  void onMTUChange(uint16_t mtu, ble_gap_conn_desc *desc) override;
+#else
+  void onConnect(BLEServer *server, esp_ble_gatts_cb_param_t *param) override;
+
+  void onDisconnect(BLEServer *server) override;
+
+  void onMtuChanged(BLEServer *server, esp_ble_gatts_cb_param_t *param) override;
+#endif
+};
+
+/// Operations that differ between the hosts.
+class BleGatt {
+ public:
+
+  static void init(uint16_t mtu, esp_power_level_t powerLevel);
+
+  static void release();
+
+  /// @returns true once the host has been released, see release().
+  static bool isReleased() {
+    return released_;
+  };
+
+  static void notify(BLECharacteristic *characteristic);
+
+  static void setServerCallbacks(BLEServer *server, BLEServerCallbacks *callbacks);
+
+  static void enableBonding();
+
+  static void setDeviceName(const char *name);
+
+  static void setAdvertisingPower(esp_power_level_t powerLevel);
+
+  static BLEUUID uuid(const uint8_t *bytes);
+
+  static void addCccd(BLECharacteristic *characteristic, void *storage = nullptr);
+
+  static void addUtf8Format(BLECharacteristic *characteristic);
+
+  static void encryptWrites(BLECharacteristic *characteristic);
+
+  static uint16_t peerMtu(BLEServer *server, const BleGattPeer &peer);
+
+  static void setDataLength(const BleGattPeer &peer, uint16_t octets);
+
+  static void indicateServicesChanged(BLEServer *server, const BleGattPeer &peer);
+
+  static void updateConnParams(BLEServer *server,
+                               const BleGattPeer &peer,
+                               uint16_t minInterval,
+                               uint16_t maxInterval,
+                               uint16_t latency,
+                               uint16_t timeout);
+
+ private:
+
+  static volatile bool released_;
+};
+
+/// @}
@@ -0,0 +1,193 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file ble_gatt_bluedroid.cpp
+/// @brief Bluedroid backend of the GATT layer.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#ifndef CO_BMEC_BLE_NIMBLE
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstring>
+#include <new>
+#include <BLESecurity.h>
+#include "ble_gatt.h"
+#include "modules/memory/co_bmec_boot_arena.h"
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+volatile bool BleGatt::released_ = false;
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// BleGattServerCallbacks.
+
+void BleGattServerCallbacks::onConnect(BLEServer *server, esp_ble_gatts_cb_param_t *param) {
+  BleGattPeer peer;
+  memcpy(peer.address_,
+         param->connect.remote_bda,
+         sizeof(peer.address_));
+  peer.connId_ = param->connect.conn_id;
+  onPeerConnect(server,
+                peer);
+}
+
+void BleGattServerCallbacks::onDisconnect(BLEServer *server) {
+  onPeerDisconnect(server);
+}
+
+void BleGattServerCallbacks::onMtuChanged(BLEServer *server, esp_ble_gatts_cb_param_t *param) {
+  onPeerMtu(param->mtu.mtu);
+}
+
+// BleGatt.
+
+/// Starts the host.
+/// @param mtu largest MTU offered to clients.
+/// @param powerLevel transmit power.
+void BleGatt::init(uint16_t mtu, esp_power_level_t powerLevel) {
+  // Frees some extra stack.
+  esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
+
+  BLEDevice::init("");
+  BLEDevice::setPower(powerLevel);
+  BLEDevice::setMTU(mtu);
+}
+
+/// Stops the host and returns the controller memory to the heap. The host cannot be restarted.
+void BleGatt::release() {
+  released_ = true;
+  BLEDevice::deinit(false);
+  esp_bt_controller_mem_release(ESP_BT_MODE_BTDM);
+}
+
+/// Notifies the subscribed clients. Dropped once released, the host is no longer running.
+/// @param characteristic characteristic.
+void BleGatt::notify(BLECharacteristic *characteristic) {
+  if (!released_) {
+    characteristic->notify();
+  }
+}
+
+/// Sets the server callbacks, which the server does not delete.
+/// @param server server.
+/// @param callbacks callbacks, kept.
+void BleGatt::setServerCallbacks(BLEServer *server, BLEServerCallbacks *callbacks) {
+  server->setCallbacks(callbacks);
+}
+
+/// Bonds with clients without pairing input, the keys are persisted by the host, so a
+/// bonded client keeps its GATT cache and skips discovery on reconnect.
+void BleGatt::enableBonding() {
+  auto *security = CoBmecBootArena::make<BLESecurity>();
+  security->setAuthenticationMode(ESP_LE_AUTH_REQ_SC_BOND);
+  security->setCapability(ESP_IO_CAP_NONE);
+  security->setInitEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+  security->setRespEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+}
+
+/// @param name device name.
+void BleGatt::setDeviceName(const char *name) {
+  esp_ble_gap_set_device_name(name);
+}
+
+/// Sets the transmit power of advertising, connections keep the power set by init.
+/// @param powerLevel transmit power.
+void BleGatt::setAdvertisingPower(esp_power_level_t powerLevel) {
+  BLEDevice::setPower(powerLevel,
+                      ESP_BLE_PWR_TYPE_ADV);
+}
+
+/// @param bytes 128 bit UUID, least significant byte first.
+/// @returns UUID.
+BLEUUID BleGatt::uuid(const uint8_t *bytes) {
+  esp_bt_uuid_t espUuid;
+  espUuid.len = ESP_UUID_LEN_128;
+  memcpy(espUuid.uuid.uuid128,
+         bytes,
+         ESP_UUID_LEN_128);
+  return BLEUUID(espUuid);
+}
+
+/// Adds the client characteristic configuration descriptor needed to subscribe.
+/// @param characteristic characteristic.
+/// @param storage sizeof(BleGattCccd) bytes for the descriptor, nullptr to allocate it.
+void BleGatt::addCccd(BLECharacteristic *characteristic, void *storage) {
+  characteristic->addDescriptor(storage ? new(storage) BLE2902() : CoBmecBootArena::make<BLE2902>());
+}
+
+/// Marks the value as UTF-8 text.
+/// @param characteristic characteristic.
+void BleGatt::addUtf8Format(BLECharacteristic *characteristic) {
+  auto *format = CoBmecBootArena::make<BLE2904>();
+  format->setFormat(BLE2904::FORMAT_UTF8);
+  characteristic->addDescriptor(format);
+}
+
+/// Rejects writes on an unencrypted link, so that the client pairs first.
+/// @param characteristic characteristic.
+void BleGatt::encryptWrites(BLECharacteristic *characteristic) {
+  characteristic->setAccessPermissions(ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE_ENCRYPTED);
+}
+
+/// @returns the MTU agreed with the client.
+uint16_t BleGatt::peerMtu(BLEServer *server, const BleGattPeer &peer) {
+  return server->getPeerMTU(peer.connId_);
+}
+
+/// Requests data length extension.
+/// @param peer client.
+/// @param octets link layer payload.
+void BleGatt::setDataLength(const BleGattPeer &peer, uint16_t octets) {
+  esp_bd_addr_t address;
+  memcpy(address,
+         peer.address_,
+         sizeof(address));
+  esp_ble_gap_set_pkt_data_len(address,
+                               octets);
+}
+
+/// Tells the client to discard its cache of the whole attribute table.
+/// @param server server.
+/// @param peer client.
+void BleGatt::indicateServicesChanged(BLEServer *server, const BleGattPeer &peer) {
+  esp_bd_addr_t address;
+  memcpy(address,
+         peer.address_,
+         sizeof(address));
+  esp_ble_gatts_send_service_change_indication(server->getGattsIf(),
+                                               address);
+}
+
+/// Requests connection parameters, intervals in 1.25 ms and the timeout in 10 ms units.
+void BleGatt::updateConnParams(BLEServer *server,
+                               const BleGattPeer &peer,
+                               uint16_t minInterval,
+                               uint16_t maxInterval,
+                               uint16_t latency,
+                               uint16_t timeout) {
+  esp_bd_addr_t address;
+  memcpy(address,
+         peer.address_,
+         sizeof(address));
+  server->updateConnParams(address,
+                           minInterval,
+                           maxInterval,
+                           latency,
+                           timeout);
+}
+
+#endif
+
+/// @}
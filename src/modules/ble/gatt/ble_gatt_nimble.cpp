@@ -0,0 +1,179 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file ble_gatt_nimble.cpp
+/// @brief NimBLE backend of the GATT layer.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#ifdef CO_BMEC_BLE_NIMBLE
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstring>
+#include <services/gap/ble_svc_gap.h>
+#include <services/gatt/ble_svc_gatt.h>
+#include "ble_gatt.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define DATA_LENGTH_US_PER_OCTET    8  /// On the 1M PHY.
+#define DATA_LENGTH_OVERHEAD        14  /// Link layer header, MIC and CRC octets.
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+volatile bool BleGatt::released_ = false;
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// BleGattServerCallbacks.
+
+void BleGattServerCallbacks::onConnect(BLEServer *server, ble_gap_conn_desc *desc) {
+  BleGattPeer peer;
+  memcpy(peer.address_,
+         desc->peer_ota_addr.val,
+         sizeof(peer.address_));
+  peer.connId_ = desc->conn_handle;
+  onPeerConnect(server,
+                peer);
+}
+
+void BleGattServerCallbacks::onDisconnect(BLEServer *server) {
+  onPeerDisconnect(server);
+}
+
+void BleGattServerCallbacks::onMTUChange(uint16_t mtu, ble_gap_conn_desc *desc) {
+  onPeerMtu(mtu);
+}
+
+// BleGatt.
+
+/// Starts the host.
+/// @param mtu largest MTU offered to clients.
+/// @param powerLevel transmit power.
+void BleGatt::init(uint16_t mtu, esp_power_level_t powerLevel) {
+  // The NimBLE controller is configured for BLE only, classic memory is not reserved.
+  BLEDevice::init("");
+  BLEDevice::setPower(powerLevel);
+  BLEDevice::setMTU(mtu);
+}
+
+/// Stops the host and returns the controller memory to the heap. The host cannot be restarted.
+/// The server, services, characteristics and callbacks are kept, deinit(true) would delete
+/// them while the modules still hold them, and they may live in the boot arena.
+void BleGatt::release() {
+  released_ = true;
+  BLEDevice::deinit(false);
+  esp_bt_controller_mem_release(ESP_BT_MODE_BTDM);
+}
+
+/// Notifies the subscribed clients. Dropped once released, the host is no longer running.
+/// @param characteristic characteristic.
+void BleGatt::notify(BLECharacteristic *characteristic) {
+  if (!released_) {
+    characteristic->notify();
+  }
+}
+
+/// Sets the server callbacks, which the server does not own as they may live in the boot arena.
+/// @param server server.
+/// @param callbacks callbacks, kept.
+void BleGatt::setServerCallbacks(BLEServer *server, BLEServerCallbacks *callbacks) {
+  server->setCallbacks(callbacks,
+                       false);
+}
+
+/// Bonds with clients without pairing input, the keys are persisted by the host, so a
+/// bonded client keeps its GATT cache and skips discovery on reconnect.
+void BleGatt::enableBonding() {
+  BLEDevice::setSecurityAuth(true,
+                             false,
+                             true);
+  BLEDevice::setSecurityIOCap(BLE_HS_IO_NO_INPUT_OUTPUT);
+}
+
+/// @param name device name.
+void BleGatt::setDeviceName(const char *name) {
+  ble_svc_gap_device_name_set(name);
+}
+
+/// Sets the transmit power of advertising, connections keep the power set by init.
+/// @param powerLevel transmit power.
+void BleGatt::setAdvertisingPower(esp_power_level_t powerLevel) {
+  BLEDevice::setPower(powerLevel,
+                      ESP_BLE_PWR_TYPE_ADV);
+}
+
+/// @param bytes 128 bit UUID, least significant byte first.
+/// @returns UUID.
+BLEUUID BleGatt::uuid(const uint8_t *bytes) {
+  return BLEUUID(bytes,
+                 16,
+                 false);
+}
+
+/// NimBLE adds the client characteristic configuration descriptor to notifying characteristics.
+/// @param characteristic characteristic.
+/// @param storage unused.
+void BleGatt::addCccd(BLECharacteristic *characteristic, void *storage) {}
+
+/// Marks the value as UTF-8 text.
+/// @param characteristic characteristic.
+void BleGatt::addUtf8Format(BLECharacteristic *characteristic) {
+  auto *format = static_cast<NimBLE2904 *>(characteristic->createDescriptor("2904"));
+  format->setFormat(NimBLE2904::FORMAT_UTF8);
+}
+
+/// NimBLE sets the permission from the BleGattProperty::WRITE_ENC property.
+/// @param characteristic characteristic.
+void BleGatt::encryptWrites(BLECharacteristic *characteristic) {}
+
+/// @returns the MTU agreed with the client.
+uint16_t BleGatt::peerMtu(BLEServer *server, const BleGattPeer &peer) {
+  return server->getPeerMTU(peer.connId_);
+}
+
+/// Requests data length extension.
+/// @param peer client.
+/// @param octets link layer payload.
+void BleGatt::setDataLength(const BleGattPeer &peer, uint16_t octets) {
+  ble_gap_set_data_len(peer.connId_,
+                       octets,
+                       (octets + DATA_LENGTH_OVERHEAD) * DATA_LENGTH_US_PER_OCTET);
+}
+
+/// Tells the clients to discard their cache of the whole attribute table.
+/// @param server server.
+/// @param peer client, NimBLE indicates every subscribed client.
+void BleGatt::indicateServicesChanged(BLEServer *server, const BleGattPeer &peer) {
+  ble_svc_gatt_changed(0x0001,
+                       0xffff);
+}
+
+/// Requests connection parameters, intervals in 1.25 ms and the timeout in 10 ms units.
+void BleGatt::updateConnParams(BLEServer *server,
+                               const BleGattPeer &peer,
+                               uint16_t minInterval,
+                               uint16_t maxInterval,
+                               uint16_t latency,
+                               uint16_t timeout) {
+  server->updateConnParams(peer.connId_,
+                           minInterval,
+                           maxInterval,
+                           latency,
+                           timeout);
+}
+
+#endif
+
+/// @}
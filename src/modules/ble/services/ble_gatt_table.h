@@ -0,0 +1,137 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file ble_gatt_table.h
+/// @brief Table driven registration of BLE services with compile time UUIDs and pooled storage.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <array>
+#include <new>
+#include "modules/ble/gatt/ble_gatt.h"
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+#define BLE_GATT_SERVICE_INDEX       10  ///< UUID index of the service, the characteristics follow.
+#define BLE_GATT_MAX_INDEX           99  ///< The index is written as two decimal digits.
+#define BLE_GATT_UUID_LEN            16
+
+//*********************************************************************
+// #forward declarations
+//*********************************************************************
+
+//*********************************************************************
+// class declarations
+//*********************************************************************
+/// 128 bit UUID, least significant byte first.
+struct BleGattUuid {
+  uint8_t bytes_[BLE_GATT_UUID_LEN]{};
+};
+
+/// Builds the UUID "000000NN-000G-0000-0000-681ff943633b" where NN is the index in decimal
+/// and G the group, as the services previously did at runtime with String concatenation.
+/// @param group service group, e.g. 0x0005 for the first status service.
+/// @param index index of the service or characteristic.
+/// @returns UUID.
+constexpr BleGattUuid bleGattUuid(uint16_t group, uint8_t index) {
+  const uint8_t base[] = {0x3b, 0x63, 0x43, 0xf9, 0x1f, 0x68, 0x00, 0x00, 0x00, 0x00};
+  BleGattUuid uuid;
+  for (size_t i = 0; i < sizeof(base); i++) {
+    uuid.bytes_[i] = base[i];
+  }
+  uuid.bytes_[10] = group & 0xff;
+  uuid.bytes_[11] = group >> 8;
+  uuid.bytes_[12] = ((index / 10) << 4) | (index % 10);
+  return uuid;
+}
+
+/// Characteristic of a service table.
+/// @tparam Service class that holds the characteristic pointer.
+template<typename Service>
+struct BleGattChar {
+  BLECharacteristic *Service::*member_;  ///< Set to the created characteristic.
+  uint32_t properties_;
+  bool cccd_;  ///< Adds a client characteristic configuration descriptor.
+};
+
+/// @returns the number of characteristics in a table.
+template<typename Service, size_t N>
+constexpr size_t bleGattChars(const BleGattChar<Service> (&)[N]) {
+  return N;
+}
+
+/// @returns the number of client characteristic configuration descriptors in a table.
+template<typename Service, size_t N>
+constexpr size_t bleGattCccds(const BleGattChar<Service> (&table)[N]) {
+  size_t cccds = 0;
+  for (size_t i = 0; i < N; i++) {
+    cccds += table[i].cccd_;
+  }
+  return cccds;
+}
+
+/// Static storage for the characteristics and descriptors of one service.
+/// The UUIDs and handle count are derived from the table at compile time.
+/// @tparam GROUP service group of the UUIDs.
+/// @tparam CHARS number of characteristics, bleGattChars(table).
+/// @tparam CCCDS number of descriptors, bleGattCccds(table).
+template<uint16_t GROUP, size_t CHARS, size_t CCCDS>
+class BleGattPool {
+ public:
+
+  static_assert(BLE_GATT_SERVICE_INDEX + CHARS <= BLE_GATT_MAX_INDEX, "Too many characteristics for the UUID scheme.");
+
+  /// Service declaration, then a declaration and value per characteristic and one handle per descriptor.
+  static constexpr uint16_t HANDLES = 1 + 2 * CHARS + CCCDS;
+
+  /// Service UUID followed by the characteristic UUIDs.
+  static constexpr std::array<BleGattUuid, CHARS + 1> UUIDS = [] {
+    std::array<BleGattUuid, CHARS + 1> uuids{};
+    for (size_t i = 0; i < uuids.size(); i++) {
+      uuids[i] = bleGattUuid(GROUP, BLE_GATT_SERVICE_INDEX + i);
+    }
+    return uuids;
+  }();
+
+  /// Creates the service and its characteristics in the pool.
+  /// @param server server.
+  /// @param service object whose characteristic pointers are set.
+  /// @param table characteristic table.
+  /// @returns the service.
+  template<typename Service>
+  BLEService *create(BLEServer *server, Service &service, const BleGattChar<Service> (&table)[CHARS]) {
+    BLEService *bleService = server->createService(BleGatt::uuid(UUIDS[0].bytes_),
+                                                   HANDLES);
+
+    size_t cccd = 0;
+    for (size_t i = 0; i < CHARS; i++) {
+      auto *characteristic = new(chars_[i]) BLECharacteristic(BleGatt::uuid(UUIDS[i + 1].bytes_),
+                                                              table[i].properties_);
+      service.*(table[i].member_) = characteristic;
+      bleService->addCharacteristic(characteristic);
+      if (table[i].cccd_) {
+        BleGatt::addCccd(characteristic,
+                         cccds_[cccd++]);
+      }
+    }
+    return bleService;
+  }
+
+ private:
+
+  alignas(BLECharacteristic) uint8_t chars_[CHARS][sizeof(BLECharacteristic)]{};
+  alignas(BleGattCccd) uint8_t cccds_[CCCDS ? CCCDS : 1][sizeof(BleGattCccd)]{};
+};
+
+/// @}
@@ -0,0 +1,47 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file ble_bulk_service.cpp
+/// @brief BLE bulk transfer service for payloads larger than one attribute.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "modules/ble/gatt/ble_gatt.h"
+#include "../ble_gatt_table.h"
+#include "ble_bulk_service.h"
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+#define BLE_SERVICE_BULK_GROUP      0x0007
+
+//*********************************************************************
+// #constructors.
+//*********************************************************************
+/// Creates the service on the server.
+/// @param server
+BleServiceBulk::BleServiceBulk(BLEServer *server) {
+
+  // Characteristics in UUID order, following the service.
+  static constexpr BleGattChar<BleServiceBulk> TABLE[] = {
+      {&BleServiceBulk::charData_, BleGattProperty::NOTIFY, true},
+      {&BleServiceBulk::charControl_, BleGattProperty::WRITE | BleGattProperty::WRITE_NR, false},
+      {&BleServiceBulk::charStats_, BleGattProperty::READ, false},
+  };
+
+  // Storage for a single instance.
+  static BleGattPool<BLE_SERVICE_BULK_GROUP, bleGattChars(TABLE), bleGattCccds(TABLE)> pool;
+
+  // Create service.
+  bleService_ = pool.create(server, *this, TABLE);
+}
+
+/// @}
@@ -0,0 +1,49 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file ble_bulk_service.h
+/// @brief BLE bulk transfer service for payloads larger than one attribute.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "modules/ble/gatt/ble_gatt.h"
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+
+//*********************************************************************
+// #forward declarations
+//*********************************************************************
+
+//*********************************************************************
+// class declarations
+//*********************************************************************
+/// BLE bulk transfer service class.
+class BleServiceBulk {
+ public:
+  explicit BleServiceBulk(BLEServer *server);
+
+  // Service
+  BLEService *bleService_{};
+
+  // Characteristics for the service.
+  BLECharacteristic *charData_{};  ///< Framed chunks, by notification.
+  BLECharacteristic *charControl_{};  ///< Credits and aborts from the client.
+  BLECharacteristic *charStats_{};  ///< Transfer statistics.
+
+ private:
+
+};
+
+/// @}
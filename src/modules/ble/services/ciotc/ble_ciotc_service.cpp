@@ -15,14 +15,14 @@
 // #includes.
 //*********************************************************************
 #include "Arduino.h"
-#include <BLEDevice.h>
+#include "modules/ble/gatt/ble_gatt.h"
+#include "../ble_gatt_table.h"
 #include "ble_ciotc_service.h"
 
 //*********************************************************************
 // #defines
 //*********************************************************************
-#define BLE_SERVICE_CIOTC_HANDLES       6
-#define BLE_SERVICE_CIOTC_BASE_UUID     "-0002-0000-0000-681ff943633b"
+#define BLE_SERVICE_CIOTC_GROUP     0x0002
 
 //*********************************************************************
 // #constructors.
@@ -31,14 +31,17 @@
 /// @param server
 BleServiceCiotc::BleServiceCiotc(BLEServer *server) {
 
-    int uuidIndex = 10;
+    // Characteristics in UUID order, following the service.
+    static constexpr BleGattChar<BleServiceCiotc> TABLE[] = {
+        {&BleServiceCiotc::charDeviceId_, BleGattProperty::WRITE | BleGattProperty::READ, false},
+        {&BleServiceCiotc::charPrivateKey_, BleGattProperty::WRITE, false},
+    };
 
-    // Create service.
-    bleService_ = server->createService(BLEUUID(("000000" + String(uuidIndex++) + BLE_SERVICE_CIOTC_BASE_UUID).c_str()), BLE_SERVICE_CIOTC_HANDLES);
+    // Storage for a single instance.
+    static BleGattPool<BLE_SERVICE_CIOTC_GROUP, bleGattChars(TABLE), bleGattCccds(TABLE)> pool;
 
-    // Add the characteristics.
-    bleService_->addCharacteristic(charDeviceId_ = new BLECharacteristic(BLEUUID(("000000" + String(uuidIndex++) + BLE_SERVICE_CIOTC_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_READ));
-    bleService_->addCharacteristic(charPrivateKey_ = new BLECharacteristic(BLEUUID(("000000" + String(uuidIndex++) +  BLE_SERVICE_CIOTC_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_WRITE));
+    // Create service.
+    bleService_ = pool.create(server, *this, TABLE);
 }
 
 /// @}
\ No newline at end of file
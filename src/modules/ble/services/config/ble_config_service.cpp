@@ -15,17 +15,16 @@
 // #includes.
 //*********************************************************************
 #include "Arduino.h"
-#include <BLEDevice.h>
-#include <BLE2902.h>
+#include "modules/ble/gatt/ble_gatt.h"
+#include "../ble_gatt_table.h"
 #include "ble_config_service.h"
+#include "modules/memory/co_bmec_boot_arena.h"
 
 //*********************************************************************
 // #defines
 //*********************************************************************
-static uint8_t BLE_SERVICE_1_HANDLES = 30 * 2;
-static uint8_t BLE_SERVICE_2_HANDLES = 7 * 2;
-static const char *BLE_SERVICE_1_BASE_UUID = "-0003-0000-0000-681ff943633b";
-static const char *BLE_SERVICE_2_BASE_UUID = "-0004-0000-0000-681ff943633b";
+#define BLE_SERVICE_1_GROUP         0x0003
+#define BLE_SERVICE_2_GROUP         0x0004
 
 //*********************************************************************
 // #constructors.
@@ -34,8 +33,8 @@ static const char *BLE_SERVICE_2_BASE_UUID = "-0004-0000-0000-681ff943633b";
 /// @param server
 
 BleServiceConfig::BleServiceConfig(BLEServer *server){
-  bleServiceConfig1_ = new BleServiceConfig1(server);
-  bleServiceConfig2_ = new BleServiceConfig2(server);
+  bleServiceConfig1_ = CoBmecBootArena::make<BleServiceConfig1>(server);
+  bleServiceConfig2_ = CoBmecBootArena::make<BleServiceConfig2>(server);
 }
 
 /// Starts the child services.
@@ -48,61 +47,61 @@ void BleServiceConfig::start() const {
 
 BleServiceConfig::BleServiceConfig1::BleServiceConfig1(BLEServer *server) {
 
-  // Init the iterator.
-  int serviceIndex = 10;
+  // Characteristics in UUID order, following the service.
+  static constexpr BleGattChar<BleServiceConfig1> TABLE[] = {
+      {&BleServiceConfig1::newDataChar_, BleGattProperty::READ | BleGattProperty::WRITE | BleGattProperty::NOTIFY, true},
+      {&BleServiceConfig1::firmwareVersionChar_, BleGattProperty::READ, false},
+      {&BleServiceConfig1::customerNameChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::customerKeyChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::siteNameChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::siteKeyChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::lineNameChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::pingTMsChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::enabledChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::nozzleCountChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::enabledInputBypassedChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::errorAutoResetChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::errorAutoResetDelaySChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::warningAlertDelaySChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::warningAlertRepeatDelaySChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::errorAlertDelaySChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::errorAlertRepeatDelaySChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::reactor1EnabledChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::reactor2EnabledChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::reactor3EnabledChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::reactor4EnabledChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::currentSetPointMaChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::currentWarningPercentChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::currentErrorPercentChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::ppmSetPointChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::ppmWarningPercentChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig1::ppmErrorPercentChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+  };
+
+  // Storage for a single instance.
+  static BleGattPool<BLE_SERVICE_1_GROUP, bleGattChars(TABLE), bleGattCccds(TABLE)> pool;
 
   // Create service.
-  bleService_ = server->createService(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLE_SERVICE_1_HANDLES);
-
-  // Add the characteristics.
-  bleService_->addCharacteristic(newDataChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY));
-
-  bleService_->addCharacteristic(firmwareVersionChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(customerNameChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(customerKeyChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(siteNameChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(siteKeyChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(lineNameChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(pingTMsChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(enabledChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(nozzleCountChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(enabledInputBypassedChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(errorAutoResetChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(errorAutoResetDelaySChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(warningAlertDelaySChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(warningAlertRepeatDelaySChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(errorAlertDelaySChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(errorAlertRepeatDelaySChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(reactor1EnabledChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(reactor2EnabledChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(reactor3EnabledChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(reactor4EnabledChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(currentSetPointMaChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(currentWarningPercentChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(currentErrorPercentChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(ppmSetPointChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(ppmWarningPercentChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(ppmErrorPercentChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  
-  // Add the descriptors.
-  newDataChar_->addDescriptor(new BLE2902());
+  bleService_ = pool.create(server, *this, TABLE);
 }
 
 BleServiceConfig::BleServiceConfig2::BleServiceConfig2(BLEServer *server) {
 
-  // Init the iterator.
-  int serviceIndex = 10;
+  // Characteristics in UUID order, following the service.
+  static constexpr BleGattChar<BleServiceConfig2> TABLE[] = {
+      {&BleServiceConfig2::airFlowPerNozzleSetPointMlpmChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig2::airFlowWarningPercentChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig2::airFlowErrorPercentChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig2::waterFlowPerNozzleSetPointMlpmChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig2::waterFlowWarningPercentChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+      {&BleServiceConfig2::waterFlowErrorPercentChar_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+  };
+
+  // Storage for a single instance.
+  static BleGattPool<BLE_SERVICE_2_GROUP, bleGattChars(TABLE), bleGattCccds(TABLE)> pool;
 
   // Create service.
-  bleService_ = server->createService(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLE_SERVICE_2_HANDLES);
-
-  // Add the characteristics.
-  bleService_->addCharacteristic(airFlowPerNozzleSetPointMlpmChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(airFlowWarningPercentChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(airFlowErrorPercentChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(waterFlowPerNozzleSetPointMlpmChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(waterFlowWarningPercentChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
-  bleService_->addCharacteristic(waterFlowErrorPercentChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE));
+  bleService_ = pool.create(server, *this, TABLE);
 }
 
 /// @}
\ No newline at end of file
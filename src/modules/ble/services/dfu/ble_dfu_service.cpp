@@ -0,0 +1,47 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file ble_dfu_service.cpp
+/// @brief BLE firmware update service.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "modules/ble/gatt/ble_gatt.h"
+#include "../ble_gatt_table.h"
+#include "ble_dfu_service.h"
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+#define BLE_SERVICE_DFU_GROUP       0x0009
+
+//*********************************************************************
+// #constructors.
+//*********************************************************************
+/// Creates the service on the server.
+/// @param server
+BleServiceDfu::BleServiceDfu(BLEServer *server) {
+
+  // Characteristics in UUID order, following the service.
+  static constexpr BleGattChar<BleServiceDfu> TABLE[] = {
+      {&BleServiceDfu::charData_, BleGattProperty::WRITE_NR, false},
+      {&BleServiceDfu::charControl_, BleGattProperty::WRITE, false},
+      {&BleServiceDfu::charStatus_, BleGattProperty::READ | BleGattProperty::NOTIFY, true},
+  };
+
+  // Storage for a single instance.
+  static BleGattPool<BLE_SERVICE_DFU_GROUP, bleGattChars(TABLE), bleGattCccds(TABLE)> pool;
+
+  // Create service.
+  bleService_ = pool.create(server, *this, TABLE);
+}
+
+/// @}
@@ -0,0 +1,49 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file ble_dfu_service.h
+/// @brief BLE firmware update service.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "modules/ble/gatt/ble_gatt.h"
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+
+//*********************************************************************
+// #forward declarations
+//*********************************************************************
+
+//*********************************************************************
+// class declarations
+//*********************************************************************
+/// BLE firmware update service class.
+class BleServiceDfu {
+ public:
+  explicit BleServiceDfu(BLEServer *server);
+
+  // Service
+  BLEService *bleService_{};
+
+  // Characteristics for the service.
+  BLECharacteristic *charData_{};  ///< Offset prefixed payload chunks, without response.
+  BLECharacteristic *charControl_{};  ///< Start and abort commands.
+  BLECharacteristic *charStatus_{};  ///< State, offsets and acknowledgements.
+
+ private:
+
+};
+
+/// @}
@@ -0,0 +1,48 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file ble_display_service.cpp
+/// @brief BLE display service for streamed frames and animations.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "modules/ble/gatt/ble_gatt.h"
+#include "../ble_gatt_table.h"
+#include "ble_display_service.h"
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+#define BLE_SERVICE_DISPLAY_GROUP   0x0008
+
+//*********************************************************************
+// #constructors.
+//*********************************************************************
+/// Creates the service on the server.
+/// @param server
+BleServiceDisplay::BleServiceDisplay(BLEServer *server) {
+
+  // Characteristics in UUID order, following the service.
+  static constexpr BleGattChar<BleServiceDisplay> TABLE[] = {
+      {&BleServiceDisplay::charFrame_, BleGattProperty::WRITE | BleGattProperty::WRITE_NR, false},
+      {&BleServiceDisplay::charControl_, BleGattProperty::WRITE, false},
+      {&BleServiceDisplay::charState_, BleGattProperty::READ | BleGattProperty::NOTIFY, true},
+      {&BleServiceDisplay::charSettings_, BleGattProperty::READ | BleGattProperty::WRITE, false},
+  };
+
+  // Storage for a single instance.
+  static BleGattPool<BLE_SERVICE_DISPLAY_GROUP, bleGattChars(TABLE), bleGattCccds(TABLE)> pool;
+
+  // Create service.
+  bleService_ = pool.create(server, *this, TABLE);
+}
+
+/// @}
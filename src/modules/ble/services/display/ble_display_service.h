@@ -0,0 +1,50 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ble ble
+/// @{
+
+/// @file ble_display_service.h
+/// @brief BLE display service for streamed frames and animations.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "modules/ble/gatt/ble_gatt.h"
+
+//*********************************************************************
+// #defines
+//*********************************************************************
+
+//*********************************************************************
+// #forward declarations
+//*********************************************************************
+
+//*********************************************************************
+// class declarations
+//*********************************************************************
+/// BLE display service class.
+class BleServiceDisplay {
+ public:
+  explicit BleServiceDisplay(BLEServer *server);
+
+  // Service
+  BLEService *bleService_{};
+
+  // Characteristics for the service.
+  BLECharacteristic *charFrame_{};  ///< Key and delta frames, see CoBmecDisplayCodec.
+  BLECharacteristic *charControl_{};  ///< Mode and clip commands.
+  BLECharacteristic *charState_{};  ///< Mode, clip and error counters.
+  BLECharacteristic *charSettings_{};  ///< Packed settings, see CoBmecDisplaySettings.
+
+ private:
+
+};
+
+/// @}
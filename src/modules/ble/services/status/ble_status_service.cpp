@@ -15,15 +15,15 @@
 // #includes.
 //*********************************************************************
 #include "Arduino.h"
+#include "../ble_gatt_table.h"
 #include "ble_status_service.h"
+#include "modules/memory/co_bmec_boot_arena.h"
 
 //*********************************************************************
 // #defines
 //*********************************************************************
-static uint8_t BLE_SERVICE_1_HANDLES = 26 * 2;
-static uint8_t BLE_SERVICE_2_HANDLES = 19 * 2;
-static const char *BLE_SERVICE_1_BASE_UUID = "-0005-0000-0000-681ff943633b";
-static const char *BLE_SERVICE_2_BASE_UUID = "-0006-0000-0000-681ff943633b";
+#define BLE_SERVICE_1_GROUP         0x0005
+#define BLE_SERVICE_2_GROUP         0x0006
 
 //*********************************************************************
 // #constructors.
@@ -31,8 +31,8 @@ static const char *BLE_SERVICE_2_BASE_UUID = "-0006-0000-0000-681ff943633b";
 /// Creates the service on the server.
 /// @param server
 BleServiceStatus::BleServiceStatus(BLEServer *server) {
-  bleServiceStatus1_ = new BleServiceStatus1(server);
-  bleServiceStatus2_ = new BleServiceStatus2(server);
+  bleServiceStatus1_ = CoBmecBootArena::make<BleServiceStatus1>(server);
+  bleServiceStatus2_ = CoBmecBootArena::make<BleServiceStatus2>(server);
 }
 
 /// Starts the child services.
@@ -45,71 +45,70 @@ void BleServiceStatus::start() const {
 
 BleServiceStatus::BleServiceStatus1::BleServiceStatus1(BLEServer *server) {
 
-  // Init the iterator.
-  int serviceIndex = 10;
+  // Characteristics in UUID order, following the service.
+  static constexpr BleGattChar<BleServiceStatus1> TABLE[] = {
+      {&BleServiceStatus1::newDataChar_, BleGattProperty::READ | BleGattProperty::WRITE | BleGattProperty::NOTIFY, true},
+      {&BleServiceStatus1::runtimeMChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::stateChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::enableSwitchEnabledChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::enabledInputEnabledChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::ozoneSafetySensorSafeChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::waterFlowMlpmChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::waterPressureMbarChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::waterAoChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::waterErrorStateChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::coolingPressureMbarChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::coolingTempCChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::coolingAtmosphericPressureMbarChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::coolingAoChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::coolingErrorStateChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::airFlowSmlpmChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::airAoChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::airErrorStateChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::ozoneOzonePpmChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::ozoneOzoneAiChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::ozoneScrubbedAiChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::ozoneTempDegCChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::ozonePressureMbarChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus1::ozoneErrorStateChar_, BleGattProperty::READ, false},
+  };
+
+  // Storage for a single instance.
+  static BleGattPool<BLE_SERVICE_1_GROUP, bleGattChars(TABLE), bleGattCccds(TABLE)> pool;
 
   // Create service.
-  bleService_ = server->createService(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLE_SERVICE_1_HANDLES);
-
-  // Add the characteristics.
-  bleService_->addCharacteristic(newDataChar_ = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY));
-
-  bleService_->addCharacteristic(runtimeMChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(stateChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(enableSwitchEnabledChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(enabledInputEnabledChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(ozoneSafetySensorSafeChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(waterFlowMlpmChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(waterPressureMbarChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(waterAoChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(waterErrorStateChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(coolingPressureMbarChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(coolingTempCChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(coolingAtmosphericPressureMbarChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(coolingAoChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(coolingErrorStateChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(airFlowSmlpmChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(airAoChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(airErrorStateChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(ozoneOzonePpmChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(ozoneOzoneAiChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(ozoneScrubbedAiChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(ozoneTempDegCChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(ozonePressureMbarChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(ozoneErrorStateChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_1_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-
-
-  // Add the descriptors.
-  newDataChar_->addDescriptor(new BLE2902());
+  bleService_ = pool.create(server, *this, TABLE);
 }
 
 BleServiceStatus::BleServiceStatus2::BleServiceStatus2(BLEServer *server) {
 
-  // Init the iterator.
-  int serviceIndex = 10;
+  // Characteristics in UUID order, following the service.
+  static constexpr BleGattChar<BleServiceStatus2> TABLE[] = {
+      {&BleServiceStatus2::reactor1CurrentMaChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::reactor1AoChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::reactor1ErrorStateChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::reactor2CurrentMaChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::reactor2AoChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::reactor2ErrorStateChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::reactor3CurrentMaChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::reactor3AoChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::reactor3ErrorStateChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::reactor4CurrentMaChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::reactor4AoChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::reactor4ErrorStateChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::batteryOkayChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::batteryVoltageChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::psuOkayChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::psuVoltageChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::warningAlertChar_, BleGattProperty::READ, false},
+      {&BleServiceStatus2::errorAlertChar_, BleGattProperty::READ, false},
+  };
+
+  // Storage for a single instance.
+  static BleGattPool<BLE_SERVICE_2_GROUP, bleGattChars(TABLE), bleGattCccds(TABLE)> pool;
 
   // Create service.
-  bleService_ = server->createService(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLE_SERVICE_2_HANDLES);
-
-  // Add the characteristics.
-  bleService_->addCharacteristic(reactor1CurrentMaChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(reactor1AoChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(reactor1ErrorStateChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(reactor2CurrentMaChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(reactor2AoChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(reactor2ErrorStateChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(reactor3CurrentMaChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(reactor3AoChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(reactor3ErrorStateChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(reactor4CurrentMaChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(reactor4AoChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(reactor4ErrorStateChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(batteryOkayChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(batteryVoltageChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(psuOkayChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(psuVoltageChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(warningAlertChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
-  bleService_->addCharacteristic(errorAlertChar_  = new BLECharacteristic(BLEUUID(("000000" + String(serviceIndex++) + BLE_SERVICE_2_BASE_UUID).c_str()), BLECharacteristic::PROPERTY_READ));
+  bleService_ = pool.create(server, *this, TABLE);
 }
 
 /// @}
\ No newline at end of file
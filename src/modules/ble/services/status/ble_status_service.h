@@ -13,8 +13,7 @@
 
 #pragma once
 
-#include <BLEDevice.h>
-#include <BLE2902.h>
+#include "modules/ble/gatt/ble_gatt.h"
 
 //*********************************************************************
 // #includes.
@@ -32,6 +31,7 @@
 // class declarations
 //*********************************************************************
 /// BLE state service class.
+/// Fed by a CoBmecBleStatusPublisher, with newDataChar_ as the characteristic notified per batch.
 class BleServiceStatus {
   class BleServiceStatus1 {
    public:
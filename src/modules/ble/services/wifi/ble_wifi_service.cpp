@@ -14,15 +14,13 @@
 //*********************************************************************
 // #includes.
 //*********************************************************************
-#include <BLEDevice.h>
-#include <BLE2902.h>
-#include <BLE2904.h>
+#include "modules/ble/gatt/ble_gatt.h"
 #include "ble_wifi_service.h"
 
 //*********************************************************************
 // #defines
 //*********************************************************************
-#define BLE_SERVICE_WIFI_HANDLES 70
+#define BLE_SERVICE_WIFI_HANDLES 60
 
 //*********************************************************************
 // #constructors.
@@ -36,113 +34,76 @@ BleServiceWifi::BleServiceWifi(BLEServer *server) {
 
     // -----------------------------------------------------------------------------------------------------------------
     bleService_->addCharacteristic(charApCommand_);
-    charApCommand_->addDescriptor(new BLE2902());
+    BleGatt::addCccd(charApCommand_);
 
     // -----------------------------------------------------------------------------------------------------------------
     bleService_->addCharacteristic(charApState_);
-    charApState_->addDescriptor(new BLE2902());
+    BleGatt::addCccd(charApState_);
 
     // -----------------------------------------------------------------------------------------------------------------
     bleService_->addCharacteristic(charApError_);
-    charApError_->addDescriptor(new BLE2902());
+    BleGatt::addCccd(charApError_);
 
     // -----------------------------------------------------------------------------------------------------------------
     bleService_->addCharacteristic(charScanCommand_);
-    charScanCommand_->addDescriptor(new BLE2902());
+    BleGatt::addCccd(charScanCommand_);
 
     // -----------------------------------------------------------------------------------------------------------------
     bleService_->addCharacteristic(charScanState_);
-    charScanState_->addDescriptor(new BLE2902());
+    BleGatt::addCccd(charScanState_);
 
     // -----------------------------------------------------------------------------------------------------------------
     bleService_->addCharacteristic(charScanError_);
-    charScanError_->addDescriptor(new BLE2902());
+    BleGatt::addCccd(charScanError_);
 
     // -----------------------------------------------------------------------------------------------------------------
     bleService_->addCharacteristic(charSsid_);
-    charSsid_->addDescriptor(new BLE2902());
+    BleGatt::addCccd(charSsid_);
 
     // Add format descriptor.
-    auto *pCharSsidDescBle2904 = new BLE2904();
-    pCharSsidDescBle2904->setFormat(BLE2904::FORMAT_UTF8);
-    charSsid_->addDescriptor(pCharSsidDescBle2904);
+    BleGatt::addUtf8Format(charSsid_);
 
     // -----------------------------------------------------------------------------------------------------------------
     bleService_->addCharacteristic(charSecurity_);
-    charSecurity_->addDescriptor(new BLE2902());
+    BleGatt::addCccd(charSecurity_);
 
     // -----------------------------------------------------------------------------------------------------------------
     bleService_->addCharacteristic(charIdentity_);
-    charIdentity_->addDescriptor(new BLE2902());
+    BleGatt::addCccd(charIdentity_);
 
     // Add format descriptor.
-    auto *pCharIdentityDescBle2904 = new BLE2904();
-    pCharIdentityDescBle2904->setFormat(BLE2904::FORMAT_UTF8);
-    charIdentity_->addDescriptor(pCharIdentityDescBle2904);
+    BleGatt::addUtf8Format(charIdentity_);
 
     // -----------------------------------------------------------------------------------------------------------------
     bleService_->addCharacteristic(charUsername_);
-    charUsername_->addDescriptor(new BLE2902());
+    BleGatt::addCccd(charUsername_);
 
     // Add format descriptor.
-    auto *pCharUsernameDescBle2904 = new BLE2904();
-    pCharUsernameDescBle2904->setFormat(BLE2904::FORMAT_UTF8);
-    charUsername_->addDescriptor(pCharUsernameDescBle2904);
+    BleGatt::addUtf8Format(charUsername_);
 
     // -----------------------------------------------------------------------------------------------------------------
     bleService_->addCharacteristic(charPassword_);
-//    charPassword_->setAccessPermissions(ESP_GATT_PERM_READ_ENCRYPTED);  Feature enable to improve security.
-    charPassword_->addDescriptor(new BLE2902());
+    BleGatt::encryptWrites(charPassword_);  // Pairs the client before the password is sent.
+    BleGatt::addCccd(charPassword_);
 
     // Add format descriptor.
-    auto *pCharPasswordDescBle2904 = new BLE2904();
-    pCharPasswordDescBle2904->setFormat(BLE2904::FORMAT_UTF8);
-    charPassword_->addDescriptor(pCharPasswordDescBle2904);
+    BleGatt::addUtf8Format(charPassword_);
 
     // -----------------------------------------------------------------------------------------------------------------
-    bleService_->addCharacteristic(charApListPart1_);
-    charApListPart1_->addDescriptor(new BLE2902());
-
-    // Add format descriptor.
-    auto *pCharApListPart1DescBle2904 = new BLE2904();
-    pCharApListPart1DescBle2904->setFormat(BLE2904::FORMAT_UTF8);
-    charApListPart1_->addDescriptor(pCharApListPart1DescBle2904);
-
-    // -----------------------------------------------------------------------------------------------------------------
-    bleService_->addCharacteristic(charApListPart2_);
-    charApListPart2_->addDescriptor(new BLE2902());
-
-    // Add format descriptor.
-    auto *pCharApListPart2DescBle2904 = new BLE2904();
-    pCharApListPart2DescBle2904->setFormat(BLE2904::FORMAT_UTF8);
-    charApListPart2_->addDescriptor(pCharApListPart2DescBle2904);
+    bleService_->addCharacteristic(charTelemetry_);
+    BleGatt::addCccd(charTelemetry_);
 
     // -----------------------------------------------------------------------------------------------------------------
-    bleService_->addCharacteristic(charApListPart3_);
-    charApListPart3_->addDescriptor(new BLE2902());
-
-    // Add format descriptor.
-    auto *pCharApListPart3DescBle2904 = new BLE2904();
-    pCharApListPart3DescBle2904->setFormat(BLE2904::FORMAT_UTF8);
-    charApListPart3_->addDescriptor(pCharApListPart3DescBle2904);
+    bleService_->addCharacteristic(charPowerProfile_);
+    BleGatt::addCccd(charPowerProfile_);
 
     // -----------------------------------------------------------------------------------------------------------------
-    bleService_->addCharacteristic(charApListPart4_);
-    charApListPart4_->addDescriptor(new BLE2902());
-
-    // Add format descriptor.
-    auto *pCharApListPart4DescBle2904 = new BLE2904();
-    pCharApListPart4DescBle2904->setFormat(BLE2904::FORMAT_UTF8);
-    charApListPart4_->addDescriptor(pCharApListPart4DescBle2904);
+    bleService_->addCharacteristic(charPowerReport_);
+    BleGatt::addCccd(charPowerReport_);
 
     // -----------------------------------------------------------------------------------------------------------------
-    bleService_->addCharacteristic(charApListPart5_);
-    charApListPart5_->addDescriptor(new BLE2902());
-
-    // Add format descriptor.
-    auto *pCharApListPart5DescBle2904 = new BLE2904();
-    pCharApListPart5DescBle2904->setFormat(BLE2904::FORMAT_UTF8);
-    charApListPart5_->addDescriptor(pCharApListPart5DescBle2904);
+    bleService_->addCharacteristic(charScanProgress_);
+    BleGatt::addCccd(charScanProgress_);
 }
 
 /// @}
\ No newline at end of file
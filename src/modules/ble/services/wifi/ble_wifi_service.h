@@ -16,7 +16,8 @@
 //*********************************************************************
 // #includes.
 //*********************************************************************
-#include <BLEServer.h>
+#include "modules/ble/gatt/ble_gatt.h"
+#include "modules/memory/co_bmec_boot_arena.h"
 
 //*********************************************************************
 // #defines
@@ -47,39 +48,39 @@ class BleServiceWifi {
   static constexpr const char *CHAR_IDENTITY_UUID = "00000019-0001-0000-0000-681ff943633b";
   static constexpr const char *CHAR_USERNAME_UUID = "00000020-0001-0000-0000-681ff943633b";
   static constexpr const char *CHAR_PASSWORD_UUID = "00000021-0001-0000-0000-681ff943633b";
-  static constexpr const char *CHAR_AP_LIST_PART_1 = "00000022-0001-0000-0000-681ff943633b";
-  static constexpr const char *CHAR_AP_LIST_PART_2 = "00000023-0001-0000-0000-681ff943633b";
-  static constexpr const char *CHAR_AP_LIST_PART_3 = "00000024-0001-0000-0000-681ff943633b";
-  static constexpr const char *CHAR_AP_LIST_PART_4 = "00000025-0001-0000-0000-681ff943633b";
-  static constexpr const char *CHAR_AP_LIST_PART_5 = "00000026-0001-0000-0000-681ff943633b";
+  static constexpr const char *CHAR_TELEMETRY_UUID = "00000027-0001-0000-0000-681ff943633b";
+  static constexpr const char *CHAR_POWER_PROFILE_UUID = "00000028-0001-0000-0000-681ff943633b";
+  static constexpr const char *CHAR_POWER_REPORT_UUID = "00000029-0001-0000-0000-681ff943633b";
+  static constexpr const char *CHAR_SCAN_PROGRESS_UUID = "00000030-0001-0000-0000-681ff943633b";
 
   /// Service
   BLEService *bleService_{};
 
   /// Characteristics for the startService.
-  BLECharacteristic *charApCommand_ = new BLECharacteristic(CHAR_AP_COMMAND_UUID, BLECharacteristic::PROPERTY_WRITE);
+  BLECharacteristic *charApCommand_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_AP_COMMAND_UUID, BleGattProperty::WRITE);
 
-  BLECharacteristic *charApState_ = new BLECharacteristic(CHAR_AP_STATE_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+  BLECharacteristic *charApState_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_AP_STATE_UUID, BleGattProperty::READ | BleGattProperty::NOTIFY);
 
-  BLECharacteristic *charApError_ = new BLECharacteristic(CHAR_AP_ERROR_UUID, BLECharacteristic::PROPERTY_READ);
+  BLECharacteristic *charApError_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_AP_ERROR_UUID, BleGattProperty::READ);
 
-  BLECharacteristic *charScanCommand_ = new BLECharacteristic(CHAR_SCAN_COMMAND_UUID, BLECharacteristic::PROPERTY_WRITE);
+  BLECharacteristic *charScanCommand_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_SCAN_COMMAND_UUID, BleGattProperty::WRITE);
 
-  BLECharacteristic *charScanState_ = new BLECharacteristic(CHAR_SCAN_STATE_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+  BLECharacteristic *charScanState_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_SCAN_STATE_UUID, BleGattProperty::READ | BleGattProperty::NOTIFY);
 
-  BLECharacteristic *charScanError_ = new BLECharacteristic(CHAR_SCAN_ERROR_UUID, BLECharacteristic::PROPERTY_READ);
+  BLECharacteristic *charScanError_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_SCAN_ERROR_UUID, BleGattProperty::READ);
 
-  BLECharacteristic *charSsid_ = new BLECharacteristic(CHAR_SSID_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
-  BLECharacteristic *charSecurity_ = new BLECharacteristic(CHAR_SECURITY_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
-  BLECharacteristic *charIdentity_ = new BLECharacteristic(CHAR_IDENTITY_UUID, BLECharacteristic::PROPERTY_WRITE);
-  BLECharacteristic *charUsername_ = new BLECharacteristic(CHAR_USERNAME_UUID, BLECharacteristic::PROPERTY_WRITE);
-  BLECharacteristic *charPassword_ = new BLECharacteristic(CHAR_PASSWORD_UUID, BLECharacteristic::PROPERTY_WRITE);
+  BLECharacteristic *charScanProgress_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_SCAN_PROGRESS_UUID, BleGattProperty::READ | BleGattProperty::NOTIFY);
 
-  BLECharacteristic *charApListPart1_ = new BLECharacteristic(CHAR_AP_LIST_PART_1, BLECharacteristic::PROPERTY_READ);
-  BLECharacteristic *charApListPart2_ = new BLECharacteristic(CHAR_AP_LIST_PART_2, BLECharacteristic::PROPERTY_READ);
-  BLECharacteristic *charApListPart3_ = new BLECharacteristic(CHAR_AP_LIST_PART_3, BLECharacteristic::PROPERTY_READ);
-  BLECharacteristic *charApListPart4_ = new BLECharacteristic(CHAR_AP_LIST_PART_4, BLECharacteristic::PROPERTY_READ);
-  BLECharacteristic *charApListPart5_ = new BLECharacteristic(CHAR_AP_LIST_PART_5, BLECharacteristic::PROPERTY_READ);
+  BLECharacteristic *charSsid_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_SSID_UUID, BleGattProperty::READ | BleGattProperty::WRITE);
+  BLECharacteristic *charSecurity_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_SECURITY_UUID, BleGattProperty::READ | BleGattProperty::WRITE);
+  BLECharacteristic *charIdentity_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_IDENTITY_UUID, BleGattProperty::WRITE);
+  BLECharacteristic *charUsername_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_USERNAME_UUID, BleGattProperty::WRITE);
+  BLECharacteristic *charPassword_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_PASSWORD_UUID, BleGattProperty::WRITE | BleGattProperty::WRITE_ENC);
+
+  BLECharacteristic *charTelemetry_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_TELEMETRY_UUID, BleGattProperty::READ);
+
+  BLECharacteristic *charPowerProfile_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_POWER_PROFILE_UUID, BleGattProperty::READ | BleGattProperty::WRITE);
+  BLECharacteristic *charPowerReport_ = CoBmecBootArena::make<BLECharacteristic>(CHAR_POWER_REPORT_UUID, BleGattProperty::READ);
 
  private:
 
@@ -0,0 +1,168 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup boot boot
+/// @{
+
+/// @file co_bmec_boot_health.cpp
+/// @brief Boot health check of a new firmware image, with automatic rollback.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <esp_ota_ops.h>
+#include "co_bmec_boot_health.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define PREF_NS_BOOT                "BOOT"
+#define PREF_KEY_HEALTHY_MS         "healthy_ms"
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+portMUX_TYPE CoBmecBootHealth::mux_ = portMUX_INITIALIZER_UNLOCKED;
+volatile uint8_t CoBmecBootHealth::checks_ = 0;
+volatile uint32_t CoBmecBootHealth::checkTMs_[CHECK_COUNT];
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+/// Leaves a new image pending verification after the Arduino init, the gate decides.
+extern "C" bool verifyRollbackLater() {
+  return true;
+}
+
+// Constructors.
+
+/// @param flashMutex Global flash mutex.
+CoBmecBootHealth::CoBmecBootHealth(SemaphoreHandle_t flashMutex)
+    : flashMutex_(flashMutex) {
+
+  esp_ota_img_states_t state;
+  pending_ = esp_ota_get_state_partition(esp_ota_get_running_partition(),
+                                         &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY;
+  if (pending_) {
+    log_w("New image pending verification, rolling back unless healthy within %lu ms.",
+          (unsigned long) CO_BMEC_BOOT_HEALTH_TIMEOUT_MS);
+  }
+}
+
+// Public methods.
+
+/// Reports a check as passed. Cheap enough to call on every frame, from any task.
+/// @param check check.
+void CoBmecBootHealth::report(Check check) {
+  auto bit = static_cast<uint8_t>(check);
+  if (checks_ & bit) {
+    return;
+  }
+
+  portENTER_CRITICAL(&mux_);
+  if (!(checks_ & bit)) {
+    checkTMs_[__builtin_ctz(bit)] = millis();
+    checks_ = checks_ | bit;
+  }
+  portEXIT_CRITICAL(&mux_);
+}
+
+/// Marks the image valid once healthy, or rolls back on timeout. Called periodically.
+/// @param provisioned true if the device has a wifi profile, and so is expected to get the time.
+void CoBmecBootHealth::loop(bool provisioned) {
+  if (done_) {
+    return;
+  }
+
+  uint32_t nowMs = millis();
+  uint8_t required = provisioned ? ALL_CHECKS : OFFLINE_CHECKS;
+  if ((checks_ & required) == required) {
+    onHealthy(nowMs);
+    return;
+  }
+
+  if (nowMs < CO_BMEC_BOOT_HEALTH_TIMEOUT_MS) {
+    return;
+  }
+
+  done_ = true;
+  if (!pending_) {
+    log_w("Boot health checks incomplete: 0x%02x.",
+          checks_);
+    return;
+  }
+
+  log_e("New image failed the boot health checks: 0x%02x, rolling back.",
+        checks_);
+  esp_err_t err = esp_ota_mark_app_invalid_rollback_and_reboot();
+
+  // Only returns if there is no image to go back to.
+  log_e("Rollback failed with error %d, keeping the image.",
+        err);
+}
+
+// Private methods.
+
+/// Marks a pending image valid and records the time it took.
+/// @param nowMs time from boot.
+void CoBmecBootHealth::onHealthy(uint32_t nowMs) {
+  done_ = true;
+  healthyMs_ = nowMs;
+
+  log_i("Boot healthy in %lu ms: frame %lu ms, time %lu ms, wifi %lu ms.",
+        (unsigned long) healthyMs_,
+        (unsigned long) checkTMs_[0],
+        (unsigned long) checkTMs_[1],
+        (unsigned long) checkTMs_[2]);
+
+  if (!pending_) {
+    return;
+  }
+
+  if (esp_ota_mark_app_valid_cancel_rollback() != ESP_OK) {
+    log_e("Failed to mark the image valid.");
+    return;
+  }
+  pending_ = false;
+  saveHealthyMs();
+  log_w("New image marked valid.");
+}
+
+/// Keeps the boot to valid time of the last update, to tune the gate.
+void CoBmecBootHealth::saveHealthyMs() {
+
+  // Take the mutex.
+  xSemaphoreTake(flashMutex_,
+                 portMAX_DELAY);
+
+  // Set namespace.
+  if (!preferences_.begin(PREF_NS_BOOT)) {
+    log_e("Could not init BOOT NVS.");
+  }
+
+  uint32_t lastMs = preferences_.getUInt(PREF_KEY_HEALTHY_MS,
+                                         0);
+  if (!preferences_.putUInt(PREF_KEY_HEALTHY_MS,
+                            healthyMs_)) {
+    log_e("Failed to save the boot health time to NVS");
+  }
+
+  // Commit.
+  preferences_.end();
+
+  // Release the mutex.
+  while (!xSemaphoreGive(flashMutex_)) {
+    log_e("Failed to give flashMutex_.");
+  }
+
+  log_i("Boot to valid %lu ms, previous update %lu ms.",
+        (unsigned long) healthyMs_,
+        (unsigned long) lastMs);
+}
+
+/// @}
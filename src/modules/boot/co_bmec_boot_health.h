@@ -0,0 +1,92 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @defgroup boot boot
+/// @brief Boot health check of a new firmware image.
+/// @{
+
+/// @file co_bmec_boot_health.h
+/// @brief Boot health check of a new firmware image, with automatic rollback.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "Arduino.h"
+#include <Preferences.h>
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_BOOT_HEALTH_TIMEOUT_MS     120000  ///< Time from boot for a new image to pass every check.
+#define CO_BMEC_BOOT_HEALTH_WIFI_LOOPS     10  ///< Wifi task iterations for it to count as alive.
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Gates a new image on the device actually working, so that a bad build reverts by itself.
+///
+/// After an update the bootloader starts the new image as pending verification. It is only
+/// marked valid once every Check has been reported, within CO_BMEC_BOOT_HEALTH_TIMEOUT_MS of
+/// boot. TIME is only required once wifi is provisioned, so that a unit updated over the BLE
+/// before it has a wifi profile can still pass. Otherwise, or if it resets before then, the previous image is booted again.
+///
+/// The checks are timed on every boot, so that the gate can be kept fast, but nothing is
+/// written unless an image is being verified. A normal boot is never held up.
+class CoBmecBootHealth {
+ public:
+
+  enum class Check : uint8_t {
+    FIRST_FRAME = 1 << 0,  ///< The renderer has shown a frame.
+    TIME = 1 << 1,  ///< The time is synced or was restored from the RTC.
+    WIFI = 1 << 2,  ///< The wifi task loop is running.
+  };
+
+  explicit CoBmecBootHealth(SemaphoreHandle_t flashMutex);
+
+  static void report(Check check);
+
+  void loop(bool provisioned);
+
+  /// @returns true while the running image is pending verification.
+  bool isPending() const {
+    return pending_;
+  };
+
+  /// @returns the time from boot to every check passing, 0 until then.
+  uint32_t getHealthyMs() const {
+    return healthyMs_;
+  };
+
+ private:
+
+  static constexpr uint8_t ALL_CHECKS = 0x07;
+  static constexpr uint8_t OFFLINE_CHECKS = ALL_CHECKS & ~static_cast<uint8_t>(Check::TIME);
+  static constexpr uint8_t CHECK_COUNT = 3;
+
+  SemaphoreHandle_t flashMutex_;
+  Preferences preferences_{};
+
+  bool pending_ = false;  ///< The running image is pending verification.
+  bool done_ = false;
+  uint32_t healthyMs_ = 0;
+
+  static portMUX_TYPE mux_;
+  static volatile uint8_t checks_;  ///< Check bits reported.
+  static volatile uint32_t checkTMs_[CHECK_COUNT];  ///< Time from boot of each check.
+
+  void onHealthy(uint32_t nowMs);
+
+  void saveHealthyMs();
+};
+
+/// @}
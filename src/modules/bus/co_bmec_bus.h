@@ -0,0 +1,181 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @defgroup bus bus
+/// @brief Typed publish and subscribe between the modules.
+/// @{
+
+/// @file co_bmec_bus.h
+/// @brief Typed, allocation free event bus, one topic per event type.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include <type_traits>
+#include "Arduino.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_BUS_MAX_SUBSCRIBERS        4  ///< Per topic.
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Where the subscriber runs.
+enum class CoBmecBusDelivery : uint8_t {
+  INLINE,  ///< On the publishing task, during publish. For short, thread safe handlers.
+  DEFERRED,  ///< On the subscriber task, when it calls dispatch.
+};
+
+/// Receives the events of a topic.
+/// @tparam Event topic, a trivially copyable struct.
+template<typename Event>
+class CoBmecBusSubscriber {
+ public:
+  virtual ~CoBmecBusSubscriber() = default;
+
+  virtual void onEvent(const Event &event) = 0;
+};
+
+/// Subscription as seen by the topic.
+/// @tparam Event topic.
+template<typename Event>
+class CoBmecBusSlot {
+ public:
+  virtual ~CoBmecBusSlot() = default;
+
+  virtual void deliver(const Event &event) = 0;
+};
+
+/// Topic of an event type. The subscriptions are registered at construction, from then on
+/// publishing only walks a fixed table.
+/// @tparam Event topic, a trivially copyable struct.
+template<typename Event>
+class CoBmecBus {
+ public:
+
+  static_assert(std::is_trivially_copyable<Event>::value, "Events are copied into queues.");
+
+  /// Delivers an event to every subscriber. Never blocks: a deferred subscriber with a full
+  /// queue loses the event, see CoBmecBusSubscription.
+  /// @param event event.
+  static void publish(const Event &event) {
+    size_t count = count_;
+    for (size_t slot = 0; slot < count; slot++) {
+      slots_[slot]->deliver(event);
+    }
+  };
+
+  /// @param slot subscription, never removed.
+  /// @returns false if the topic has CO_BMEC_BUS_MAX_SUBSCRIBERS already.
+  static bool subscribe(CoBmecBusSlot<Event> *slot) {
+    bool subscribed = false;
+    portENTER_CRITICAL(&mux_);
+    if (count_ < CO_BMEC_BUS_MAX_SUBSCRIBERS) {
+      slots_[count_] = slot;
+      count_ = count_ + 1;
+      subscribed = true;
+    }
+    portEXIT_CRITICAL(&mux_);
+    return subscribed;
+  };
+
+ private:
+
+  static inline CoBmecBusSlot<Event> *slots_[CO_BMEC_BUS_MAX_SUBSCRIBERS]{};
+  static inline volatile size_t count_ = 0;
+  static inline portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+};
+
+/// Subscribes to a topic for the life of the object, with its own fixed size queue.
+///
+/// A DEFERRED subscription queues the events, and the subscriber task runs them with
+/// dispatch(). With a DEPTH of 1 the queue holds the latest event only, which suits states.
+/// Deeper queues keep the order and drop the newest events when full, see getDropped().
+/// @tparam Event topic.
+/// @tparam DEPTH events queued, unused when INLINE.
+template<typename Event, size_t DEPTH = 1>
+class CoBmecBusSubscription : public CoBmecBusSlot<Event> {
+ public:
+
+  static_assert(DEPTH > 0, "The queue holds at least one event.");
+
+  /// @param subscriber receiver.
+  /// @param delivery where the subscriber runs.
+  CoBmecBusSubscription(CoBmecBusSubscriber<Event> &subscriber, CoBmecBusDelivery delivery)
+      : subscriber_(subscriber),
+        delivery_(delivery) {
+    if (delivery_ == CoBmecBusDelivery::DEFERRED) {
+      queue_ = xQueueCreateStatic(DEPTH,
+                                  sizeof(Event),
+                                  storage_,
+                                  &queueBuffer_);
+    }
+    if (!CoBmecBus<Event>::subscribe(this)) {
+      log_e("Too many subscribers for a topic.");
+    }
+  }
+
+  CoBmecBusSubscription(const CoBmecBusSubscription &) = delete;
+
+  CoBmecBusSubscription &operator=(const CoBmecBusSubscription &) = delete;
+
+  /// Runs the queued events. Called from the subscriber task.
+  /// @returns the number of events run.
+  size_t dispatch() {
+    size_t count = 0;
+    Event event;
+    while (queue_ && xQueueReceive(queue_,
+                                   &event,
+                                   0)) {
+      subscriber_.onEvent(event);
+      count++;
+    }
+    return count;
+  };
+
+  /// @returns the events lost to a full queue.
+  uint32_t getDropped() const {
+    return dropped_;
+  };
+
+  // Overrides.
+  void deliver(const Event &event) override {
+    if (!queue_) {
+      subscriber_.onEvent(event);
+    }
+    else if (DEPTH == 1) {
+      (void) xQueueOverwrite(queue_,
+                             &event);
+    }
+    else if (!xQueueSend(queue_,
+                         &event,
+                         0)) {
+      dropped_ = dropped_ + 1;
+    }
+  };
+
+ private:
+
+  CoBmecBusSubscriber<Event> &subscriber_;
+  CoBmecBusDelivery delivery_;
+
+  QueueHandle_t queue_ = nullptr;  ///< nullptr when INLINE.
+  StaticQueue_t queueBuffer_{};
+  alignas(Event) uint8_t storage_[DEPTH * sizeof(Event)]{};
+  volatile uint32_t dropped_ = 0;
+};
+
+/// @}
@@ -10,11 +10,13 @@
 // #includes.
 //*********************************************************************
 #include <esp_adc_cal.h>
-#include <BLECharacteristic.h>
-#include <soc/timer_group_struct.h>
-#include <soc/timer_group_reg.h>
+#include <modules/ble/gatt/ble_gatt.h>
 #include <modules/ble/co_bmec_ble.h>
+#include <memory>
+#include <new>
 #include <modules/ota/co_bmec_ota.h>
+#include <modules/memory/co_bmec_memory_monitor.h>
+#include <modules/metrics/co_bmec_metrics.h>
 #include "date_time_light.h"
 
 //*********************************************************************
@@ -25,6 +27,12 @@
 //*********************************************************************
 // definitions.
 //*********************************************************************
+static const uint32_t FRAME_BOUNDS_US[] = {1000, 2000, 5000, 10000, 20000, 50000};
+static CoBmecMetrics::Histogram frameMetric("display_frame_seconds",
+                                            "Time to send a frame to the strip.",
+                                            FRAME_BOUNDS_US,
+                                            sizeof(FRAME_BOUNDS_US) / sizeof(FRAME_BOUNDS_US[0]),
+                                            1000000);
 
 //*********************************************************************
 // Constants.
@@ -32,11 +40,21 @@
 
 /// FREE RTOS.
 static const uint32_t CORE_0_TASK_STACK_SIZE = 5000;  // Used 2152 -> 2500.
-static const uint32_t CORE_1_TASK_STACK_SIZE =
-    12000;  /// Used 2644 -> 12000. This is used by OTA a large margin of error is required.
+static const uint32_t CORE_1_TASK_STACK_SIZE = 4000;  // Used 2644 -> 4000. OTA has its own task.
 
 static const uint32_t LOOP_0_IDLE_TIME_MS = 100;
-static const uint32_t LOOP_1_IDLE_TIME_MS = 100;
+
+/// WATCHDOG.
+static const uint32_t CORE_0_DEADLINE_MS = 15000;  /// BLE, serial and NTP steps.
+static const uint32_t CORE_1_DEADLINE_MS = 10000;  /// getLocalTime waits up to 5 s before the first sync.
+
+/// SERIAL.
+static const unsigned long SERIAL_BAUD = 115200;
+static const int SERIAL_COMMAND_TELEMETRY = 't';
+static const int SERIAL_COMMAND_OTA = 'u';  /// Followed by the payload URL and a newline.
+static const int SERIAL_COMMAND_LOG_LEVEL = 'l';  /// Followed by the module and level digits, e.g. "l23".
+static const size_t SERIAL_MEMORY_TEXT_LEN = 2048;  /// Allocated, too large for the core 0 stack.
+static const uint32_t LOOP_1_DISPLAY_TIME_MS = 1000 / CO_BMEC_DISPLAY_MAX_FPS;  /// Frame period when not drawing the clock.
 
 /// LED STRIP.
 static int16_t LED_PIN = 13;
@@ -46,17 +64,39 @@ static uint16_t DT_LED_COUNT = DT_HOURS_PER_DAY * DT_DAYS_PER_WEEK;
 static uint16_t WIFI_LED = 0;
 static uint16_t BLE_LED = 1;
 
+/// BLE.
+static const CoBmecBle::Lifecycle BLE_LIFECYCLE = CoBmecBle::Lifecycle::ON_DEMAND;
+static const uint8_t BLE_BUTTON_PIN = 0;  /// The BOOT button, low when pressed.
+static const uint32_t BLE_BUTTON_LONG_PRESS_MS = 3000;
+static const char *BLE_DEVICE_NAME = "DateTimeLight";
+
 /// NTP
 const char *NTP_SERVER = "pool.ntp.org";
-const long GMT_OFFSET_SEC = 2 * 60 * 60;
 
 /// Stars low and high priority loops.
 void DateTimeLight::init() {
 
   log_i("DateTimeLight init.");
 
+  // Measure the heap used by the boot.
+  CoBmecBootArena::begin();
+
+  // Start the serial for commands.
+  Serial.begin(SERIAL_BAUD);
+
+  // Supervise the tasks started from here on.
+  CoBmecWatchdog::begin(LOW_PRIORITY_CORE,
+                        SUPERVISOR_PRIORITY);
+
+  // Drain the binary log to the serial.
+  CoBmecLog::begin(LOW_PRIORITY_CORE,
+                   LOG_PRIORITY);
+
+  // Sample the stacks and heaps of the tasks started from here on.
+  CoBmecMemoryMonitor::begin();
+
   // Start low priority loop.
-  (void) xTaskCreatePinnedToCore(
+  (void) CoBmecBootArena::createTask(
       [](void *dateTimeLightRef) {
         auto *dateTimeLight = static_cast<DateTimeLight *>(dateTimeLightRef);
         dateTimeLight->core0Loop();
@@ -65,10 +105,9 @@ void DateTimeLight::init() {
       CORE_0_TASK_STACK_SIZE,  // Stack size in words.
       this,  // Task input parameter
       NOMINAL_PRIORITY,  // Priority of the task
-      nullptr,  // Task handle.
       LOW_PRIORITY_CORE); // Core where the task should run
   // Start high priority loop.
-  (void) xTaskCreatePinnedToCore(
+  (void) CoBmecBootArena::createTask(
       [](void *dateTimeLightRef) {
         auto *dateTimeLight = static_cast<DateTimeLight *>(dateTimeLightRef);
         dateTimeLight->core1Loop();
@@ -77,7 +116,6 @@ void DateTimeLight::init() {
       CORE_1_TASK_STACK_SIZE,  // Stack size in words.
       this,  // Task input parameter
       NOMINAL_PRIORITY,  // Priority of the task
-      nullptr,  // Task handle.
       HIGH_PRIORITY_CORE); // Core where the task should run
 
   log_i("DateTimeLight initialised.");
@@ -86,36 +124,93 @@ void DateTimeLight::init() {
 void DateTimeLight::core0Loop() {
   log_i("cor01Loop started on core: %u", xPortGetCoreID());
 
+  // Start timing the boot health checks.
+  coBmecBootHealth_ = CoBmecBootArena::make<CoBmecBootHealth>(
+      flashMutex_);
+
   // Init the BLE module.
   CoBmecBle::init(
-      this, bleConnectionStateCallback);
+      flashMutex_, BLE_LIFECYCLE);
+  CoBmecBle::startAdvertising(BLE_DEVICE_NAME);
+  pinMode(BLE_BUTTON_PIN, INPUT_PULLUP);
+
+  // Instantiate the display before the renderer looks for it.
+  coBmecDisplay_ = CoBmecBootArena::make<CoBmecDisplay>(
+      CoBmecBle::bleServiceDisplay_, DT_LED_COUNT);
+  coBmecDisplaySettings_ = CoBmecBootArena::make<CoBmecDisplaySettings>(
+      CoBmecBle::bleServiceDisplay_, flashMutex_);
 
   // Instantiate and init the Wi-Fi module.
-  coBmecWifi_ = new CoBmecWifi(
-      this,
+  coBmecWifi_ = CoBmecBootArena::make<CoBmecWifi>(
       LOW_PRIORITY_CORE,
       NOMINAL_PRIORITY,
       flashMutex_,
       CoBmecBle::bleServiceWifi_,
-      &apStateCallback);
+      CoBmecBle::bulk_);
+
+  // Instantiate the time sync before the Wi-Fi reports its state.
+  coBmecTimeSync_ = CoBmecBootArena::make<CoBmecTimeSync>(
+      coBmecWifi_,
+      NTP_SERVER);
 
-  // Set the callback reference.
-  coBmecWifi_->ref_ = this;
+  // Serve the metrics to the fleet scraper once the Wi-Fi has an IP.
+  coBmecMetricsServer_ = CoBmecBootArena::make<CoBmecMetricsServer>(
+      LOW_PRIORITY_CORE,
+      METRICS_PRIORITY);
 
   // Init the Wi-Fi module.
   coBmecWifi_->init();
 
+  // The boot objects are all created.
+  CoBmecBootArena::report();
+
   // Set the init state of the core.
   core0Inited_ = true;
+  watchdog0Id_ = CoBmecWatchdog::add("core_0_loop",
+                                     CORE_0_DEADLINE_MS);
 
   for (;;) {
 
     vTaskDelay(LOOP_0_IDLE_TIME_MS / portTICK_PERIOD_MS);
-
-    // FEATURE replace this by setting the watchdog time. Cannot be done without recompiling the arduino core.
-    TIMERG0.wdt_wprotect = TIMG_WDT_WKEY_VALUE;
-    TIMERG0.wdt_feed = 1;
-    TIMERG0.wdt_wprotect = 0;
+    CoBmecWatchdog::beat(watchdog0Id_);
+
+    // BLE connection events.
+    connectionSubscription_.dispatch();
+
+    // NTP poll schedule.
+    CoBmecWatchdog::trace(watchdog0Id_,
+                          "time sync");
+    coBmecTimeSync_->loop();
+
+    // Start or stop the metrics server with the Wi-Fi.
+    CoBmecWatchdog::trace(watchdog0Id_,
+                          "metrics");
+    coBmecMetricsServer_->loop();
+
+    // Persist the display settings.
+    coBmecDisplaySettings_->loop();
+
+    // Mark a new image valid, or roll it back.
+    checkBootHealth();
+
+    // Release the BLE once provisioned.
+    checkBleButton();
+    CoBmecBle::advertiser_->setStatus(
+        static_cast<uint8_t>(coBmecWifi_->getState()),
+        coBmecWifi_->isProvisioned(),
+        CoBmecTimeSync::isSynced());
+    CoBmecWatchdog::trace(watchdog0Id_,
+                          "ble");
+    CoBmecBle::loop(coBmecWifi_->isProvisioned());
+    showDfuProgress();
+
+    // Serial commands.
+    CoBmecWatchdog::trace(watchdog0Id_,
+                          "serial");
+    checkSerial();
+
+    // Stack and heap high-water marks.
+    CoBmecMemoryMonitor::loop();
   }
 }
 
@@ -123,13 +218,15 @@ void DateTimeLight::core1Loop() {
   log_i("core1Loop started on core: %u", xPortGetCoreID());
 
   /// Init the strip.
-  strip_ = new Adafruit_NeoPixel(
+  strip_ = CoBmecBootArena::make<Adafruit_NeoPixel>(
       DT_LED_COUNT, LED_PIN, NEO_GRB + NEO_KHZ800);
   strip_->begin();  // Init.
   strip_->show();  // Clear.
 
   // Set the core initialised.
   core1Inited_ = true;
+  watchdog1Id_ = CoBmecWatchdog::add("core_1_loop",
+                                     CORE_1_DEADLINE_MS);
 
   int rippleIndex1 = 0;
   int rippleIndex2 = 1;
@@ -137,22 +234,41 @@ void DateTimeLight::core1Loop() {
 
   for (;;) {
 
-    TIMERG0.wdt_wprotect = TIMG_WDT_WKEY_VALUE;
-    TIMERG0.wdt_feed = 1;
-    TIMERG0.wdt_wprotect = 0;
+    CoBmecWatchdog::beat(watchdog1Id_);
+
+    // The Wi-Fi status LED.
+    apStateSubscription_.dispatch();
+
+    // Settings only change between frames.
+    applySettings();
+
+    // Frames from the BLE replace the clock.
+    if (renderDisplay()) {
+      vTaskDelay(LOOP_1_DISPLAY_TIME_MS / portTICK_PERIOD_MS);
+      continue;
+    }
 
-    vTaskDelay(LOOP_1_IDLE_TIME_MS / portTICK_PERIOD_MS);
+    // The ripple moves one pixel per frame.
+    vTaskDelay(settings_.rippleStepMs / portTICK_PERIOD_MS);
 
-    strip_->show();
+    CoBmecWatchdog::trace(watchdog1Id_,
+                          "show");
+    showFrame();
 
     // Time sync failed.
+    CoBmecWatchdog::trace(watchdog1Id_,
+                          "local time");
     if (!getLocalTime(&timeInfo_)) {
       log_w("Waiting on time sync...");
       continue;
     }
 
+    /// Dim at night.
+    strip_->setBrightness(CoBmecDisplaySettings::isNight(settings_, timeInfo_) ? settings_.nightBrightness
+                                                                              : settings_.brightness);
+
     /// Fill with rainbow.
-    strip_->rainbow(0, 1, 255,50);
+    strip_->rainbow(settings_.firstHue, settings_.hueReps, settings_.saturation, settings_.value);
 
     /// Set the hours pixels.
     strip_->fill(
@@ -162,75 +278,237 @@ void DateTimeLight::core1Loop() {
     /// Set the ripple that moves around.
     strip_->setPixelColor(
         rippleIndex1 < DT_LED_COUNT ? rippleIndex1++ : rippleIndex1 = 0,
-        0,
-        0,
-        5);
+        settings_.rippleRgb[0] / 10,
+        settings_.rippleRgb[1] / 10,
+        settings_.rippleRgb[2] / 10);
 
     strip_->setPixelColor(
         rippleIndex2 < DT_LED_COUNT ? rippleIndex2++ : rippleIndex2 = 0,
-        0,
-        0,
-        25);
+        settings_.rippleRgb[0] / 2,
+        settings_.rippleRgb[1] / 2,
+        settings_.rippleRgb[2] / 2);
 
     strip_->setPixelColor(
         rippleIndex3 < DT_LED_COUNT ? rippleIndex3++ : rippleIndex3 = 0,
-        0,
-        0,
-        50);
+        settings_.rippleRgb[0],
+        settings_.rippleRgb[1],
+        settings_.rippleRgb[2]);
+  }
+}
+
+/// Sends the frame to the strip and records how long it took. The first frame of any mode
+/// passes the FIRST_FRAME boot health check.
+void DateTimeLight::showFrame() {
+  uint32_t startUs = micros();
+  strip_->show();
+  frameMetric.observe(micros() - startUs);
+  CoBmecBootHealth::report(CoBmecBootHealth::Check::FIRST_FRAME);
+}
+
+/// Shows the frames streamed over the BLE.
+/// @returns false in clock mode.
+bool DateTimeLight::renderDisplay() {
+  if (!core0Inited_ || coBmecDisplay_->getMode() == CoBmecDisplay::Mode::CLOCK) {
+    return false;
+  }
+
+  if (coBmecDisplay_->render(millis(), frame_)) {
+    for (uint16_t pixel = 0; pixel < DT_LED_COUNT; pixel++) {
+      strip_->setPixelColor(
+          pixel, frame_[pixel * 3], frame_[pixel * 3 + 1], frame_[pixel * 3 + 2]);
+    }
+    showFrame();
+  }
+  return true;
+}
+
+/// Applies the settings written over the BLE, with the time zone of the local time.
+void DateTimeLight::applySettings() {
+  if (!core0Inited_ || !coBmecDisplaySettings_->update(settings_)) {
+    return;
+  }
+
+  CoBmecTimeSync::setTimeZone(settings_.gmtOffsetSec);
+  log_i("Display settings applied.");
+}
+
+/// Runs the serial commands.
+void DateTimeLight::checkSerial() {
+  if (!Serial.available()) {
+    return;
+  }
+
+  switch (Serial.read()) {
+    case SERIAL_COMMAND_TELEMETRY: {
+      coBmecWifi_->printTelemetry(Serial);
+      coBmecWifi_->printTrace(Serial);
+      std::unique_ptr<char[]> text(new(std::nothrow) char[SERIAL_MEMORY_TEXT_LEN]);
+      if (text) {
+        size_t written = CoBmecBootArena::format(text.get(),
+                                                 SERIAL_MEMORY_TEXT_LEN);
+        (void) CoBmecMemoryMonitor::format(text.get() + written,
+                                           SERIAL_MEMORY_TEXT_LEN - written);
+        Serial.print(text.get());
+      }
+    }
+      break;
+    case SERIAL_COMMAND_LOG_LEVEL: {
+      String levelCommand = Serial.readStringUntil('\n');
+      levelCommand.trim();
+      if (levelCommand.length() != 2) {
+        log_w("Log level requires a module and a level digit.");
+        break;
+      }
+      auto module = CoBmecLog::Module(levelCommand[0] - '0');
+      CoBmecLog::setLevel(module,
+                          CoBmecLog::Level(levelCommand[1] - '0'));
+      log_i("Log level of module %u: %u",
+            uint8_t(module),
+            uint8_t(CoBmecLog::getLevel(module)));
+    }
+      break;
+    case SERIAL_COMMAND_OTA: {
+      String url = Serial.readStringUntil('\n');
+      url.trim();
+      startOta(url.c_str());
+    }
+      break;
+    default:break;
+  }
+}
+
+/// Starts an update over the Wi-Fi in the OTA task, with its progress on the strip.
+/// @param url payload URL.
+void DateTimeLight::startOta(const std::string &url) {
+  log_i("OTA_UPDATE requested from %s",
+        url.c_str());
+
+  // Keep the radio awake for the download.
+  coBmecWifi_->requestAwake(CoBmecWifi::AwakeReason::OTA);
+
+  CoBmecOta::Callbacks callbacks;
+  callbacks.onProgress = [this](size_t done, size_t total) {
+    coBmecDisplay_->showProgress(done,
+                                 total);
+  };
+  callbacks.onFailed = [this](CoBmecOta::Result) {
+    coBmecDisplay_->endProgress();
+    coBmecWifi_->releaseAwake(CoBmecWifi::AwakeReason::OTA);
+  };
+
+  if (!CoBmecOta::start(url,
+                        LOW_PRIORITY_CORE,
+                        callbacks)) {
+    log_w("OTA_UPDATE already running.");
+    coBmecWifi_->releaseAwake(CoBmecWifi::AwakeReason::OTA);
+  }
+}
+
+/// Shows the progress of a firmware update over the BLE on the strip.
+void DateTimeLight::showDfuProgress() {
+  if (CoBmecBle::dfu_->isActive()) {
+    size_t done;
+    size_t total;
+    CoBmecBle::dfu_->getProgress(done,
+                                 total);
+    coBmecDisplay_->showProgress(done,
+                                 total);
+    dfuShown_ = true;
+  }
+  else if (dfuShown_) {
+    coBmecDisplay_->endProgress();
+    dfuShown_ = false;
+  }
+}
+
+/// Reports the checks polled from the core 0 loop and runs the boot health gate.
+void DateTimeLight::checkBootHealth() {
+  if (CoBmecTimeSync::isValid()) {
+    CoBmecBootHealth::report(CoBmecBootHealth::Check::TIME);
+  }
+  if (coBmecWifi_->getLoopCount() >= CO_BMEC_BOOT_HEALTH_WIFI_LOOPS) {
+    CoBmecBootHealth::report(CoBmecBootHealth::Check::WIFI);
   }
+  coBmecBootHealth_->loop(coBmecWifi_->isProvisioned());
 }
 
-void DateTimeLight::bleConnectionStateCallback(bool connected) {
-  // FEATURE implement BLE.
-  //  auto *dateTimeLight = static_cast<DateTimeLight *>(CoBmecBle::ref_);
+/// A long press of the BLE button keeps the BLE up, or restarts into the boot window
+/// once the BLE has been released.
+void DateTimeLight::checkBleButton() {
+  if (digitalRead(BLE_BUTTON_PIN) != LOW) {
+    buttonDownTMs_ = 0;
+    return;
+  }
+
+  uint32_t nowMs = millis();
+  if (!buttonDownTMs_) {
+    buttonDownTMs_ = nowMs | 1;
+  }
+  else if (nowMs - buttonDownTMs_ >= BLE_BUTTON_LONG_PRESS_MS) {
+    buttonDownTMs_ = 0;
+    if (CoBmecBle::isReleased()) {
+      log_i("BLE requested, restarting.");
+      esp_restart();
+    }
+    log_i("BLE kept alive.");
+    CoBmecBle::keepAlive();
+    CoBmecBle::advertiser_->boost();
+  }
+}
 
-  if (connected) {
+/// Run by the core 0 loop.
+/// @param event BLE connection state.
+void DateTimeLight::onEvent(const CoBmecBle::ConnectionEvent &event) {
+  // Keep the radio awake while provisioning so that commands complete promptly.
+  if (coBmecWifi_) {
+    if (event.connected) {
+      coBmecWifi_->requestAwake(CoBmecWifi::AwakeReason::BLE);
+    }
+    else {
+      coBmecWifi_->releaseAwake(CoBmecWifi::AwakeReason::BLE);
+    }
+  }
+
+  if (event.connected) {
     log_i("BLE device connected");
     {
-      //      dateTimeLight->strip_->setPixelColor(
+      //      strip_->setPixelColor(
       //          BLE_LED, 0, 0, 255);
     }
   } else {
     log_i("BLE device disconnected");
     {
-      //      dateTimeLight->strip_->setPixelColor(
+      //      strip_->setPixelColor(
       //          BLE_LED, 0, 0, 0);
     }
   }
 }
 
-void DateTimeLight::apStateCallback(
-    CoBmecWifi *coBmecWifi, CoBmecWifi::ApState apState
-) {
-
-  auto *dateTimeLight = static_cast<DateTimeLight *>(coBmecWifi->ref_);
-
-  switch (apState) {
+/// Run by the core 1 loop, which owns the strip.
+/// @param event AP state.
+void DateTimeLight::onEvent(const CoBmecWifi::ApStateEvent &event) {
+  switch (event.apState) {
     case CoBmecWifi::ApState::UNDEFINED:
     case CoBmecWifi::ApState::ERROR:
     case CoBmecWifi::ApState::DISCONNECTING:
     case CoBmecWifi::ApState::DISCONNECTED: {
-      dateTimeLight->strip_->setPixelColor(
+      strip_->setPixelColor(
           WIFI_LED, 255, 0, 0);
-      dateTimeLight->strip_->show();
+      strip_->show();
     }
       break;
     case CoBmecWifi::ApState::CONNECTING:
     case CoBmecWifi::ApState::CONNECTED: {
-      dateTimeLight->strip_->setPixelColor(
+      strip_->setPixelColor(
           WIFI_LED, 255, 150, 0);
-      dateTimeLight->strip_->show();
+      strip_->show();
     }
       break;
     case CoBmecWifi::ApState::PINGING:break;
     case CoBmecWifi::ApState::PINGED: {
-
-      /// Config the time.
-      configTime(GMT_OFFSET_SEC, 0, NTP_SERVER);
-
-      dateTimeLight->strip_->setPixelColor(
+      strip_->setPixelColor(
           WIFI_LED, 0, 5, 0);
-      dateTimeLight->strip_->show();
+      strip_->show();
     }
       break;
   }
@@ -19,11 +19,21 @@
 //*********************************************************************
 #include "Arduino.h"
 #include "Wire.h"
-#include "../../../.pio/libdeps/esp32dev/Adafruit NeoPixel/Adafruit_NeoPixel.h"
+#include <Adafruit_NeoPixel.h>
 #include <string>
 #include <algorithm>
-#include <BLECharacteristic.h>
+#include <modules/ble/gatt/ble_gatt.h>
 #include <modules/wifi/co_bmec_wifi.h>
+#include <modules/time_sync/co_bmec_time_sync.h>
+#include <modules/display/co_bmec_display.h>
+#include <modules/display/co_bmec_display_settings.h>
+#include <modules/boot/co_bmec_boot_health.h>
+#include <modules/watchdog/co_bmec_watchdog.h>
+#include <modules/log/co_bmec_log.h>
+#include <modules/memory/co_bmec_boot_arena.h>
+#include <modules/bus/co_bmec_bus.h>
+#include <modules/ble/co_bmec_ble.h>
+#include <modules/metrics/co_bmec_metrics_server.h>
 
 //*********************************************************************
 // defines.
@@ -33,6 +43,9 @@
 #define LOW_PRIORITY_CORE           0
 #define HIGH_PRIORITY_CORE          1
 #define NOMINAL_PRIORITY            4
+#define SUPERVISOR_PRIORITY         (NOMINAL_PRIORITY + 1)
+#define LOG_PRIORITY                1  ///< Drains the log when nothing else runs.
+#define METRICS_PRIORITY            (NOMINAL_PRIORITY - 1)  ///< Scrapes wait on the loops.
 
 // ESP32 pins.
 
@@ -48,7 +61,8 @@
 // class declarations.
 //*********************************************************************
 
-class DateTimeLight {
+class DateTimeLight : public CoBmecBusSubscriber<CoBmecWifi::ApStateEvent>,
+                      public CoBmecBusSubscriber<CoBmecBle::ConnectionEvent> {
  public:
   enum class State {
     CONNECTING,
@@ -57,35 +71,76 @@ class DateTimeLight {
 
   void init();
 
+  void onEvent(const CoBmecWifi::ApStateEvent &event) override;
+
+  void onEvent(const CoBmecBle::ConnectionEvent &event) override;
+
  private:
 
   Preferences preferences_;
 
   /// Mutexes
-  SemaphoreHandle_t flashMutex_ = xSemaphoreCreateMutex();
+  SemaphoreHandle_t flashMutex_ = CoBmecBootArena::createMutex();
+
+  /// Boot health gate of a new image.
+  CoBmecBootHealth *coBmecBootHealth_{};
 
   /// Communication.
   CoBmecWifi *coBmecWifi_{};
 
+  /// Module events, run by the loops so that the publishers never wait on them.
+  CoBmecBusSubscription<CoBmecWifi::ApStateEvent> apStateSubscription_{*this, CoBmecBusDelivery::DEFERRED};  ///< Core 1, owns the strip.
+  CoBmecBusSubscription<CoBmecBle::ConnectionEvent> connectionSubscription_{*this, CoBmecBusDelivery::DEFERRED};  ///< Core 0.
+
+  /// BLE button.
+  uint32_t buttonDownTMs_ = 0;  ///< Time the button was pressed, 0 if released.
+
   bool core0Inited_ = false;
   bool core1Inited_ = false;
 
+  /// Watchdog heartbeats of the core loops.
+  CoBmecWatchdog::Id watchdog0Id_ = -1;
+  CoBmecWatchdog::Id watchdog1Id_ = -1;
+
   /// LED Strip.
   Adafruit_NeoPixel* strip_{};
 
+  /// Frames streamed over the BLE.
+  CoBmecDisplay *coBmecDisplay_{};
+  uint8_t frame_[CO_BMEC_DISPLAY_MAX_LEDS * 3]{};  ///< Frame being shown, written by core 1.
+  bool dfuShown_ = false;  ///< The BLE firmware update progress is on the strip.
+
+  /// Clock settings, written over the BLE.
+  CoBmecDisplaySettings *coBmecDisplaySettings_{};
+  CoBmecDisplaySettings::Settings settings_;  ///< Settings in use, written by core 1.
+
   /// NTP.
+  CoBmecTimeSync *coBmecTimeSync_{};
   struct tm timeInfo_{};
 
+  /// Metrics for the fleet scraper, served while the Wi-Fi has an IP.
+  CoBmecMetricsServer *coBmecMetricsServer_{};
+
   /// Core loops.
   [[noreturn]] void core0Loop();
 
   [[noreturn]] void core1Loop();
 
-  /// Module callbacks.
+  void checkBleButton();
+
+  void checkBootHealth();
+
+  void checkSerial();
+
+  void showFrame();
+
+  void startOta(const std::string &url);
+
+  void showDfuProgress();
 
-  static void bleConnectionStateCallback(bool connected);
+  bool renderDisplay();
 
-  static void apStateCallback(CoBmecWifi *, CoBmecWifi::ApState apState);
+  void applySettings();
 
 };
 
@@ -0,0 +1,311 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup display display
+/// @{
+
+/// @file co_bmec_display.cpp
+/// @brief Frames and animations streamed to the strip over BLE.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include "co_bmec_display.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CLIP_ENTRY_HEADER           2  /// Length of a clip entry (uint16 LE).
+#define PERMILLE                    1000
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Constructors.
+
+/// @param bleServiceDisplay display service.
+/// @param ledCount number of pixels on the strip.
+CoBmecDisplay::CoBmecDisplay(BleServiceDisplay *bleServiceDisplay, size_t ledCount)
+    : bleServiceDisplay_(bleServiceDisplay),
+      liveCodec_(ledCount),
+      clipCodec_(ledCount) {
+
+  bleServiceDisplay_->charFrame_->setCallbacks(this);
+  bleServiceDisplay_->charControl_->setCallbacks(this);
+  bleServiceDisplay_->charState_->setCallbacks(this);
+  publishState();
+}
+
+// Public methods.
+
+/// Gets the frame to show. Called by the renderer, at least at the clip frame rate.
+/// @param tMs current time.
+/// @param rgb output, 3 bytes per pixel.
+/// @returns true if rgb was updated.
+bool CoBmecDisplay::render(uint32_t tMs, uint8_t *rgb) {
+  // Never stall the renderer on the BLE task.
+  if (xSemaphoreTake(mutex_, 0) != pdTRUE) {
+    return false;
+  }
+
+  size_t frameLength = liveCodec_.getLedCount() * 3;
+  bool updated = false;
+  switch (getMode()) {
+    case Mode::LIVE:
+    case Mode::RECORD: {
+      if (backShown_) {
+        memcpy(rgb,
+               back_,
+               frameLength);
+        backShown_ = false;
+        updated = true;
+      }
+    }
+      break;
+    case Mode::CLIP: {
+      if (int32_t(tMs - nextFrameTMs_) >= 0) {
+        playFrame();
+        memcpy(rgb,
+               play_,
+               frameLength);
+        updated = true;
+
+        // Keep the frame rate, but do not catch up after a stall.
+        uint32_t periodMs = 1000 / state_.fps;
+        nextFrameTMs_ = int32_t(tMs - nextFrameTMs_) < int32_t(periodMs) ? nextFrameTMs_ + periodMs : tMs + periodMs;
+      }
+    }
+      break;
+    case Mode::PROGRESS: {
+      if (!progressShown_) {
+        size_t ledCount = liveCodec_.getLedCount();
+        size_t done = ledCount * progress_ / PERMILLE;
+        for (size_t pixel = 0; pixel < ledCount; pixel++) {
+          uint32_t color = pixel < done ? CO_BMEC_DISPLAY_PROGRESS_RGB : CO_BMEC_DISPLAY_PROGRESS_BACK_RGB;
+          rgb[pixel * 3] = color >> 16;
+          rgb[pixel * 3 + 1] = color >> 8;
+          rgb[pixel * 3 + 2] = color;
+        }
+        progressShown_ = true;
+        updated = true;
+      }
+    }
+      break;
+    default:break;
+  }
+
+  xSemaphoreGive(mutex_);
+  return updated;
+}
+
+/// Shows a progress bar until endProgress. Called from any task but the BLE's.
+/// @param done work done.
+/// @param total total work.
+void CoBmecDisplay::showProgress(size_t done, size_t total) {
+  auto progress = uint16_t(total ? uint64_t(std::min(done,
+                                                     total)) * PERMILLE / total : 0);
+
+  // The bar only changes every pixel, skip the mutex in between.
+  if (getMode() == Mode::PROGRESS && progress == progress_) {
+    return;
+  }
+
+  xSemaphoreTake(mutex_,
+                 portMAX_DELAY);
+  if (getMode() != Mode::PROGRESS) {
+    progressMode_ = getMode();
+    setMode(Mode::PROGRESS);
+  }
+  progress_ = progress;
+  progressShown_ = false;
+  xSemaphoreGive(mutex_);
+}
+
+/// Restores the mode the progress bar replaced.
+void CoBmecDisplay::endProgress() {
+  xSemaphoreTake(mutex_,
+                 portMAX_DELAY);
+  if (getMode() == Mode::PROGRESS) {
+    setMode(progressMode_);
+    publishState();
+  }
+  xSemaphoreGive(mutex_);
+}
+
+// Private methods.
+
+/// Changes the mode. Called with the mutex held.
+/// @param mode mode.
+void CoBmecDisplay::setMode(Mode mode) {
+  if (mode == Mode::CLIP) {
+    if (!state_.clipFrames) {
+      return;
+    }
+    playOffset_ = 0;
+    clipCodec_.reset();
+    nextFrameTMs_ = millis();
+  }
+  state_.mode = static_cast<uint8_t>(mode);
+  log_i("Display mode %u",
+        state_.mode);
+}
+
+/// Decodes a frame written on the BLE. Called with the mutex held.
+/// @param frame frame.
+/// @param length length of the frame.
+void CoBmecDisplay::onFrame(const uint8_t *frame, size_t length) {
+  Mode mode = getMode();
+  if (mode == Mode::PROGRESS) {
+    return;
+  }
+  if (mode == Mode::CLOCK || mode == Mode::CLIP) {
+    setMode(Mode::LIVE);
+  }
+
+  auto result = liveCodec_.decode(frame,
+                                  length,
+                                  back_);
+  if (result == CoBmecDisplayCodec::Result::OK && mode == Mode::RECORD && !record(frame,
+                                                                                  length)) {
+    result = CoBmecDisplayCodec::Result::OUT_OF_RANGE;
+  }
+
+  if (result != CoBmecDisplayCodec::Result::OK) {
+    state_.errors++;
+    state_.lastResult = static_cast<uint8_t>(result);
+    return;
+  }
+
+  state_.frames++;
+  if (CoBmecDisplayCodec::isShown(frame,
+                                  length)) {
+    backShown_ = true;
+  }
+}
+
+/// Appends a frame to the clip.
+/// @param frame frame.
+/// @param length length of the frame.
+/// @returns false if the clip is full or would start without a key frame.
+bool CoBmecDisplay::record(const uint8_t *frame, size_t length) {
+  if (state_.clipBytes + CLIP_ENTRY_HEADER + length > sizeof(clip_)) {
+    return false;
+  }
+
+  clipKeyed_ = clipKeyed_ || CoBmecDisplayCodec::isKeyFrame(frame,
+                                                           length);
+  bool shown = CoBmecDisplayCodec::isShown(frame,
+                                           length);
+  if (shown && !clipKeyed_) {
+    return false;
+  }
+
+  clip_[state_.clipBytes] = length & 0xff;
+  clip_[state_.clipBytes + 1] = length >> 8;
+  memcpy(&clip_[state_.clipBytes + CLIP_ENTRY_HEADER],
+         frame,
+         length);
+  state_.clipBytes += CLIP_ENTRY_HEADER + length;
+  state_.clipFrames += shown;
+  return true;
+}
+
+/// Decodes the clip entries up to the next shown frame, looping at the end.
+/// Called with the mutex held.
+void CoBmecDisplay::playFrame() {
+  for (;;) {
+    if (playOffset_ >= state_.clipBytes) {
+      // Start over, the first shown frame is preceded by a key frame.
+      playOffset_ = 0;
+      clipCodec_.reset();
+    }
+
+    const uint8_t *entry = &clip_[playOffset_];
+    size_t length = entry[0] | (entry[1] << 8);
+    const uint8_t *frame = entry + CLIP_ENTRY_HEADER;
+    playOffset_ += CLIP_ENTRY_HEADER + length;
+
+    // Entries were validated when recorded.
+    (void) clipCodec_.decode(frame,
+                             length,
+                             play_);
+    if (CoBmecDisplayCodec::isShown(frame,
+                                    length)) {
+      return;
+    }
+  }
+}
+
+/// Writes the state to the BLE characteristic.
+void CoBmecDisplay::publishState() {
+  State state = state_;
+  bleServiceDisplay_->charState_
+                    ->setValue(reinterpret_cast<uint8_t *>(&state),
+                               sizeof(state));
+}
+
+/// Publishes the state.
+/// @param characteristic state characteristic.
+void CoBmecDisplay::onRead(BLECharacteristic *characteristic) {
+  if (characteristic == bleServiceDisplay_->charState_) {
+    xSemaphoreTake(mutex_,
+                   portMAX_DELAY);
+    publishState();
+    xSemaphoreGive(mutex_);
+  }
+}
+
+/// Handles frames and commands.
+/// @param characteristic frame or control characteristic.
+void CoBmecDisplay::onWrite(BLECharacteristic *characteristic) {
+  std::string value = characteristic->getValue();
+  auto *data = reinterpret_cast<const uint8_t *>(value.data());
+
+  xSemaphoreTake(mutex_,
+                 portMAX_DELAY);
+
+  if (characteristic == bleServiceDisplay_->charFrame_) {
+    onFrame(data,
+            value.length());
+  }
+  else if (characteristic == bleServiceDisplay_->charControl_ && !value.empty() && getMode() != Mode::PROGRESS) {
+    switch (static_cast<Command>(data[0])) {
+      case Command::MODE: {
+        if (value.length() >= 2 && data[1] <= static_cast<uint8_t>(Mode::CLIP)) {
+          setMode(static_cast<Mode>(data[1]));
+        }
+      }
+        break;
+      case Command::CLIP_BEGIN: {
+        state_.fps = value.length() >= 2 ? std::min(std::max(data[1],
+                                                             uint8_t(1)),
+                                                    uint8_t(CO_BMEC_DISPLAY_MAX_FPS))
+                                         : CO_BMEC_DISPLAY_DEFAULT_FPS;
+        state_.clipBytes = 0;
+        state_.clipFrames = 0;
+        clipKeyed_ = false;
+        liveCodec_.reset();
+        setMode(Mode::RECORD);
+      }
+        break;
+      case Command::CLIP_END: {
+        setMode(state_.clipFrames ? Mode::CLIP : Mode::CLOCK);
+      }
+        break;
+      default:break;
+    }
+
+    publishState();
+    BleGatt::notify(bleServiceDisplay_->charState_);
+  }
+
+  xSemaphoreGive(mutex_);
+}
+
+/// @}
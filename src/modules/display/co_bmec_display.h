@@ -0,0 +1,134 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup display display
+/// @{
+
+/// @file co_bmec_display.h
+/// @brief Frames and animations streamed to the strip over BLE.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "Arduino.h"
+#include "modules/ble/services/display/ble_display_service.h"
+#include "co_bmec_display_codec.h"
+#include "modules/memory/co_bmec_boot_arena.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_DISPLAY_CLIP_BYTES            8192  ///< Encoded clip storage.
+#define CO_BMEC_DISPLAY_MAX_FPS               50  ///< Fastest clip playback.
+#define CO_BMEC_DISPLAY_DEFAULT_FPS           20
+#define CO_BMEC_DISPLAY_PROGRESS_RGB          0x0040ff  ///< Done part of the progress bar.
+#define CO_BMEC_DISPLAY_PROGRESS_BACK_RGB     0x020202  ///< Remaining part of the progress bar.
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Receives frames on the display service and hands the renderer the frame to show.
+///
+/// In LIVE mode frames are decoded into the back buffer as they arrive. In RECORD mode they
+/// are also previewed, and stored encoded in the clip, which CLIP mode plays back in a loop
+/// at a fixed frame rate without the BLE. Writing a frame in CLOCK or CLIP mode switches to LIVE.
+///
+/// PROGRESS mode is set by the device itself, e.g. during a firmware update, and shows a
+/// progress bar over the whole strip. Frames are ignored until the previous mode is restored.
+class CoBmecDisplay : public BLECharacteristicCallbacks {
+ public:
+
+  enum class Mode : uint8_t {
+    CLOCK,  ///< The renderer draws the clock.
+    LIVE,  ///< Frames from the BLE.
+    RECORD,  ///< Frames from the BLE, stored in the clip.
+    CLIP,  ///< Clip playback.
+    PROGRESS,  ///< Progress bar, not settable over the BLE.
+  };
+
+  enum class Command : uint8_t {
+    UNDEFINED,
+    MODE,  ///< Followed by the Mode. CLIP requires a recorded clip.
+    CLIP_BEGIN,  ///< Followed by the frame rate, clears the clip and starts recording.
+    CLIP_END,  ///< Starts playback of the recorded clip.
+  };
+
+  /// Published on the state characteristic.
+  struct __attribute__((packed)) State {
+    uint8_t mode = 0;
+    uint8_t fps = CO_BMEC_DISPLAY_DEFAULT_FPS;
+    uint16_t clipFrames = 0;  ///< Shown frames in the clip.
+    uint16_t clipBytes = 0;
+    uint32_t frames = 0;  ///< Frames decoded.
+    uint16_t errors = 0;  ///< Frames rejected.
+    uint8_t lastResult = 0;  ///< CoBmecDisplayCodec::Result of the last rejected frame.
+  };
+
+  CoBmecDisplay(BleServiceDisplay *bleServiceDisplay, size_t ledCount);
+
+  /// @returns the mode. The clock is drawn in CLOCK mode only.
+  Mode getMode() const {
+    return static_cast<Mode>(state_.mode);
+  };
+
+  bool render(uint32_t tMs, uint8_t *rgb);
+
+  void showProgress(size_t done, size_t total);
+
+  void endProgress();
+
+ private:
+
+  BleServiceDisplay *bleServiceDisplay_;
+
+  /// Guards everything below, written by the BLE task and read by the renderer.
+  SemaphoreHandle_t mutex_ = CoBmecBootArena::createMutex();
+
+  State state_;
+
+  CoBmecDisplayCodec liveCodec_;  ///< Decodes LIVE and RECORD frames.
+  CoBmecDisplayCodec clipCodec_;  ///< Decodes the clip on playback.
+
+  uint8_t back_[CO_BMEC_DISPLAY_MAX_LEDS * 3]{};  ///< Frame being received.
+  bool backShown_ = false;  ///< back_ holds a complete frame not yet rendered.
+
+  /// Clip, stored as [length (uint16 LE)][frame] entries.
+  uint8_t clip_[CO_BMEC_DISPLAY_CLIP_BYTES]{};
+  bool clipKeyed_ = false;  ///< The clip has a key frame before its first shown frame.
+
+  uint8_t play_[CO_BMEC_DISPLAY_MAX_LEDS * 3]{};  ///< Frame being played.
+  size_t playOffset_ = 0;  ///< Next clip entry.
+  uint32_t nextFrameTMs_ = 0;
+
+  /// Progress bar.
+  Mode progressMode_ = Mode::CLOCK;  ///< Mode to restore.
+  uint16_t progress_ = 0;  ///< Permille shown.
+  bool progressShown_ = false;  ///< The bar was rendered since it last changed.
+
+  void setMode(Mode mode);
+
+  void onFrame(const uint8_t *frame, size_t length);
+
+  bool record(const uint8_t *frame, size_t length);
+
+  void playFrame();
+
+  void publishState();
+
+  // Overrides.
+  void onRead(BLECharacteristic *characteristic) override;
+
+  void onWrite(BLECharacteristic *characteristic) override;
+};
+
+/// @}
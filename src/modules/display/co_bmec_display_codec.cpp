@@ -0,0 +1,203 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup display display
+/// @{
+
+/// @file co_bmec_display_codec.cpp
+/// @brief Decoder of the key and delta frames written to the display service.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include <cstring>
+#include "co_bmec_display_codec.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define RGB                     3  /// Bytes per pixel.
+#define RUN_HEADER              3  /// Start (uint16 LE) and count.
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Constructors.
+
+/// @param ledCount number of pixels, at most CO_BMEC_DISPLAY_MAX_LEDS.
+CoBmecDisplayCodec::CoBmecDisplayCodec(size_t ledCount)
+    : ledCount_(std::min(ledCount,
+                         size_t(CO_BMEC_DISPLAY_MAX_LEDS))) {}
+
+// Public methods.
+
+/// Applies a frame to the buffer. A malformed frame may have been partly applied.
+/// @param frame frame.
+/// @param length length of the frame.
+/// @param rgb buffer of getLedCount() pixels.
+/// @returns result.
+CoBmecDisplayCodec::Result CoBmecDisplayCodec::decode(const uint8_t *frame, size_t length, uint8_t *rgb) {
+  if (length < CO_BMEC_DISPLAY_FRAME_HEADER) {
+    return Result::MALFORMED;
+  }
+
+  auto type = static_cast<Type>(frame[0]);
+  const uint8_t *data = frame + CO_BMEC_DISPLAY_FRAME_HEADER;
+  length -= CO_BMEC_DISPLAY_FRAME_HEADER;
+
+  switch (type) {
+    case Type::KEY_RAW: {
+      if (length != ledCount_ * RGB) {
+        return Result::MALFORMED;
+      }
+      memcpy(rgb,
+             data,
+             length);
+    }
+      break;
+    case Type::KEY_RLE: {
+      size_t pixel = 0;
+      for (size_t offset = 0; offset < length; offset += 1 + RGB) {
+        if (length - offset < 1 + RGB) {
+          return Result::MALFORMED;
+        }
+        size_t count = data[offset];
+        if (pixel + count > ledCount_) {
+          return Result::OUT_OF_RANGE;
+        }
+        for (size_t i = 0; i < count; i++, pixel++) {
+          memcpy(&rgb[pixel * RGB],
+                 &data[offset + 1],
+                 RGB);
+        }
+      }
+      if (pixel != ledCount_) {
+        return Result::MALFORMED;
+      }
+    }
+      break;
+    case Type::KEY_PALETTE: {
+      if (length != (ledCount_ + 1) / 2) {
+        return Result::MALFORMED;
+      }
+      for (size_t pixel = 0; pixel < ledCount_; pixel++) {
+        setIndexed(rgb,
+                   pixel,
+                   data,
+                   pixel);
+      }
+    }
+      break;
+    case Type::DELTA_RAW:
+    case Type::DELTA_FILL:
+    case Type::DELTA_PALETTE:return decodeRuns(type,
+                                               data,
+                                               length,
+                                               rgb);
+    case Type::PALETTE: {
+      if (length % (1 + RGB)) {
+        return Result::MALFORMED;
+      }
+      for (size_t offset = 0; offset < length; offset += 1 + RGB) {
+        if (data[offset] >= CO_BMEC_DISPLAY_PALETTE_SIZE) {
+          return Result::OUT_OF_RANGE;
+        }
+        memcpy(palette_[data[offset]],
+               &data[offset + 1],
+               RGB);
+      }
+    }
+      break;
+    default:return Result::UNKNOWN_TYPE;
+  }
+  return Result::OK;
+}
+
+/// Clears the palette, for a clip played from the start.
+void CoBmecDisplayCodec::reset() {
+  memset(palette_,
+         0,
+         sizeof(palette_));
+}
+
+/// @returns true if the frame replaces every pixel.
+bool CoBmecDisplayCodec::isKeyFrame(const uint8_t *frame, size_t length) {
+  if (length < CO_BMEC_DISPLAY_FRAME_HEADER) {
+    return false;
+  }
+  auto type = static_cast<Type>(frame[0]);
+  return type == Type::KEY_RAW || type == Type::KEY_RLE || type == Type::KEY_PALETTE;
+}
+
+/// @returns true if the frame completes a displayed frame.
+bool CoBmecDisplayCodec::isShown(const uint8_t *frame, size_t length) {
+  return length >= CO_BMEC_DISPLAY_FRAME_HEADER && (frame[1] & static_cast<uint8_t>(Flag::SHOW));
+}
+
+// Private methods.
+
+/// Applies the runs of a delta frame.
+CoBmecDisplayCodec::Result CoBmecDisplayCodec::decodeRuns(Type type,
+                                                          const uint8_t *data,
+                                                          size_t length,
+                                                          uint8_t *rgb) const {
+  size_t offset = 0;
+  while (offset < length) {
+    if (length - offset < RUN_HEADER) {
+      return Result::MALFORMED;
+    }
+    size_t start = data[offset] | (data[offset + 1] << 8);
+    size_t count = data[offset + 2];
+    offset += RUN_HEADER;
+    if (start + count > ledCount_) {
+      return Result::OUT_OF_RANGE;
+    }
+
+    size_t runLength = type == Type::DELTA_RAW ? count * RGB : type == Type::DELTA_FILL ? RGB : (count + 1) / 2;
+    if (length - offset < runLength) {
+      return Result::MALFORMED;
+    }
+
+    const uint8_t *run = &data[offset];
+    for (size_t i = 0; i < count; i++) {
+      size_t pixel = start + i;
+      switch (type) {
+        case Type::DELTA_RAW:memcpy(&rgb[pixel * RGB],
+                                    &run[i * RGB],
+                                    RGB);
+          break;
+        case Type::DELTA_FILL:memcpy(&rgb[pixel * RGB],
+                                     run,
+                                     RGB);
+          break;
+        default:setIndexed(rgb,
+                           pixel,
+                           run,
+                           i);
+          break;
+      }
+    }
+    offset += runLength;
+  }
+  return Result::OK;
+}
+
+/// Sets a pixel from a packed 4 bit palette index.
+/// @param rgb buffer.
+/// @param pixel pixel to set.
+/// @param indices packed indices, low nibble first.
+/// @param index index to use.
+void CoBmecDisplayCodec::setIndexed(uint8_t *rgb, size_t pixel, const uint8_t *indices, size_t index) const {
+  uint8_t paletteIndex = (indices[index / 2] >> ((index % 2) * 4)) & 0x0f;
+  memcpy(&rgb[pixel * RGB],
+         palette_[paletteIndex],
+         RGB);
+}
+
+/// @}
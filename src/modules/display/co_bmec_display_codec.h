@@ -0,0 +1,90 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @defgroup display display
+/// @brief Display module, frames and animations streamed over BLE.
+/// @{
+
+/// @file co_bmec_display_codec.h
+/// @brief Decoder of the key and delta frames written to the display service.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include <cstdint>
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_DISPLAY_MAX_LEDS              256  ///< Largest strip the buffers are sized for.
+#define CO_BMEC_DISPLAY_PALETTE_SIZE          16  ///< Colours addressed by a 4 bit index.
+#define CO_BMEC_DISPLAY_FRAME_HEADER          2  ///< Type and flags bytes.
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Decodes frames into an RGB buffer, 3 bytes per pixel.
+///
+/// A frame is [Type][Flags][payload], runs are [start (uint16 LE)][count (uint8)][data]:
+/// - KEY_RAW: RGB for every pixel.
+/// - KEY_RLE: [count][R][G][B] repeated until every pixel is set.
+/// - KEY_PALETTE: a 4 bit palette index per pixel, low nibble first.
+/// - DELTA_RAW: runs with RGB per pixel.
+/// - DELTA_FILL: runs with one RGB for the whole run.
+/// - DELTA_PALETTE: runs with a 4 bit index per pixel.
+/// - PALETTE: [first index][R][G][B] repeated, sets palette entries.
+///
+/// A frame larger than one write is sent as several frames, only the last with Flag::SHOW.
+/// A palette key frame of 168 pixels is 86 bytes against 506 bytes raw.
+class CoBmecDisplayCodec {
+ public:
+
+  enum class Type : uint8_t {
+    UNDEFINED, KEY_RAW, KEY_RLE, KEY_PALETTE, DELTA_RAW, DELTA_FILL, DELTA_PALETTE, PALETTE,
+  };
+
+  enum class Flag : uint8_t {
+    SHOW = 1 << 0,  ///< The frame is complete and can be shown.
+  };
+
+  enum class Result : uint8_t {
+    OK, MALFORMED, OUT_OF_RANGE, UNKNOWN_TYPE,
+  };
+
+  explicit CoBmecDisplayCodec(size_t ledCount);
+
+  Result decode(const uint8_t *frame, size_t length, uint8_t *rgb);
+
+  void reset();
+
+  /// @returns the number of pixels.
+  size_t getLedCount() const {
+    return ledCount_;
+  };
+
+  static bool isKeyFrame(const uint8_t *frame, size_t length);
+
+  static bool isShown(const uint8_t *frame, size_t length);
+
+ private:
+
+  size_t ledCount_;
+  uint8_t palette_[CO_BMEC_DISPLAY_PALETTE_SIZE][3]{};
+
+  Result decodeRuns(Type type, const uint8_t *data, size_t length, uint8_t *rgb) const;
+
+  void setIndexed(uint8_t *rgb, size_t pixel, const uint8_t *indices, size_t index) const;
+};
+
+/// @}
@@ -0,0 +1,205 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup display display
+/// @{
+
+/// @file co_bmec_display_settings.cpp
+/// @brief Display settings written over BLE as one packed, versioned struct.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "co_bmec_display_settings.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define PREF_NS_DISPLAY_SETTINGS    "DISPLAY"
+#define PREF_KEY_SETTINGS           "settings"
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Constructors.
+
+/// Loads the saved settings, or the defaults if there are none.
+/// @param bleServiceDisplay display service.
+/// @param flashMutex Global flash mutex.
+CoBmecDisplaySettings::CoBmecDisplaySettings(BleServiceDisplay *bleServiceDisplay, SemaphoreHandle_t flashMutex)
+    : bleServiceDisplay_(bleServiceDisplay),
+      flashMutex_(flashMutex) {
+
+  load();
+  bleServiceDisplay_->charSettings_->setValue(reinterpret_cast<uint8_t *>(&settings_),
+                                              sizeof(settings_));
+  bleServiceDisplay_->charSettings_->setCallbacks(this);
+}
+
+// Public methods.
+
+/// Copies the settings if they changed since the last update. Called by the renderer
+/// between frames, never waits on the BLE task.
+/// @param settings settings to update.
+/// @returns true if the settings were copied.
+bool CoBmecDisplaySettings::update(Settings &settings) {
+  if (xSemaphoreTake(mutex_, 0) != pdTRUE) {
+    return false;
+  }
+
+  bool updated = !applied_;
+  if (updated) {
+    settings = settings_;
+    applied_ = true;
+  }
+
+  xSemaphoreGive(mutex_);
+  return updated;
+}
+
+/// Persists the settings if they changed. Called periodically from a single task.
+void CoBmecDisplaySettings::loop() {
+  xSemaphoreTake(mutex_,
+                 portMAX_DELAY);
+  Settings settings = settings_;
+  xSemaphoreGive(mutex_);
+
+  if (memcmp(&settings,
+             &saved_,
+             sizeof(settings))) {
+    save(settings);
+  }
+}
+
+/// @param settings settings.
+/// @returns true if the settings can be applied.
+bool CoBmecDisplaySettings::isValid(const Settings &settings) {
+  return settings.version == CO_BMEC_DISPLAY_SETTINGS_VERSION
+      && settings.hueReps > 0
+      && settings.rippleStepMs >= CO_BMEC_DISPLAY_SETTINGS_MIN_RIPPLE_MS
+      && settings.rippleStepMs <= CO_BMEC_DISPLAY_SETTINGS_MAX_RIPPLE_MS
+      && abs(settings.gmtOffsetSec) <= CO_BMEC_DISPLAY_SETTINGS_MAX_GMT_OFFSET
+      && settings.nightStartMin < CO_BMEC_DISPLAY_SETTINGS_MINUTES_PER_DAY
+      && settings.nightEndMin < CO_BMEC_DISPLAY_SETTINGS_MINUTES_PER_DAY;
+}
+
+/// @param settings settings.
+/// @param timeInfo local time.
+/// @returns true if the time is in the night mode window.
+bool CoBmecDisplaySettings::isNight(const Settings &settings, const struct tm &timeInfo) {
+  uint16_t minute = timeInfo.tm_hour * 60 + timeInfo.tm_min;
+  if (settings.nightStartMin <= settings.nightEndMin) {
+    return minute >= settings.nightStartMin && minute < settings.nightEndMin;
+  }
+  return minute >= settings.nightStartMin || minute < settings.nightEndMin;
+}
+
+// Private methods.
+
+/// Loads the settings from NVS. Settings of another version are dropped.
+void CoBmecDisplaySettings::load() {
+
+  // Take the mutex.
+  xSemaphoreTake(flashMutex_,
+                 portMAX_DELAY);
+
+  // Set namespace.
+  if (!preferences_.begin(PREF_NS_DISPLAY_SETTINGS)) {
+    log_e("Could not init display NVS.");
+  }
+
+  Settings settings;
+  if (preferences_.getBytesLength(PREF_KEY_SETTINGS) == sizeof(settings)) {
+    (void) preferences_.getBytes(PREF_KEY_SETTINGS,
+                                 &settings,
+                                 sizeof(settings));
+  }
+
+  preferences_.end();
+
+  // Release the mutex.
+  while (!xSemaphoreGive(flashMutex_)) {
+    log_e("Failed to give flashMutex_.");
+  }
+
+  if (isValid(settings)) {
+    settings_ = settings;
+  }
+  else {
+    log_w("Display settings not loaded, using the defaults.");
+  }
+  saved_ = settings_;
+}
+
+/// Saves the settings to NVS.
+/// @param settings settings.
+void CoBmecDisplaySettings::save(const Settings &settings) {
+
+  // Take the mutex.
+  xSemaphoreTake(flashMutex_,
+                 portMAX_DELAY);
+
+  // Set namespace.
+  if (!preferences_.begin(PREF_NS_DISPLAY_SETTINGS)) {
+    log_e("Could not init display NVS.");
+  }
+
+  if (preferences_.putBytes(PREF_KEY_SETTINGS,
+                            &settings,
+                            sizeof(settings)) != sizeof(settings)) {
+    log_e("Failed to save the display settings to NVS");
+  }
+
+  // Commit.
+  preferences_.end();
+
+  // Release the mutex.
+  while (!xSemaphoreGive(flashMutex_)) {
+    log_e("Failed to give flashMutex_.");
+  }
+
+  // Not retried until the settings change again.
+  saved_ = settings;
+  log_i("Display settings saved.");
+}
+
+/// Validates and stores the written settings. A rejected write is undone, so that the
+/// characteristic always reads the settings in use.
+/// @param characteristic settings characteristic.
+void CoBmecDisplaySettings::onWrite(BLECharacteristic *characteristic) {
+  std::string value = characteristic->getValue();
+
+  Settings settings;
+  bool valid = value.length() == sizeof(settings);
+  if (valid) {
+    memcpy(&settings,
+           value.data(),
+           sizeof(settings));
+    valid = isValid(settings);
+  }
+
+  xSemaphoreTake(mutex_,
+                 portMAX_DELAY);
+
+  if (!valid) {
+    log_w("Display settings rejected, %u bytes",
+          value.length());
+  }
+  else if (memcmp(&settings,
+                  &settings_,
+                  sizeof(settings))) {
+    settings_ = settings;
+    applied_ = false;
+  }
+  characteristic->setValue(reinterpret_cast<uint8_t *>(&settings_),
+                           sizeof(settings_));
+
+  xSemaphoreGive(mutex_);
+}
+
+/// @}
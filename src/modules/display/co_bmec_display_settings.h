@@ -0,0 +1,105 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup display display
+/// @{
+
+/// @file co_bmec_display_settings.h
+/// @brief Display settings written over BLE as one packed, versioned struct.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "Arduino.h"
+#include <Preferences.h>
+#include "modules/ble/services/display/ble_display_service.h"
+#include "modules/memory/co_bmec_boot_arena.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_DISPLAY_SETTINGS_VERSION          1  ///< Bumped whenever Settings changes layout.
+#define CO_BMEC_DISPLAY_SETTINGS_MIN_RIPPLE_MS    20
+#define CO_BMEC_DISPLAY_SETTINGS_MAX_RIPPLE_MS    1000
+#define CO_BMEC_DISPLAY_SETTINGS_MAX_GMT_OFFSET   (14 * 60 * 60)
+#define CO_BMEC_DISPLAY_SETTINGS_MINUTES_PER_DAY  (24 * 60)
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Holds the settings of the clock renderer.
+///
+/// The settings characteristic is read and written as a whole Settings struct, so a change
+/// is a single write. A write is validated and rejected as a whole. The renderer picks up
+/// accepted settings with update() between frames and never sees a partly applied write.
+/// Settings are persisted from loop(), and only if they differ from those last saved.
+class CoBmecDisplaySettings : public BLECharacteristicCallbacks {
+ public:
+
+  /// Value of the settings characteristic, little endian.
+  struct __attribute__((packed)) Settings {
+    uint8_t version = CO_BMEC_DISPLAY_SETTINGS_VERSION;
+    uint8_t brightness = 255;  ///< Strip brightness, 255 is full.
+
+    /// Palette, the rainbow under the clock.
+    uint16_t firstHue = 0;
+    uint8_t hueReps = 1;
+    uint8_t saturation = 255;
+    uint8_t value = 50;
+
+    /// Ripple, three pixels moving around the strip.
+    uint8_t rippleRgb[3] = {0, 0, 50};  ///< Head of the ripple, the trail fades.
+    uint16_t rippleStepMs = 100;  ///< Time to move one pixel.
+
+    /// Local time.
+    int32_t gmtOffsetSec = 2 * 60 * 60;
+
+    /// Night mode, off if start and end are equal. The window may span midnight.
+    uint16_t nightStartMin = 0;  ///< Minutes after midnight.
+    uint16_t nightEndMin = 0;  ///< Minutes after midnight.
+    uint8_t nightBrightness = 8;
+  };
+
+  CoBmecDisplaySettings(BleServiceDisplay *bleServiceDisplay, SemaphoreHandle_t flashMutex);
+
+  bool update(Settings &settings);
+
+  void loop();
+
+  static bool isValid(const Settings &settings);
+
+  static bool isNight(const Settings &settings, const struct tm &timeInfo);
+
+ private:
+
+  BleServiceDisplay *bleServiceDisplay_;
+  SemaphoreHandle_t flashMutex_;
+  Preferences preferences_{};
+
+  /// Guards the settings and flags, written by the BLE task.
+  SemaphoreHandle_t mutex_ = CoBmecBootArena::createMutex();
+
+  Settings settings_;
+  bool applied_ = false;  ///< The renderer has the settings.
+
+  Settings saved_;  ///< Settings in the flash, used by loop() only.
+
+  void load();
+
+  void save(const Settings &settings);
+
+  // Overrides.
+  void onWrite(BLECharacteristic *characteristic) override;
+};
+
+/// @}
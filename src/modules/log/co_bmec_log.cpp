@@ -0,0 +1,269 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup log log
+/// @{
+
+/// @file co_bmec_log.cpp
+/// @brief Deferred format binary logger, decoded on the host by tools/log_decode.py.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstring>
+#include <soc/soc_memory_layout.h>
+#include "co_bmec_log.h"
+#include "modules/memory/co_bmec_boot_arena.h"
+#include "modules/watchdog/co_bmec_watchdog.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define LOG_TASK_DEADLINE_MS        10000  /// A full ring takes about 200 ms at 115200 baud.
+#define FRAME_HEADER_LEN            3  /// Magic and record length.
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+CoBmecLog::Ring CoBmecLog::rings_[portNUM_PROCESSORS];
+CoBmecLog::Level CoBmecLog::levels_[uint8_t(Module::COUNT)] = {
+    CoBmecLog::Level(CORE_DEBUG_LEVEL), CoBmecLog::Level(CORE_DEBUG_LEVEL),
+    CoBmecLog::Level(CORE_DEBUG_LEVEL), CoBmecLog::Level(CORE_DEBUG_LEVEL),
+    CoBmecLog::Level(CORE_DEBUG_LEVEL), CoBmecLog::Level(CORE_DEBUG_LEVEL),
+    CoBmecLog::Level(CORE_DEBUG_LEVEL),
+};
+
+static_assert((CO_BMEC_LOG_RING_SIZE & (CO_BMEC_LOG_RING_SIZE - 1)) == 0,
+              "CO_BMEC_LOG_RING_SIZE must be a power of 2.");
+static_assert(CO_BMEC_LOG_MAX_FRAME - FRAME_HEADER_LEN - 1 <= UINT8_MAX,
+              "The record length must fit its byte.");
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+/// Starts the task draining the rings to the serial. Records logged before are kept until the
+/// rings fill.
+/// @param core core to run the task on.
+/// @param priority priority of the task, below the tasks that log.
+void CoBmecLog::begin(int core, int priority) {
+  (void) CoBmecBootArena::createTask(task, // Function to implement the task
+                                     "log", // Name of the task
+                                     CO_BMEC_LOG_TASK_STACK_SIZE,  // Stack size in words
+                                     nullptr,  // Task input parameter
+                                     priority,  // Priority of the task
+                                     core); // Core where the task should run
+}
+
+/// @param module module.
+/// @param level most verbose level logged, NONE to silence the module.
+void CoBmecLog::setLevel(Module module, Level level) {
+  if (module < Module::COUNT && level <= Level::VERBOSE) {
+    levels_[uint8_t(module)] = level;
+  }
+}
+
+/// @param module module.
+/// @returns the most verbose level logged.
+CoBmecLog::Level CoBmecLog::getLevel(Module module) {
+  return module < Module::COUNT ? levels_[uint8_t(module)] : Level::NONE;
+}
+
+// Private methods.
+
+/// Copies the frame to the ring of the calling core, or drops it if the ring is full.
+/// Interrupts are masked so that nothing else on the core writes the ring meanwhile, and the
+/// task cannot move to the other core.
+void CoBmecLog::push(const Frame &frame) {
+  UBaseType_t interruptMask = portSET_INTERRUPT_MASK_FROM_ISR();
+  Ring &ring = rings_[xPortGetCoreID()];
+
+  uint32_t head = ring.head;
+  size_t length = frame.length();
+  if (CO_BMEC_LOG_RING_SIZE - (head - ring.tail) < length) {
+    ring.dropped = ring.dropped + 1;
+  }
+  else {
+    size_t offset = head & (CO_BMEC_LOG_RING_SIZE - 1);
+    size_t firstLength = std::min(length,
+                                  size_t(CO_BMEC_LOG_RING_SIZE - offset));
+    memcpy(ring.data + offset,
+           frame.data(),
+           firstLength);
+    memcpy(ring.data,
+           frame.data() + firstLength,
+           length - firstLength);
+
+    // Publish the frame once it is in the ring.
+    __sync_synchronize();
+    ring.head = head + length;
+  }
+
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(interruptMask);
+}
+
+/// Writes the frames in the ring to the serial.
+void CoBmecLog::drain(Ring &ring) {
+  uint32_t head = ring.head;
+  __sync_synchronize();
+  uint32_t tail = ring.tail;
+  if (head == tail) {
+    return;
+  }
+
+  size_t offset = tail & (CO_BMEC_LOG_RING_SIZE - 1);
+  size_t length = head - tail;
+  size_t firstLength = std::min(length,
+                                size_t(CO_BMEC_LOG_RING_SIZE - offset));
+  (void) Serial.write(ring.data + offset,
+                      firstLength);
+  if (length > firstLength) {
+    (void) Serial.write(ring.data,
+                        length - firstLength);
+  }
+
+  // Free the space once it has been read.
+  __sync_synchronize();
+  ring.tail = head;
+}
+
+/// Drains the rings and reports the dropped records.
+void CoBmecLog::task(void *) {
+  CoBmecWatchdog::Id watchdogId = CoBmecWatchdog::add("log",
+                                                      LOG_TASK_DEADLINE_MS);
+  uint32_t reported[portNUM_PROCESSORS]{};
+
+  for (;;) {
+    CoBmecWatchdog::beat(watchdogId);
+
+    for (uint8_t core = 0; core < portNUM_PROCESSORS; core++) {
+      Ring &ring = rings_[core];
+      drain(ring);
+
+      uint32_t dropped = ring.dropped;
+      if (dropped != reported[core]) {
+        CO_BMEC_LOG_W(LOG,
+                      "Dropped %lu records on core %u.",
+                      (unsigned long) (dropped - reported[core]),
+                      core);
+        reported[core] = dropped;
+      }
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(CO_BMEC_LOG_DRAIN_MS));
+  }
+}
+
+// Frame.
+
+/// Starts the frame with the record header.
+/// @param module module.
+/// @param level level.
+/// @param format printf format, a string literal.
+CoBmecLog::Frame::Frame(Module module, Level level, const char *format) {
+  data_[length_++] = CO_BMEC_LOG_FRAME_MAGIC_0;
+  data_[length_++] = CO_BMEC_LOG_FRAME_MAGIC_1;
+  length_++;  // Record length, set by finish().
+  put(uint32_t(uintptr_t(format)));
+  put(millis());
+  data_[length_++] = uint8_t(module);
+  data_[length_++] = uint8_t(level);
+}
+
+/// Sets the record length and appends the checksum.
+void CoBmecLog::Frame::finish() {
+  uint8_t checksum = 0;
+  for (size_t index = FRAME_HEADER_LEN; index < length_; index++) {
+    checksum += data_[index];
+  }
+  data_[2] = uint8_t(length_ - FRAME_HEADER_LEN);
+  data_[length_++] = checksum;
+}
+
+/// Appends the tag of an argument if it fits with the checksum.
+/// @param tag tag.
+/// @param size bytes following the tag.
+/// @returns false if the argument does not fit, and is left out.
+bool CoBmecLog::Frame::reserve(Tag tag, size_t size) {
+  if (length_ + 1 + size + 1 > CO_BMEC_LOG_MAX_FRAME) {
+    return false;
+  }
+  data_[length_++] = uint8_t(tag);
+  return true;
+}
+
+/// Appends the value, little endian.
+void CoBmecLog::Frame::put(uint32_t value) {
+  memcpy(data_ + length_,
+         &value,
+         sizeof(value));
+  length_ += sizeof(value);
+}
+
+void CoBmecLog::Frame::addInt32(uint32_t value) {
+  if (reserve(Tag::INT32,
+              sizeof(value))) {
+    put(value);
+  }
+}
+
+void CoBmecLog::Frame::addInt64(uint64_t value) {
+  if (reserve(Tag::INT64,
+              sizeof(value))) {
+    put(uint32_t(value));
+    put(uint32_t(value >> 32));
+  }
+}
+
+void CoBmecLog::Frame::addDouble(double value) {
+  if (reserve(Tag::DOUBLE,
+              sizeof(value))) {
+    memcpy(data_ + length_,
+           &value,
+           sizeof(value));
+    length_ += sizeof(value);
+  }
+}
+
+/// Strings in flash are sent as their address, the others are copied and may be cut.
+void CoBmecLog::Frame::addString(const char *value) {
+  if (!value) {
+    value = "";
+  }
+
+  if (esp_ptr_in_drom(value)) {
+    if (reserve(Tag::STRING_ADDRESS,
+                sizeof(uint32_t))) {
+      put(uint32_t(uintptr_t(value)));
+    }
+    return;
+  }
+
+  // Length byte, at least one character and the checksum.
+  if (length_ + 4 > CO_BMEC_LOG_MAX_FRAME) {
+    return;
+  }
+  size_t stringLength = strnlen(value,
+                                std::min(size_t(CO_BMEC_LOG_MAX_STRING),
+                                         CO_BMEC_LOG_MAX_FRAME - length_ - 3));
+  data_[length_++] = uint8_t(Tag::STRING);
+  data_[length_++] = uint8_t(stringLength);
+  memcpy(data_ + length_,
+         value,
+         stringLength);
+  length_ += stringLength;
+}
+
+/// Only whether the secret is set is sent.
+void CoBmecLog::Frame::addSecret(Secret value) {
+  if (reserve(Tag::SECRET,
+              1)) {
+    data_[length_++] = value.set ? 1 : 0;
+  }
+}
+
+/// @}
@@ -0,0 +1,220 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @defgroup log log
+/// @brief Deferred format binary logger.
+/// @{
+
+/// @file co_bmec_log.h
+/// @brief Deferred format binary logger, decoded on the host by tools/log_decode.py.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "Arduino.h"
+#include <type_traits>
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_LOG_RING_SIZE              2048  ///< Per core, a power of 2.
+#define CO_BMEC_LOG_MAX_FRAME              96  ///< Longest frame, longer arguments are cut.
+#define CO_BMEC_LOG_MAX_STRING             32  ///< Longest copied string argument.
+#define CO_BMEC_LOG_DRAIN_MS               50  ///< Period of the drain task.
+#define CO_BMEC_LOG_TASK_STACK_SIZE        2048
+#define CO_BMEC_LOG_FRAME_MAGIC_0          0xB5
+#define CO_BMEC_LOG_FRAME_MAGIC_1          0x4C
+
+/// Logs the format and arguments of a record, formatted on the host.
+/// @param module CoBmecLog::Module, e.g. WIFI.
+/// @param level CoBmecLog::Level, e.g. INFO.
+/// @param format printf format, a string literal.
+#define CO_BMEC_LOG(module, level, format, ...) \
+  do { \
+    if (CoBmecLog::isEnabled(CoBmecLog::Module::module, CoBmecLog::Level::level)) { \
+      CoBmecLog::write(CoBmecLog::Module::module, CoBmecLog::Level::level, format, ##__VA_ARGS__); \
+    } \
+  } while (0)
+
+#define CO_BMEC_LOG_E(module, format, ...) CO_BMEC_LOG(module, ERROR, format, ##__VA_ARGS__)
+#define CO_BMEC_LOG_W(module, format, ...) CO_BMEC_LOG(module, WARN, format, ##__VA_ARGS__)
+#define CO_BMEC_LOG_I(module, format, ...) CO_BMEC_LOG(module, INFO, format, ##__VA_ARGS__)
+#define CO_BMEC_LOG_D(module, format, ...) CO_BMEC_LOG(module, DEBUG, format, ##__VA_ARGS__)
+#define CO_BMEC_LOG_V(module, format, ...) CO_BMEC_LOG(module, VERBOSE, format, ##__VA_ARGS__)
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Logs records without formatting them on the device.
+///
+/// A record is the address of its format string, the time, the module and level, and the raw
+/// arguments. The host finds the format in the ELF of the image, see tools/log_decode.py.
+/// Strings in flash are sent as their address too, other strings are copied.
+///
+/// Each core writes to its own ring with the interrupts of that core masked, so a writer never
+/// waits on a lock or on the other core, and interrupt handlers may log. A full ring drops the
+/// record and counts it. A low priority task drains the rings to the serial.
+///
+/// Each module has its own level, set at run time. Levels above CORE_DEBUG_LEVEL are compiled
+/// out. Credentials are passed through secret(), which only sends whether they are set.
+class CoBmecLog {
+ public:
+
+  /// Order is the module names of tools/log_decode.py.
+  enum class Module : uint8_t {
+    APP, LOG, WIFI, BLE, OTA, TIME, DISPLAY, COUNT,
+  };
+
+  /// As ARDUHAL_LOG_LEVEL_*.
+  enum class Level : uint8_t {
+    NONE, ERROR, WARN, INFO, DEBUG, VERBOSE,
+  };
+
+  /// An argument that is never sent.
+  struct Secret {
+    bool set;
+  };
+
+  /// @returns the argument logged as <secret>, or <empty> if not set.
+  static Secret secret(const char *value) {
+    return {value && *value};
+  };
+
+  static Secret secret(const String &value) {
+    return {!value.isEmpty()};
+  };
+
+  static void begin(int core, int priority);
+
+  static void setLevel(Module module, Level level);
+
+  static Level getLevel(Module module);
+
+  /// @returns true if records of the module at the level are logged.
+  static bool isEnabled(Module module, Level level) {
+    return uint8_t(level) <= CORE_DEBUG_LEVEL
+        && level <= levels_[uint8_t(module)];
+  };
+
+  /// Use CO_BMEC_LOG, which checks the level before the arguments are evaluated.
+  /// @param module module.
+  /// @param level level.
+  /// @param format printf format, a string literal.
+  /// @param args arguments: integers, enums, floating points, pointers, strings or secrets.
+  template<typename... Args>
+  static void write(Module module, Level level, const char *format, const Args &... args) {
+    Frame frame(module,
+                level,
+                format);
+    (frame.add(args), ...);
+    frame.finish();
+    push(frame);
+  };
+
+ private:
+
+  /// Argument tags.
+  enum class Tag : uint8_t {
+    INT32 = 1,  ///< 4 bytes.
+    INT64,  ///< 8 bytes.
+    DOUBLE,  ///< 8 bytes.
+    STRING,  ///< Length byte and the bytes.
+    STRING_ADDRESS,  ///< 4 bytes, a string in flash.
+    SECRET,  ///< 1 byte, 1 if set.
+  };
+
+  /// [magic 0, magic 1, record length, record, record checksum], where the record is
+  /// [format address (u32 LE), time ms (u32 LE), module, level, tagged arguments].
+  class Frame {
+   public:
+
+    Frame(Module module, Level level, const char *format);
+
+    template<typename T>
+    void add(const T &value) {
+      if constexpr (std::is_same<T, Secret>::value) {
+        addSecret(value);
+      }
+      else if constexpr (std::is_enum<T>::value || std::is_integral<T>::value) {
+        if constexpr (sizeof(T) <= sizeof(uint32_t)) {
+          addInt32(uint32_t(value));
+        }
+        else {
+          addInt64(uint64_t(value));
+        }
+      }
+      else if constexpr (std::is_floating_point<T>::value) {
+        addDouble(double(value));
+      }
+      else if constexpr (std::is_convertible<const T &, const char *>::value) {
+        addString(value);
+      }
+      else if constexpr (std::is_same<T, String>::value) {
+        addString(value.c_str());
+      }
+      else {
+        static_assert(std::is_pointer<T>::value,
+                      "Unsupported log argument.");
+        addInt32(uint32_t(uintptr_t(value)));
+      }
+    };
+
+    void finish();
+
+    const uint8_t *data() const {
+      return data_;
+    };
+
+    size_t length() const {
+      return length_;
+    };
+
+   private:
+
+    uint8_t data_[CO_BMEC_LOG_MAX_FRAME];
+    size_t length_ = 0;
+
+    bool reserve(Tag tag, size_t size);
+
+    void put(uint32_t value);
+
+    void addInt32(uint32_t value);
+
+    void addInt64(uint64_t value);
+
+    void addDouble(double value);
+
+    void addString(const char *value);
+
+    void addSecret(Secret value);
+  };
+
+  /// Written by one core, read by the drain task. Indices run free, masked on access.
+  struct Ring {
+    uint8_t data[CO_BMEC_LOG_RING_SIZE];
+    volatile uint32_t head = 0;  ///< Written by the core of the ring.
+    volatile uint32_t tail = 0;  ///< Written by the drain task.
+    volatile uint32_t dropped = 0;  ///< Records that did not fit, written by the core of the ring.
+  };
+
+  static Ring rings_[portNUM_PROCESSORS];
+  static Level levels_[uint8_t(Module::COUNT)];
+
+  static void push(const Frame &frame);
+
+  static void drain(Ring &ring);
+
+  [[noreturn]] static void task(void *);
+};
+
+/// @}
@@ -0,0 +1,209 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup memory memory
+/// @{
+
+/// @file co_bmec_boot_arena.cpp
+/// @brief Boot time allocations, static with CO_BMEC_STATIC_ALLOC.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include "co_bmec_boot_arena.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+// Constant initialised, so usable from the global constructors.
+#ifdef CO_BMEC_STATIC_ALLOC
+alignas(max_align_t) uint8_t CoBmecBootArena::arena_[CO_BMEC_BOOT_ARENA_SIZE];
+#else
+uint8_t CoBmecBootArena::arena_[1];
+#endif
+size_t CoBmecBootArena::used_ = 0;
+size_t CoBmecBootArena::overflow_ = 0;
+portMUX_TYPE CoBmecBootArena::mux_ = portMUX_INITIALIZER_UNLOCKED;
+uint32_t CoBmecBootArena::heapBefore_ = 0;
+uint32_t CoBmecBootArena::heapAfter_ = 0;
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+/// Records the free heap before the modules are created, see report.
+void CoBmecBootArena::begin() {
+  heapBefore_ = esp_get_free_heap_size();
+}
+
+/// @param size bytes.
+/// @param align alignment, a power of 2.
+/// @returns storage from the arena, nullptr if not static or full.
+void *CoBmecBootArena::allocate(size_t size, size_t align) {
+#ifdef CO_BMEC_STATIC_ALLOC
+  void *storage = nullptr;
+  portENTER_CRITICAL(&mux_);
+  size_t offset = (used_ + align - 1) & ~(align - 1);
+  if (offset + size <= CO_BMEC_BOOT_ARENA_SIZE) {
+    storage = &arena_[offset];
+    used_ = offset + size;
+  }
+  else {
+    overflow_ += size;
+  }
+  portEXIT_CRITICAL(&mux_);
+
+  if (!storage) {
+    log_w("Boot arena full, %lu bytes from the heap.",
+          (unsigned long) size);
+  }
+  return storage;
+#else
+  (void) size;
+  (void) align;
+  return nullptr;
+#endif
+}
+
+/// Creates a task that never ends, see xTaskCreatePinnedToCore.
+/// @param stackSize stack size in bytes.
+/// @returns the task, nullptr if it could not be created.
+TaskHandle_t CoBmecBootArena::createTask(TaskFunction_t function,
+                                         const char *name,
+                                         uint32_t stackSize,
+                                         void *parameter,
+                                         UBaseType_t priority,
+                                         BaseType_t core) {
+#ifdef CO_BMEC_STATIC_ALLOC
+  auto *stack = static_cast<StackType_t *>(allocate(stackSize * sizeof(StackType_t),
+                                                    alignof(StackType_t)));
+  auto *tcb = static_cast<StaticTask_t *>(allocate(sizeof(StaticTask_t),
+                                                   alignof(StaticTask_t)));
+  if (stack && tcb) {
+    return xTaskCreateStaticPinnedToCore(function,
+                                         name,
+                                         stackSize,
+                                         parameter,
+                                         priority,
+                                         stack,
+                                         tcb,
+                                         core);
+  }
+#endif
+  TaskHandle_t task = nullptr;
+  (void) xTaskCreatePinnedToCore(function,
+                                 name,
+                                 stackSize,
+                                 parameter,
+                                 priority,
+                                 &task,
+                                 core);
+  return task;
+}
+
+/// @returns the queue, see xQueueCreate.
+QueueHandle_t CoBmecBootArena::createQueue(UBaseType_t length, UBaseType_t itemSize) {
+#ifdef CO_BMEC_STATIC_ALLOC
+  auto *storage = static_cast<uint8_t *>(allocate(length * itemSize,
+                                                  alignof(max_align_t)));
+  auto *queue = static_cast<StaticQueue_t *>(allocate(sizeof(StaticQueue_t),
+                                                      alignof(StaticQueue_t)));
+  if (storage && queue) {
+    return xQueueCreateStatic(length,
+                              itemSize,
+                              storage,
+                              queue);
+  }
+#endif
+  return xQueueCreate(length,
+                      itemSize);
+}
+
+/// @returns the mutex, see xSemaphoreCreateMutex.
+SemaphoreHandle_t CoBmecBootArena::createMutex() {
+#ifdef CO_BMEC_STATIC_ALLOC
+  auto *semaphore = static_cast<StaticSemaphore_t *>(allocate(sizeof(StaticSemaphore_t),
+                                                              alignof(StaticSemaphore_t)));
+  if (semaphore) {
+    return xSemaphoreCreateMutexStatic(semaphore);
+  }
+#endif
+  return xSemaphoreCreateMutex();
+}
+
+/// @returns the semaphore, see xSemaphoreCreateCounting.
+SemaphoreHandle_t CoBmecBootArena::createCounting(UBaseType_t max, UBaseType_t initial) {
+#ifdef CO_BMEC_STATIC_ALLOC
+  auto *semaphore = static_cast<StaticSemaphore_t *>(allocate(sizeof(StaticSemaphore_t),
+                                                              alignof(StaticSemaphore_t)));
+  if (semaphore) {
+    return xSemaphoreCreateCountingStatic(max,
+                                          initial,
+                                          semaphore);
+  }
+#endif
+  return xSemaphoreCreateCounting(max,
+                                  initial);
+}
+
+/// @returns the stream buffer, see xStreamBufferCreate.
+StreamBufferHandle_t CoBmecBootArena::createStreamBuffer(size_t size, size_t triggerLevel) {
+#ifdef CO_BMEC_STATIC_ALLOC
+  // One more byte than the size, as xStreamBufferCreate allocates.
+  auto *storage = static_cast<uint8_t *>(allocate(size + 1,
+                                                  1));
+  auto *streamBuffer = static_cast<StaticStreamBuffer_t *>(allocate(sizeof(StaticStreamBuffer_t),
+                                                                    alignof(StaticStreamBuffer_t)));
+  if (storage && streamBuffer) {
+    return xStreamBufferCreateStatic(size + 1,
+                                     triggerLevel,
+                                     storage,
+                                     streamBuffer);
+  }
+#endif
+  return xStreamBufferCreate(size,
+                             triggerLevel);
+}
+
+/// Logs the heap used by the boot, call once the modules are created.
+void CoBmecBootArena::report() {
+  heapAfter_ = esp_get_free_heap_size();
+
+  char text[128];
+  (void) format(text,
+                sizeof(text));
+  log_i("%s",
+        text);
+}
+
+/// Formats the boot heap figures as text.
+/// @param buffer output.
+/// @param length length of the buffer.
+/// @returns number of characters written.
+size_t CoBmecBootArena::format(char *buffer, size_t length) {
+  int count = snprintf(buffer,
+                       length,
+#ifdef CO_BMEC_STATIC_ALLOC
+                       "boot heap %lu -> %lu bytes, arena %lu of %lu bytes, overflow %lu bytes\n",
+#else
+                       "boot heap %lu -> %lu bytes, arena off %lu of %lu bytes, overflow %lu bytes\n",
+#endif
+                       (unsigned long) heapBefore_,
+                       (unsigned long) heapAfter_,
+                       (unsigned long) used_,
+                       (unsigned long) sizeof(arena_),
+                       (unsigned long) overflow_);
+  return count > 0 ? std::min(size_t(count),
+                              length ? length - 1 : 0) : 0;
+}
+
+/// @}
@@ -0,0 +1,99 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup memory memory
+/// @{
+
+/// @file co_bmec_boot_arena.h
+/// @brief Boot time allocations, static with CO_BMEC_STATIC_ALLOC.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include <new>
+#include <utility>
+#include "Arduino.h"
+#include "freertos/stream_buffer.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#ifndef CO_BMEC_BOOT_ARENA_SIZE
+#define CO_BMEC_BOOT_ARENA_SIZE            49152  ///< Bytes, the task stacks included. See report().
+#endif
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Allocates the objects, tasks and RTOS primitives that live from boot until the restart.
+///
+/// Built with CO_BMEC_STATIC_ALLOC, they are placed in an arena of CO_BMEC_BOOT_ARENA_SIZE
+/// bytes in .bss and the RTOS objects use the static FreeRTOS constructors, so the heap left
+/// after boot is the same on every boot and cannot fragment from them. Otherwise, and if the
+/// arena is full, they come from the heap. Nothing allocated here is ever freed.
+///
+/// Objects created and deleted at runtime, such as the OTA task, stay on the heap.
+class CoBmecBootArena {
+ public:
+
+  static void begin();
+
+  static void *allocate(size_t size, size_t align);
+
+  /// Constructs a boot object.
+  /// @tparam T type.
+  /// @param args constructor arguments.
+  /// @returns the object.
+  template<typename T, typename... Args>
+  static T *make(Args &&... args) {
+#ifdef CO_BMEC_STATIC_ALLOC
+    void *storage = allocate(sizeof(T),
+                             alignof(T));
+    if (storage) {
+      return new(storage) T(std::forward<Args>(args)...);
+    }
+#endif
+    return new T(std::forward<Args>(args)...);
+  };
+
+  static TaskHandle_t createTask(TaskFunction_t function,
+                                 const char *name,
+                                 uint32_t stackSize,
+                                 void *parameter,
+                                 UBaseType_t priority,
+                                 BaseType_t core);
+
+  static QueueHandle_t createQueue(UBaseType_t length, UBaseType_t itemSize);
+
+  static SemaphoreHandle_t createMutex();
+
+  static SemaphoreHandle_t createCounting(UBaseType_t max, UBaseType_t initial);
+
+  static StreamBufferHandle_t createStreamBuffer(size_t size, size_t triggerLevel);
+
+  static void report();
+
+  static size_t format(char *buffer, size_t length);
+
+ private:
+
+  static uint8_t arena_[];
+  static size_t used_;
+  static size_t overflow_;  ///< Bytes that did not fit and went to the heap.
+  static portMUX_TYPE mux_;
+  static uint32_t heapBefore_;
+  static uint32_t heapAfter_;
+};
+
+/// @}
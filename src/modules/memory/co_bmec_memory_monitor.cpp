@@ -0,0 +1,405 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup memory memory
+/// @{
+
+/// @file co_bmec_memory_monitor.cpp
+/// @brief Stack and heap high-water marks, per feature phase.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include <esp_heap_caps.h>
+#include "co_bmec_memory_monitor.h"
+#include "co_bmec_boot_arena.h"
+#include "modules/metrics/co_bmec_metrics.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+SemaphoreHandle_t CoBmecMemoryMonitor::mutex_ = nullptr;
+volatile uint8_t CoBmecMemoryMonitor::phases_ = 1 << static_cast<uint8_t>(Phase::RUN);
+uint32_t CoBmecMemoryMonitor::sampleTMs_ = 0;
+
+CoBmecMemoryMonitor::PhasePeak CoBmecMemoryMonitor::phasePeaks_[static_cast<size_t>(Phase::COUNT)];
+CoBmecMemoryMonitor::TaskPeak CoBmecMemoryMonitor::taskPeaks_[CO_BMEC_MEMORY_MAX_TASKS];
+size_t CoBmecMemoryMonitor::taskCount_ = 0;
+
+/// Read when the metrics are scraped.
+static CoBmecMetrics::Gauge heapFreeMetric("heap_free_bytes",
+                                           "Free 8 bit heap.",
+                                           1,
+                                           []() { return int32_t(heap_caps_get_free_size(MALLOC_CAP_8BIT)); });
+static CoBmecMetrics::Gauge heapMinFreeMetric("heap_min_free_bytes",
+                                              "Lowest free 8 bit heap since boot.",
+                                              1,
+                                              []() { return int32_t(heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT)); });
+static CoBmecMetrics::Gauge heapLargestFreeMetric("heap_largest_free_block_bytes",
+                                                  "Largest free 8 bit heap block.",
+                                                  1,
+                                                  []() { return int32_t(heap_caps_get_largest_free_block(MALLOC_CAP_8BIT)); });
+
+/// The peaks per phase, labelled with the phase and the heap or the task. Never sampled peaks are left out.
+static CoBmecMetrics::GaugeFamily phaseHeapMinFreeMetric(
+    "heap_phase_min_free_bytes",
+    "Lowest free heap seen while the phase was active.",
+    [](CoBmecMetrics::GaugeFamily::Samples &samples) {
+      for (size_t phase = 0; phase < static_cast<size_t>(CoBmecMemoryMonitor::Phase::COUNT); phase++) {
+        CoBmecMemoryMonitor::PhasePeak phasePeak;
+        if (!CoBmecMemoryMonitor::getPhasePeak(static_cast<CoBmecMemoryMonitor::Phase>(phase),
+                                               phasePeak)) {
+          return;
+        }
+        for (size_t heap = 0; heap < static_cast<size_t>(CoBmecMemoryMonitor::Heap::COUNT); heap++) {
+          if (phasePeak.heaps[heap].minFree == CO_BMEC_MEMORY_UNSEEN) {
+            continue;
+          }
+          char labels[48];
+          snprintf(labels,
+                   sizeof(labels),
+                   "phase=\"%s\",heap=\"%s\"",
+                   CoBmecMemoryMonitor::toString(static_cast<CoBmecMemoryMonitor::Phase>(phase)),
+                   CoBmecMemoryMonitor::toString(static_cast<CoBmecMemoryMonitor::Heap>(heap)));
+          samples.add(labels,
+                      int32_t(phasePeak.heaps[heap].minFree));
+        }
+      }
+    });
+static CoBmecMetrics::GaugeFamily taskStackMinFreeMetric(
+    "stack_min_free_bytes",
+    "Lowest free stack of the task since it started, as of the end of the phase.",
+    [](CoBmecMetrics::GaugeFamily::Samples &samples) {
+      CoBmecMemoryMonitor::TaskPeak taskPeak;
+      for (size_t task = 0; CoBmecMemoryMonitor::getTaskPeak(task, taskPeak); task++) {
+        for (size_t phase = 0; phase < static_cast<size_t>(CoBmecMemoryMonitor::Phase::COUNT); phase++) {
+          if (taskPeak.minStackFree[phase] == CO_BMEC_MEMORY_UNSEEN) {
+            continue;
+          }
+          char labels[48];
+          snprintf(labels,
+                   sizeof(labels),
+                   "task=\"%s\",phase=\"%s\"",
+                   taskPeak.name,
+                   CoBmecMemoryMonitor::toString(static_cast<CoBmecMemoryMonitor::Phase>(phase)));
+          samples.add(labels,
+                      int32_t(taskPeak.minStackFree[phase]));
+        }
+      }
+    });
+
+#if configUSE_TRACE_FACILITY
+/// Filled by uxTaskGetSystemState, kept off the stacks being measured.
+static TaskStatus_t taskStatus[CO_BMEC_MEMORY_MAX_TASKS];
+#endif
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+/// Starts monitoring, with a first sample. Phases set before are ignored.
+void CoBmecMemoryMonitor::begin() {
+  if (mutex_) {
+    return;
+  }
+  mutex_ = CoBmecBootArena::createMutex();
+#if !configUSE_TRACE_FACILITY
+  log_w("Task stacks not sampled, configUSE_TRACE_FACILITY is off.");
+#endif
+  sample();
+}
+
+/// Samples every CO_BMEC_MEMORY_SAMPLE_MS.
+void CoBmecMemoryMonitor::loop() {
+  if (millis() - sampleTMs_ < CO_BMEC_MEMORY_SAMPLE_MS) {
+    return;
+  }
+  sample();
+}
+
+/// Marks a feature phase as started or ended, with a sample at the change.
+/// Repeated calls with the same state are ignored.
+/// @param phase phase, not RUN.
+/// @param active true when the phase starts.
+void CoBmecMemoryMonitor::setPhase(Phase phase, bool active) {
+  if (!mutex_ || phase == Phase::RUN || phase >= Phase::COUNT) {
+    return;
+  }
+
+  uint8_t bit = 1 << static_cast<uint8_t>(phase);
+  xSemaphoreTake(mutex_,
+                 portMAX_DELAY);
+  if (bool(phases_ & bit) != active) {
+    // The phase owns the sample at its end.
+    phases_ |= bit;
+    sampleHeaps(phases_);
+    sampleTasks(phases_);
+    phases_ = active ? phases_ : phases_ & ~bit;
+  }
+  while (!xSemaphoreGive(mutex_)) log_e("Failed to give mutex_.");
+}
+
+/// @param phase phase.
+/// @param phasePeak output, lowest heap values seen while the phase was active.
+/// @returns false if not monitoring.
+bool CoBmecMemoryMonitor::getPhasePeak(Phase phase, PhasePeak &phasePeak) {
+  if (!mutex_ || phase >= Phase::COUNT) {
+    return false;
+  }
+  xSemaphoreTake(mutex_,
+                 portMAX_DELAY);
+  phasePeak = phasePeaks_[static_cast<size_t>(phase)];
+  while (!xSemaphoreGive(mutex_)) log_e("Failed to give mutex_.");
+  return true;
+}
+
+/// @param index task index, in the order the tasks were first seen.
+/// @param taskPeak output, lowest free stack seen per phase.
+/// @returns false past the last task.
+bool CoBmecMemoryMonitor::getTaskPeak(size_t index, TaskPeak &taskPeak) {
+  if (!mutex_) {
+    return false;
+  }
+  xSemaphoreTake(mutex_,
+                 portMAX_DELAY);
+  bool found = index < taskCount_;
+  if (found) {
+    taskPeak = taskPeaks_[index];
+  }
+  while (!xSemaphoreGive(mutex_)) log_e("Failed to give mutex_.");
+  return found;
+}
+
+/// Formats the current heap and the peaks as text.
+/// @param buffer output.
+/// @param length length of the buffer.
+/// @returns number of characters written.
+size_t CoBmecMemoryMonitor::format(char *buffer, size_t length) {
+  size_t written = 0;
+  // Appends to the buffer, truncating when full.
+  auto append = [&](int count) {
+    if (count > 0) {
+      written = std::min(written + size_t(count),
+                         length ? length - 1 : 0);
+    }
+  };
+  // Appends a peak, "-" if never sampled.
+  auto appendValue = [&](uint32_t value) {
+    append(value == CO_BMEC_MEMORY_UNSEEN ? snprintf(buffer + written,
+                                                     length - written,
+                                                     " -")
+                                          : snprintf(buffer + written,
+                                                     length - written,
+                                                     " %lu",
+                                                     (unsigned long) value));
+  };
+
+  if (length) {
+    buffer[0] = '\0';
+  }
+  if (!mutex_) {
+    return 0;
+  }
+
+  // Now, and the lowest since boot.
+  append(snprintf(buffer + written,
+                  length - written,
+                  "heap free/boot min/largest:"));
+  for (size_t heap = 0; heap < static_cast<size_t>(Heap::COUNT); heap++) {
+    uint32_t caps = getCaps(static_cast<Heap>(heap));
+    append(snprintf(buffer + written,
+                    length - written,
+                    " %s %lu/%lu/%lu",
+                    toString(static_cast<Heap>(heap)),
+                    (unsigned long) heap_caps_get_free_size(caps),
+                    (unsigned long) heap_caps_get_minimum_free_size(caps),
+                    (unsigned long) heap_caps_get_largest_free_block(caps)));
+  }
+  append(snprintf(buffer + written,
+                  length - written,
+                  "\n"));
+
+  xSemaphoreTake(mutex_,
+                 portMAX_DELAY);
+
+  // Heap per phase.
+  for (size_t phase = 0; phase < static_cast<size_t>(Phase::COUNT); phase++) {
+    const PhasePeak &phasePeak = phasePeaks_[phase];
+    append(snprintf(buffer + written,
+                    length - written,
+                    "%s samples %lu min free/largest:",
+                    toString(static_cast<Phase>(phase)),
+                    (unsigned long) phasePeak.samples));
+    for (size_t heap = 0; heap < static_cast<size_t>(Heap::COUNT); heap++) {
+      append(snprintf(buffer + written,
+                      length - written,
+                      " %s",
+                      toString(static_cast<Heap>(heap))));
+      appendValue(phasePeak.heaps[heap].minFree);
+      appendValue(phasePeak.heaps[heap].minLargest);
+    }
+    append(snprintf(buffer + written,
+                    length - written,
+                    "\n"));
+  }
+
+  // Stacks per phase.
+  append(snprintf(buffer + written,
+                  length - written,
+                  "stack min free bytes:"));
+  for (size_t phase = 0; phase < static_cast<size_t>(Phase::COUNT); phase++) {
+    append(snprintf(buffer + written,
+                    length - written,
+                    " %s",
+                    toString(static_cast<Phase>(phase))));
+  }
+  append(snprintf(buffer + written,
+                  length - written,
+                  "\n"));
+  for (size_t task = 0; task < taskCount_; task++) {
+    append(snprintf(buffer + written,
+                    length - written,
+                    "%s:",
+                    taskPeaks_[task].name));
+    for (uint32_t minStackFree : taskPeaks_[task].minStackFree) {
+      appendValue(minStackFree);
+    }
+    append(snprintf(buffer + written,
+                    length - written,
+                    "\n"));
+  }
+
+  while (!xSemaphoreGive(mutex_)) log_e("Failed to give mutex_.");
+  return written;
+}
+
+/// @returns the name of a phase.
+const char *CoBmecMemoryMonitor::toString(Phase phase) {
+  static const char *PHASE_NAMES[] = {
+      "run", "ble_init", "scan", "ota", "ntp",
+  };
+  return phase < Phase::COUNT ? PHASE_NAMES[static_cast<size_t>(phase)] : "";
+}
+
+/// @returns the name of a heap capability.
+const char *CoBmecMemoryMonitor::toString(Heap heap) {
+  static const char *HEAP_NAMES[] = {
+      "default", "internal", "dma",
+  };
+  return heap < Heap::COUNT ? HEAP_NAMES[static_cast<size_t>(heap)] : "";
+}
+
+// Private methods.
+
+/// Samples the heaps and the stacks for the active phases.
+void CoBmecMemoryMonitor::sample() {
+  xSemaphoreTake(mutex_,
+                 portMAX_DELAY);
+  sampleHeaps(phases_);
+  sampleTasks(phases_);
+  while (!xSemaphoreGive(mutex_)) log_e("Failed to give mutex_.");
+}
+
+/// Lowers the heap peaks of the phases, mutex_ taken.
+/// @param phases phase bits.
+void CoBmecMemoryMonitor::sampleHeaps(uint8_t phases) {
+  sampleTMs_ = millis();
+
+  HeapPeak now[static_cast<size_t>(Heap::COUNT)];
+  for (size_t heap = 0; heap < static_cast<size_t>(Heap::COUNT); heap++) {
+    uint32_t caps = getCaps(static_cast<Heap>(heap));
+    now[heap].minFree = heap_caps_get_free_size(caps);
+    now[heap].minLargest = heap_caps_get_largest_free_block(caps);
+  }
+
+  for (size_t phase = 0; phase < static_cast<size_t>(Phase::COUNT); phase++) {
+    if (!(phases & (1 << phase))) {
+      continue;
+    }
+    PhasePeak &phasePeak = phasePeaks_[phase];
+    phasePeak.samples++;
+    for (size_t heap = 0; heap < static_cast<size_t>(Heap::COUNT); heap++) {
+      phasePeak.heaps[heap].minFree = std::min(phasePeak.heaps[heap].minFree,
+                                               now[heap].minFree);
+      phasePeak.heaps[heap].minLargest = std::min(phasePeak.heaps[heap].minLargest,
+                                                  now[heap].minLargest);
+    }
+  }
+}
+
+/// Lowers the stack peaks of the phases, for every task, mutex_ taken.
+/// @param phases phase bits.
+void CoBmecMemoryMonitor::sampleTasks(uint8_t phases) {
+#if configUSE_TRACE_FACILITY
+  UBaseType_t count = uxTaskGetSystemState(taskStatus,
+                                           CO_BMEC_MEMORY_MAX_TASKS,
+                                           nullptr);
+  if (!count) {
+    log_w("More than %u tasks, stacks not sampled.",
+          CO_BMEC_MEMORY_MAX_TASKS);
+  }
+
+  for (UBaseType_t task = 0; task < count; task++) {
+    TaskPeak *taskPeak = findTask(taskStatus[task].pcTaskName);
+    if (!taskPeak) {
+      continue;
+    }
+    // In bytes on the ESP32.
+    uint32_t stackFree = taskStatus[task].usStackHighWaterMark;
+    for (size_t phase = 0; phase < static_cast<size_t>(Phase::COUNT); phase++) {
+      if (phases & (1 << phase)) {
+        taskPeak->minStackFree[phase] = std::min(taskPeak->minStackFree[phase],
+                                                 stackFree);
+      }
+    }
+  }
+#else
+  (void) phases;
+#endif
+}
+
+/// Finds the peaks of a task by name, adding them on first sight. Tasks of the same name,
+/// such as the OTA task started again, share their peaks.
+/// @param name task name.
+/// @returns nullptr if the table is full.
+CoBmecMemoryMonitor::TaskPeak *CoBmecMemoryMonitor::findTask(const char *name) {
+  for (size_t task = 0; task < taskCount_; task++) {
+    if (!strncmp(taskPeaks_[task].name,
+                 name,
+                 CO_BMEC_MEMORY_TASK_NAME_LEN - 1)) {
+      return &taskPeaks_[task];
+    }
+  }
+  if (taskCount_ == CO_BMEC_MEMORY_MAX_TASKS) {
+    return nullptr;
+  }
+
+  TaskPeak &taskPeak = taskPeaks_[taskCount_++];
+  strlcpy(taskPeak.name,
+          name,
+          sizeof(taskPeak.name));
+  std::fill(std::begin(taskPeak.minStackFree),
+            std::end(taskPeak.minStackFree),
+            CO_BMEC_MEMORY_UNSEEN);
+  return &taskPeak;
+}
+
+/// @returns the heap_caps capabilities of a heap.
+uint32_t CoBmecMemoryMonitor::getCaps(Heap heap) {
+  switch (heap) {
+    case Heap::INTERNAL:return MALLOC_CAP_INTERNAL;
+    case Heap::DMA:return MALLOC_CAP_DMA;
+    default:return MALLOC_CAP_8BIT;
+  }
+}
+
+/// @}
@@ -0,0 +1,123 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @defgroup memory memory
+/// @brief Stack and heap instrumentation.
+/// @{
+
+/// @file co_bmec_memory_monitor.h
+/// @brief Stack and heap high-water marks, per feature phase.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include "Arduino.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_MEMORY_SAMPLE_MS           1000  ///< Period of the samples outside the phase changes.
+#define CO_BMEC_MEMORY_MAX_TASKS           32  ///< Tasks sampled, system tasks included.
+#define CO_BMEC_MEMORY_TASK_NAME_LEN       16  ///< configMAX_TASK_NAME_LEN.
+#define CO_BMEC_MEMORY_UNSEEN              UINT32_MAX  ///< Peak of a phase never sampled.
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Samples the stack high-water mark of every task, and the free, minimum free and largest
+/// free heap block per capability. The lowest values seen are kept for the whole run and
+/// for each feature phase active at the time, so that the stacks can be sized from data.
+///
+/// Samples are taken every CO_BMEC_MEMORY_SAMPLE_MS by loop(), and by setPhase() as a phase
+/// starts and ends. The free heap is only seen at the samples.
+///
+/// A stack high-water mark is the lowest free stack since the task started and is never reset,
+/// so a task's figure for a phase is its lifetime minimum as of the end of the phase, which
+/// includes whatever ran before. A phase only stands out when it lowers the mark.
+///
+/// The peaks are on the serial with format() and scraped as the heap_phase_min_free_bytes and
+/// stack_min_free_bytes metrics.
+class CoBmecMemoryMonitor {
+ public:
+
+  enum class Phase : uint8_t {
+    RUN,  ///< Always active.
+    BLE_INIT,
+    SCAN,
+    OTA,  ///< Over the Wi-Fi or the BLE.
+    NTP,
+    COUNT,
+  };
+
+  enum class Heap : uint8_t {
+    DEFAULT,  ///< MALLOC_CAP_8BIT, what malloc and new use.
+    INTERNAL,
+    DMA,
+    COUNT,
+  };
+
+  /// Lowest values seen, CO_BMEC_MEMORY_UNSEEN if never sampled.
+  struct HeapPeak {
+    uint32_t minFree = CO_BMEC_MEMORY_UNSEEN;
+    uint32_t minLargest = CO_BMEC_MEMORY_UNSEEN;  ///< Largest free block.
+  };
+
+  struct PhasePeak {
+    uint32_t samples = 0;
+    HeapPeak heaps[static_cast<size_t>(Heap::COUNT)];
+  };
+
+  struct TaskPeak {
+    char name[CO_BMEC_MEMORY_TASK_NAME_LEN]{};
+    uint32_t minStackFree[static_cast<size_t>(Phase::COUNT)]{};  ///< Bytes since the task started, as of the end of the phase. CO_BMEC_MEMORY_UNSEEN if never sampled.
+  };
+
+  static void begin();
+
+  static void loop();
+
+  static void setPhase(Phase phase, bool active);
+
+  static bool getPhasePeak(Phase phase, PhasePeak &phasePeak);
+
+  static bool getTaskPeak(size_t index, TaskPeak &taskPeak);
+
+  static size_t format(char *buffer, size_t length);
+
+  static const char *toString(Phase phase);
+
+  static const char *toString(Heap heap);
+
+ private:
+
+  static SemaphoreHandle_t mutex_;  ///< Guards the peaks, nullptr until begin.
+  static volatile uint8_t phases_;  ///< Active phase bits.
+  static uint32_t sampleTMs_;
+
+  static PhasePeak phasePeaks_[static_cast<size_t>(Phase::COUNT)];
+  static TaskPeak taskPeaks_[CO_BMEC_MEMORY_MAX_TASKS];
+  static size_t taskCount_;
+
+  static void sample();
+
+  static void sampleHeaps(uint8_t phases);
+
+  static void sampleTasks(uint8_t phases);
+
+  static TaskPeak *findTask(const char *name);
+
+  static uint32_t getCaps(Heap heap);
+};
+
+/// @}
@@ -0,0 +1,308 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup metrics metrics
+/// @{
+
+/// @file co_bmec_metrics.cpp
+/// @brief Platform independent metrics registry, formatted as Prometheus text.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include <cstdio>
+#include "co_bmec_metrics.h"
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+std::atomic<CoBmecMetrics::Metric *> CoBmecMetrics::head_{nullptr};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "The metric updates must not take a lock.");
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+/// Appends the count written by snprintf, truncating when the buffer is full.
+/// @returns the new length written.
+static size_t append(size_t written, int count, size_t length) {
+  return count > 0 ? std::min(written + size_t(count),
+                              length ? length - 1 : 0)
+                   : written;
+}
+
+/// Formats an integer value in its base unit.
+/// @param value value in the unit of the scale.
+/// @param scale units per base unit.
+static int formatValue(char *buffer, size_t length, int64_t value, uint32_t scale) {
+  return scale == 1 ? snprintf(buffer,
+                               length,
+                               "%lld",
+                               (long long) value)
+                    : snprintf(buffer,
+                               length,
+                               "%.9g",
+                               double(value) / scale);
+}
+
+// Public methods.
+
+/// Formats every metric in the Prometheus text format, truncated to the buffer.
+/// @returns the length written.
+size_t CoBmecMetrics::format(char *buffer, size_t length) {
+  size_t written = 0;
+  if (length) {
+    buffer[0] = '\0';
+  }
+
+  for (const Metric *metric = head_.load(std::memory_order_acquire); metric; metric = metric->next_) {
+    written = append(written,
+                     snprintf(buffer + written,
+                              length - written,
+                              "# HELP %s %s\n# TYPE %s %s\n",
+                              metric->name_,
+                              metric->help_,
+                              metric->name_,
+                              metric->type_),
+                     length);
+    written = append(written,
+                     int(metric->formatSamples(buffer + written,
+                                               length - written)),
+                     length);
+  }
+  return written;
+}
+
+// Private methods.
+
+/// Pushes the metric on the list. Lock free, so metrics may be constructed from any task.
+void CoBmecMetrics::add(Metric *metric) {
+  Metric *head = head_.load(std::memory_order_relaxed);
+  do {
+    metric->next_ = head;
+  } while (!head_.compare_exchange_weak(head,
+                                        metric,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed));
+}
+
+// Metric.
+
+CoBmecMetrics::Metric::Metric(const char *name, const char *help, const char *type)
+    : name_(name),
+      help_(help),
+      type_(type) {}
+
+// Counter.
+
+CoBmecMetrics::Counter::Counter(const char *name, const char *help)
+    : Metric(name,
+             help,
+             "counter") {
+  CoBmecMetrics::add(this);
+}
+
+/// @returns the sum of the core slots.
+uint32_t CoBmecMetrics::Counter::get() const {
+  uint32_t value = 0;
+  for (const auto &slot : values_) {
+    value += slot.load(std::memory_order_relaxed);
+  }
+  return value;
+}
+
+size_t CoBmecMetrics::Counter::formatSamples(char *buffer, size_t length) const {
+  return append(0,
+                snprintf(buffer,
+                         length,
+                         "%s %lu\n",
+                         name_,
+                         (unsigned long) get()),
+                length);
+}
+
+// Gauge.
+
+/// @param scale units per base unit of the value.
+/// @param sampler reads the value when formatted, nullptr to format the value set.
+CoBmecMetrics::Gauge::Gauge(const char *name, const char *help, uint32_t scale, Sampler sampler)
+    : Metric(name,
+             help,
+             "gauge"),
+      scale_(scale ? scale : 1),
+      sampler_(sampler) {
+  CoBmecMetrics::add(this);
+}
+
+/// @returns the value, sampled if the gauge has a sampler.
+int32_t CoBmecMetrics::Gauge::get() const {
+  return sampler_ ? sampler_() : value_.load(std::memory_order_relaxed);
+}
+
+size_t CoBmecMetrics::Gauge::formatSamples(char *buffer, size_t length) const {
+  size_t written = append(0,
+                          snprintf(buffer,
+                                   length,
+                                   "%s ",
+                                   name_),
+                          length);
+  written = append(written,
+                   formatValue(buffer + written,
+                               length - written,
+                               get(),
+                               scale_),
+                   length);
+  return append(written,
+                snprintf(buffer + written,
+                         length - written,
+                         "\n"),
+                length);
+}
+
+// GaugeFamily.
+
+CoBmecMetrics::GaugeFamily::GaugeFamily(const char *name, const char *help, Sampler sampler, uint32_t scale)
+    : Metric(name,
+             help,
+             "gauge"),
+      sampler_(sampler),
+      scale_(scale ? scale : 1) {
+  CoBmecMetrics::add(this);
+}
+
+size_t CoBmecMetrics::GaugeFamily::formatSamples(char *buffer, size_t length) const {
+  Samples samples(*this,
+                  buffer,
+                  length);
+  if (length) {
+    buffer[0] = '\0';
+  }
+  sampler_(samples);
+  return samples.written_;
+}
+
+CoBmecMetrics::GaugeFamily::Samples::Samples(const GaugeFamily &family, char *buffer, size_t length)
+    : family_(family),
+      buffer_(buffer),
+      length_(length) {}
+
+/// Formats a sample of the family.
+/// @param labels Prometheus labels without the braces, e.g. "task=\"wifi\"".
+/// @param value value in the unit of the scale.
+void CoBmecMetrics::GaugeFamily::Samples::add(const char *labels, int32_t value) {
+  written_ = append(written_,
+                    snprintf(buffer_ + written_,
+                             length_ - written_,
+                             "%s{%s} ",
+                             family_.name_,
+                             labels),
+                    length_);
+  written_ = append(written_,
+                    formatValue(buffer_ + written_,
+                                length_ - written_,
+                                value,
+                                family_.scale_),
+                    length_);
+  written_ = append(written_,
+                    snprintf(buffer_ + written_,
+                             length_ - written_,
+                             "\n"),
+                    length_);
+}
+
+// Histogram.
+
+CoBmecMetrics::Histogram::Histogram(const char *name,
+                                    const char *help,
+                                    const uint32_t *bounds,
+                                    uint8_t boundCount,
+                                    uint32_t scale)
+    : Metric(name,
+             help,
+             "histogram"),
+      bounds_(bounds),
+      boundCount_(std::min(boundCount,
+                           uint8_t(CO_BMEC_METRICS_MAX_BUCKETS))),
+      scale_(scale ? scale : 1) {
+  CoBmecMetrics::add(this);
+}
+
+/// Counts the value in the first bucket whose bound it does not exceed.
+/// @param value value in the unit of the scale.
+void CoBmecMetrics::Histogram::observe(uint32_t value) {
+  uint8_t bucket = std::lower_bound(bounds_,
+                                    bounds_ + boundCount_,
+                                    value) - bounds_;
+  uint8_t slot = core();
+  counts_[slot][bucket].fetch_add(1,
+                                  std::memory_order_relaxed);
+  sums_[slot].fetch_add(value,
+                        std::memory_order_relaxed);
+}
+
+/// Formats the cumulative buckets, the sum and the count. The count is the +Inf bucket, so that
+/// they agree while observations are added.
+size_t CoBmecMetrics::Histogram::formatSamples(char *buffer, size_t length) const {
+  size_t written = 0;
+  uint32_t cumulative = 0;
+  for (uint8_t bucket = 0; bucket <= boundCount_; bucket++) {
+    for (const auto &slot : counts_) {
+      cumulative += slot[bucket].load(std::memory_order_relaxed);
+    }
+
+    written = append(written,
+                     snprintf(buffer + written,
+                              length - written,
+                              "%s_bucket{le=\"",
+                              name_),
+                     length);
+    written = append(written,
+                     bucket < boundCount_ ? formatValue(buffer + written,
+                                                        length - written,
+                                                        bounds_[bucket],
+                                                        scale_)
+                                          : snprintf(buffer + written,
+                                                     length - written,
+                                                     "+Inf"),
+                     length);
+    written = append(written,
+                     snprintf(buffer + written,
+                              length - written,
+                              "\"} %lu\n",
+                              (unsigned long) cumulative),
+                     length);
+  }
+
+  uint64_t sum = 0;
+  for (const auto &slot : sums_) {
+    sum += slot.load(std::memory_order_relaxed);
+  }
+  written = append(written,
+                   snprintf(buffer + written,
+                            length - written,
+                            "%s_sum ",
+                            name_),
+                   length);
+  written = append(written,
+                   formatValue(buffer + written,
+                               length - written,
+                               int64_t(sum),
+                               scale_),
+                   length);
+  return append(written,
+                snprintf(buffer + written,
+                         length - written,
+                         "\n%s_count %lu\n",
+                         name_,
+                         (unsigned long) cumulative),
+                length);
+}
+
+/// @}
@@ -0,0 +1,206 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @defgroup metrics metrics
+/// @brief Metrics registry.
+/// @{
+
+/// @file co_bmec_metrics.h
+/// @brief Platform independent metrics registry, formatted as Prometheus text.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#endif
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#ifdef ARDUINO
+#define CO_BMEC_METRICS_CORES          portNUM_PROCESSORS
+#else
+#define CO_BMEC_METRICS_CORES          1
+#endif
+#define CO_BMEC_METRICS_MAX_BUCKETS    12  ///< Bounds of a histogram, +Inf excluded.
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Counters, gauges and fixed bucket histograms, formatted in the Prometheus text format.
+///
+/// Metrics register themselves when constructed, usually as statics of the module that
+/// updates them, and stay registered. Counters and histograms keep a slot per core that is
+/// only written from that core with an atomic add, so updates never contend across cores nor
+/// take a lock. The slots are summed when formatted.
+///
+/// Values are integers in the unit given by the scale, e.g. a scale of 1000 for ms, and are
+/// formatted in the base unit. Names follow the Prometheus conventions, e.g. "wifi_connects_total".
+class CoBmecMetrics {
+ public:
+
+  /// A registered metric.
+  class Metric {
+   public:
+
+    Metric(const Metric &) = delete;
+
+    Metric &operator=(const Metric &) = delete;
+
+   protected:
+
+    /// @param name name, a string literal.
+    /// @param help help text, a string literal.
+    /// @param type Prometheus type.
+    Metric(const char *name, const char *help, const char *type);
+
+    const char *name_;
+
+    virtual size_t formatSamples(char *buffer, size_t length) const = 0;
+
+   private:
+
+    friend class CoBmecMetrics;
+
+    const char *help_;
+    const char *type_;
+    Metric *next_ = nullptr;
+  };
+
+  /// Counts up. Wraps at 2^32, which Prometheus treats as a reset.
+  class Counter : public Metric {
+   public:
+
+    Counter(const char *name, const char *help);
+
+    /// @param count amount to add.
+    void add(uint32_t count = 1) {
+      values_[core()].fetch_add(count,
+                                std::memory_order_relaxed);
+    };
+
+    uint32_t get() const;
+
+   private:
+
+    std::atomic<uint32_t> values_[CO_BMEC_METRICS_CORES]{};
+
+    size_t formatSamples(char *buffer, size_t length) const override;
+  };
+
+  /// A value that goes up and down, set by its owner or read when formatted.
+  class Gauge : public Metric {
+   public:
+
+    using Sampler = int32_t (*)();
+
+    Gauge(const char *name, const char *help, uint32_t scale = 1, Sampler sampler = nullptr);
+
+    void set(int32_t value) {
+      value_.store(value,
+                   std::memory_order_relaxed);
+    };
+
+    int32_t get() const;
+
+   private:
+
+    uint32_t scale_;
+    Sampler sampler_;
+    std::atomic<int32_t> value_{0};
+
+    size_t formatSamples(char *buffer, size_t length) const override;
+  };
+
+  /// Gauges of one name told apart by their labels, read when formatted, e.g. a value per task.
+  class GaugeFamily : public Metric {
+   public:
+
+    /// The samples of the family being formatted.
+    class Samples {
+     public:
+
+      void add(const char *labels, int32_t value);
+
+     private:
+
+      friend class GaugeFamily;
+
+      Samples(const GaugeFamily &family, char *buffer, size_t length);
+
+      const GaugeFamily &family_;
+      char *buffer_;
+      size_t length_;
+      size_t written_ = 0;
+    };
+
+    using Sampler = void (*)(Samples &samples);
+
+    /// @param sampler adds the samples when formatted.
+    /// @param scale units per base unit of the values.
+    GaugeFamily(const char *name, const char *help, Sampler sampler, uint32_t scale = 1);
+
+   private:
+
+    Sampler sampler_;
+    uint32_t scale_;
+
+    size_t formatSamples(char *buffer, size_t length) const override;
+  };
+
+  /// Counts the observations below each bound. The sum of each core slot wraps at 2^32, which
+  /// Prometheus treats as a reset, the slots are summed in 64 bits when formatted.
+  class Histogram : public Metric {
+   public:
+
+    /// @param bounds ascending upper bounds, kept.
+    /// @param boundCount bounds, up to CO_BMEC_METRICS_MAX_BUCKETS.
+    Histogram(const char *name, const char *help, const uint32_t *bounds, uint8_t boundCount, uint32_t scale = 1);
+
+    void observe(uint32_t value);
+
+   private:
+
+    const uint32_t *bounds_;
+    uint8_t boundCount_;
+    uint32_t scale_;
+    std::atomic<uint32_t> counts_[CO_BMEC_METRICS_CORES][CO_BMEC_METRICS_MAX_BUCKETS + 1]{};  ///< Last is +Inf.
+    std::atomic<uint32_t> sums_[CO_BMEC_METRICS_CORES]{};  ///< 64 bit atomics take a lock on Xtensa.
+
+    size_t formatSamples(char *buffer, size_t length) const override;
+  };
+
+  static size_t format(char *buffer, size_t length);
+
+ private:
+
+  static std::atomic<Metric *> head_;
+
+  static void add(Metric *metric);
+
+  /// @returns the slot of the calling core.
+  static uint8_t core() {
+#ifdef ARDUINO
+    return xPortGetCoreID();
+#else
+    return 0;
+#endif
+  };
+};
+
+/// @}
@@ -0,0 +1,134 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup metrics metrics
+/// @{
+
+/// @file co_bmec_metrics_server.cpp
+/// @brief Serves the metrics registry over HTTP for a Prometheus scraper.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <memory>
+#include <new>
+#include "co_bmec_metrics_server.h"
+#include "co_bmec_metrics.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define METRICS_CONTENT_TYPE        "text/plain; version=0.0.4"
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Constructors.
+
+/// @param core core to run the server task on.
+/// @param priority priority of the server task.
+/// @param port TCP port.
+CoBmecMetricsServer::CoBmecMetricsServer(int core, int priority, uint16_t port)
+    : core_(core),
+      priority_(priority),
+      port_(port) {}
+
+// Public methods.
+
+/// Serves while the station has an IP. Run by the loop() task.
+/// @param event AP state.
+void CoBmecMetricsServer::onEvent(const CoBmecWifi::ApStateEvent &event) {
+  switch (event.apState) {
+    case CoBmecWifi::ApState::CONNECTED:
+    case CoBmecWifi::ApState::PINGING:
+    case CoBmecWifi::ApState::PINGED:(void) start();
+      break;
+    default:stop();
+      break;
+  }
+}
+
+/// Starts or stops the server as the wifi state changes. Called periodically from a single task.
+void CoBmecMetricsServer::loop() {
+  apStateSubscription_.dispatch();
+}
+
+// Private methods.
+
+/// Starts the server, listening on the address the station obtained.
+/// @returns false if the server could not be started.
+bool CoBmecMetricsServer::start() {
+  if (server_) {
+    return true;
+  }
+
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.server_port = port_;
+  config.ctrl_port = port_ + 1;
+  config.core_id = core_;
+  config.task_priority = priority_;
+  config.stack_size = CO_BMEC_METRICS_SERVER_STACK_SIZE;
+  config.max_open_sockets = CO_BMEC_METRICS_SERVER_MAX_SOCKETS;
+  config.max_uri_handlers = 1;
+  config.lru_purge_enable = true;  // A scraper that never closes cannot lock the others out.
+
+  if (httpd_start(&server_,
+                  &config) != ESP_OK) {
+    log_e("Could not start the metrics server.");
+    server_ = nullptr;
+    return false;
+  }
+
+  httpd_uri_t metricsUri{};
+  metricsUri.uri = "/metrics";
+  metricsUri.method = HTTP_GET;
+  metricsUri.handler = onMetrics;
+  (void) httpd_register_uri_handler(server_,
+                                    &metricsUri);
+
+  log_i("Metrics served on port %u",
+        port_);
+  return true;
+}
+
+/// Stops the server and closes its sockets, waiting for a scrape in progress.
+void CoBmecMetricsServer::stop() {
+  if (!server_) {
+    return;
+  }
+
+  (void) httpd_stop(server_);
+  server_ = nullptr;
+  log_i("Metrics server stopped.");
+}
+
+/// Formats the metrics into a buffer that is doubled until the text fits.
+esp_err_t CoBmecMetricsServer::onMetrics(httpd_req_t *request) {
+  for (size_t length = CO_BMEC_METRICS_TEXT_LEN; length <= CO_BMEC_METRICS_MAX_TEXT_LEN; length *= 2) {
+    std::unique_ptr<char[]> text(new(std::nothrow) char[length]);
+    if (!text) {
+      break;
+    }
+
+    size_t written = CoBmecMetrics::format(text.get(),
+                                           length);
+    if (written < length - 1) {
+      (void) httpd_resp_set_type(request,
+                                 METRICS_CONTENT_TYPE);
+      return httpd_resp_send(request,
+                             text.get(),
+                             ssize_t(written));
+    }
+  }
+
+  log_w("Metrics do not fit %lu bytes.",
+        (unsigned long) CO_BMEC_METRICS_MAX_TEXT_LEN);
+  return httpd_resp_send_500(request);
+}
+
+/// @}
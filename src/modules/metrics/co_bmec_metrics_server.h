@@ -0,0 +1,71 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup metrics metrics
+/// @{
+
+/// @file co_bmec_metrics_server.h
+/// @brief Serves the metrics registry over HTTP for a Prometheus scraper.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "Arduino.h"
+#include <esp_http_server.h>
+#include "modules/bus/co_bmec_bus.h"
+#include "modules/wifi/co_bmec_wifi.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_METRICS_SERVER_PORT            9100  ///< As the node exporter.
+#define CO_BMEC_METRICS_SERVER_STACK_SIZE      3072  ///< Bytes.
+#define CO_BMEC_METRICS_SERVER_MAX_SOCKETS     2
+#define CO_BMEC_METRICS_TEXT_LEN               2048  ///< Initial text buffer, doubled while too short.
+#define CO_BMEC_METRICS_MAX_TEXT_LEN           16384
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Serves GET /metrics in the Prometheus text format, on the ESP-IDF HTTP server.
+///
+/// The server runs while the station has an IP: it is started once the wifi is CONNECTED and
+/// stopped when the connection is lost, so that it never starts before the network interface
+/// is up. The server task blocks on its sockets between scrapes. The text is formatted per
+/// request into a heap buffer, so nothing is held between scrapes.
+class CoBmecMetricsServer : public CoBmecBusSubscriber<CoBmecWifi::ApStateEvent> {
+ public:
+
+  CoBmecMetricsServer(int core, int priority, uint16_t port = CO_BMEC_METRICS_SERVER_PORT);
+
+  void onEvent(const CoBmecWifi::ApStateEvent &event) override;
+
+  void loop();
+
+ private:
+
+  int core_;
+  int priority_;
+  uint16_t port_;
+  httpd_handle_t server_ = nullptr;
+
+  CoBmecBusSubscription<CoBmecWifi::ApStateEvent> apStateSubscription_{*this, CoBmecBusDelivery::DEFERRED};
+
+  bool start();
+
+  void stop();
+
+  static esp_err_t onMetrics(httpd_req_t *request);
+};
+
+/// @}
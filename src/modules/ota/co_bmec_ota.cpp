@@ -15,101 +15,443 @@
 // #includes.
 //*********************************************************************
 #include "co_bmec_ota.h"
+#include <algorithm>
+#include <new>
 #include <Update.h>
 #include <WiFiClientSecure.h>
 #include <HTTPClient.h>
+#include <mbedtls/pk.h>
+#include "co_bmec_ota_key.h"
+#include "modules/memory/co_bmec_memory_monitor.h"
 
 //*********************************************************************
 // defines.
 //*********************************************************************
-
+#define RANGE_HEADER_LEN            32
 
 //*********************************************************************
 // definitions.
 //*********************************************************************
+volatile bool CoBmecOta::running_ = false;
+CoBmecWatchdog::Id CoBmecOta::watchdogId_ = -1;
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+class CoBmecOta::DownloadClock : public CoBmecOtaDownload::Clock {
+ public:
+  uint32_t millis() override {
+    return ::millis();
+  };
+
+  void delay(uint32_t ms) override {
+    vTaskDelay(std::max(ms / portTICK_PERIOD_MS,
+                        uint32_t(1)));
+  };
+};
+
+/// A new TLS connection per request. Integrity comes from the manifest, not the TLS.
+class CoBmecOta::DownloadConnection : public CoBmecOtaDownload::Connection {
+ public:
+  explicit DownloadConnection(const std::string &url)
+      : url_(url) {};
+
+  int get(size_t offset, int &length) override;
+
+  size_t available() override {
+    return stream_->available();
+  };
+
+  int read(uint8_t *data, size_t length) override {
+    return stream_->read(data,
+                         length);
+  };
+
+  bool connected() override {
+    return stream_->connected();
+  };
+
+  void end() override {
+    if (https_) {
+      https_->end();
+    }
+    https_.reset();
+    wifiClientSecure_.reset();
+    stream_ = nullptr;
+  };
+
+ private:
+  const std::string &url_;
+  std::unique_ptr<WiFiClientSecure> wifiClientSecure_;
+  std::unique_ptr<HTTPClient> https_;
+  WiFiClient *stream_ = nullptr;
+};
+
+/// Feeds the watchdog of the OTA task and reports the progress.
+class CoBmecOta::DownloadListener : public CoBmecOtaDownload::Listener {
+ public:
+  explicit DownloadListener(const Progress &onProgress)
+      : onProgress_(onProgress) {};
+
+  void onConnect(size_t offset) override {
+    CoBmecWatchdog::trace(watchdogId_,
+                          "ota connect",
+                          offset);
+  };
+
+  void onPoll() override {
+    CoBmecWatchdog::beat(watchdogId_);
+  };
+
+  void onProgress(size_t done, size_t total) override {
+    onProgress_(done,
+                total);
+  };
+
+  void onRetry(uint8_t retries, size_t offset, uint32_t delayMs) override {
+    CoBmecWatchdog::beat(watchdogId_);
+    CoBmecWatchdog::trace(watchdogId_,
+                          "ota retry",
+                          retries);
+    log_w("Download stopped at %lu bytes, resuming in %lu ms",
+          (unsigned long) offset,
+          (unsigned long) delayMs);
+  };
+
+ private:
+  const Progress &onProgress_;
+};
 
 //*********************************************************************
 // implementations.
 //*********************************************************************
 
-/// Starts an OTA_UPDATE attempt. Restarts on success and failure.
-/// @param url URL at which the .bin file is to be found.
+/// Starts an OTA_UPDATE attempt. Restarts on success, returns on failure.
+/// @param url URL at which the payload (.bin, or encoded by tools/ota_manifest.py) is to be found, the manifest has CO_BMEC_OTA_MANIFEST_SUFFIX appended.
 /// @param optional function to run before restart.
-void CoBmecOta::ota(
-    const std::string &url, const std::function<void()> &beforeRestart
+/// @param onProgress optional function called as the payload is written.
+/// @returns the failure.
+CoBmecOta::Result CoBmecOta::ota(
+    const std::string &url, const std::function<void()> &beforeRestart, const Progress &onProgress
 ) {
 
-  // Create the network client.
-  auto *wifiClientSecure = new WiFiClientSecure;
+  // Get the signed manifest.
+  Manifest manifest;
+  CoBmecWatchdog::trace(watchdogId_,
+                        "ota manifest");
+  Result result = fetchManifest(url + CO_BMEC_OTA_MANIFEST_SUFFIX,
+                                manifest);
+  if (result != Result::OK) {
+    return result;
+  }
+
+  log_i("Manifest verified, downloading file %u bytes, encoding %u, image %u bytes...",
+        manifest.payloadSize,
+        manifest.encoding,
+        manifest.imageSize);
+
+  // Start the update.
+  std::unique_ptr<CoBmecOtaDecoder> decoder;
+  result = begin(manifest,
+                 decoder);
+  if (result != Result::OK) {
+    return result;
+  }
+
+  // Download, resuming from the last received byte, the decoder state is kept across resumes.
+  DownloadClock clock;
+  DownloadConnection connection(url);
+  DownloadListener listener(onProgress);
+  CoBmecOtaDownload download(clock,
+                             connection,
+                             listener);
+  switch (download.run(*decoder,
+                       manifest.payloadSize)) {
+    case CoBmecOtaDownload::Result::OK:result = Result::OK;
+      break;
+    case CoBmecOtaDownload::Result::CONNECT_FAILED:result = Result::CONNECT_FAILED;
+      break;
+    case CoBmecOtaDownload::Result::HTTP_ERROR:result = Result::HTTP_ERROR;
+      break;
+    case CoBmecOtaDownload::Result::INTERRUPTED:result = Result::INTERRUPTED;
+      break;
+    case CoBmecOtaDownload::Result::DECODE_FAILED:result = toResult(download.getDecoderResult());
+      break;
+  }
+
+  result = end(manifest,
+               *decoder,
+               result);
+  if (result != Result::OK) {
+    return result;
+  }
+
+  log_w("OTA_UPDATE update complete. Restarting to new firmware...");
+  beforeRestart();
+  ESP.restart();
+  return Result::OK;
+}
+
+/// Starts an OTA_UPDATE attempt in its own task, whose stack is freed when it ends.
+/// @param url see ota.
+/// @param core core to run on.
+/// @param callbacks run on the task.
+/// @returns false if an update is already running or the task could not be created.
+bool CoBmecOta::start(const std::string &url, BaseType_t core, const Callbacks &callbacks) {
+  if (running_) {
+    return false;
+  }
+
+  struct Task {
+    std::string url;
+    Callbacks callbacks;
+  };
+
+  running_ = true;
+  auto *task = new Task{url, callbacks};
+  if (xTaskCreatePinnedToCore(
+      [](void *taskRef) {
+        auto *task = static_cast<Task *>(taskRef);
+        watchdogId_ = CoBmecWatchdog::add("ota",
+                                          CO_BMEC_OTA_TASK_DEADLINE_MS);
+        CoBmecMemoryMonitor::setPhase(CoBmecMemoryMonitor::Phase::OTA,
+                                      true);
+        Result result = ota(task->url,
+                            task->callbacks.beforeRestart,
+                            task->callbacks.onProgress);
+
+        // Only failures return.
+        log_e("OTA_UPDATE failed with error %u",
+              static_cast<uint8_t>(result));
+        task->callbacks.onFailed(result);
+        CoBmecWatchdog::remove(watchdogId_);
+        watchdogId_ = -1;
+        CoBmecMemoryMonitor::setPhase(CoBmecMemoryMonitor::Phase::OTA,
+                                      false);
+        delete task;
+        running_ = false;
+        vTaskDelete(nullptr);
+      }, // Function to implement the task
+      "ota", // Name of the task
+      CO_BMEC_OTA_TASK_STACK_SIZE,  // Stack size.
+      task,  // Task input parameter
+      CO_BMEC_OTA_TASK_PRIORITY,  // Priority of the task
+      nullptr,  // Task handle.
+      core) != pdPASS) {  // Core where the task should run
+    delete task;
+    running_ = false;
+    return false;
+  }
+  return true;
+}
+
+/// @param manifest manifest, as received.
+/// @returns OK if the manifest is well formed and signed with the release key.
+CoBmecOta::Result CoBmecOta::check(const Manifest &manifest) {
+  if (manifest.magic != CO_BMEC_OTA_MANIFEST_MAGIC
+      || manifest.version != CO_BMEC_OTA_MANIFEST_VERSION
+      || manifest.signatureLength > sizeof(manifest.signature)) {
+    log_e("Malformed manifest.");
+    return Result::MANIFEST_FAILED;
+  }
+  if (!verify(manifest)) {
+    log_e("Manifest signature rejected.");
+    return Result::BAD_SIGNATURE;
+  }
+  return Result::OK;
+}
+
+/// Creates the decoder and starts the update, whatever the transport.
+/// @param manifest checked manifest.
+/// @param decoder output, holds a sector and, for a deflated payload, the 32 KB window.
+/// @returns result.
+CoBmecOta::Result CoBmecOta::begin(const Manifest &manifest, std::unique_ptr<CoBmecOtaDecoder> &decoder) {
+  decoder.reset(new(std::nothrow) CoBmecOtaDecoder(manifest.encoding));
+  if (!decoder) {
+    return Result::NO_MEMORY;
+  }
+
+  Result result = toResult(decoder->begin(manifest.baseSize,
+                                          manifest.baseSha256));
+  if (result != Result::OK) {
+    log_e("Failed to start decoding with error %u",
+          static_cast<uint8_t>(result));
+    decoder.reset();
+    return result;
+  }
+
+  if (!Update.begin(manifest.imageSize)) {
+    log_e("Failed to start update with error: %s",
+          Update.errorString());
+    decoder.reset();
+    return Result::BEGIN_FAILED;
+  }
+  return Result::OK;
+}
+
+/// Checks the size and hash of what was written and activates it, or abandons the update.
+/// @param manifest manifest.
+/// @param decoder decoder, fed the whole payload.
+/// @param result result of the transfer.
+/// @returns OK if the image is to be booted on restart.
+CoBmecOta::Result CoBmecOta::end(const Manifest &manifest, CoBmecOtaDecoder &decoder, Result result) {
+  uint8_t sha256[CO_BMEC_OTA_SHA256_LEN];
+  if (result == Result::OK) {
+    result = toResult(decoder.end(sha256));
+  }
+
+  if (result == Result::OK && (decoder.getWritten() != manifest.imageSize || memcmp(sha256,
+                                                                                    manifest.sha256,
+                                                                                    sizeof(sha256)))) {
+    log_e("Image hash does not match the manifest.");
+    result = Result::BAD_HASH;
+  }
+
+  if (result != Result::OK) {
+    Update.abort();
+    return result;
+  }
+
+  if (!Update.end()) {
+    log_e("Update failed with error with error %s",
+          Update.errorString());
+    return Result::END_FAILED;
+  }
+  return Result::OK;
+}
+
+/// Downloads and verifies the manifest.
+/// @param url URL of the manifest.
+/// @param manifest output.
+/// @returns result.
+CoBmecOta::Result CoBmecOta::fetchManifest(const std::string &url, Manifest &manifest) {
 
-  // No CA set.
-  wifiClientSecure->setInsecure();
+  // Create the network client. Integrity comes from the signature, not the TLS.
+  WiFiClientSecure wifiClientSecure;
+  wifiClientSecure.setInsecure();
 
   // Create the https client.
   HTTPClient https;
+  https.setTimeout(CO_BMEC_OTA_TIMEOUT_MS);
 
   // Failed to connect.
-  if (!https.begin(*wifiClientSecure,
+  if (!https.begin(wifiClientSecure,
                    url.c_str())) {
     log_e("Failed to connect to: %s",
           url.c_str());
-    beforeRestart();
-    ESP.restart();
+    return Result::CONNECT_FAILED;
   }
-  // Start connection and send HTTP header.
-  int httpCode = https.GET();
 
-  // Error response.
-  if (httpCode <= 0) {
-    log_e("Failed to download file with error: %s",
+  Result result = Result::OK;
+  int httpCode = https.GET();
+  if (httpCode != HTTP_CODE_OK || https.getSize() != sizeof(manifest)) {
+    log_e("Failed to download the manifest: %s",
           https.errorToString(httpCode).c_str());
-    beforeRestart();
-    ESP.restart();
+    result = Result::MANIFEST_FAILED;
   }
-
-  // File not found.
-  if (!(httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_MOVED_PERMANENTLY)) {
-    log_e("Unexpected HTTP code: %s",
-          https.errorToString(httpCode).c_str());
-    beforeRestart();
-    ESP.restart();
+  else if (https.getStream().readBytes(reinterpret_cast<uint8_t *>(&manifest),
+                                       sizeof(manifest)) != sizeof(manifest)) {
+    log_e("Malformed manifest.");
+    result = Result::MANIFEST_FAILED;
+  }
+  else {
+    result = check(manifest);
   }
 
-  // Get the file size.
-  auto fileBytes = (size_t) https.getSize();
+  https.end();
+  return result;
+}
 
-  log_i("File found, downloading file %u bytes...",
-        fileBytes);
+/// @param manifest manifest.
+/// @returns true if the manifest is signed with the release key.
+bool CoBmecOta::verify(const Manifest &manifest) {
+  uint8_t hash[CO_BMEC_OTA_SHA256_LEN];
+  if (mbedtls_sha256_ret(reinterpret_cast<const uint8_t *>(&manifest),
+                         offsetof(Manifest, signatureLength),
+                         hash,
+                         0)) {
+    return false;
+  }
 
-  // Set the callback to log the progress.
-  Update.onProgress([](size_t progress_bytes, size_t total_bytes) {
-    log_i("Downloading... %u%%",
-          progress_bytes * 100
-              / total_bytes); // NOLINT(bugprone-lambda-function-name)
-  });
+  // The parser needs the terminating NUL of a PEM key.
+  mbedtls_pk_context key;
+  mbedtls_pk_init(&key);
+  int ret = mbedtls_pk_parse_public_key(&key,
+                                        reinterpret_cast<const uint8_t *>(CO_BMEC_OTA_PUBLIC_KEY),
+                                        sizeof(CO_BMEC_OTA_PUBLIC_KEY));
+  if (!ret) {
+    ret = mbedtls_pk_verify(&key,
+                            MBEDTLS_MD_SHA256,
+                            hash,
+                            sizeof(hash),
+                            manifest.signature,
+                            manifest.signatureLength);
+  }
+  mbedtls_pk_free(&key);
+  return ret == 0;
+}
 
-  // Start the update.
-  if (!Update.begin(fileBytes)) {
-    log_e("Failed to start update with error: %s",
-          Update.errorString());
-    beforeRestart();
-    ESP.restart();
+// DownloadConnection.
+
+/// Connects and sends the GET, with a Range header from the offset.
+/// @param offset first byte requested.
+/// @param length output, Content-Length of the response.
+/// @returns the HTTP status, 0 if the connection failed, < 0 if the request failed.
+int CoBmecOta::DownloadConnection::get(size_t offset, int &length) {
+  wifiClientSecure_.reset(new(std::nothrow) WiFiClientSecure());
+  https_.reset(new(std::nothrow) HTTPClient());
+  if (!wifiClientSecure_ || !https_) {
+    return 0;
   }
+  wifiClientSecure_->setInsecure();
+  https_->setTimeout(CO_BMEC_OTA_TIMEOUT_MS);
 
-  // Write the stream to the partition.
-  Update.writeStream(https.getStream());
+  // Failed to connect.
+  if (!https_->begin(*wifiClientSecure_,
+                     url_.c_str())) {
+    log_e("Failed to connect to: %s",
+          url_.c_str());
+    return 0;
+  }
 
-  if (!Update.end()) {
-    log_e("Update failed with error with error %s",
-          Update.errorString());
-    beforeRestart();
-    ESP.restart();
+  // Ask for the rest of the payload.
+  if (offset) {
+    char range[RANGE_HEADER_LEN];
+    snprintf(range,
+             sizeof(range),
+             "bytes=%lu-",
+             (unsigned long) offset);
+    https_->addHeader("Range",
+                      range);
   }
 
-  log_w("OTA_UPDATE update complete. Restarting to new firmware...");
-  beforeRestart();
-  ESP.restart();
+  int httpCode = https_->GET();
+  if (httpCode <= 0) {
+    log_e("Failed to download file with error: %s",
+          https_->errorToString(httpCode).c_str());
+    return -1;
+  }
+  length = https_->getSize();
+  stream_ = https_->getStreamPtr();
+  return httpCode;
 }
 
+/// @param result decoder result.
+/// @returns the matching OTA result.
+CoBmecOta::Result CoBmecOta::toResult(CoBmecOtaDecoder::Result result) {
+  switch (result) {
+    case CoBmecOtaDecoder::Result::OK:
+      return Result::OK;
+    case CoBmecOtaDecoder::Result::NO_MEMORY:
+      return Result::NO_MEMORY;
+    case CoBmecOtaDecoder::Result::BAD_BASE:
+      return Result::BAD_BASE;
+    case CoBmecOtaDecoder::Result::WRITE_FAILED:
+      return Result::WRITE_FAILED;
+    default:
+      log_e("Malformed payload.");
+      return Result::DECODE_FAILED;
+  }
+}
 
 /// @}
\ No newline at end of file
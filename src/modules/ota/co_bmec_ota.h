@@ -19,11 +19,24 @@
 //*********************************************************************
 // #includes.
 //*********************************************************************
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "Arduino.h"
+#include "co_bmec_ota_decoder.h"
+#include "co_bmec_ota_download.h"
+#include "modules/watchdog/co_bmec_watchdog.h"
 
 //*********************************************************************
 // defines.
 //*********************************************************************
-
+#define CO_BMEC_OTA_MANIFEST_SUFFIX        ".manifest"  ///< The manifest is found next to the image.
+#define CO_BMEC_OTA_MANIFEST_MAGIC         0x41544f42  ///< "BOTA".
+#define CO_BMEC_OTA_MANIFEST_VERSION       2
+#define CO_BMEC_OTA_MAX_SIGNATURE_LEN      72  ///< DER encoded ECDSA P-256 signature.
+#define CO_BMEC_OTA_TASK_STACK_SIZE        12000  ///< TLS and the signature check, freed when the task ends.
+#define CO_BMEC_OTA_TASK_PRIORITY          2  ///< Below the application loops.
+#define CO_BMEC_OTA_TASK_DEADLINE_MS       60000  ///< Longest time between watchdog beats, a TLS handshake included.
 
 //*********************************************************************
 // forward declarations.
@@ -32,12 +45,93 @@
 //*********************************************************************
 // class declarations.
 //*********************************************************************
+/// Downloads a firmware image into the OTA partition and restarts into it.
+///
+/// The image is described by a manifest, signed with the release key, which gives its size
+/// and SHA-256. The image is hashed as it is written and only activated if the hash matches.
+/// The payload downloaded may be deflated and/or a delta against the running image, see
+/// CoBmecOtaDecoder, which cuts the download size and time. A dropped connection resumes
+/// from the last received payload byte with an HTTP Range request, so that a download is
+/// not restarted from scratch.
+///
+/// start() runs the update in its own low priority task, so the application loops keep their
+/// cadence and their stacks need no room for TLS.
 class CoBmecOta {
  public:
-  static void ota(const std::string& url, const std::function<void()>& beforeRestart = [](){});
+
+  enum class Result : uint8_t {
+    OK,
+    MANIFEST_FAILED,  ///< Manifest not found or malformed.
+    BAD_SIGNATURE,
+    CONNECT_FAILED,
+    HTTP_ERROR,  ///< Unexpected status or length, e.g. a server ignoring the Range.
+    INTERRUPTED,  ///< The connection dropped, resumable.
+    BEGIN_FAILED,  ///< The image does not fit the partition.
+    WRITE_FAILED,
+    BAD_HASH,
+    END_FAILED,
+    NO_MEMORY,
+    BAD_BASE,  ///< The delta was made against another image.
+    DECODE_FAILED,
+  };
+
+  /// Signed description of an image, little endian.
+  struct __attribute__((packed)) Manifest {
+    uint32_t magic = 0;
+    uint8_t version = 0;
+    uint8_t encoding = 0;  ///< CoBmecOtaDecoder::Encoding bits.
+    uint8_t reserved[2]{};
+    uint32_t imageSize = 0;
+    uint8_t sha256[CO_BMEC_OTA_SHA256_LEN]{};  ///< Of the image.
+    uint32_t payloadSize = 0;  ///< Of the encoded download.
+    uint32_t baseSize = 0;  ///< Of the image a delta applies to.
+    uint8_t baseSha256[CO_BMEC_OTA_SHA256_LEN]{};
+    uint8_t signatureLength = 0;  ///< The signature covers the fields above.
+    uint8_t signature[CO_BMEC_OTA_MAX_SIGNATURE_LEN]{};
+  };
+
+  /// Called with the payload bytes written and the payload size.
+  using Progress = std::function<void(size_t done, size_t total)>;
+
+  /// Run by the OTA task.
+  struct Callbacks {
+    std::function<void()> beforeRestart = []() {};
+    Progress onProgress = [](size_t, size_t) {};
+    std::function<void(Result)> onFailed = [](Result) {};
+  };
+
+  static Result ota(const std::string &url,
+                    const std::function<void()> &beforeRestart = []() {},
+                    const Progress &onProgress = [](size_t, size_t) {});
+
+  static bool start(const std::string &url, BaseType_t core, const Callbacks &callbacks);
+
+  /// @returns true while an OTA task runs.
+  static bool isRunning() {
+    return running_;
+  };
+
+  static Result check(const Manifest &manifest);
+
+  static Result begin(const Manifest &manifest, std::unique_ptr<CoBmecOtaDecoder> &decoder);
+
+  static Result end(const Manifest &manifest, CoBmecOtaDecoder &decoder, Result result);
+
+  static Result toResult(CoBmecOtaDecoder::Result result);
 
  private:
 
+  static volatile bool running_;
+  static CoBmecWatchdog::Id watchdogId_;  ///< Of the OTA task, -1 when run by another task.
+
+  static Result fetchManifest(const std::string &url, Manifest &manifest);
+
+  static bool verify(const Manifest &manifest);
+
+  /// CoBmecOtaDownload interfaces over FreeRTOS, the HTTPS client and the watchdog.
+  class DownloadClock;
+  class DownloadConnection;
+  class DownloadListener;
 };
 
 /// @}
\ No newline at end of file
@@ -0,0 +1,299 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ota ota
+/// @{
+
+/// @file co_bmec_ota_decoder.cpp
+/// @brief Streaming inflate and delta patching of OTA payloads into the update partition.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include <cstring>
+#include <Update.h>
+#include <esp_ota_ops.h>
+#include "co_bmec_ota_decoder.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define COPY_OP_LEN                 9  /// Op code, offset and length.
+#define INSERT_OP_LEN               5  /// Op code and length.
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+/// @param data little endian bytes.
+/// @returns the uint32.
+static uint32_t readUint32(const uint8_t *data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) | (uint32_t(data[3]) << 24);
+}
+
+// Constructors.
+
+/// @param encoding Encoding bits of the payload.
+CoBmecOtaDecoder::CoBmecOtaDecoder(uint8_t encoding)
+    : encoding_(encoding) {
+
+  mbedtls_sha256_init(&sha_);
+}
+
+CoBmecOtaDecoder::~CoBmecOtaDecoder() {
+  mbedtls_sha256_free(&sha_);
+  free(inflator_);
+  free(window_);
+}
+
+// Public methods.
+
+/// Allocates the inflate state and checks the running image a delta applies to.
+/// @param baseSize size of the running image, for a delta.
+/// @param baseSha256 SHA-256 of the running image, for a delta.
+/// @returns result.
+CoBmecOtaDecoder::Result CoBmecOtaDecoder::begin(size_t baseSize, const uint8_t *baseSha256) {
+  (void) mbedtls_sha256_starts_ret(&sha_,
+                                   0);
+
+  if (has(Encoding::DEFLATE)) {
+    inflator_ = static_cast<tinfl_decompressor *>(malloc(sizeof(tinfl_decompressor)));
+    window_ = static_cast<uint8_t *>(malloc(TINFL_LZ_DICT_SIZE));
+    if (!inflator_ || !window_) {
+      return Result::NO_MEMORY;
+    }
+    tinfl_init(inflator_);
+  }
+
+  if (has(Encoding::DELTA)) {
+    base_ = esp_ota_get_running_partition();
+    baseSize_ = baseSize;
+    if (!base_ || baseSize_ > base_->size) {
+      return Result::BAD_BASE;
+    }
+
+    // Hash the running image, a sector at a time.
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    (void) mbedtls_sha256_starts_ret(&sha,
+                                     0);
+    for (size_t offset = 0; offset < baseSize_; offset += sizeof(sector_)) {
+      size_t length = std::min(sizeof(sector_),
+                               baseSize_ - offset);
+      if (esp_partition_read(base_,
+                             offset,
+                             sector_,
+                             length) != ESP_OK) {
+        mbedtls_sha256_free(&sha);
+        return Result::BAD_BASE;
+      }
+      (void) mbedtls_sha256_update_ret(&sha,
+                                       sector_,
+                                       length);
+    }
+    uint8_t sha256[CO_BMEC_OTA_SHA256_LEN];
+    (void) mbedtls_sha256_finish_ret(&sha,
+                                     sha256);
+    mbedtls_sha256_free(&sha);
+
+    if (memcmp(sha256,
+               baseSha256,
+               sizeof(sha256))) {
+      return Result::BAD_BASE;
+    }
+  }
+  return Result::OK;
+}
+
+/// Decodes a chunk of the payload.
+/// @param data chunk.
+/// @param length length of the chunk.
+/// @returns result.
+CoBmecOtaDecoder::Result CoBmecOtaDecoder::write(const uint8_t *data, size_t length) {
+  return has(Encoding::DEFLATE) ? inflate(data,
+                                          length) : patch(data,
+                                                          length);
+}
+
+/// Writes the last sector.
+/// @param sha256 output, SHA-256 of the written image.
+/// @returns MALFORMED if the payload ended early.
+CoBmecOtaDecoder::Result CoBmecOtaDecoder::end(uint8_t *sha256) {
+  if ((has(Encoding::DEFLATE) && !inflated_) || opFill_ || insertRemaining_) {
+    return Result::MALFORMED;
+  }
+
+  Result result = flush();
+  (void) mbedtls_sha256_finish_ret(&sha_,
+                                   sha256);
+  return result;
+}
+
+// Private methods.
+
+/// Inflates a chunk of the zlib stream through the window.
+CoBmecOtaDecoder::Result CoBmecOtaDecoder::inflate(const uint8_t *data, size_t length) {
+  tinfl_status status;
+  do {
+    if (inflated_) {
+      // Trailing bytes after the end of the stream.
+      return length ? Result::MALFORMED : Result::OK;
+    }
+
+    size_t inLength = length;
+    size_t outLength = TINFL_LZ_DICT_SIZE - windowOffset_;
+    status = tinfl_decompress(inflator_,
+                              data,
+                              &inLength,
+                              window_,
+                              window_ + windowOffset_,
+                              &outLength,
+                              TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+    data += inLength;
+    length -= inLength;
+
+    if (status < TINFL_STATUS_DONE) {
+      return Result::MALFORMED;
+    }
+    inflated_ = status == TINFL_STATUS_DONE;
+
+    if (outLength) {
+      Result result = patch(window_ + windowOffset_,
+                            outLength);
+      if (result != Result::OK) {
+        return result;
+      }
+      windowOffset_ = (windowOffset_ + outLength) & (TINFL_LZ_DICT_SIZE - 1);
+    }
+  } while (length || status == TINFL_STATUS_HAS_MORE_OUTPUT);
+
+  return Result::OK;
+}
+
+/// Applies a chunk of delta ops, or passes the image through.
+CoBmecOtaDecoder::Result CoBmecOtaDecoder::patch(const uint8_t *data, size_t length) {
+  if (!has(Encoding::DELTA)) {
+    return emit(data,
+                length);
+  }
+
+  while (length) {
+    // Inserted bytes.
+    if (insertRemaining_) {
+      size_t chunk = std::min(size_t(insertRemaining_),
+                              length);
+      Result result = emit(data,
+                           chunk);
+      if (result != Result::OK) {
+        return result;
+      }
+      data += chunk;
+      length -= chunk;
+      insertRemaining_ -= chunk;
+      continue;
+    }
+
+    // Op header, possibly split between chunks.
+    op_[opFill_++] = *data++;
+    length--;
+    auto opCode = static_cast<OpCode>(op_[0]);
+    size_t opLength = opCode == OpCode::COPY ? COPY_OP_LEN : INSERT_OP_LEN;
+    if (opCode != OpCode::COPY && opCode != OpCode::INSERT) {
+      return Result::MALFORMED;
+    }
+    if (opFill_ < opLength) {
+      continue;
+    }
+    opFill_ = 0;
+
+    if (opCode == OpCode::INSERT) {
+      insertRemaining_ = readUint32(&op_[1]);
+    }
+    else {
+      Result result = copy(readUint32(&op_[1]),
+                           readUint32(&op_[5]));
+      if (result != Result::OK) {
+        return result;
+      }
+    }
+  }
+  return Result::OK;
+}
+
+/// Copies bytes of the running image, straight into the sector buffer.
+CoBmecOtaDecoder::Result CoBmecOtaDecoder::copy(uint32_t offset, uint32_t length) {
+  if (offset > baseSize_ || length > baseSize_ - offset) {
+    return Result::MALFORMED;
+  }
+
+  while (length) {
+    size_t chunk = std::min(size_t(length),
+                            sizeof(sector_) - sectorFill_);
+    if (esp_partition_read(base_,
+                           offset,
+                           &sector_[sectorFill_],
+                           chunk) != ESP_OK) {
+      return Result::BAD_BASE;
+    }
+    sectorFill_ += chunk;
+    offset += chunk;
+    length -= chunk;
+
+    if (sectorFill_ == sizeof(sector_)) {
+      Result result = flush();
+      if (result != Result::OK) {
+        return result;
+      }
+    }
+  }
+  return Result::OK;
+}
+
+/// Appends image bytes to the sector buffer.
+CoBmecOtaDecoder::Result CoBmecOtaDecoder::emit(const uint8_t *data, size_t length) {
+  while (length) {
+    size_t chunk = std::min(length,
+                            sizeof(sector_) - sectorFill_);
+    memcpy(&sector_[sectorFill_],
+           data,
+           chunk);
+    sectorFill_ += chunk;
+    data += chunk;
+    length -= chunk;
+
+    if (sectorFill_ == sizeof(sector_)) {
+      Result result = flush();
+      if (result != Result::OK) {
+        return result;
+      }
+    }
+  }
+  return Result::OK;
+}
+
+/// Writes the sector buffer to the partition and adds it to the hash.
+CoBmecOtaDecoder::Result CoBmecOtaDecoder::flush() {
+  if (!sectorFill_) {
+    return Result::OK;
+  }
+
+  (void) mbedtls_sha256_update_ret(&sha_,
+                                   sector_,
+                                   sectorFill_);
+  if (Update.write(sector_,
+                   sectorFill_) != sectorFill_) {
+    log_e("Failed to write the update with error: %s",
+          Update.errorString());
+    return Result::WRITE_FAILED;
+  }
+  written_ += sectorFill_;
+  sectorFill_ = 0;
+  return Result::OK;
+}
+
+/// @}
@@ -0,0 +1,123 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ota ota
+/// @{
+
+/// @file co_bmec_ota_decoder.h
+/// @brief Streaming inflate and delta patching of OTA payloads into the update partition.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include <cstdint>
+#include <esp_partition.h>
+#include <esp32/rom/miniz.h>
+#include <mbedtls/sha256.h>
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_OTA_SHA256_LEN             32
+#define CO_BMEC_OTA_BUFFER_SIZE            4096  ///< One flash sector per write.
+#define CO_BMEC_OTA_DELTA_OP_MAX           9  ///< Longest delta op header.
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Turns a payload, fed in arbitrary chunks, into the image written to the update partition.
+///
+/// A DEFLATE payload is a zlib stream, inflated with the ROM miniz into a 32 KB window.
+/// A DELTA payload is a sequence of ops that rebuild the image from the running one:
+/// - COPY: [0][offset (uint32 LE)][length (uint32 LE)], bytes of the running image.
+/// - INSERT: [1][length (uint32 LE)][bytes].
+/// Both may be combined, the ops are then deflated. RAM is bounded by the window and
+/// the sector buffer whatever the image size. The written image is hashed as it is written.
+class CoBmecOtaDecoder {
+ public:
+
+  /// Payload encoding bits.
+  enum class Encoding : uint8_t {
+    RAW = 0,
+    DEFLATE = 1 << 0,
+    DELTA = 1 << 1,
+  };
+
+  enum class Result : uint8_t {
+    OK,
+    NO_MEMORY,
+    MALFORMED,  ///< Corrupt zlib stream or delta op.
+    BAD_BASE,  ///< The running image is not the one the delta was made against.
+    WRITE_FAILED,
+  };
+
+  explicit CoBmecOtaDecoder(uint8_t encoding);
+
+  ~CoBmecOtaDecoder();
+
+  Result begin(size_t baseSize, const uint8_t *baseSha256);
+
+  Result write(const uint8_t *data, size_t length);
+
+  Result end(uint8_t *sha256);
+
+  /// @returns the bytes written to the update partition.
+  size_t getWritten() const {
+    return written_;
+  };
+
+ private:
+
+  enum class OpCode : uint8_t {
+    COPY,
+    INSERT,
+  };
+
+  uint8_t encoding_;
+
+  /// Inflate.
+  tinfl_decompressor *inflator_ = nullptr;
+  uint8_t *window_ = nullptr;  ///< TINFL_LZ_DICT_SIZE bytes, wrapping.
+  size_t windowOffset_ = 0;
+  bool inflated_ = false;  ///< The end of the zlib stream was reached.
+
+  /// Patch.
+  const esp_partition_t *base_ = nullptr;
+  size_t baseSize_ = 0;
+  uint8_t op_[CO_BMEC_OTA_DELTA_OP_MAX]{};  ///< Op header being received.
+  size_t opFill_ = 0;
+  uint32_t insertRemaining_ = 0;  ///< Bytes of the INSERT being received.
+
+  /// Output.
+  alignas(4) uint8_t sector_[CO_BMEC_OTA_BUFFER_SIZE]{};
+  size_t sectorFill_ = 0;
+  size_t written_ = 0;
+  mbedtls_sha256_context sha_{};
+
+  bool has(Encoding encoding) const {
+    return encoding_ & static_cast<uint8_t>(encoding);
+  };
+
+  Result inflate(const uint8_t *data, size_t length);
+
+  Result patch(const uint8_t *data, size_t length);
+
+  Result copy(uint32_t offset, uint32_t length);
+
+  Result emit(const uint8_t *data, size_t length);
+
+  Result flush();
+};
+
+/// @}
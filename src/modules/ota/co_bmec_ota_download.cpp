@@ -0,0 +1,164 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ota ota
+/// @{
+
+/// @file co_bmec_ota_download.cpp
+/// @brief Platform independent resumable download of an OTA payload.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include "co_bmec_ota_download.h"
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <cstdio>
+#define log_e(format, ...) printf("E " format "\n", ##__VA_ARGS__)
+#endif
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+uint8_t CoBmecOtaDownload::input_[CO_BMEC_OTA_INPUT_SIZE];
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Constructors.
+
+/// @param clock time source.
+/// @param connection HTTP client.
+/// @param listener progress outputs.
+/// @param timeoutMs time without data after which the download is resumed.
+/// @param retryMs backoff per consecutive retry.
+CoBmecOtaDownload::CoBmecOtaDownload(Clock &clock,
+                                     Connection &connection,
+                                     Listener &listener,
+                                     uint32_t timeoutMs,
+                                     uint32_t retryMs)
+    : clock_(clock),
+      connection_(connection),
+      listener_(listener),
+      timeoutMs_(timeoutMs),
+      retryMs_(retryMs) {}
+
+// Public methods.
+
+/// Downloads the payload, resuming from the last received byte while the attempts make progress.
+/// The decoder state is kept across resumes.
+/// @param decoder decoder, fed.
+/// @param size size of the payload.
+/// @returns OK once the whole payload is decoded.
+CoBmecOtaDownload::Result CoBmecOtaDownload::run(CoBmecOtaDecoder &decoder, size_t size) {
+  Result result = Result::OK;
+  uint8_t retries = 0;
+  offset_ = 0;
+  while (offset_ < size) {
+    size_t startOffset = offset_;
+    result = download(decoder,
+                      size);
+    if (result == Result::OK || result == Result::HTTP_ERROR || result == Result::DECODE_FAILED) {
+      break;
+    }
+
+    // Only retry while the downloads make progress.
+    retries = offset_ > startOffset ? 1 : retries + 1;
+    if (retries > CO_BMEC_OTA_MAX_RETRIES) {
+      break;
+    }
+    listener_.onRetry(retries,
+                      offset_,
+                      retries * retryMs_);
+    clock_.delay(retries * retryMs_);
+  }
+  return result;
+}
+
+// Private methods.
+
+/// Downloads the rest of the payload from the offset, until done or the connection drops.
+/// @param decoder decoder, fed.
+/// @param size size of the payload.
+/// @returns OK once the whole payload is decoded.
+CoBmecOtaDownload::Result CoBmecOtaDownload::download(CoBmecOtaDecoder &decoder, size_t size) {
+
+  // Ask for the rest of the payload.
+  listener_.onConnect(offset_);
+  int length = -1;
+  int httpCode = connection_.get(offset_,
+                                 length);
+
+  // Failed to connect.
+  if (httpCode == 0) {
+    connection_.end();
+    return Result::CONNECT_FAILED;
+  }
+
+  // Error response.
+  if (httpCode < 0) {
+    connection_.end();
+    return Result::INTERRUPTED;
+  }
+
+  // A server ignoring the range would send the payload from the start.
+  if (httpCode != (offset_ ? CO_BMEC_OTA_HTTP_PARTIAL_CONTENT : CO_BMEC_OTA_HTTP_OK)
+      || length < 0 || size_t(length) != size - offset_) {
+    log_e("Unexpected HTTP code %d, %d bytes",
+          httpCode,
+          length);
+    connection_.end();
+    return Result::HTTP_ERROR;
+  }
+
+  // Decode as received, the decoder writes whole sectors.
+  Result result = Result::INTERRUPTED;
+  uint32_t dataTMs = clock_.millis();
+  while (offset_ < size) {
+    listener_.onPoll();
+    size_t available = connection_.available();
+    if (!available) {
+      if (!connection_.connected() || clock_.millis() - dataTMs >= timeoutMs_) {
+        break;
+      }
+      clock_.delay(1);
+      continue;
+    }
+
+    int read = connection_.read(input_,
+                                std::min({available,
+                                          sizeof(input_),
+                                          size - offset_}));
+    if (read <= 0) {
+      continue;
+    }
+    dataTMs = clock_.millis();
+
+    decoderResult_ = decoder.write(input_,
+                                   read);
+    if (decoderResult_ != CoBmecOtaDecoder::Result::OK) {
+      connection_.end();
+      return Result::DECODE_FAILED;
+    }
+    offset_ += read;
+    listener_.onProgress(offset_,
+                         size);
+  }
+
+  if (offset_ == size) {
+    result = Result::OK;
+  }
+
+  connection_.end();
+  return result;
+}
+
+/// @}
@@ -0,0 +1,145 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ota ota
+/// @{
+
+/// @file co_bmec_ota_download.h
+/// @brief Platform independent resumable download of an OTA payload.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include <cstdint>
+#include "co_bmec_ota_decoder.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_OTA_INPUT_SIZE             1024  ///< Network read size, the decoder buffers the sectors.
+#define CO_BMEC_OTA_TIMEOUT_MS             10000  ///< Time without data after which a download is resumed.
+#define CO_BMEC_OTA_MAX_RETRIES            5  ///< Consecutive resumes without progress.
+#define CO_BMEC_OTA_RETRY_MS               2000  ///< Backoff per consecutive retry.
+
+#define CO_BMEC_OTA_HTTP_OK                200
+#define CO_BMEC_OTA_HTTP_PARTIAL_CONTENT   206
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Downloads a payload into a decoder, resuming from the last received byte with an HTTP
+/// Range request when the connection drops or stalls.
+/// The network, time and progress are reached through the Connection, Clock and Listener
+/// interfaces so that the resume and retry logic builds on the host against a local server.
+class CoBmecOtaDownload {
+ public:
+
+  enum class Result : uint8_t {
+    OK,
+    CONNECT_FAILED,
+    HTTP_ERROR,  ///< Unexpected status or length, e.g. a server ignoring the Range. Not retried.
+    INTERRUPTED,  ///< The connection dropped or stalled, resumable.
+    DECODE_FAILED,  ///< The decoder failed, see getDecoderResult(). Not retried.
+  };
+
+  /// Time source.
+  class Clock {
+   public:
+    virtual ~Clock() = default;
+
+    /// @returns milliseconds since start.
+    virtual uint32_t millis() = 0;
+
+    /// Blocks the calling task.
+    virtual void delay(uint32_t ms) = 0;
+  };
+
+  /// One HTTP GET of the payload at a time.
+  class Connection {
+   public:
+    virtual ~Connection() = default;
+
+    /// Connects and sends the request.
+    /// @param offset first byte requested, asked with a Range header when not 0.
+    /// @param length output, Content-Length of the response, -1 if unknown.
+    /// @returns the HTTP status, 0 if the connection failed, < 0 if the request failed.
+    virtual int get(size_t offset, int &length) = 0;
+
+    /// @returns the body bytes that can be read without blocking.
+    virtual size_t available() = 0;
+
+    /// @returns the bytes read, <= 0 if none.
+    virtual int read(uint8_t *data, size_t length) = 0;
+
+    /// @returns false once the server closed the connection.
+    virtual bool connected() = 0;
+
+    /// Closes the connection.
+    virtual void end() = 0;
+  };
+
+  /// Progress outputs, run on the downloading task.
+  class Listener {
+   public:
+    virtual ~Listener() = default;
+
+    /// Called before each request.
+    virtual void onConnect(size_t offset) = 0;
+
+    /// Called on each pass of the receive loop, e.g. to feed the watchdog.
+    virtual void onPoll() = 0;
+
+    /// Called with the payload bytes decoded and the payload size.
+    virtual void onProgress(size_t done, size_t total) = 0;
+
+    /// Called before waiting to resume.
+    virtual void onRetry(uint8_t retries, size_t offset, uint32_t delayMs) = 0;
+  };
+
+  CoBmecOtaDownload(Clock &clock,
+                    Connection &connection,
+                    Listener &listener,
+                    uint32_t timeoutMs = CO_BMEC_OTA_TIMEOUT_MS,
+                    uint32_t retryMs = CO_BMEC_OTA_RETRY_MS);
+
+  Result run(CoBmecOtaDecoder &decoder, size_t size);
+
+  /// @returns the bytes of the payload decoded.
+  size_t getOffset() const {
+    return offset_;
+  };
+
+  /// @returns the failure of the decoder, after DECODE_FAILED.
+  CoBmecOtaDecoder::Result getDecoderResult() const {
+    return decoderResult_;
+  };
+
+ private:
+
+  Clock &clock_;
+  Connection &connection_;
+  Listener &listener_;
+  uint32_t timeoutMs_;
+  uint32_t retryMs_;
+
+  size_t offset_ = 0;
+  CoBmecOtaDecoder::Result decoderResult_ = CoBmecOtaDecoder::Result::OK;
+
+  /// Payload data being received, off the task stack. One download runs at a time.
+  static uint8_t input_[CO_BMEC_OTA_INPUT_SIZE];
+
+  Result download(CoBmecOtaDecoder &decoder, size_t size);
+};
+
+/// @}
@@ -0,0 +1,28 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup ota ota
+/// @{
+
+/// @file co_bmec_ota_key.h
+/// @brief Public key that OTA manifests are verified with.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+/// ECDSA P-256 public key that manifests are signed for, PEM. Replace it with the public key
+/// of the release signing key, whose private key is kept off the repository. Manifests are
+/// signed with tools/ota_manifest.py.
+#define CO_BMEC_OTA_PUBLIC_KEY \
+  "-----BEGIN PUBLIC KEY-----\n" \
+  "MFkwEwYHKoZIzj0CAQYIKoZIzj0DAQcDQgAEQ8rpKTLBnP8GUzDZNBPaRMA0Fr8D\n" \
+  "aacMvgUw9ybq5RvRKYoQqxPYNcvC5fjwEb0uQnxmhAMnlkmIrEGJ1PMEfA==\n" \
+  "-----END PUBLIC KEY-----\n"
+
+/// @}
@@ -0,0 +1,212 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup time_sync time_sync
+/// @{
+
+/// @file co_bmec_time_sync.cpp
+/// @brief Schedules the NTP polls and keeps the radio awake around them.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include <esp_sntp.h>
+#include "co_bmec_time_sync.h"
+#include "modules/memory/co_bmec_memory_monitor.h"
+#include "modules/metrics/co_bmec_metrics.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define SNTP_FALLBACK_INTERVAL_MS    (4 * CO_BMEC_TIME_SYNC_POLL_INTERVAL_MS)  /// The SNTP timer only polls if the schedule stalls.
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+volatile uint32_t CoBmecTimeSync::syncCount_ = 0;
+
+static CoBmecMetrics::Counter pollsMetric("ntp_polls_total",
+                                          "NTP requests sent.");
+static CoBmecMetrics::Counter pollTimeoutsMetric("ntp_poll_timeouts_total",
+                                                 "NTP polls without a sync.");
+static CoBmecMetrics::Gauge offsetMetric("ntp_offset_seconds",
+                                         "Correction of the last sync of a valid clock, positive if it was behind.",
+                                         1000);
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Constructors.
+
+/// @param coBmecWifi wifi module that keeps the radio awake.
+/// @param server NTP server.
+CoBmecTimeSync::CoBmecTimeSync(
+    CoBmecWifi *coBmecWifi,
+    const char *server)
+    : coBmecWifi_(coBmecWifi),
+      server_(server) {}
+
+// Public methods.
+
+/// Polls are only sent while the internet is reachable. Run inline on the wifi task.
+/// @param event AP state.
+void CoBmecTimeSync::onEvent(const CoBmecWifi::ApStateEvent &event) {
+  switch (event.apState) {
+    case CoBmecWifi::ApState::PINGED:online_ = true;
+      break;
+    case CoBmecWifi::ApState::PINGING:
+    case CoBmecWifi::ApState::CONNECTED:break;
+    default:online_ = false;
+      break;
+  }
+}
+
+/// Runs the poll schedule. Called periodically from a single task.
+void CoBmecTimeSync::loop() {
+  uint32_t nowMs = millis();
+
+  switch (state_) {
+    case State::IDLE: {
+      // Wake the radio ahead of the poll.
+      if (online_ && int32_t(nowMs + CO_BMEC_TIME_SYNC_WAKE_LEAD_MS - nextPollTMs_) >= 0) {
+        coBmecWifi_->requestAwake(CoBmecWifi::AwakeReason::NTP);
+        state_ = State::WAKING;
+        stateTMs_ = nowMs;
+      }
+    }
+      break;
+    case State::WAKING: {
+      if (!online_) {
+        coBmecWifi_->releaseAwake(CoBmecWifi::AwakeReason::NTP);
+        state_ = State::IDLE;
+      }
+      else if (nowMs - stateTMs_ >= CO_BMEC_TIME_SYNC_WAKE_LEAD_MS) {
+        poll();
+        state_ = State::POLLING;
+        stateTMs_ = nowMs;
+      }
+    }
+      break;
+    case State::POLLING: {
+      if (syncCount_ != pollSyncCount_) {
+        endPoll(true);
+      }
+      else if (!online_) {
+        // Not a miss, the connection dropped. Poll again once back online.
+        coBmecWifi_->releaseAwake(CoBmecWifi::AwakeReason::NTP);
+        nextPollTMs_ = nowMs;
+        state_ = State::IDLE;
+      }
+      else if (nowMs - stateTMs_ >= CO_BMEC_TIME_SYNC_TIMEOUT_MS) {
+        endPoll(false);
+      }
+    }
+      break;
+  }
+}
+
+/// The system time survives a software restart, e.g. into a new image, so the clock can be
+/// valid before the first sync.
+/// @returns true if the time has been synced, or restored from the RTC.
+bool CoBmecTimeSync::isValid() {
+  return isSynced() || time(nullptr) >= CO_BMEC_TIME_SYNC_VALID_EPOCH;
+}
+
+/// Sets the time zone of the local time. Not thread safe, call it from the task that
+/// reads the local time.
+/// @param gmtOffsetSec offset east of UTC.
+void CoBmecTimeSync::setTimeZone(long gmtOffsetSec) {
+  // POSIX offsets are west of UTC.
+  long offsetSec = labs(gmtOffsetSec);
+  char tz[CO_BMEC_TIME_SYNC_TZ_LEN];
+  snprintf(tz,
+           sizeof(tz),
+           "UTC%c%ld:%02ld:%02ld",
+           gmtOffsetSec > 0 ? '-' : '+',
+           offsetSec / 3600,
+           offsetSec % 3600 / 60,
+           offsetSec % 60);
+  setenv("TZ",
+         tz,
+         1);
+  tzset();
+}
+
+// Private methods.
+
+/// Sends an NTP request.
+void CoBmecTimeSync::poll() {
+  pollSyncCount_ = syncCount_;
+  CoBmecMemoryMonitor::setPhase(CoBmecMemoryMonitor::Phase::NTP,
+                                true);
+
+  if (!configured_) {
+    // Starting SNTP sends the first request. Unlike configTime() this leaves the time zone alone.
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0,
+                       server_);
+    sntp_init();
+    sntp_set_sync_interval(SNTP_FALLBACK_INTERVAL_MS);
+    configured_ = true;
+  }
+  else {
+    sntp_restart();
+  }
+
+  pollsMetric.add();
+  log_i("NTP poll sent.");
+}
+
+/// Records the poll, lets the radio sleep and schedules the next poll.
+/// @param synced true if the time was synced.
+void CoBmecTimeSync::endPoll(bool synced) {
+  if (synced) {
+    log_i("NTP time synced.");
+  }
+  else {
+    pollTimeoutsMetric.add();
+    log_w("NTP poll timed out. Retrying in %lu ms",
+          (unsigned long) CO_BMEC_TIME_SYNC_RETRY_MS);
+  }
+
+  CoBmecMemoryMonitor::setPhase(CoBmecMemoryMonitor::Phase::NTP,
+                                false);
+  coBmecWifi_->recordNtpPoll(synced);
+  coBmecWifi_->releaseAwake(CoBmecWifi::AwakeReason::NTP);
+
+  nextPollTMs_ = millis() + (synced ? CO_BMEC_TIME_SYNC_POLL_INTERVAL_MS : CO_BMEC_TIME_SYNC_RETRY_MS);
+  state_ = State::IDLE;
+}
+
+/// Sets the time received by SNTP, measuring the correction first. Called from the lwip task.
+/// @param tv time received.
+void CoBmecTimeSync::syncTime(struct timeval *tv) {
+  if (isValid()) {
+    struct timeval now{};
+    gettimeofday(&now,
+                 nullptr);
+    int64_t offsetMs = (int64_t(tv->tv_sec) - now.tv_sec) * 1000 + (tv->tv_usec - now.tv_usec) / 1000;
+    offsetMetric.set(int32_t(std::max(std::min(offsetMs,
+                                               int64_t(INT32_MAX)),
+                                      int64_t(INT32_MIN))));
+  }
+
+  settimeofday(tv,
+               nullptr);
+  sntp_set_sync_status(SNTP_SYNC_STATUS_COMPLETED);
+  syncCount_ = syncCount_ + 1;
+}
+
+/// Replaces the weak ESP-IDF implementation, which sets the time before the notification
+/// callback could measure the correction.
+extern "C" void sntp_sync_time(struct timeval *tv) {
+  CoBmecTimeSync::syncTime(tv);
+}
+
+/// @}
@@ -0,0 +1,91 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @defgroup time_sync time_sync
+/// @brief Time sync module.
+/// @{
+
+/// @file co_bmec_time_sync.h
+/// @brief Schedules the NTP polls and keeps the radio awake around them.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <modules/wifi/co_bmec_wifi.h>
+#include <modules/bus/co_bmec_bus.h>
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_TIME_SYNC_POLL_INTERVAL_MS    3600000  ///< Time between successful polls, the SNTP default.
+#define CO_BMEC_TIME_SYNC_RETRY_MS            60000  ///< Time to the next poll after a miss.
+#define CO_BMEC_TIME_SYNC_WAKE_LEAD_MS        1000  ///< Radio awake time before a poll is sent.
+#define CO_BMEC_TIME_SYNC_TIMEOUT_MS          10000  ///< Time after which a poll counts as missed.
+#define CO_BMEC_TIME_SYNC_TZ_LEN              20  ///< "UTC+hh:mm:ss".
+#define CO_BMEC_TIME_SYNC_VALID_EPOCH         1609459200  ///< 2021-01-01, earlier times were never synced.
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Polls NTP on its own schedule rather than the SNTP timer, so that the radio is
+/// only held fully awake for the poll and may modem sleep the rest of the time.
+///
+/// The time is synced in UTC. The time zone is left to the task that reads the local time.
+class CoBmecTimeSync : public CoBmecBusSubscriber<CoBmecWifi::ApStateEvent> {
+ public:
+
+  CoBmecTimeSync(CoBmecWifi *coBmecWifi, const char *server);
+
+  void onEvent(const CoBmecWifi::ApStateEvent &event) override;
+
+  void loop();
+
+  /// @returns true once the time has been synced.
+  static bool isSynced() {
+    return syncCount_ > 0;
+  };
+
+  static bool isValid();
+
+  static void setTimeZone(long gmtOffsetSec);
+
+  static void syncTime(struct timeval *tv);
+
+ private:
+
+  enum class State {
+    IDLE,  ///< Waiting for the next poll.
+    WAKING,  ///< Radio held awake before the poll.
+    POLLING,  ///< Waiting for the time sync.
+  };
+
+  CoBmecWifi *coBmecWifi_;
+  const char *server_;
+
+  volatile bool online_ = false;  ///< Set by the wifi task.
+  CoBmecBusSubscription<CoBmecWifi::ApStateEvent> apStateSubscription_{*this, CoBmecBusDelivery::INLINE};
+  bool configured_ = false;  ///< SNTP has been started.
+
+  State state_ = State::IDLE;
+  uint32_t stateTMs_ = 0;
+  uint32_t nextPollTMs_ = 0;
+  uint32_t pollSyncCount_ = 0;  ///< syncCount_ when the poll was sent.
+
+  static volatile uint32_t syncCount_;
+
+  void poll();
+
+  void endPoll(bool synced);
+};
+
+/// @}
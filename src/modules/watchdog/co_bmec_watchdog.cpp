@@ -0,0 +1,180 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup watchdog watchdog
+/// @{
+
+/// @file co_bmec_watchdog.cpp
+/// @brief Per task software watchdog and stall detector.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <esp_task_wdt.h>
+#include <esp_attr.h>
+#include "co_bmec_watchdog.h"
+#include "modules/memory/co_bmec_boot_arena.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define STALL_REPORT_MAGIC          0x57444f47  /// "WDOG".
+#define STALL_LOG_DRAIN_MS          100  /// Time for the report to reach the serial before restarting.
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+CoBmecWatchdog::Entry CoBmecWatchdog::entries_[CO_BMEC_WATCHDOG_MAX_TASKS];
+portMUX_TYPE CoBmecWatchdog::mux_ = portMUX_INITIALIZER_UNLOCKED;
+
+RTC_NOINIT_ATTR CoBmecWatchdog::StallReport CoBmecWatchdog::stallReport_;
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+/// Reports the stall that caused the last restart, and starts the supervisor.
+/// @param core core to run the supervisor on.
+/// @param priority priority of the supervisor, above the supervised tasks.
+void CoBmecWatchdog::begin(int core, int priority) {
+  logLastStall();
+
+  // Panic if the supervisor itself stops, the supervised tasks have their own deadlines.
+  (void) esp_task_wdt_init(CO_BMEC_WATCHDOG_HW_TIMEOUT_S,
+                           true);
+  (void) esp_task_wdt_delete(xTaskGetIdleTaskHandleForCPU(0));
+  (void) esp_task_wdt_delete(xTaskGetIdleTaskHandleForCPU(1));
+
+  (void) CoBmecBootArena::createTask(task, // Function to implement the task
+                                     "watchdog", // Name of the task
+                                     CO_BMEC_WATCHDOG_TASK_STACK_SIZE,  // Stack size in words
+                                     nullptr,  // Task input parameter
+                                     priority,  // Priority of the task
+                                     core); // Core where the task should run
+}
+
+/// Registers the calling task.
+/// @param name task name, a string literal.
+/// @param deadlineMs longest time between beats.
+/// @returns the id to beat with, -1 if every entry is taken.
+CoBmecWatchdog::Id CoBmecWatchdog::add(const char *name, uint32_t deadlineMs) {
+  Id id = -1;
+  portENTER_CRITICAL(&mux_);
+  for (Id i = 0; i < CO_BMEC_WATCHDOG_MAX_TASKS; i++) {
+    Entry &entry = entries_[i];
+    if (!entry.name) {
+      entry.deadlineMs = deadlineMs;
+      entry.beatTMs = millis();
+      entry.event = "added";
+      entry.value = 0;
+      entry.eventTMs = entry.beatTMs;
+      entry.name = name;
+      id = i;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&mux_);
+
+  if (id < 0) {
+    log_e("No watchdog entry left for %s.",
+          name);
+  }
+  return id;
+}
+
+/// Unregisters a task, e.g. before it deletes itself.
+/// @param id registered task, ignored if -1.
+void CoBmecWatchdog::remove(Id id) {
+  if (id < 0) {
+    return;
+  }
+  portENTER_CRITICAL(&mux_);
+  entries_[id].name = nullptr;
+  portEXIT_CRITICAL(&mux_);
+}
+
+// Private methods.
+
+/// Method run by the FreeRTOS task.
+void CoBmecWatchdog::task(void *) {
+  (void) esp_task_wdt_add(nullptr);
+
+  for (;;) {
+    vTaskDelay(CO_BMEC_WATCHDOG_CHECK_MS / portTICK_PERIOD_MS);
+    check();
+    (void) esp_task_wdt_reset();
+  }
+}
+
+/// Checks every deadline.
+void CoBmecWatchdog::check() {
+  uint32_t nowMs = millis();
+  for (const Entry &entry : entries_) {
+    if (!entry.name) {
+      continue;
+    }
+
+    // A beat after nowMs was read counts as on time.
+    auto stallMs = int32_t(nowMs - entry.beatTMs);
+    if (stallMs > int32_t(entry.deadlineMs)) {
+      onStall(entry,
+              stallMs,
+              nowMs);
+    }
+  }
+}
+
+/// Reports the stall and restarts.
+/// @param entry stalled task.
+/// @param stallMs time since its last beat.
+/// @param nowMs time of the check.
+void CoBmecWatchdog::onStall(const Entry &entry, uint32_t stallMs, uint32_t nowMs) {
+  const char *event = entry.event;
+  uint32_t eventAgoMs = nowMs - entry.eventTMs;
+
+  log_e("Task %s stalled for %lu ms, deadline %lu ms. Last event %s (%lu) %lu ms ago. Restarting.",
+        entry.name,
+        (unsigned long) stallMs,
+        (unsigned long) entry.deadlineMs,
+        event,
+        (unsigned long) entry.value,
+        (unsigned long) eventAgoMs);
+
+  stallReport_.magic = STALL_REPORT_MAGIC;
+  strlcpy(stallReport_.name,
+          entry.name,
+          sizeof(stallReport_.name));
+  strlcpy(stallReport_.event,
+          event,
+          sizeof(stallReport_.event));
+  stallReport_.value = entry.value;
+  stallReport_.stallMs = stallMs;
+  stallReport_.eventAgoMs = eventAgoMs;
+
+  vTaskDelay(STALL_LOG_DRAIN_MS / portTICK_PERIOD_MS);
+  esp_restart();
+}
+
+/// Logs the stall kept in RTC memory by the last restart, if any.
+void CoBmecWatchdog::logLastStall() {
+  if (stallReport_.magic != STALL_REPORT_MAGIC) {
+    return;
+  }
+
+  // The strings may be anything after a power cycle with the magic by chance.
+  stallReport_.name[sizeof(stallReport_.name) - 1] = '\0';
+  stallReport_.event[sizeof(stallReport_.event) - 1] = '\0';
+  log_e("Restarted by the watchdog: task %s stalled for %lu ms, last event %s (%lu) %lu ms before.",
+        stallReport_.name,
+        (unsigned long) stallReport_.stallMs,
+        stallReport_.event,
+        (unsigned long) stallReport_.value,
+        (unsigned long) stallReport_.eventAgoMs);
+  stallReport_.magic = 0;
+}
+
+/// @}
@@ -0,0 +1,115 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @defgroup watchdog watchdog
+/// @brief Per task software watchdog.
+/// @{
+
+/// @file co_bmec_watchdog.h
+/// @brief Per task software watchdog and stall detector.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "Arduino.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_WATCHDOG_MAX_TASKS         8
+#define CO_BMEC_WATCHDOG_CHECK_MS          500  ///< Period of the deadline checks.
+#define CO_BMEC_WATCHDOG_HW_TIMEOUT_S      5  ///< Task watchdog timeout of the supervisor itself.
+#define CO_BMEC_WATCHDOG_TASK_STACK_SIZE   2500
+#define CO_BMEC_WATCHDOG_NAME_LEN          16
+#define CO_BMEC_WATCHDOG_EVENT_LEN         24
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Supervises the tasks, each with its own deadline.
+///
+/// A task registers itself with add() and then calls beat() at least once per deadline, a
+/// single store, and trace() at the points it may block. The supervisor task checks the
+/// deadlines. When one is missed it logs which task stalled, for how long and its last trace
+/// event, keeps the report in RTC memory for the next boot, and restarts.
+///
+/// The supervisor is the only task on the ESP-IDF task watchdog, which is set to panic, so a
+/// hung supervisor resets too. The idle tasks are taken off it: a long CPU bound job, such as
+/// an OTA handshake, is judged by its own deadline rather than by starving the idle task.
+class CoBmecWatchdog {
+ public:
+
+  using Id = int8_t;  ///< Registered task, -1 for none.
+
+  static void begin(int core, int priority);
+
+  static Id add(const char *name, uint32_t deadlineMs);
+
+  static void remove(Id id);
+
+  /// Shows the calling task is alive.
+  /// @param id registered task, ignored if -1.
+  static void beat(Id id) {
+    if (id >= 0) {
+      entries_[id].beatTMs = millis();
+    }
+  };
+
+  /// Records where the task is, for the stall report.
+  /// @param id registered task, ignored if -1.
+  /// @param event event, a string literal.
+  /// @param value event value.
+  static void trace(Id id, const char *event, uint32_t value = 0) {
+    if (id >= 0) {
+      Entry &entry = entries_[id];
+      entry.event = event;
+      entry.value = value;
+      entry.eventTMs = millis();
+    }
+  };
+
+ private:
+
+  struct Entry {
+    const char *name = nullptr;  ///< nullptr when free.
+    uint32_t deadlineMs = 0;
+    volatile uint32_t beatTMs = 0;
+    const char *volatile event = "";
+    volatile uint32_t value = 0;
+    volatile uint32_t eventTMs = 0;
+  };
+
+  /// Kept across the restart, reported on the next boot.
+  struct StallReport {
+    uint32_t magic;
+    char name[CO_BMEC_WATCHDOG_NAME_LEN];
+    char event[CO_BMEC_WATCHDOG_EVENT_LEN];
+    uint32_t value;
+    uint32_t stallMs;
+    uint32_t eventAgoMs;
+  };
+
+  static Entry entries_[CO_BMEC_WATCHDOG_MAX_TASKS];
+  static portMUX_TYPE mux_;
+  static StallReport stallReport_;  ///< In RTC memory, not cleared by a software restart.
+
+  static void task(void *);
+
+  static void check();
+
+  static void onStall(const Entry &entry, uint32_t stallMs, uint32_t nowMs);
+
+  static void logLastStall();
+};
+
+/// @}
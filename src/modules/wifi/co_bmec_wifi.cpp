@@ -15,13 +15,19 @@
 // #includes.
 //*********************************************************************
 #include <cstdint>
+#include <memory>
 #include "esp_wpa2.h" //wpa2 library for connections to Enterprise networks
 #include <WiFi.h>
-#include <BLEDevice.h>
+#include <esp_wifi.h>
+#include "modules/ble/gatt/ble_gatt.h"
 #include <Arduino_JSON.h>
 #include <ESP32Ping.h>
 
 #include "co_bmec_wifi.h"
+#include "modules/watchdog/co_bmec_watchdog.h"
+#include "modules/memory/co_bmec_memory_monitor.h"
+#include "modules/log/co_bmec_log.h"
+#include "modules/metrics/co_bmec_metrics.h"
 
 //*********************************************************************
 // defines.
@@ -29,9 +35,35 @@
 #define WIFI_TASK_STACK_SIZE         4000  /// Used 2360 -> 4000. The number of wifi networks may affect this so a large margin of error is required.
 
 #define WIFI_IDLE_TIME_MS            100
+#define WIFI_TASK_DEADLINE_MS        30000  /// Longest step, a ping test or a WPA2 enterprise connection included.
+#define TELEMETRY_TEXT_LEN           768
+#define POWER_TEXT_LEN               160
+#define SCAN_LIST_MAX_LEN            2048  /// JSON bytes sent per channel, further results are dropped.
 
 #define PREF_NS_WIFI_CONFIG     "WIFI_CONFIG"
-#define CONNECT_MAX_BACKOFF_MS  32000
+
+#define PROFILE_KEY_LEN             16  /// NVS keys are limited to 15 characters.
+#define CANDIDATE_MAX_AGE_MS        60000  /// Scan candidates older than this are refreshed before connecting.
+#define HISTORY_CAP                 10  /// Maximum success or fail count that contributes to a candidate score.
+#define HISTORY_SUCCESS_WEIGHT_DB   2  /// Score added per successful connection.
+#define HISTORY_FAIL_WEIGHT_DB      3  /// Score removed per failed connection.
+#define ROAM_HYSTERESIS_DB          8  /// A candidate must be this much stronger than the current AP.
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+static CoBmecMetrics::Counter connectsMetric("wifi_connects_total",
+                                             "Connection attempts that obtained an IP.");
+static CoBmecMetrics::Counter connectFailuresMetric("wifi_connect_failures_total",
+                                                    "Connection attempts that did not obtain an IP.");
+static CoBmecMetrics::Counter disconnectsMetric("wifi_disconnects_total",
+                                                "Connections lost after an IP was obtained.");
+static CoBmecMetrics::Gauge apStateMetric("wifi_ap_state",
+                                          "CoBmecWifi::ApState.");
+static CoBmecMetrics::Gauge rssiMetric("wifi_rssi_dbm",
+                                       "RSSI of the AP, 0 if not connected.",
+                                       1,
+                                       []() { return int32_t(CoBmecWifi::getRssiDbm()); });
 
 //*********************************************************************
 // #constructors.
@@ -41,6 +73,28 @@
 // implementations.
 //*********************************************************************
 
+// Helpers.
+
+/// Builds the NVS key of a profile field.
+/// @param key buffer of PROFILE_KEY_LEN bytes.
+/// @param profileIndex index of the profile.
+/// @param field name of the field.
+/// @returns key.
+static const char *profileKey(char *key, uint8_t profileIndex, const char *field) {
+  snprintf(key,
+           PROFILE_KEY_LEN,
+           "p%u_%s",
+           profileIndex,
+           field);
+  return key;
+}
+
+/// Summarises the connection history of a profile.
+/// @returns successful minus failed connection attempts.
+static int profileHistory(const CoBmecWifi::ApProfile &profile) {
+  return int(profile.successCount_) - int(profile.failCount_);
+}
+
 // Constructors.
 
 /// Initialises the wifi module and BLE callbacks.
@@ -48,21 +102,18 @@
 /// @param priority Priority at which to run the FreeRTOS task.
 /// @param flashMutex Global flash mutex.
 /// @param bleServiceWifi wifi ble service.
-/// @param ref pointer to pass back in the callback.
-/// @param apStateCallback callback. Caller can pass reference through public void* ref_.
+/// @param bulk BLE bulk transfers.
 CoBmecWifi::CoBmecWifi(
-    void *ref,
     int core,
     int priority,
     SemaphoreHandle_t flashMutex,
     BleServiceWifi *bleServiceWifi,
-    void (*apStateCallback)(CoBmecWifi *, ApState))
-    : ref_(ref),
-      core_(core),
+    CoBmecBleBulk *bulk)
+    : core_(core),
       priority_(priority),
       flashMutex_(flashMutex),
       bleServiceWifi_(bleServiceWifi),
-      apStateCallback_(apStateCallback) {}
+      bulk_(bulk) {}
 
 // Public methods.
 
@@ -70,17 +121,43 @@ CoBmecWifi::CoBmecWifi(
 void CoBmecWifi::init() {
   log_i("CoBmecWifi module init");
 
+  // Publish the states on the ble.
+  const StatusPublisher::Field statusFields[] = {
+      CO_BMEC_BLE_STATUS_FIELD(BleStatus, apState, bleServiceWifi_->charApState_),
+      CO_BMEC_BLE_STATUS_FIELD(BleStatus, scanState, bleServiceWifi_->charScanState_),
+  };
+  statusPublisher_ = CoBmecBootArena::make<StatusPublisher>(statusFields,
+                                                            nullptr,
+                                                            CO_BMEC_WIFI_BLE_STATUS_MS);
+
   // Load the Wi-Fi configuration from NVS.
   loadConfig();
 
   // Set ble callbacks.
   bleServiceWifi_->charApCommand_->setCallbacks(this);
   bleServiceWifi_->charScanCommand_->setCallbacks(this);
+  bleServiceWifi_->charTelemetry_->setCallbacks(this);
+  bleServiceWifi_->charPowerProfile_->setCallbacks(this);
+  bleServiceWifi_->charPowerReport_->setCallbacks(this);
+
+  // Send the telemetry and the trace on the bulk channel when the client asks.
+  bulk_->setSource(CoBmecBleBulk::Channel::TELEMETRY,
+                   [this](char *buffer, size_t length) {
+                     return formatTelemetry(buffer,
+                                            length);
+                   });
+  bulk_->setSource(CoBmecBleBulk::Channel::TRACE,
+                   [this](char *buffer, size_t length) {
+                     return formatTrace(buffer,
+                                        length);
+                   });
 
   // Set the Wi-Fi listener (see onWrite).
   (void) WiFi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
+    CoBmecWifiStateMachine::WifiEvent wifiEvent = toWifiEvent(event,
+                                                              info);
     if (!xQueueSend(wifiEventQueue_,
-                    &event,
+                    &wifiEvent,
                     WIFI_EVENT_QUEUE_IDLE_TIME_MS / portTICK_PERIOD_MS)) {
       log_w("failed to add item to wifiEventQueue_ queue."); // NOLINT(bugprone-lambda-function-name)
     }
@@ -90,61 +167,140 @@ void CoBmecWifi::init() {
   WiFi.setAutoReconnect(false);
 
   // Create the background task.
-  (void) xTaskCreatePinnedToCore(task, // Function to implement the task
-                                 "CoBmecWifi", // Name of the task
-                                 WIFI_TASK_STACK_SIZE,  // Stack size in words
-                                 this,  // Task input parameter
-                                 priority_,  // Priority of the task
-                                 nullptr,  // Task handle.
-                                 core_); // Core where the task should run
+  (void) CoBmecBootArena::createTask(task, // Function to implement the task
+                                     "CoBmecWifi", // Name of the task
+                                     WIFI_TASK_STACK_SIZE,  // Stack size in words
+                                     this,  // Task input parameter
+                                     priority_,  // Priority of the task
+                                     core_); // Core where the task should run
 
   log_i("CoBmecWifi module inited");
 }
 
-/// Initialises the wifi module and BLE callbacks.
 /// @returns the rssi of the connected wifi AP in dBm.
 long CoBmecWifi::getRssiDbm() {
   return WiFi.RSSI();
 }
 
-// Private methods.
+/// Prints the connection telemetry.
+/// @param print output, e.g. Serial.
+void CoBmecWifi::printTelemetry(Print &print) const {
+  std::unique_ptr<char[]> text(new(std::nothrow) char[TELEMETRY_TEXT_LEN + POWER_TEXT_LEN]);
+  if (!text) {
+    return;
+  }
+  (void) formatTelemetry(text.get(),
+                         TELEMETRY_TEXT_LEN + POWER_TEXT_LEN);
+  print.print(text.get());
+}
 
-/// Sets the scanning state, notifies on the BLE and calls the callback.
-void CoBmecWifi::setApState(CoBmecWifi::ApState apState) {
+/// Prints the recorded driver events, for CoBmecWifiTrace::parse and a replay on the host.
+/// @param print output.
+void CoBmecWifi::printTrace(Print &print) const {
+  std::unique_ptr<char[]> text(new(std::nothrow) char[CO_BMEC_WIFI_TRACE_TEXT_LEN]);
+  if (!text) {
+    return;
+  }
+  (void) formatTrace(text.get(),
+                     CO_BMEC_WIFI_TRACE_TEXT_LEN);
+  print.print(text.get());
+}
 
-  // Log state.
-  switch (apState) {
-    case ApState::UNDEFINED:log_i("ApState: UNDEFINED");
-      break;
-    case ApState::DISCONNECTING:log_i("ApState: DISCONNECTING");
-      break;
-    case ApState::DISCONNECTED:log_i("ApState: DISCONNECTED");
-      break;
-    case ApState::CONNECTING:log_i("ApState: CONNECTING");
-      break;
-    case ApState::CONNECTED:log_i("ApState: CONNECTED");
-      break;
-    case ApState::PINGING:log_i("ApState: PINGING");
-      break;
-    case ApState::PINGED:log_i("ApState: PINGED");
-      break;
-    case ApState::ERROR:log_i("ApState: ERROR");
-      break;
+/// Formats the connection telemetry and the power report. Callable from any task.
+/// @param buffer output.
+/// @param length length of the buffer.
+/// @returns number of characters written.
+size_t CoBmecWifi::formatTelemetry(char *buffer, size_t length) const {
+  xSemaphoreTake(telemetryMutex_,
+                 portMAX_DELAY);
+  size_t written = telemetry_.format(buffer,
+                                     length);
+  xSemaphoreGive(telemetryMutex_);
+
+  // Power.
+  xSemaphoreTake(powerMutex_,
+                 portMAX_DELAY);
+  written += power_.format(::millis(),
+                           buffer + written,
+                           length - written);
+  xSemaphoreGive(powerMutex_);
+  return written;
+}
+
+/// Formats the recorded driver events, see CoBmecWifiTrace::format. Callable from any task.
+/// @param buffer output.
+/// @param length length of the buffer.
+/// @returns number of characters written.
+size_t CoBmecWifi::formatTrace(char *buffer, size_t length) const {
+  xSemaphoreTake(traceMutex_,
+                 portMAX_DELAY);
+  size_t written = trace_.format(buffer,
+                                 length);
+  xSemaphoreGive(traceMutex_);
+  return written;
+}
+
+/// Selects the power save mode used outside awake windows and saves it.
+/// The listen interval takes effect from the next association.
+/// @param powerProfile NONE, MIN_MODEM or MAX_MODEM.
+/// @param listenInterval beacon intervals between wakes in MAX_MODEM.
+void CoBmecWifi::setPowerProfile(PowerProfile powerProfile, uint8_t listenInterval) {
+  xSemaphoreTake(powerMutex_,
+                 portMAX_DELAY);
+  (void) power_.setProfile(millis(),
+                           powerProfile,
+                           listenInterval);
+  uint8_t value[] = {static_cast<uint8_t>(power_.getProfile()), power_.getListenInterval()};
+  xSemaphoreGive(powerMutex_);
+
+  log_i("Power profile %u, listen interval %u",
+        value[0],
+        value[1]);
+
+  bleServiceWifi_->charPowerProfile_
+                 ->setValue(value,
+                            sizeof(value));
+  savePowerProfile();
+  applyPowerSave();
+}
+
+/// Keeps the radio fully awake until released, e.g. around an NTP poll, OTA check or BLE provisioning.
+/// @param awakeReason reason, released independently of the other reasons.
+void CoBmecWifi::requestAwake(AwakeReason awakeReason) {
+  xSemaphoreTake(powerMutex_,
+                 portMAX_DELAY);
+  bool changed = power_.requestAwake(awakeReason);
+  xSemaphoreGive(powerMutex_);
+
+  if (changed) {
+    applyPowerSave();
   }
+}
 
-  // Set the state.
-  apState_ = apState;
-  // Notify on the ble characteristic.
-  bleServiceWifi_->charApState_
-                 ->setValue(reinterpret_cast<uint8_t *>(&apState_),
-                            1);
-  bleServiceWifi_->charApState_->notify();
+/// Returns to the power profile once no awake window is open.
+/// @param awakeReason reason.
+void CoBmecWifi::releaseAwake(AwakeReason awakeReason) {
+  xSemaphoreTake(powerMutex_,
+                 portMAX_DELAY);
+  bool changed = power_.releaseAwake(awakeReason);
+  xSemaphoreGive(powerMutex_);
+
+  if (changed) {
+    applyPowerSave();
+  }
+}
 
-  // Callback.
-  apStateCallback_(this,
-                   apState);
+/// Counts an NTP poll for the power report.
+/// @param synced true if the time was synced before the poll timed out.
+void CoBmecWifi::recordNtpPoll(bool synced) {
+  xSemaphoreTake(powerMutex_,
+                 portMAX_DELAY);
+  power_.onNtpPoll(synced);
+  xSemaphoreGive(powerMutex_);
 }
 
+// Private methods.
+
 /// Sets AP state to error and notifies on the BLE.
 void CoBmecWifi::setApError(const String &errorMessage) {
   // Log error.
@@ -152,100 +308,84 @@ void CoBmecWifi::setApError(const String &errorMessage) {
         errorMessage.c_str());
 
   // Set the state.
-  setApState(ApState::ERROR);
+  stateMachine_.setApState(ApState::ERROR);
   // Notify on the ble characteristic.
   bleServiceWifi_->charApError_->setValue(errorMessage.c_str());
 }
 
-/// Sets the scanning state and notifies on the BLE.
-void CoBmecWifi::setScanState(CoBmecWifi::ScanState scanState) {
-  // Log state.
-  switch (scanState) {
-    case ScanState::UNDEFINED:log_i("ScanState: UNDEFINED");
-      break;
-    case ScanState::SCANNING:log_i("ScanState: SCANNING");
-      break;
-    case ScanState::SCANNED:log_i("ScanState: SCANNED");
-      break;
-    case ScanState::ERROR:log_i("ScanState: ERROR");
-      break;
-  }
-  // Set the state.
-  scanState_ = scanState;
-  // Notify on the ble characteristic.
-  bleServiceWifi_->charScanState_
-                 ->setValue(reinterpret_cast<uint8_t *>(&scanState_),
-                            1);
-  bleServiceWifi_->charScanState_->notify();
-}
-
-/// Sets the scanning error.
+/// Sets the scanning error on the BLE. The state machine sets the state.
 void CoBmecWifi::setScanError(const String &errorMessage) {
   // Log error.
   log_w("Scan Error: %s",
         errorMessage.c_str());
 
-  // Set the state.
-  setScanState(ScanState::ERROR);
   // Notify on the ble characteristic.
   bleServiceWifi_->charScanError_->setValue(errorMessage.c_str());
 }
 
-/// Callback for events from WiFi driver.
-void CoBmecWifi::onWifiEvent(WiFiEvent_t event) {
-  //FEATURE param WiFiEventInfo_t info can be used to improve specificity of state.
+/// Converts an event from the WiFi driver for the state machine.
+/// @param event event.
+/// @param info event information.
+/// @returns the event.
+CoBmecWifiStateMachine::WifiEvent CoBmecWifi::toWifiEvent(
+    WiFiEvent_t event, const WiFiEventInfo_t &info) {
+  using Event = CoBmecWifiStateMachine::Event;
+
+  CoBmecWifiStateMachine::WifiEvent wifiEvent;
 
   switch (static_cast<system_event_id_t>(event)) {
-    case SYSTEM_EVENT_WIFI_READY: {
-      log_i("WiFi ready.");
-    }
+    case SYSTEM_EVENT_WIFI_READY:wifiEvent.event = Event::WIFI_READY;
       break;
-    case SYSTEM_EVENT_SCAN_DONE: {
-      log_i("WiFi scan done.");
-      onScanDone();
-    }
+    case SYSTEM_EVENT_SCAN_DONE:wifiEvent.event = Event::SCAN_DONE;
       break;
-    case SYSTEM_EVENT_STA_START: {
-      log_i("WiFi started.");
-      setApState(ApState::DISCONNECTED);
-    }
+    case SYSTEM_EVENT_STA_START:wifiEvent.event = Event::STA_START;
       break;
-    case SYSTEM_EVENT_STA_STOP: {
-      log_i("WiFi stopped.");
-    }
+    case SYSTEM_EVENT_STA_STOP:wifiEvent.event = Event::STA_STOP;
       break;
-    case SYSTEM_EVENT_STA_CONNECTED: {
-      log_i("Connected to WiFi access point.");
-      // Do nothing - wait for IP.
-    }
+    case SYSTEM_EVENT_STA_CONNECTED:wifiEvent.event = Event::STA_CONNECTED;
       break;
     case SYSTEM_EVENT_STA_DISCONNECTED: {
-      log_i("Disconnected from WiFi access point.");
-      setApState(ApState::DISCONNECTED);
+      wifiEvent.event = Event::STA_DISCONNECTED;
+      wifiEvent.reason = info.wifi_sta_disconnected.reason;
     }
       break;
-    case SYSTEM_EVENT_STA_AUTHMODE_CHANGE: {
-      log_i("Authentication mode of access point has changed.");
-      setApState(ApState::DISCONNECTED);
-    }
+    case SYSTEM_EVENT_STA_AUTHMODE_CHANGE:wifiEvent.event = Event::STA_AUTHMODE_CHANGE;
       break;
-    case SYSTEM_EVENT_STA_GOT_IP: {
-      log_i("Obtained IP address: %s",
-            WiFi.localIP().toString().c_str());
-      saveConfig();
-      setApState(ApState::CONNECTED);
-    }
+    case SYSTEM_EVENT_STA_GOT_IP:wifiEvent.event = Event::STA_GOT_IP;
       break;
-    case SYSTEM_EVENT_STA_LOST_IP: {
-      log_i("Lost IP address and IP address is reset to 0.");
-      setApState(ApState::DISCONNECTED);
-    }
+    case SYSTEM_EVENT_STA_LOST_IP:wifiEvent.event = Event::STA_LOST_IP;
       break;
-    default: {
-      log_e("Unexpected wifi event.");
-    }
+    default:wifiEvent.event = Event::UNDEFINED;
       break;
   }
+
+  return wifiEvent;
+}
+
+/// Callback for read events from the ble driver.
+void CoBmecWifi::onRead(BLECharacteristic *characteristic) {
+
+  // Publish the telemetry as read, so it is only copied when requested.
+  if (characteristic == bleServiceWifi_->charTelemetry_) {
+    xSemaphoreTake(telemetryMutex_,
+                   portMAX_DELAY);
+    CoBmecWifiTelemetry::Data data = telemetry_.getData();
+    xSemaphoreGive(telemetryMutex_);
+    bleServiceWifi_->charTelemetry_
+                   ->setValue(reinterpret_cast<uint8_t *>(&data),
+                              sizeof(data));
+  }
+
+  // Publish the power report as read.
+  if (characteristic == bleServiceWifi_->charPowerReport_) {
+    xSemaphoreTake(powerMutex_,
+                   portMAX_DELAY);
+    CoBmecWifiPower::Report report = power_.report(millis());
+    xSemaphoreGive(powerMutex_);
+    bleServiceWifi_->charPowerReport_
+                   ->setValue(reinterpret_cast<uint8_t *>(&report),
+                              sizeof(report));
+  }
 }
 
 /// Callback for write events from the ble driver.
@@ -253,22 +393,37 @@ void CoBmecWifi::onWrite(BLECharacteristic *characteristic) {
 
   // AP commands.
   if (characteristic == bleServiceWifi_->charApCommand_) {
-    switch ((ApCommand) bleServiceWifi_->charApCommand_->getValue()
-                                       .c_str()[0]) {
-      case ApCommand::DISCONNECT: {
-        log_i("ApCommand: DISCONNECT");
-        wifiDisconnect();
-      }
-        break;
+    ApRequest apRequest;
+    apRequest.command = (ApCommand) bleServiceWifi_->charApCommand_->getValue()
+                                                   .c_str()[0];
+    switch (apRequest.command) {
       case ApCommand::CONNECT: {
-        log_i("ApCommand: CONNECT");
-        setConfig();
-        wifiConnect();
+        // Take the profile as written, later writes do not change the request.
+        apRequest.security = bleServiceWifi_->charSecurity_->getValue()[0];
+        strlcpy(apRequest.identity,
+                bleServiceWifi_->charIdentity_->getValue().c_str(),
+                sizeof(apRequest.identity));
+        strlcpy(apRequest.username,
+                bleServiceWifi_->charUsername_->getValue().c_str(),
+                sizeof(apRequest.username));
+        strlcpy(apRequest.password,
+                bleServiceWifi_->charPassword_->getValue().c_str(),
+                sizeof(apRequest.password));
       }
-        break;
-      case ApCommand::PING: {
-        log_i("ApCommand: PING");
-        internetPing();
+        [[fallthrough]];  // For the ssid.
+      case ApCommand::FORGET: {
+        strlcpy(apRequest.ssid,
+                bleServiceWifi_->charSsid_->getValue().c_str(),
+                sizeof(apRequest.ssid));
+      }
+        [[fallthrough]];
+      case ApCommand::PING:
+      case ApCommand::DISCONNECT: {
+        if (!xQueueSend(apRequestQueue_,
+                        &apRequest,
+                        0)) {
+          log_w("failed to add item to apRequestQueue_ queue.");
+        }
       }
         break;
       default:break;
@@ -281,29 +436,51 @@ void CoBmecWifi::onWrite(BLECharacteristic *characteristic) {
                                          .c_str()[0]) {
       case ScanCommand::SCAN: {
         log_i("ScanCommand: SCAN");
-        if (WiFi.scanComplete() != WIFI_SCAN_RUNNING) {
-          setScanState(ScanState::SCANNING);
-
-          // Wait for any connection attempts to finish before starting a scan.
-          while (apState_ == ApState::CONNECTING) {
-            vTaskDelay(WIFI_IDLE_TIME_MS / portTICK_PERIOD_MS);
-          }
-
-          // Start scan.
-          WiFi.scanNetworks(true);
-
+        std::string value = bleServiceWifi_->charScanCommand_->getValue();
+        const auto *data = reinterpret_cast<const uint8_t *>(value.data());
+
+        // Get the options. Missing options keep their defaults.
+        ScanRequest scanRequest;
+        uint8_t flags = value.length() > 1 ? data[1] : 0;
+        scanRequest.passive_ = flags & static_cast<uint8_t>(ScanFlag::PASSIVE);
+        if (flags & static_cast<uint8_t>(ScanFlag::TARGETED)) {
+          strncpy(scanRequest.ssid_,
+                  bleServiceWifi_->charSsid_->getValue().c_str(),
+                  sizeof(scanRequest.ssid_) - 1);
+        }
+        if (value.length() > 3) {
+          scanRequest.channelMask_ = data[2] | data[3] << 8;
         }
-        else {
-          log_w("Scan already running.");
+        if (value.length() > 5) {
+          uint16_t dwellMs = data[4] | data[5] << 8;
+          scanRequest.dwellMs_ = dwellMs ? min(dwellMs,
+                                               (uint16_t) CO_BMEC_WIFI_SCAN_MAX_DWELL_MS)
+                                         : CO_BMEC_WIFI_SCAN_DWELL_MS;
         }
+
+        // The task starts the scan once any connection attempt or scan has finished.
+        // A newer request replaces one that has not started.
+        (void) xQueueOverwrite(scanRequestQueue_,
+                               &scanRequest);
       }
         break;
       default:break;
     }
   }
+
+  // Power profile: mode then listen interval.
+  if (characteristic == bleServiceWifi_->charPowerProfile_) {
+    if (bleServiceWifi_->charPowerProfile_->getValue().length() < 2) {
+      log_w("Power profile requires a mode and listen interval.");
+      return;
+    }
+    std::string data = bleServiceWifi_->charPowerProfile_->getValue();
+    setPowerProfile(static_cast<PowerProfile>(data[0]),
+                    uint8_t(data[1]));
+  }
 }
 
-/// Loads the mqtt from NVS.
+/// Loads the AP profiles from NVS.
 void CoBmecWifi::loadConfig() {
 
   // Take the mutex.
@@ -316,14 +493,64 @@ void CoBmecWifi::loadConfig() {
   }
 
   // Get preferences.
-  config_->ssid_ = preferences_.getString("ssid",
-                                          DEFAULT_WIFI_SSID);
-  config_->security_ = static_cast<wifi_auth_mode_t>(preferences_
-      .getUInt("security"), WIFI_AUTH_WPA_WPA2_PSK);
-  config_->identity_ = preferences_.getString("identity");
-  config_->username_ = preferences_.getString("username");
-  config_->password_ = preferences_.getString("password",
-                                              DEFAULT_WIFI_PASSWORD);
+  uint8_t profileCount = preferences_.getUChar("profiles",
+                                               UINT8_MAX);
+  if (profileCount == UINT8_MAX) {
+    // Migrate the single AP config of earlier firmware, if there is one. A unit that was never
+    // provisioned stays unprovisioned.
+    config_->profileCount_ = 0;
+    if (preferences_.isKey("ssid")) {
+      ApProfile &profile = config_->profiles_[0];
+      profile.ssid_ = preferences_.getString("ssid");
+      profile.security_ = static_cast<wifi_auth_mode_t>(preferences_
+          .getUShort("security",
+                     WIFI_AUTH_WPA_WPA2_PSK));
+      profile.identity_ = preferences_.getString("identity");
+      profile.username_ = preferences_.getString("username");
+      profile.password_ = preferences_.getString("password");
+      profile.updated_ = true;
+      config_->profileCount_ = profile.ssid_.isEmpty() ? 0 : 1;
+    }
+    config_->profileCountUpdated_ = true;
+  }
+  else {
+    char key[PROFILE_KEY_LEN];
+    config_->profileCount_ = min(profileCount,
+                                 (uint8_t) CO_BMEC_WIFI_MAX_PROFILES);
+    for (uint8_t profileIndex = 0; profileIndex < config_->profileCount_;
+         profileIndex++) {
+      ApProfile &profile = config_->profiles_[profileIndex];
+      profile.ssid_ = preferences_.getString(profileKey(key,
+                                                        profileIndex,
+                                                        "ssid"));
+      profile.security_ = static_cast<wifi_auth_mode_t>(preferences_
+          .getUShort(profileKey(key,
+                                profileIndex,
+                                "sec")));
+      profile.identity_ = preferences_.getString(profileKey(key,
+                                                            profileIndex,
+                                                            "id"));
+      profile.username_ = preferences_.getString(profileKey(key,
+                                                            profileIndex,
+                                                            "user"));
+      profile.password_ = preferences_.getString(profileKey(key,
+                                                            profileIndex,
+                                                            "pass"));
+      profile.successCount_ = preferences_.getUShort(profileKey(key,
+                                                                profileIndex,
+                                                                "ok"));
+      profile.failCount_ = preferences_.getUShort(profileKey(key,
+                                                             profileIndex,
+                                                             "fail"));
+    }
+  }
+
+  // Get the power profile.
+  auto powerProfile = static_cast<PowerProfile>(preferences_
+      .getUChar("ps",
+                static_cast<uint8_t>(PowerProfile::MIN_MODEM)));
+  uint8_t listenInterval = preferences_.getUChar("listen",
+                                                 CO_BMEC_WIFI_POWER_DEFAULT_LISTEN);
 
   preferences_.end();
 
@@ -332,78 +559,88 @@ void CoBmecWifi::loadConfig() {
     log_e("Failed to give flashMutex_.");
   }
 
+  // Start with the profile that has the best history.
+  activeProfile_ = -1;
+  for (int profileIndex = 0; profileIndex < config_->profileCount_;
+       profileIndex++) {
+    if (activeProfile_ < 0
+        || profileHistory(config_->profiles_[profileIndex])
+            > profileHistory(config_->profiles_[activeProfile_])) {
+      activeProfile_ = profileIndex;
+    }
+  }
+
+  // Apply the power profile once the radio has started (see applyPowerSave).
+  xSemaphoreTake(powerMutex_,
+                 portMAX_DELAY);
+  (void) power_.setProfile(millis(),
+                           powerProfile,
+                           listenInterval);
+  uint8_t powerValue[] = {static_cast<uint8_t>(power_.getProfile()), power_.getListenInterval()};
+  xSemaphoreGive(powerMutex_);
+  bleServiceWifi_->charPowerProfile_
+                 ->setValue(powerValue,
+                            sizeof(powerValue));
+
   // Set the values on the BLE.
-  bleServiceWifi_->charSsid_->setValue(config_->ssid_.c_str());
-  bleServiceWifi_->charSecurity_
-                 ->setValue(reinterpret_cast<uint8_t *>(&config_->security_),
-                            1);
-  bleServiceWifi_->charIdentity_->setValue(config_->identity_.c_str());
-  bleServiceWifi_->charUsername_->setValue(config_->username_.c_str());
-  bleServiceWifi_->charPassword_->setValue(config_->password_.c_str());
+  if (activeProfile_ >= 0) {
+    ApProfile &profile = config_->profiles_[activeProfile_];
+    bleServiceWifi_->charSsid_->setValue(profile.ssid_.c_str());
+    bleServiceWifi_->charSecurity_
+                   ->setValue(reinterpret_cast<uint8_t *>(&profile.security_),
+                              1);
+  }
 
   // Log.
-  log_i("status_->ssid_: %s",
-        config_->ssid_.c_str());
-  log_i("status_->security: %u",
-        config_->security_);
-  log_i("status_->identity_: %s",
-        config_->identity_.c_str());
-  log_i("status_->username_: %s",
-        config_->username_.c_str());
-  log_i("status_->password: %s",
-        config_->password_.c_str());
-}
-
-/// Sets the wifi mqtt from the BLE.
-void CoBmecWifi::setConfig() {
-
-  // Set the values if they have changed.
-  String newSsid = bleServiceWifi_->charSsid_->getValue().c_str();
-  if (config_->ssid_ != newSsid) {
-    config_->ssid_ = newSsid;
-    config_->ssidUpdated_ = true;
-    log_i("updated ssid_");
-  }
-  auto newSecurity =
-      (wifi_auth_mode_t) bleServiceWifi_->charSecurity_->getData()[0];
-  if (config_->security_ != newSecurity) {
-    config_->security_ = newSecurity;
-    config_->securityUpdated_ = true;
-    log_i("updated security");
-  }
-  String newIdentity = bleServiceWifi_->charIdentity_->getValue().c_str();
-  if (config_->identity_ != newIdentity) {
-    config_->identity_ = newIdentity;
-    config_->identityUpdated_ = true;
-    log_i("updated identity_");
-  }
-  String newUsername = bleServiceWifi_->charUsername_->getValue().c_str();
-  if (config_->username_ != newUsername) {
-    config_->username_ = newUsername;
-    config_->usernameUpdated_ = true;
-    log_i("updated username_");
-  }
-  String newPassword = bleServiceWifi_->charPassword_->getValue().c_str();
-  if (config_->password_ != newPassword) {
-    config_->password_ = newPassword;
-    config_->passwordUpdated_ = true;
-    log_i("updated password");
+  CO_BMEC_LOG_I(WIFI,
+                "config_->profileCount_: %u",
+                config_->profileCount_);
+  for (uint8_t profileIndex = 0; profileIndex < config_->profileCount_;
+       profileIndex++) {
+    const ApProfile &profile = config_->profiles_[profileIndex];
+    CO_BMEC_LOG_I(WIFI,
+                  "profile %u: ssid %s, security %u, password %s, ok %u, fail %u",
+                  profileIndex,
+                  profile.ssid_,
+                  profile.security_,
+                  CoBmecLog::secret(profile.password_),
+                  profile.successCount_,
+                  profile.failCount_);
+  }
+}
+
+/// Adds or updates the profile written on the BLE and makes it active.
+/// @param apRequest CONNECT request with the profile fields.
+void CoBmecWifi::setConfig(const ApRequest &apRequest) {
+
+  // Get the values.
+  ApProfile profile;
+  profile.ssid_ = apRequest.ssid;
+  profile.security_ = (wifi_auth_mode_t) apRequest.security;
+  profile.identity_ = apRequest.identity;
+  profile.username_ = apRequest.username;
+  profile.password_ = apRequest.password;
+
+  if (profile.ssid_.isEmpty()) {
+    log_w("WARNING: Attempted to set a profile with no ssid_");
+    return;
   }
 
+  // Store the profile and connect to it next.
+  activeProfile_ = upsertProfile(profile);
+
   // Log.
-  log_v("status_->ssid_: %s",
-        config_->ssid_.c_str());
-  log_v("status_->security: %u",
-        config_->security_);
-  log_v("status_->identity_: %s",
-        config_->identity_.c_str());
-  log_v("status_->username_: %s",
-        config_->username_.c_str());
-  log_v("status_->password: %s",
-        config_->password_.c_str());
-}
-
-/// Saves the wifi mqtt.
+  CO_BMEC_LOG_V(WIFI,
+                "profile %d: ssid %s, security %u, identity %s, username %s, password %s",
+                activeProfile_,
+                profile.ssid_,
+                profile.security_,
+                CoBmecLog::secret(profile.identity_),
+                CoBmecLog::secret(profile.username_),
+                CoBmecLog::secret(profile.password_));
+}
+
+/// Saves the updated AP profiles.
 void CoBmecWifi::saveConfig() {
 
   // Take the mutex.
@@ -415,36 +652,62 @@ void CoBmecWifi::saveConfig() {
     log_e("Could not init wifi NVS.");
   }
 
-  // Set WiFi in preferences.
-  if (config_->ssidUpdated_) {
-    if (!preferences_.putString("ssid",
-                                config_->ssid_)) {
-      log_e("Failed to save status_->ssid_ to NVS");
+  // Set the profiles in preferences.
+  char key[PROFILE_KEY_LEN];
+  for (uint8_t profileIndex = 0; profileIndex < config_->profileCount_;
+       profileIndex++) {
+    ApProfile &profile = config_->profiles_[profileIndex];
+    if (!profile.updated_) {
+      continue;
     }
-  }
-  if (config_->securityUpdated_) {
-    if (!preferences_.putUShort("security",
-                                static_cast<uint>(config_->security_))) {
-      log_e("Failed to save status_->security to NVS");
-    }
-  }
-  if (config_->identityUpdated_) {
-    if (!preferences_.putString("identity",
-                                config_->identity_)) {
-      log_w("Failed to save status_->identity_ to NVS");
-    }
-  }
-  if (config_->usernameUpdated_) {
-    if (!preferences_.putString("username",
-                                config_->username_)) {
-      log_w("Failed to save status_->username_ to NVS");
+    if (!preferences_.putString(profileKey(key,
+                                           profileIndex,
+                                           "ssid"),
+                                profile.ssid_)) {
+      log_e("Failed to save profile %u ssid_ to NVS",
+            profileIndex);
     }
+    (void) preferences_.putUShort(profileKey(key,
+                                             profileIndex,
+                                             "sec"),
+                                  static_cast<uint16_t>(profile.security_));
+    (void) preferences_.putString(profileKey(key,
+                                             profileIndex,
+                                             "id"),
+                                  profile.identity_);
+    (void) preferences_.putString(profileKey(key,
+                                             profileIndex,
+                                             "user"),
+                                  profile.username_);
+    (void) preferences_.putString(profileKey(key,
+                                             profileIndex,
+                                             "pass"),
+                                  profile.password_);
+    (void) preferences_.putUShort(profileKey(key,
+                                             profileIndex,
+                                             "ok"),
+                                  profile.successCount_);
+    (void) preferences_.putUShort(profileKey(key,
+                                             profileIndex,
+                                             "fail"),
+                                  profile.failCount_);
+    profile.updated_ = false;
   }
-  if (config_->passwordUpdated_) {
-    if (!preferences_.putString("password",
-                                config_->password_)) {
-      log_e("Failed to save status_->password to NVS");
+
+  if (config_->profileCountUpdated_) {
+    if (!preferences_.putUChar("profiles",
+                               config_->profileCount_)) {
+      log_e("Failed to save config_->profileCount_ to NVS");
     }
+
+    // Remove the single AP config of earlier firmware.
+    (void) preferences_.remove("ssid");
+    (void) preferences_.remove("security");
+    (void) preferences_.remove("identity");
+    (void) preferences_.remove("username");
+    (void) preferences_.remove("password");
+
+    config_->profileCountUpdated_ = false;
   }
 
   // Commit.
@@ -481,328 +744,831 @@ void CoBmecWifi::deleteConfig() {
   }
 
   // Set the values.
-  config_->ssid_ = "";
-  config_->security_ = WIFI_AUTH_OPEN;
-  config_->identity_ = "";
-  config_->username_ = "";
-  config_->password_ = "";
+  *config_ = Config();
+  activeProfile_ = -1;
+  candidatesValid_ = false;
 
   // Set the values on the BLE.
-  bleServiceWifi_->charSsid_->setValue(config_->ssid_.c_str());
+  auto security = WIFI_AUTH_OPEN;
+  bleServiceWifi_->charSsid_->setValue("");
   bleServiceWifi_->charSecurity_
-                 ->setValue(reinterpret_cast<uint8_t *>(&config_->security_),
+                 ->setValue(reinterpret_cast<uint8_t *>(&security),
                             1);
-  bleServiceWifi_->charIdentity_->setValue(config_->identity_.c_str());
-  bleServiceWifi_->charUsername_->setValue(config_->username_.c_str());
-  bleServiceWifi_->charPassword_->setValue(config_->password_.c_str());
+  bleServiceWifi_->charIdentity_->setValue("");
+  bleServiceWifi_->charUsername_->setValue("");
+  bleServiceWifi_->charPassword_->setValue("");
+
+  // The power profile is not part of the AP config.
+  savePowerProfile();
+}
+
+/// Finds a stored profile.
+/// @param ssid ssid of the profile.
+/// @returns index of the profile or -1 if not found.
+int CoBmecWifi::findProfile(const String &ssid) const {
+  for (int profileIndex = 0; profileIndex < config_->profileCount_;
+       profileIndex++) {
+    if (config_->profiles_[profileIndex].ssid_ == ssid) {
+      return profileIndex;
+    }
+  }
+  return -1;
+}
+
+/// Adds a profile or updates the credentials of the profile with the same ssid.
+/// When the table is full the profile with the worst history is replaced.
+/// @param profile profile to store.
+/// @returns index of the stored profile.
+int CoBmecWifi::upsertProfile(const ApProfile &profile) {
+  int profileIndex = findProfile(profile.ssid_);
+
+  // Update the credentials of an existing profile.
+  if (profileIndex >= 0) {
+    ApProfile &stored = config_->profiles_[profileIndex];
+    if (stored.security_ != profile.security_
+        || stored.identity_ != profile.identity_
+        || stored.username_ != profile.username_
+        || stored.password_ != profile.password_) {
+      stored.security_ = profile.security_;
+      stored.identity_ = profile.identity_;
+      stored.username_ = profile.username_;
+      stored.password_ = profile.password_;
+      // The old history does not apply to new credentials.
+      stored.failCount_ = 0;
+      stored.updated_ = true;
+      log_i("updated profile %d",
+            profileIndex);
+    }
+    return profileIndex;
+  }
+
+  // Add a new profile.
+  if (config_->profileCount_ < CO_BMEC_WIFI_MAX_PROFILES) {
+    profileIndex = config_->profileCount_++;
+    config_->profileCountUpdated_ = true;
+  }
+  else {
+    profileIndex = 0;
+    for (int index = 1; index < config_->profileCount_; index++) {
+      if (profileHistory(config_->profiles_[index])
+          < profileHistory(config_->profiles_[profileIndex])) {
+        profileIndex = index;
+      }
+    }
+    log_w("Profile limit reached. Replacing profile %s",
+          config_->profiles_[profileIndex].ssid_.c_str());
+  }
+
+  config_->profiles_[profileIndex] = profile;
+  config_->profiles_[profileIndex].successCount_ = 0;
+  config_->profiles_[profileIndex].failCount_ = 0;
+  config_->profiles_[profileIndex].updated_ = true;
+
+  // Candidates refer to profiles by index.
+  candidatesValid_ = false;
 
+  log_i("added profile %d",
+        profileIndex);
+  return profileIndex;
+}
+
+/// Removes a stored profile.
+/// @param profileIndex index of the profile.
+void CoBmecWifi::removeProfile(int profileIndex) {
+  log_i("removing profile %s",
+        config_->profiles_[profileIndex].ssid_.c_str());
+
+  // Shift the following profiles down.
+  for (int index = profileIndex; index < config_->profileCount_ - 1;
+       index++) {
+    config_->profiles_[index] = config_->profiles_[index + 1];
+    config_->profiles_[index].updated_ = true;
+  }
+  config_->profiles_[--config_->profileCount_] = ApProfile();
+  config_->profileCountUpdated_ = true;
+
+  // Follow the active profile.
+  if (activeProfile_ == profileIndex) {
+    activeProfile_ = -1;
+  }
+  else if (activeProfile_ > profileIndex) {
+    activeProfile_--;
+  }
+
+  // Candidates refer to profiles by index.
+  candidatesValid_ = false;
+}
+
+/// Ranks the scan results that match a stored profile by RSSI and connection history.
+/// Only the best CO_BMEC_WIFI_MAX_CANDIDATES are kept using a bounded heap in a fixed buffer,
+/// so the number of APs in range does not affect memory use.
+/// @param resultCount number of scan results.
+/// @param merge true to keep the candidates of the previous channels of the same scan.
+void CoBmecWifi::rankCandidates(int resultCount, bool merge) {
+  // Orders the heap so that the worst candidate is at the front.
+  auto worse = [](const ApCandidate &a, const ApCandidate &b) {
+    return a.score_ > b.score_;
+  };
+
+  uint8_t candidateCount = 0;
+  if (merge) {
+    candidateCount = candidateCount_;
+    std::make_heap(candidates_,
+                   candidates_ + candidateCount,
+                   worse);
+  }
+  for (int resultIndex = 0; resultIndex < resultCount; resultIndex++) {
+    int profileIndex = findProfile(WiFi.SSID(resultIndex));
+    uint8_t *bssid = WiFi.BSSID(resultIndex);
+    if (profileIndex < 0 || !bssid) {
+      continue;
+    }
+
+    // Score the candidate.
+    const ApProfile &profile = config_->profiles_[profileIndex];
+    ApCandidate &candidate = candidates_[candidateCount];
+    candidate.profileIndex_ = profileIndex;
+    candidate.rssiDbm_ = WiFi.RSSI(resultIndex);
+    candidate.channel_ = WiFi.channel(resultIndex);
+    memcpy(candidate.bssid_,
+           bssid,
+           sizeof(candidate.bssid_));
+    candidate.score_ = candidate.rssiDbm_
+        + min((int) profile.successCount_,
+              HISTORY_CAP) * HISTORY_SUCCESS_WEIGHT_DB
+        - min((int) profile.failCount_,
+              HISTORY_CAP) * HISTORY_FAIL_WEIGHT_DB;
+
+    // Add to the heap and drop the worst once the buffer is full.
+    std::push_heap(candidates_,
+                   candidates_ + ++candidateCount,
+                   worse);
+    if (candidateCount > CO_BMEC_WIFI_MAX_CANDIDATES) {
+      std::pop_heap(candidates_,
+                    candidates_ + candidateCount--,
+                    worse);
+    }
+  }
+
+  // Order best first.
+  std::sort_heap(candidates_,
+                 candidates_ + candidateCount,
+                 worse);
+
+  candidateCount_ = candidateCount;
+  candidateIndex_ = 0;
+  candidatesTMs_ = millis();
+  candidatesValid_ = true;
+
+  for (uint8_t index = 0; index < candidateCount_; index++) {
+    CO_BMEC_LOG_I(WIFI,
+                  "candidate %u: %s rssi %d score %d",
+                  index,
+                  config_->profiles_[candidates_[index].profileIndex_].ssid_,
+                  candidates_[index].rssiDbm_,
+                  candidates_[index].score_);
+  }
+}
+
+/// @returns true if the candidates are from a recent scan.
+bool CoBmecWifi::candidatesFresh() const {
+  return candidatesValid_ && (::millis() - candidatesTMs_) < CANDIDATE_MAX_AGE_MS;
+}
+
+/// Chooses the profile for the next connection attempt.
+/// Scan candidates are attempted in rank order, then the profiles are rotated by connection history.
+/// @returns the candidate to connect to, or nullptr to connect to the active profile by ssid.
+const CoBmecWifi::ApCandidate *CoBmecWifi::selectProfile() {
+  if (candidatesFresh() && candidateIndex_ < candidateCount_) {
+    const ApCandidate *candidate = &candidates_[candidateIndex_++];
+    activeProfile_ = candidate->profileIndex_;
+    return candidate;
+  }
+
+  if (!config_->profileCount_) {
+    activeProfile_ = -1;
+    return nullptr;
+  }
+
+  // Order the profiles by connection history.
+  uint8_t order[CO_BMEC_WIFI_MAX_PROFILES];
+  for (uint8_t profileIndex = 0; profileIndex < config_->profileCount_;
+       profileIndex++) {
+    order[profileIndex] = profileIndex;
+  }
+  std::stable_sort(order,
+                   order + config_->profileCount_,
+                   [this](uint8_t a, uint8_t b) {
+                     return profileHistory(config_->profiles_[a])
+                         > profileHistory(config_->profiles_[b]);
+                   });
+
+  activeProfile_ = order[fallbackIndex_++ % config_->profileCount_];
+  return nullptr;
+}
+
+/// Runs an AP command written on the BLE. Called by the wifi task.
+/// @param apRequest command and profile fields.
+void CoBmecWifi::runApRequest(const ApRequest &apRequest) {
+  switch (apRequest.command) {
+    case ApCommand::DISCONNECT: {
+      log_i("ApCommand: DISCONNECT");
+      wifiDisconnect();
+    }
+      break;
+    case ApCommand::CONNECT: {
+      log_i("ApCommand: CONNECT");
+      setConfig(apRequest);
+      pinProfile_ = true;
+      stateMachine_.connect();
+    }
+      break;
+    case ApCommand::PING: {
+      log_i("ApCommand: PING");
+      // Blocks for the ping test.
+      stateMachine_.ping();
+    }
+      break;
+    case ApCommand::FORGET: {
+      log_i("ApCommand: FORGET");
+      int profileIndex = findProfile(apRequest.ssid);
+      if (profileIndex < 0) {
+        log_w("No profile to forget.");
+        break;
+      }
+      bool active = profileIndex == activeProfile_;
+      removeProfile(profileIndex);
+      saveConfig();
+      // Move on, the task will connect to the next profile.
+      if (active) {
+        stateMachine_.reconnect();
+      }
+    }
+      break;
+    default:break;
+  }
 }
 
 /// Attempts to make disconnect wifi connection.
 void CoBmecWifi::wifiDisconnect() {
 
-  // Set the state.
-  setApState(ApState::DISCONNECTING);
-
   // Clear from NVS.
   deleteConfig();
 
   // Disconnect.
-  WiFi.disconnect();
+  stateMachine_.disconnect();
 }
 
-/// Attempts to make wifi connection.
-void CoBmecWifi::wifiConnect() {
+/// Attempts to make wifi connection to the active profile.
+/// @param candidate optional scan candidate to pin the BSSID and channel.
+/// @returns false if there is no active profile.
+bool CoBmecWifi::wifiConnect(const ApCandidate *candidate) {
 
-  if (config_->ssid_.isEmpty()) {
-    log_w("WARNING: Attempted to connect to AP with no ssid_");
-    setApState(ApState::DISCONNECTED);
-    return;
+  if (activeProfile_ < 0) {
+    return false;
   }
 
-  setApState(ApState::CONNECTING);
+  const ApProfile &profile = config_->profiles_[activeProfile_];
+  int32_t channel = candidate ? candidate->channel_ : 0;
+  const uint8_t *bssid = candidate ? candidate->bssid_ : nullptr;
+
+  log_i("Connecting to profile %d: %s",
+        activeProfile_,
+        profile.ssid_.c_str());
+
+  // Show the profile in use on the BLE.
+  bleServiceWifi_->charSsid_->setValue(profile.ssid_.c_str());
 
   // Set auto connect. This may be redundant.
 //  WiFi.setAutoReconnect(false);
 
   // Attempt to connect.
-  switch (config_->security_) {
+  switch (profile.security_) {
     case WIFI_AUTH_OPEN: {
-      WiFi.begin(config_->ssid_.c_str());
+      WiFi.begin(profile.ssid_.c_str(),
+                 nullptr,
+                 channel,
+                 bssid,
+                 false);
     }
       break;
     case WIFI_AUTH_WEP:
     case WIFI_AUTH_WPA_PSK:
     case WIFI_AUTH_WPA2_PSK:
     case WIFI_AUTH_WPA_WPA2_PSK: {
-      WiFi.begin(config_->ssid_.c_str(),
-                 config_->password_.c_str());
+      WiFi.begin(profile.ssid_.c_str(),
+                 profile.password_.c_str(),
+                 channel,
+                 bssid,
+                 false);
     }
       break;
     case WIFI_AUTH_WPA2_ENTERPRISE: {
       // FEATURE this has never been tested.
-      esp_wifi_sta_wpa2_ent_set_identity((const unsigned char *) config_
-                                             ->identity_.c_str(),
-                                         (int) config_->identity_.length());
-      esp_wifi_sta_wpa2_ent_set_username((const unsigned char *) config_
-                                             ->username_.c_str(),
-                                         (int) config_->username_.length());
-      esp_wifi_sta_wpa2_ent_set_password((const unsigned char *) config_
-                                             ->password_.c_str(),
-                                         (int) config_->password_.length());
+      esp_wifi_sta_wpa2_ent_set_identity((const unsigned char *) profile
+                                             .identity_.c_str(),
+                                         (int) profile.identity_.length());
+      esp_wifi_sta_wpa2_ent_set_username((const unsigned char *) profile
+                                             .username_.c_str(),
+                                         (int) profile.username_.length());
+      esp_wifi_sta_wpa2_ent_set_password((const unsigned char *) profile
+                                             .password_.c_str(),
+                                         (int) profile.password_.length());
       esp_wifi_sta_wpa2_ent_enable(); //set mqtt settings to enable function
-      WiFi.begin(config_->ssid_.c_str());
+      WiFi.begin(profile.ssid_.c_str(),
+                 nullptr,
+                 channel,
+                 bssid,
+                 false);
     }
       break;
     case WIFI_AUTH_MAX:
     default: {
       log_w("WARNING: Unknown wifi security type.");
+      return true;
     }
   }
+
+  // The listen interval is only read on association, so it is set between begin and connect.
+  applyListenInterval();
+  if (esp_wifi_connect() != ESP_OK) {
+    log_w("esp_wifi_connect failed.");
+  }
+
+  return true;
 }
 
-/// Attempts to ping google.
-/// Prevents continuous calls with exponential backoff.
-void CoBmecWifi::internetPing() {
-  // Init the backoff index.
-  static int backoffIndex = 0;
-  // Init the last ping time.
-  static unsigned long lastPingTMs = 0;
-  // Init backoff delay.
-  static uint32_t backoffMs = 0;
-
-  // Return if delay has not expired.
-  if ((millis() - lastPingTMs) < backoffMs) {
+/// Sets the listen interval of the power profile on the station config.
+void CoBmecWifi::applyListenInterval() {
+  xSemaphoreTake(powerMutex_,
+                 portMAX_DELAY);
+  uint8_t listenInterval =
+      power_.getProfile() == PowerProfile::MAX_MODEM ? power_.getListenInterval() : 0;
+  xSemaphoreGive(powerMutex_);
+
+  wifi_config_t wifiConfig;
+  if (esp_wifi_get_config(WIFI_IF_STA,
+                          &wifiConfig) != ESP_OK) {
+    log_w("Could not get the station config.");
     return;
   }
+  // 0 selects the driver default.
+  wifiConfig.sta.listen_interval = listenInterval;
+  if (esp_wifi_set_config(WIFI_IF_STA,
+                          &wifiConfig) != ESP_OK) {
+    log_w("Could not set the listen interval.");
+  }
+}
 
-  // Set the state.
-  setApState(ApState::PINGING);
+/// Sets the power save mode of the radio from the profile and the open awake windows.
+void CoBmecWifi::applyPowerSave() {
+  xSemaphoreTake(powerMutex_,
+                 portMAX_DELAY);
+
+  PowerProfile mode = power_.getMode();
+  esp_err_t err = esp_wifi_set_ps(static_cast<wifi_ps_type_t>(mode));
+
+  // The radio must modem sleep while it shares the antenna with the BLE.
+  if (err != ESP_OK && mode == PowerProfile::NONE) {
+    log_w("Could not keep the radio awake. Using MIN_MODEM.");
+    mode = PowerProfile::MIN_MODEM;
+    err = esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+  }
+
+  if (err == ESP_OK) {
+    power_.onMode(millis(),
+                  mode);
+  }
+  else {
+    // Not started yet. Applied again once connected.
+    log_w("Could not set power save mode %u.",
+          static_cast<uint8_t>(mode));
+  }
+
+  xSemaphoreGive(powerMutex_);
+}
+
+/// Records a driver event or ping result for replay. Called by the wifi task.
+/// @param wifiEvent event.
+void CoBmecWifi::recordTrace(const CoBmecWifiStateMachine::WifiEvent &wifiEvent) {
+  xSemaphoreTake(traceMutex_,
+                 portMAX_DELAY);
+  trace_.record(::millis(),
+                wifiEvent);
+  xSemaphoreGive(traceMutex_);
+}
+
+/// Saves the power profile.
+void CoBmecWifi::savePowerProfile() {
+  xSemaphoreTake(powerMutex_,
+                 portMAX_DELAY);
+  auto powerProfile = static_cast<uint8_t>(power_.getProfile());
+  uint8_t listenInterval = power_.getListenInterval();
+  xSemaphoreGive(powerMutex_);
+
+  // Take the mutex.
+  xSemaphoreTake(flashMutex_,
+                 portMAX_DELAY);
+
+  // Set namespace.
+  if (!preferences_.begin(PREF_NS_WIFI_CONFIG)) {
+    log_e("Could not init wifi NVS.");
+  }
+
+  if (!preferences_.putUChar("ps",
+                             powerProfile)
+      || !preferences_.putUChar("listen",
+                                listenInterval)) {
+    log_e("Failed to save the power profile to NVS");
+  }
 
-  // Set the last ping.
-  lastPingTMs = millis();
+  // Commit.
+  preferences_.end();
+
+  // Release the mutex.
+  while (!xSemaphoreGive(flashMutex_)) {
+    log_e("Failed to give flashMutex_.");
+  }
+}
+
+/// @returns milliseconds since boot.
+uint32_t CoBmecWifi::millis() {
+  return ::millis();
+}
 
+/// @returns a random number in [0, max).
+uint32_t CoBmecWifi::random(uint32_t max) {
+  return ::random(max);
+}
+
+/// Starts a connection attempt to the profile set on the BLE, or else the next selected profile.
+/// @returns false if there is no profile to connect to.
+bool CoBmecWifi::connect() {
+  if (pinProfile_) {
+    pinProfile_ = false;
+    return wifiConnect();
+  }
+  return wifiConnect(selectProfile());
+}
+
+/// Disconnects from the AP.
+void CoBmecWifi::disconnect() {
+  WiFi.disconnect();
+}
+
+/// Attempts to ping google.
+/// @returns true on success.
+bool CoBmecWifi::ping() {
   // Attempt ping.
   bool pinged = Ping.ping("8.8.8.8",
                           1);
 
-  // If ping fails set the state back to connected and delay before trying again.
-  if (pinged) {
-    // Set the state.
-    setApState(ApState::PINGED);
+  // Record the result for replay.
+  CoBmecWifiStateMachine::WifiEvent wifiEvent;
+  wifiEvent.event = pinged ? CoBmecWifiStateMachine::Event::PING_SUCCEEDED
+                           : CoBmecWifiStateMachine::Event::PING_FAILED;
+  recordTrace(wifiEvent);
+
+  return pinged;
+}
 
-    // Reset the backoff index.
-    backoffIndex = 0;
-    // Reset the last ping time.
-    lastPingTMs = 0;
-    // Reset backoff delay.
-    backoffMs = 0;
+/// @returns the rssi of the connected wifi AP in dBm.
+long CoBmecWifi::rssiDbm() {
+  return getRssiDbm();
+}
+
+/// @returns true if there is more than one profile and no recent scan to rank them.
+bool CoBmecWifi::scanNeeded() {
+  return config_->profileCount_ > 1 && !candidatesFresh();
+}
 
+/// Starts an asynchronous scan.
+/// Scans requested on the BLE run one channel at a time so that results are published as each
+/// channel completes. Profile ranking and roaming scans cover all channels at once.
+void CoBmecWifi::scan() {
+  scanParts_ = 0;
+  scanProgress_ = ScanProgress();
+
+  scanChannel_ = 0;
+  if (!startScan(scanRequested_ ? nextScanChannel() : 0)) {
+    // Without candidates the profiles are tried in order until a ranking scan is due again,
+    // rather than the scan being retried on every loop.
+    if (!scanRequested_) {
+      rankCandidates(0,
+                     false);
+    }
+    scanRequested_ = false;
+    setScanError("WiFi scan failed to start.");
+    stateMachine_.setScanState(ScanState::ERROR);
   }
-  else {
-    // Set the state.
-    setApState(ApState::CONNECTED);
+}
+
+/// Starts a scan of one or all channels with the requested options.
+/// @param channel channel, 0 for all channels.
+/// @returns false if the scan could not be started.
+bool CoBmecWifi::startScan(uint8_t channel) {
+  scanChannel_ = channel;
+
+  if (!scanRequested_) {
+    return WiFi.scanNetworks(true) != WIFI_SCAN_FAILED;
+  }
+
+  CO_BMEC_LOG_I(WIFI,
+                "Scanning channel %u%s, %u ms",
+                channel,
+                scanRequest_.passive_ ? " passive" : "",
+                scanRequest_.dwellMs_);
+  return WiFi.scanNetworks(true,
+                           false,
+                           scanRequest_.passive_,
+                           scanRequest_.dwellMs_,
+                           channel) != WIFI_SCAN_FAILED;
+}
+
+/// @returns the next requested channel after the one scanned, or 0 if none.
+uint8_t CoBmecWifi::nextScanChannel() const {
+  uint16_t channelMask = scanRequest_.channelMask_ ? scanRequest_.channelMask_
+                                                   : uint16_t(((1 << CO_BMEC_WIFI_SCAN_CHANNELS) - 1) << 1);
+  for (uint8_t channel = scanChannel_ + 1; channel <= CO_BMEC_WIFI_SCAN_CHANNELS; channel++) {
+    if (channelMask & (1 << channel)) {
+      return channel;
+    }
+  }
+  return 0;
+}
+
+/// Sends the results of a completed channel on the bulk SCAN channel and notifies the progress.
+/// @param resultCount number of scan results.
+/// @param done true if this is the last channel of the scan.
+void CoBmecWifi::publishScanResults(int resultCount, bool done) {
+  String scanList;
+  uint8_t channelResults = 0;
+  for (int resultIndex = 0; resultIndex < resultCount; resultIndex++) {
+    // Targeted scans only publish the target.
+    if (scanRequested_ && scanRequest_.ssid_[0]
+        && WiFi.SSID(resultIndex) != scanRequest_.ssid_) {
+      continue;
+    }
+
+    // Create result json.
+    JSONVar scanResultJson;
+    scanResultJson["ssid"] = WiFi.SSID(resultIndex);
+    scanResultJson["rssi"] = WiFi.RSSI(resultIndex);
+    scanResultJson["sec"] = WiFi.encryptionType(resultIndex);
+    String scanResultString = JSON.stringify(scanResultJson);
+
+    // Drop the result if it does not fit with the brackets and separator.
+    if (scanList.length() + scanResultString.length() + 3 > SCAN_LIST_MAX_LEN) {
+      log_w("Too many wifi networks found. The following network will be truncated from the list: %s",
+            scanResultString.c_str());
+      continue;
+    }
+
+    if (scanList.length()) {
+      scanList += ",";
+    }
+    scanList += scanResultString;
+    channelResults++;
+  }
+
+  // Send the channel's results as a JSON array, before the progress that announces them.
+  if (channelResults) {
+    scanList = "[" + scanList + "]";
+    if (!bulk_->post(CoBmecBleBulk::Channel::SCAN,
+                     reinterpret_cast<const uint8_t *>(scanList.c_str()),
+                     scanList.length())) {
+      CO_BMEC_LOG_D(WIFI,
+                    "Scan results of channel %u not sent.",
+                    scanChannel_);
+    }
+  }
+
+  // Notify the progress.
+  scanProgress_.channel = scanChannel_;
+  scanProgress_.channelResults = channelResults;
+  scanProgress_.results += channelResults;
+  scanProgress_.done = done;
+  bleServiceWifi_->charScanProgress_
+                 ->setValue(reinterpret_cast<uint8_t *>(&scanProgress_),
+                            sizeof(scanProgress_));
+  BleGatt::notify(bleServiceWifi_->charScanProgress_);
+}
+
+/// @returns true if the best candidate of the last scan is a different AP
+/// and sufficiently stronger than the current AP.
+bool CoBmecWifi::betterApFound() {
+  uint8_t *bssid = WiFi.BSSID();
+  if (!candidateCount_
+      || !bssid
+      || !memcmp(candidates_[0].bssid_,
+                 bssid,
+                 sizeof(candidates_[0].bssid_))
+      || candidates_[0].rssiDbm_ < getRssiDbm() + ROAM_HYSTERESIS_DB) {
+    return false;
+  }
+
+  log_i("Roaming to %s with rssi %d dBm",
+        config_->profiles_[candidates_[0].profileIndex_].ssid_.c_str(),
+        candidates_[0].rssiDbm_);
+
+  // The next connection attempt is to the best candidate.
+  candidateIndex_ = 0;
+  return true;
+}
+
+/// Records the successful connection against the profile and saves the profiles.
+void CoBmecWifi::onConnected() {
+  log_i("Obtained IP address: %s",
+        WiFi.localIP().toString().c_str());
+  connectsMetric.add();
+
+  // Record the successful attempt against the profile.
+  if (activeProfile_ >= 0) {
+    ApProfile &profile = config_->profiles_[activeProfile_];
+    if (profile.successCount_ < UINT16_MAX) {
+      profile.successCount_++;
+      profile.updated_ = true;
+    }
+  }
+  // Start from the best candidate after the next disconnect.
+  candidateIndex_ = 0;
+  saveConfig();
 
-    // Compute the backoff delay.
-    backoffMs = (uint32_t) min(int(pow(2,
-                                       backoffIndex++)) * 1000
-                                   + int(random(1000)),
-                               CONNECT_MAX_BACKOFF_MS);
+  // The radio has started, so the power save mode can be set.
+  applyPowerSave();
+}
 
-    // Log the delay.
-    log_w("Failed to ping google. Trying again after %lu ms",
-          backoffMs);
+/// Records the failed connection attempt against the profile.
+void CoBmecWifi::onConnectFailed() {
+  connectFailuresMetric.add();
+  if (activeProfile_ >= 0) {
+    ApProfile &profile = config_->profiles_[activeProfile_];
+    if (profile.failCount_ < UINT16_MAX) {
+      profile.failCount_++;
+      profile.updated_ = true;
+    }
   }
 }
 
-/// Handles completion of wifi scan notifying scan state
-/// and writing AP list to BLE.
-void CoBmecWifi::onScanDone() {
+/// Queues the AP state for the BLE and publishes it.
+void CoBmecWifi::onApState(ApState apState) {
+  // Timestamp the transition.
+  xSemaphoreTake(telemetryMutex_,
+                 portMAX_DELAY);
+  uint16_t disconnects = telemetry_.getData().disconnects;
+  telemetry_.onApState(millis(),
+                       apState);
+  disconnects = telemetry_.getData().disconnects - disconnects;
+  xSemaphoreGive(telemetryMutex_);
+  disconnectsMetric.add(disconnects);
+  apStateMetric.set(int32_t(apState));
+
+  // Notified by the wifi task once the publish interval has elapsed.
+  statusPublisher_->snapshot().apState = static_cast<uint8_t>(apState);
+
+  // Subscribers.
+  CoBmecBus<ApStateEvent>::publish({apState});
+}
+
+/// Queues the scanning state for the BLE.
+void CoBmecWifi::onScanState(ScanState scanState) {
+  // Timestamp the transition.
+  xSemaphoreTake(telemetryMutex_,
+                 portMAX_DELAY);
+  telemetry_.onScanState(millis(),
+                         scanState);
+  xSemaphoreGive(telemetryMutex_);
+  CoBmecMemoryMonitor::setPhase(CoBmecMemoryMonitor::Phase::SCAN,
+                                scanState == ScanState::SCANNING);
+
+  // Notified by the wifi task once the publish interval has elapsed.
+  statusPublisher_->snapshot().scanState = static_cast<uint8_t>(scanState);
+}
+
+/// Handles completion of a wifi scan ranking the candidates, writing the AP list to BLE
+/// and starting the next requested channel.
+/// @returns whether the scan failed, continues or is done.
+CoBmecWifiStateMachine::ScanResult CoBmecWifi::scanDone() {
+  using ScanResult = CoBmecWifiStateMachine::ScanResult;
+
   // Get the scan result.
   int resultCount = WiFi.scanComplete();
+
+  // Rank the results for profile selection and roaming.
+  rankCandidates(max(resultCount,
+                     0),
+                 scanParts_ > 0);
+  scanParts_++;
+
   // Handle the scan result.
   if (resultCount == WIFI_SCAN_FAILED) {
+    scanRequested_ = false;
     setScanError("WiFi scan failed.");
+    return ScanResult::FAILED;
   }
-  else if (resultCount > 0) {
-    log_i("WiFi scan has results.");
-
-    /// Uncomment to test handling of a large number of results and large ble packet size.
-    //resultCount = 60; // Uncomment for testing only
-
-    // Get the max packet length.
-    int maxPacketLen =
-        ESP_GATT_MAX_ATTR_LEN;  //FEATURE this may need to be tested on other devices.
+  resultCount = max(resultCount,
+                    0);
 
-    uint8_t resultIndex = 0;  // Index of result.
-    int charApListPartIndex = 1;  // Index of ap list part.
+  /// Uncomment to test handling of a large number of results and large ble packet size.
+  //resultCount = 60; // Uncomment for testing only
 
-    // Write as many results to each characteristic as will fit inside the maxPacketLen.
-    while (resultIndex < resultCount) {
-      JSONVar scanResultsJson;  // Holds the array of results.
-      String scanResultsString;  // Holds string of JSON.
-      JSONVar scanResultJson;  // Holds each result.
-      String scanResultString;  // Holds string of JSON.
+  CO_BMEC_LOG_I(WIFI,
+                "WiFi scan returned %d results.",
+                resultCount);
 
-      // Add the previous loop's result to the array if it fits and exists.
-      do {
-        // Add to array if not empty.
-        if (scanResultJson.length()) {
-          scanResultsJson[scanResultsJson.length()] = scanResultJson;
-        }
+  // A targeted scan ends on the first channel the target is found on.
+  bool found = false;
+  if (scanRequested_ && scanRequest_.ssid_[0]) {
+    for (int resultIndex = 0; resultIndex < resultCount && !found; resultIndex++) {
+      found = WiFi.SSID(resultIndex) == scanRequest_.ssid_;
+    }
+  }
 
-        // Get array string.
-        scanResultsString = JSON.stringify(scanResultsJson);
-
-        // Create result json.
-        scanResultJson["ssid"] = WiFi.SSID(resultIndex);
-        scanResultJson["rssi"] = WiFi.RSSI(resultIndex);
-        scanResultJson["sec"] = WiFi.encryptionType(resultIndex);
-
-        // Get result string.
-        scanResultString = JSON.stringify(scanResultJson);
-
-        // Increment the result index.
-        resultIndex++;
-      } while (((scanResultsString.length() + scanResultString.length())
-          < maxPacketLen)
-          && (resultIndex <= resultCount));
-
-      delete[] scanResultJson;
-      delete[] scanResultsJson;
-
-      // Set to the correct char.
-      switch (charApListPartIndex++) {
-        case 1: {
-          bleServiceWifi_->charApListPart1_
-                         ->setValue(scanResultsString.c_str());
-          log_i("charApListPart1_: %s",
-                scanResultsString.c_str());
-        }
-          break;
-        case 2: {
-          bleServiceWifi_->charApListPart2_
-                         ->setValue(scanResultsString.c_str());
-          log_i("charApListPart2_: %s",
-                scanResultsString.c_str());
+  uint8_t nextChannel = scanChannel_ && !found ? nextScanChannel() : 0;
+  publishScanResults(resultCount,
+                     !nextChannel);
 
-        }
-          break;
-        case 3: {
-          bleServiceWifi_->charApListPart3_
-                         ->setValue(scanResultsString.c_str());
-          log_i("charApListPart3_: %s",
-                scanResultsString.c_str());
-        }
-          break;
-        case 4: {
-          bleServiceWifi_->charApListPart4_
-                         ->setValue(scanResultsString.c_str());
-          log_i("charApListPart4_: %s",
-                scanResultsString.c_str());
-        }
-          break;
-        case 5: {
-          bleServiceWifi_->charApListPart5_
-                         ->setValue(scanResultsString.c_str());
-          log_i("charApListPart5_: %s",
-                scanResultsString.c_str());
-        }
-          break;
-        default: {
-          log_w("Too many wifi networks found. The following network/s will be truncated from the list: %s",
-                scanResultsString.c_str());
-        }
-          break;
-      }
-    }
+  if (!nextChannel) {
+    scanRequested_ = false;
+    return ScanResult::DONE;
   }
-  else {
-    log_i("WiFi scan returned no results.");
+
+  // Scan the next channel.
+  if (!startScan(nextChannel)) {
+    scanRequested_ = false;
+    setScanError("WiFi scan failed.");
+    return ScanResult::FAILED;
   }
-  // Set the scanning state.
-  setScanState(ScanState::SCANNED);
+  return ScanResult::NEXT;
 }
 
 /// Method run by the FreeRTOS task.
 void CoBmecWifi::task(void *coBmecWifiRef) {
-  // Init the backoff index.
-  static int backoffIndex = 0;
-  // Init the last connect time.
-  static unsigned long lastConnectTMs = 0;
-  // Init backoff delay.
-  static uint32_t backoffMs = 0;
-
-
   // Collect the calling instance.
   auto *coBmecWifi = static_cast<CoBmecWifi *>(coBmecWifiRef);
 
-  WiFiEvent_t event;
+  CoBmecWifiStateMachine::WifiEvent wifiEvent;
+  CoBmecWatchdog::Id watchdogId = CoBmecWatchdog::add("wifi",
+                                                      WIFI_TASK_DEADLINE_MS);
 
   for (;;) {
 
     vTaskDelay(WIFI_IDLE_TIME_MS / portTICK_PERIOD_MS);
+    CoBmecWatchdog::beat(watchdogId);
 
     if (xQueueReceive(coBmecWifi->wifiEventQueue_,
-                      &event,
+                      &wifiEvent,
                       0)) {
-      coBmecWifi->onWifiEvent(event);
-    }
-
-    switch (coBmecWifi->apState_) {
-      case ApState::UNDEFINED:
-      case ApState::ERROR:
-      case ApState::DISCONNECTING:break;
-      case ApState::DISCONNECTED: {
-        if (coBmecWifi->scanState_ != ScanState::SCANNING) {
-          // Return if delay has not expired.
-          if ((millis() - lastConnectTMs) > backoffMs) {
-            // Set the last connection attempt time.
-            lastConnectTMs = millis();
-
-            // Start the connection attempt.
-            coBmecWifi->wifiConnect();
-
-            // Compute the backoff delay.
-            backoffMs = (uint32_t) min(int(pow(2,
-                                               backoffIndex++)) * 1000
-                                           + int(random(1000)),
-                                       CONNECT_MAX_BACKOFF_MS);
-
-            // Log the backoff.
-            log_i("If WiFi connection fails next attempt will be in %lu ms",
-                  backoffMs);
-          }
-        }
-      }
-        break;
-      case ApState::CONNECTING:break;
-      case ApState::CONNECTED: {
-        // Reset the backoff index.
-        backoffIndex = 0;
-        // Reset the last ping time.
-        lastConnectTMs = 0;
-        // Reset backoff delay.
-        backoffMs = 0;
-
-        // Start the ping attempt.
-        coBmecWifi->internetPing();
-      }
-        break;
-      case ApState::PINGING:
-      case ApState::PINGED:break;
+      // Record the event for replay.
+      coBmecWifi->recordTrace(wifiEvent);
+      CoBmecWatchdog::trace(watchdogId,
+                            "wifi event",
+                            static_cast<uint32_t>(wifiEvent.event));
+      xSemaphoreTake(coBmecWifi->telemetryMutex_,
+                     portMAX_DELAY);
+      coBmecWifi->telemetry_.onEvent(wifiEvent);
+      xSemaphoreGive(coBmecWifi->telemetryMutex_);
+      coBmecWifi->stateMachine_.onEvent(wifiEvent);
+    }
+
+    // Run the AP commands from the BLE.
+    ApRequest apRequest;
+    if (xQueueReceive(coBmecWifi->apRequestQueue_,
+                      &apRequest,
+                      0)) {
+      CoBmecWatchdog::trace(watchdogId,
+                            "wifi command",
+                            static_cast<uint32_t>(apRequest.command));
+      coBmecWifi->runApRequest(apRequest);
+      // Do not leave the credentials on the stack.
+      apRequest = ApRequest();
+    }
+
+    // Start a scan requested on the BLE once no connection attempt or scan is running.
+    if (coBmecWifi->stateMachine_.getApState() != ApState::CONNECTING
+        && coBmecWifi->stateMachine_.getScanState() != ScanState::SCANNING
+        && xQueueReceive(coBmecWifi->scanRequestQueue_,
+                         &coBmecWifi->scanRequest_,
+                         0)) {
+      coBmecWifi->scanRequested_ = true;
+      coBmecWifi->stateMachine_.scan();
     }
+
+    CoBmecWatchdog::trace(watchdogId,
+                          "wifi step",
+                          static_cast<uint32_t>(coBmecWifi->stateMachine_.getApState()));
+    coBmecWifi->stateMachine_.step();
+
+    // Notify the states that changed, at most once per interval.
+    coBmecWifi->statusPublisher_->loop(::millis());
+
+    coBmecWifi->loopCount_ = coBmecWifi->loopCount_ + 1;
   }
 }
 
 /// If PINGED then return to CONNECTED to force ping test.
 void CoBmecWifi::checkInternet() {
-  if(apState_ == ApState::PINGED){
-    log_i("Internet check started...");
-    setApState(ApState::CONNECTED);
-  } else {
-    log_w("Internet check requested but the AP is busy with a connection attempt or not connected.");
-  }
+  stateMachine_.checkInternet();
 }
 
 /// @}
\ No newline at end of file
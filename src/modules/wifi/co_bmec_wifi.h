@@ -20,16 +20,30 @@
 #include <esp_wifi_types.h>
 #include <WiFiGeneric.h>
 #include "modules/ble/services/wifi/ble_wifi_service.h"
+#include "modules/ble/co_bmec_ble_status_publisher.h"
+#include "modules/ble/co_bmec_ble_bulk.h"
 #include <Preferences.h>
+#include "co_bmec_wifi_state_machine.h"
+#include "co_bmec_wifi_trace.h"
+#include "co_bmec_wifi_telemetry.h"
+#include "co_bmec_wifi_power.h"
+#include "modules/memory/co_bmec_boot_arena.h"
+#include "modules/bus/co_bmec_bus.h"
 
 
 //*********************************************************************
 // defines.
 //*********************************************************************
-#define DEFAULT_WIFI_SSID                  "43 Arnold Street"
-#define DEFAULT_WIFI_PASSWORD              "891025255"
 #define CO_BMEC_WIFI_EVENT_QUEUE_LENGTH    10
 #define WIFI_EVENT_QUEUE_IDLE_TIME_MS      5
+#define CO_BMEC_WIFI_MAX_PROFILES          8  ///< Number of AP profiles stored in NVS.
+#define CO_BMEC_WIFI_MAX_CANDIDATES        4  ///< Number of ranked scan candidates kept for selection.
+#define CO_BMEC_WIFI_SCAN_CHANNELS         13  ///< Channels 1-13.
+#define CO_BMEC_WIFI_SCAN_DWELL_MS         300  ///< Default time on each channel, as WiFi.scanNetworks.
+#define CO_BMEC_WIFI_SCAN_MAX_DWELL_MS     1500  ///< Longer passive dwells risk the AP beacon timeout.
+#define CO_BMEC_WIFI_BLE_STATUS_MS         500  ///< Minimum time between AP and scan state notifications.
+#define CO_BMEC_WIFI_AP_REQUEST_QUEUE_LENGTH    4
+#define CO_BMEC_WIFI_CREDENTIAL_LEN        64  ///< Longest identity, username or password, as wifi_sta_config_t.
 
 //*********************************************************************
 // forward declarations.
@@ -38,104 +52,287 @@
 //*********************************************************************
 // class declarations.
 //*********************************************************************
-class CoBmecWifi : public BLECharacteristicCallbacks {
+class CoBmecWifi : public BLECharacteristicCallbacks,
+                   private CoBmecWifiStateMachine::Clock,
+                   private CoBmecWifiStateMachine::Driver,
+                   private CoBmecWifiStateMachine::Listener {
  public:
 
   enum class ApCommand {
-    UNDEFINED, DISCONNECT, CONNECT, PING,
+    UNDEFINED, DISCONNECT, CONNECT, PING, FORGET,
   };
 
-  enum class ApState {
-    UNDEFINED, ERROR, DISCONNECTING, DISCONNECTED, CONNECTING, CONNECTED, PINGING, PINGED,
+  /// AP command written on the BLE, with the profile fields as written. Plain data so that it
+  /// can be queued to the wifi task, which owns the profiles and the state machine.
+  struct ApRequest {
+    ApCommand command = ApCommand::UNDEFINED;
+    uint8_t security = 0;
+    char ssid[33]{};
+    char identity[CO_BMEC_WIFI_CREDENTIAL_LEN + 1]{};
+    char username[CO_BMEC_WIFI_CREDENTIAL_LEN + 1]{};
+    char password[CO_BMEC_WIFI_CREDENTIAL_LEN + 1]{};
+  };
+
+  using ApState = CoBmecWifiStateMachine::ApState;
+
+  /// Published on CoBmecBus by the wifi task on every AP state transition.
+  struct ApStateEvent {
+    ApState apState;
   };
 
   enum class ScanCommand {
     UNDEFINED, SCAN,
   };
 
-  enum class ScanState {
-    UNDEFINED, ERROR, SCANNING, SCANNED,
+  /// Options byte following ScanCommand::SCAN. Combined as a bit mask.
+  enum class ScanFlag : uint8_t {
+    PASSIVE = 1 << 0,  ///< Listen for beacons instead of sending probe requests.
+    TARGETED = 1 << 1,  ///< Only look for the SSID written to the ssid characteristic.
   };
 
-  struct Config {
+  /// Scan requested on the BLE as
+  /// [ScanCommand::SCAN, ScanFlag mask, channel mask (uint16 LE), dwell ms (uint16 LE)],
+  /// where only the command is required. Plain data so that it can be queued.
+  struct ScanRequest {
+    uint16_t channelMask_ = 0;  ///< Bit n selects channel n, 0 for all channels.
+    uint16_t dwellMs_ = CO_BMEC_WIFI_SCAN_DWELL_MS;  ///< Time on each channel.
+    bool passive_ = false;
+    char ssid_[33]{};  ///< Stop at the first channel on which the SSID is found, empty for all.
+  };
+
+  /// Published on the scan progress characteristic after each channel. The results of the
+  /// channel are sent as a JSON array on the bulk SCAN channel.
+  struct __attribute__((packed)) ScanProgress {
+    uint8_t channel = 0;  ///< Channel scanned, 0 for all channels at once.
+    uint8_t channelResults = 0;  ///< Results published for the channel.
+    uint16_t results = 0;  ///< Results published since the scan started.
+    uint8_t done = 0;  ///< 1 once the last channel has been scanned.
+  };
+
+  using ScanState = CoBmecWifiStateMachine::ScanState;
+
+  using PowerProfile = CoBmecWifiPower::Mode;
+
+  using AwakeReason = CoBmecWifiPower::AwakeReason;
+
+  /// Credentials and connection history for a single AP.
+  struct ApProfile {
     String ssid_;
-    bool ssidUpdated_ = false;
     wifi_auth_mode_t security_ = WIFI_AUTH_OPEN;
-    bool securityUpdated_ = false;
     String identity_;
-    bool identityUpdated_ = false;
     String username_;
-    bool usernameUpdated_ = false;
     String password_;
-    bool passwordUpdated_ = false;
+    uint16_t successCount_ = 0;  ///< Connection attempts that obtained an IP.
+    uint16_t failCount_ = 0;  ///< Connection attempts that did not.
+    bool updated_ = false;  ///< The profile must be written to NVS.
+  };
+
+  /// Stored AP profiles.
+  struct Config {
+    ApProfile profiles_[CO_BMEC_WIFI_MAX_PROFILES];
+    uint8_t profileCount_ = 0;
+    bool profileCountUpdated_ = false;
   };
 
-  CoBmecWifi(void *ref,
-             int core,
+  /// A scanned AP matching a stored profile.
+  struct ApCandidate {
+    uint8_t profileIndex_ = 0;
+    int32_t rssiDbm_ = 0;
+    int32_t channel_ = 0;
+    uint8_t bssid_[6]{};
+    int32_t score_ = 0;
+  };
+
+  CoBmecWifi(int core,
              int priority,
              SemaphoreHandle_t flashMutex,
              BleServiceWifi *bleServiceWifi,
-             void (*apStateCallback)(CoBmecWifi *, ApState));
+             CoBmecBleBulk *bulk);
 
-  void *ref_;
-
-  Config *config_ = new Config();
+  Config *config_ = CoBmecBootArena::make<Config>();
 
   static long getRssiDbm();
 
   ApState getState() {
-    return apState_;
+    return stateMachine_.getApState();
+  };
+
+  /// @returns true if at least one AP profile is stored.
+  bool isProvisioned() const {
+    return config_->profileCount_ > 0;
+  };
+
+  /// @returns the iterations of the wifi task loop, to tell that it is alive.
+  uint32_t getLoopCount() const {
+    return loopCount_;
   };
 
   void init();
 
   void checkInternet();
 
+  void printTelemetry(Print &print) const;
+
+  void printTrace(Print &print) const;
+
+  size_t formatTelemetry(char *buffer, size_t length) const;
+
+  size_t formatTrace(char *buffer, size_t length) const;
+
+  void setPowerProfile(PowerProfile powerProfile, uint8_t listenInterval);
+
+  void requestAwake(AwakeReason awakeReason);
+
+  void releaseAwake(AwakeReason awakeReason);
+
+  void recordNtpPoll(bool synced);
+
  private:
 
+  /// States published on the BLE, one characteristic per field.
+  struct __attribute__((packed)) BleStatus {
+    uint8_t apState = 0;
+    uint8_t scanState = 0;
+  };
+
+  using StatusPublisher = CoBmecBleStatusPublisher<BleStatus, 2>;
+
   int core_;  ///< Core on which to run the FreeRTOS task.
   int priority_;  ///< Priority at which to run the FreeRTOS task.
   SemaphoreHandle_t flashMutex_;
 
   Preferences preferences_{};
   BleServiceWifi *bleServiceWifi_;
+  CoBmecBleBulk *bulk_;  ///< Sends the scan results, trace and telemetry.
 
-  void (*apStateCallback_)(CoBmecWifi *, ApState);
+  CoBmecWifiStateMachine stateMachine_{*this, *this, *this};
+  CoBmecWifiTrace trace_;
+  CoBmecWifiTelemetry telemetry_;
+  CoBmecWifiPower power_;
 
-  ApState apState_ = ApState::DISCONNECTED;
-  ScanState scanState_ = ScanState::UNDEFINED;
+  volatile uint32_t loopCount_ = 0;  ///< Written by the wifi task.
 
-  QueueHandle_t wifiEventQueue_ = xQueueCreate(CO_BMEC_WIFI_EVENT_QUEUE_LENGTH, sizeof(WiFiEvent_t));
+  /// Rate limits the state notifications. Used by the wifi task only.
+  StatusPublisher *statusPublisher_{};
 
-  void setApState(ApState apState);
+  /// Guards telemetry_, updated by the wifi task and read from the BLE and core 0 tasks.
+  SemaphoreHandle_t telemetryMutex_ = CoBmecBootArena::createMutex();
 
-  __unused void setApError(const String &errorMessage);
+  /// Guards trace_, recorded by the wifi task and exported by the others.
+  SemaphoreHandle_t traceMutex_ = CoBmecBootArena::createMutex();
+
+  /// Guards power_, which is changed from the BLE, wifi and time sync tasks.
+  SemaphoreHandle_t powerMutex_ = CoBmecBootArena::createMutex();
+
+  QueueHandle_t wifiEventQueue_ =
+      CoBmecBootArena::createQueue(CO_BMEC_WIFI_EVENT_QUEUE_LENGTH, sizeof(CoBmecWifiStateMachine::WifiEvent));
 
-  void setScanState(ScanState scanState);
+  /// Holds the AP commands from the BLE until the task runs them.
+  QueueHandle_t apRequestQueue_ =
+      CoBmecBootArena::createQueue(CO_BMEC_WIFI_AP_REQUEST_QUEUE_LENGTH, sizeof(ApRequest));
+
+  /// Holds the latest scan request from the BLE until the task can start it.
+  QueueHandle_t scanRequestQueue_ = CoBmecBootArena::createQueue(1, sizeof(ScanRequest));
+
+  /// Scan in progress. Written by the wifi task only.
+  ScanRequest scanRequest_;
+  bool scanRequested_ = false;  ///< The scan in progress was requested on the BLE.
+  uint8_t scanChannel_ = 0;  ///< Channel being scanned, 0 for all channels at once.
+  uint8_t scanParts_ = 0;  ///< Channels scanned so far.
+
+  /// Scan results publishing, as each channel completes.
+  ScanProgress scanProgress_;
+
+  int activeProfile_ = -1;  ///< Index of the profile in use, -1 if none.
+  uint8_t fallbackIndex_ = 0;  ///< Rotates through profiles when no scan candidates are available.
+
+  /// Best scan candidates, ordered by descending score. One extra slot is used while ranking.
+  ApCandidate candidates_[CO_BMEC_WIFI_MAX_CANDIDATES + 1]{};
+  uint8_t candidateCount_ = 0;
+  uint8_t candidateIndex_ = 0;  ///< Next candidate to attempt.
+  unsigned long candidatesTMs_ = 0;  ///< Time of the scan that produced the candidates.
+  bool candidatesValid_ = false;
+  bool pinProfile_ = false;  ///< Connect to the active profile without selection on the next attempt.
+
+  __unused void setApError(const String &errorMessage);
 
   void setScanError(const String &errorMessage);
 
-  void onWifiEvent(WiFiEvent_t event);
+  static CoBmecWifiStateMachine::WifiEvent toWifiEvent(WiFiEvent_t event, const WiFiEventInfo_t &info);
 
   void loadConfig();
 
-  void setConfig();
+  void setConfig(const ApRequest &apRequest);
 
   void saveConfig();
 
   void deleteConfig();
 
+  int findProfile(const String &ssid) const;
+
+  int upsertProfile(const ApProfile &profile);
+
+  void removeProfile(int profileIndex);
+
+  void rankCandidates(int resultCount, bool merge);
+
+  bool candidatesFresh() const;
+
+  const ApCandidate *selectProfile();
+
+  void runApRequest(const ApRequest &apRequest);
+
   void wifiDisconnect();
 
-  void wifiConnect();
+  bool wifiConnect(const ApCandidate *candidate = nullptr);
+
+  bool startScan(uint8_t channel);
+
+  uint8_t nextScanChannel() const;
+
+  void publishScanResults(int resultCount, bool done);
 
-  void internetPing();
+  void applyListenInterval();
 
-  void onScanDone();
+  void applyPowerSave();
+
+  void savePowerProfile();
+
+  void recordTrace(const CoBmecWifiStateMachine::WifiEvent &wifiEvent);
 
   // Overrides.
+  void onRead(BLECharacteristic *characteristic) override;
+
   void onWrite(BLECharacteristic *characteristic) override;
 
+  uint32_t millis() override;
+
+  uint32_t random(uint32_t max) override;
+
+  bool connect() override;
+
+  void disconnect() override;
+
+  bool ping() override;
+
+  long rssiDbm() override;
+
+  bool scanNeeded() override;
+
+  void scan() override;
+
+  CoBmecWifiStateMachine::ScanResult scanDone() override;
+
+  bool betterApFound() override;
+
+  void onConnected() override;
+
+  void onConnectFailed() override;
+
+  void onApState(ApState apState) override;
+
+  void onScanState(ScanState scanState) override;
+
   [[noreturn]] static void task(void *coBmecWifiRef);
 
 };
@@ -0,0 +1,176 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup wifi wifi
+/// @{
+
+/// @file co_bmec_wifi_power.cpp
+/// @brief Power save profile, awake windows and current estimate of the wifi module.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include <cstdio>
+#include "co_bmec_wifi_power.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+/// Nominal figures from the ESP32 datasheet. The estimate is only as good as these.
+#define CURRENT_ACTIVE_UA           100000  /// Radio receiving, CPU at 80 MHz.
+#define CURRENT_MODEM_SLEEP_UA      20000  /// Radio off, CPU at 80 MHz.
+#define BEACON_INTERVAL_US          102400  /// 100 TU, the usual AP default.
+#define BEACON_WAKE_US              3000  /// Radio on time to receive one beacon.
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Public methods.
+
+/// Selects the mode used outside awake windows.
+/// @param tMs time of the change.
+/// @param profile mode.
+/// @param listenInterval beacon intervals between wakes in MAX_MODEM, clamped to 1-CO_BMEC_WIFI_POWER_MAX_LISTEN.
+/// @returns true if the mode the radio should be in changed.
+bool CoBmecWifiPower::setProfile(uint32_t tMs, Mode profile, uint8_t listenInterval) {
+  Mode previous = getMode();
+
+  // Charge the time so far at the previous listen interval.
+  accumulate(tMs);
+
+  profile_ = profile < Mode::COUNT ? profile : Mode::MIN_MODEM;
+  listenInterval_ = std::min(std::max(listenInterval,
+                                      uint8_t(1)),
+                             uint8_t(CO_BMEC_WIFI_POWER_MAX_LISTEN));
+  return getMode() != previous;
+}
+
+/// Opens an awake window.
+/// @param awakeReason reason.
+/// @returns true if the mode the radio should be in changed.
+bool CoBmecWifiPower::requestAwake(AwakeReason awakeReason) {
+  Mode previous = getMode();
+  awakeReasons_ |= static_cast<uint8_t>(awakeReason);
+  return getMode() != previous;
+}
+
+/// Closes an awake window.
+/// @param awakeReason reason.
+/// @returns true if the mode the radio should be in changed.
+bool CoBmecWifiPower::releaseAwake(AwakeReason awakeReason) {
+  Mode previous = getMode();
+  awakeReasons_ &= ~static_cast<uint8_t>(awakeReason);
+  return getMode() != previous;
+}
+
+/// Records the mode applied to the radio.
+/// @param tMs time the mode was applied.
+/// @param mode mode.
+void CoBmecWifiPower::onMode(uint32_t tMs, Mode mode) {
+  accumulate(tMs);
+  mode_ = mode;
+}
+
+/// Counts an NTP poll.
+/// @param synced true if the time was synced before the poll timed out.
+void CoBmecWifiPower::onNtpPoll(bool synced) {
+  if (ntpPolls_ < UINT16_MAX) {
+    ntpPolls_++;
+    if (!synced) {
+      ntpMisses_++;
+    }
+  }
+}
+
+/// @param tMs time of the report.
+/// @returns the report.
+CoBmecWifiPower::Report CoBmecWifiPower::report(uint32_t tMs) const {
+  Report report;
+  report.profile = static_cast<uint8_t>(profile_);
+  report.listenInterval = listenInterval_;
+  report.awakeReasons = awakeReasons_;
+  report.mode = static_cast<uint8_t>(mode_);
+  report.ntpPolls = ntpPolls_;
+  report.ntpMisses = ntpMisses_;
+  report.ntpMissPerMille = ntpPolls_ ? uint16_t(uint32_t(ntpMisses_) * 1000 / ntpPolls_) : 0;
+
+  // Include the time in the current mode.
+  uint32_t dwellMs = tMs - modeTMs_;
+  uint64_t totalMs = dwellMs;
+  for (size_t mode = 0; mode < static_cast<size_t>(Mode::COUNT); mode++) {
+    uint64_t modeMs = modeMs_[mode] + (mode == static_cast<size_t>(mode_) ? dwellMs : 0);
+    report.modeMs[mode] = uint32_t(std::min(modeMs,
+                                            uint64_t(UINT32_MAX)));
+    totalMs += modeMs_[mode];
+  }
+  if (totalMs) {
+    uint64_t chargeUaMs = chargeUaMs_ + uint64_t(dwellMs) * currentUa(mode_,
+                                                                       listenInterval_);
+    report.averageCurrentMa = uint16_t(chargeUaMs / totalMs / 1000);
+  }
+  return report;
+}
+
+/// Formats the report as text.
+/// @param tMs time of the report.
+/// @param buffer output.
+/// @param length length of the buffer.
+/// @returns number of characters written.
+size_t CoBmecWifiPower::format(uint32_t tMs, char *buffer, size_t length) const {
+  Report data = report(tMs);
+  int count = snprintf(buffer,
+                       length,
+                       "power profile %u listen %u awake 0x%02x mode %u current %u mA"
+                       " none %lums min %lums max %lums ntp %u missed %u (%u/1000)\n",
+                       data.profile,
+                       data.listenInterval,
+                       data.awakeReasons,
+                       data.mode,
+                       data.averageCurrentMa,
+                       (unsigned long) data.modeMs[static_cast<size_t>(Mode::NONE)],
+                       (unsigned long) data.modeMs[static_cast<size_t>(Mode::MIN_MODEM)],
+                       (unsigned long) data.modeMs[static_cast<size_t>(Mode::MAX_MODEM)],
+                       data.ntpPolls,
+                       data.ntpMisses,
+                       data.ntpMissPerMille);
+  return count > 0 ? std::min(size_t(count),
+                              length ? length - 1 : 0) : 0;
+}
+
+/// Estimates the average current of a mode.
+/// In the modem sleep modes the radio only wakes to receive beacons, once per beacon interval
+/// in MIN_MODEM (DTIM 1) and once per listen interval in MAX_MODEM.
+/// @param mode mode.
+/// @param listenInterval listen interval.
+/// @returns current in uA.
+uint32_t CoBmecWifiPower::currentUa(Mode mode, uint8_t listenInterval) {
+  uint32_t wakeIntervalUs = BEACON_INTERVAL_US;
+  switch (mode) {
+    case Mode::NONE:return CURRENT_ACTIVE_UA;
+    case Mode::MAX_MODEM:wakeIntervalUs *= std::max(listenInterval,
+                                                    uint8_t(1));
+      break;
+    default:break;
+  }
+  return CURRENT_MODEM_SLEEP_UA
+      + uint32_t(uint64_t(CURRENT_ACTIVE_UA - CURRENT_MODEM_SLEEP_UA) * BEACON_WAKE_US / wakeIntervalUs);
+}
+
+// Private methods.
+
+/// Charges the time in the applied mode.
+void CoBmecWifiPower::accumulate(uint32_t tMs) {
+  uint32_t dwellMs = tMs - modeTMs_;
+  modeMs_[static_cast<size_t>(mode_)] += dwellMs;
+  chargeUaMs_ += uint64_t(dwellMs) * currentUa(mode_,
+                                               listenInterval_);
+  modeTMs_ = tMs;
+}
+
+/// @}
@@ -0,0 +1,117 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup wifi wifi
+/// @{
+
+/// @file co_bmec_wifi_power.h
+/// @brief Power save profile, awake windows and current estimate of the wifi module.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include <cstdint>
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_WIFI_POWER_VERSION                1
+#define CO_BMEC_WIFI_POWER_DEFAULT_LISTEN         3  ///< Beacon intervals between wakes in MAX_MODEM, IDF default.
+#define CO_BMEC_WIFI_POWER_MAX_LISTEN             10  ///< Longer intervals risk the AP dropping buffered frames.
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Chooses the radio power save mode from the selected profile and the open awake windows,
+/// and accounts the time spent in each mode to estimate the average current.
+/// The radio calls are left to the caller so that the accounting builds on the host.
+class CoBmecWifiPower {
+ public:
+
+  /// Power save modes, in the order of wifi_ps_type_t.
+  enum class Mode : uint8_t {
+    NONE,  ///< Always awake.
+    MIN_MODEM,  ///< Wakes every DTIM.
+    MAX_MODEM,  ///< Wakes every listen interval.
+    COUNT,
+  };
+
+  /// Reasons to keep the radio fully awake. Combined as a bit mask.
+  enum class AwakeReason : uint8_t {
+    NTP = 1 << 0,
+    OTA = 1 << 1,
+    BLE = 1 << 2,
+  };
+
+  /// Report as published.
+  struct __attribute__((packed)) Report {
+    uint8_t version = CO_BMEC_WIFI_POWER_VERSION;
+    uint8_t profile = 0;  ///< Mode used outside awake windows.
+    uint8_t listenInterval = 0;
+    uint8_t awakeReasons = 0;  ///< Open awake windows.
+    uint8_t mode = 0;  ///< Mode applied to the radio.
+    uint16_t averageCurrentMa = 0;  ///< Estimated since boot.
+    uint16_t ntpPolls = 0;
+    uint16_t ntpMisses = 0;  ///< Polls that timed out without a time sync.
+    uint16_t ntpMissPerMille = 0;
+    uint32_t modeMs[static_cast<size_t>(Mode::COUNT)]{};  ///< Time spent in each mode.
+  };
+
+  bool setProfile(uint32_t tMs, Mode profile, uint8_t listenInterval);
+
+  bool requestAwake(AwakeReason awakeReason);
+
+  bool releaseAwake(AwakeReason awakeReason);
+
+  /// @returns the mode the radio should be in.
+  Mode getMode() const {
+    return awakeReasons_ ? Mode::NONE : profile_;
+  };
+
+  Mode getProfile() const {
+    return profile_;
+  };
+
+  uint8_t getListenInterval() const {
+    return listenInterval_;
+  };
+
+  void onMode(uint32_t tMs, Mode mode);
+
+  void onNtpPoll(bool synced);
+
+  Report report(uint32_t tMs) const;
+
+  size_t format(uint32_t tMs, char *buffer, size_t length) const;
+
+  static uint32_t currentUa(Mode mode, uint8_t listenInterval);
+
+ private:
+
+  Mode profile_ = Mode::MIN_MODEM;  ///< Arduino enables MIN_MODEM when the radio starts.
+  uint8_t listenInterval_ = CO_BMEC_WIFI_POWER_DEFAULT_LISTEN;
+  uint8_t awakeReasons_ = 0;
+
+  Mode mode_ = Mode::MIN_MODEM;  ///< Mode applied to the radio.
+  uint32_t modeTMs_ = 0;  ///< Time the applied mode was entered.
+  uint64_t modeMs_[static_cast<size_t>(Mode::COUNT)]{};
+  uint64_t chargeUaMs_ = 0;  ///< Charge of the previous modes.
+
+  uint16_t ntpPolls_ = 0;
+  uint16_t ntpMisses_ = 0;
+
+  void accumulate(uint32_t tMs);
+};
+
+/// @}
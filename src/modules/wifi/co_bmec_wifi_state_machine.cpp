@@ -0,0 +1,387 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup wifi wifi
+/// @{
+
+/// @file co_bmec_wifi_state_machine.cpp
+/// @brief Platform independent AP and scan state machine of the wifi module.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include "co_bmec_wifi_state_machine.h"
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#include "modules/log/co_bmec_log.h"
+#else
+#include <cstdio>
+#define log_e(format, ...) printf("E " format "\n", ##__VA_ARGS__)
+#define log_w(format, ...) printf("W " format "\n", ##__VA_ARGS__)
+#define log_i(format, ...) ((void) 0)
+#define log_v(format, ...) ((void) 0)
+#define CO_BMEC_LOG_I(module, format, ...) ((void) 0)
+#endif
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define BACKOFF_BASE_MS              1000
+#define BACKOFF_JITTER_MS            1000
+#define BACKOFF_MAX_EXPONENT         5  /// 2^5 * BACKOFF_BASE_MS reaches CONNECT_MAX_BACKOFF_MS.
+#define CONNECT_MAX_BACKOFF_MS       32000
+
+#define ROAM_RSSI_DBM                (-75)  /// RSSI below which roaming is considered.
+#define ROAM_LOW_RSSI_SAMPLES        6  /// Consecutive low samples before a roaming scan.
+#define ROAM_SAMPLE_MS               5000
+#define ROAM_SCAN_INTERVAL_MS        120000  /// Minimum time between roaming scans.
+
+//*********************************************************************
+// Constants.
+//*********************************************************************
+
+/// Logged by address, the names stay in flash.
+static const char *const AP_STATE_NAMES[] = {
+    "UNDEFINED", "ERROR", "DISCONNECTING", "DISCONNECTED", "CONNECTING", "CONNECTED", "PINGING", "PINGED",
+};
+static const char *const SCAN_STATE_NAMES[] = {
+    "UNDEFINED", "ERROR", "SCANNING", "SCANNED",
+};
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Constructors.
+
+/// @param clock time source.
+/// @param driver radio and profile store.
+/// @param listener state outputs.
+CoBmecWifiStateMachine::CoBmecWifiStateMachine(
+    Clock &clock, Driver &driver, Listener &listener)
+    : clock_(clock),
+      driver_(driver),
+      listener_(listener) {}
+
+// Public methods.
+
+/// Handles events from the wifi driver.
+/// @param wifiEvent event.
+void CoBmecWifiStateMachine::onEvent(const WifiEvent &wifiEvent) {
+
+  switch (wifiEvent.event) {
+    case Event::WIFI_READY: {
+      log_i("WiFi ready.");
+    }
+      break;
+    case Event::SCAN_DONE: {
+      ScanResult scanResult = driver_.scanDone();
+      if (scanResult == ScanResult::NEXT) {
+        CO_BMEC_LOG_I(WIFI,
+                      "WiFi scan part done.");
+        break;
+      }
+      CO_BMEC_LOG_I(WIFI,
+                    "WiFi scan done.");
+
+      // Roam if a sufficiently stronger AP was found.
+      if (roamScan_) {
+        roamScan_ = false;
+        if ((apState_ == ApState::CONNECTED || apState_ == ApState::PINGED)
+            && driver_.betterApFound()) {
+          // The next connection attempt is to the best candidate.
+          disconnect();
+        }
+      }
+
+      setScanState(scanResult == ScanResult::DONE ? ScanState::SCANNED : ScanState::ERROR);
+    }
+      break;
+    case Event::STA_START: {
+      log_i("WiFi started.");
+      setApState(ApState::DISCONNECTED);
+    }
+      break;
+    case Event::STA_STOP: {
+      log_i("WiFi stopped.");
+    }
+      break;
+    case Event::STA_CONNECTED: {
+      log_i("Connected to WiFi access point.");
+      // Do nothing - wait for IP.
+    }
+      break;
+    case Event::STA_DISCONNECTED: {
+      log_i("Disconnected from WiFi access point. Reason: %u",
+            wifiEvent.reason);
+      if (apState_ == ApState::CONNECTING) {
+        driver_.onConnectFailed();
+      }
+      setApState(ApState::DISCONNECTED);
+    }
+      break;
+    case Event::STA_AUTHMODE_CHANGE: {
+      log_i("Authentication mode of access point has changed.");
+      setApState(ApState::DISCONNECTED);
+    }
+      break;
+    case Event::STA_GOT_IP: {
+      driver_.onConnected();
+      roamLowRssiCount_ = 0;
+      setApState(ApState::CONNECTED);
+    }
+      break;
+    case Event::STA_LOST_IP: {
+      log_i("Lost IP address and IP address is reset to 0.");
+      setApState(ApState::DISCONNECTED);
+    }
+      break;
+    default: {
+      log_e("Unexpected wifi event.");
+    }
+      break;
+  }
+}
+
+/// Runs one iteration of the task loop.
+void CoBmecWifiStateMachine::step() {
+
+  switch (apState_) {
+    case ApState::UNDEFINED:
+    case ApState::ERROR:
+    case ApState::DISCONNECTING:break;
+    case ApState::DISCONNECTED: {
+      if (scanState_ != ScanState::SCANNING) {
+        // Return if delay has not expired.
+        if ((clock_.millis() - lastConnectTMs_) > connectBackoffMs_) {
+          // Scan to rank the profiles first if required.
+          if (driver_.scanNeeded()) {
+            scan();
+            break;
+          }
+
+          // Set the last connection attempt time.
+          lastConnectTMs_ = clock_.millis();
+
+          // Start the connection attempt.
+          connect();
+
+          // Compute the backoff delay.
+          connectBackoffMs_ = backoffMs(connectBackoffIndex_);
+
+          // Log the backoff.
+          log_i("If WiFi connection fails next attempt will be in %lu ms",
+                (unsigned long) connectBackoffMs_);
+        }
+      }
+    }
+      break;
+    case ApState::CONNECTING:break;
+    case ApState::CONNECTED: {
+      // Reset the backoff index.
+      connectBackoffIndex_ = 0;
+      // Reset the last ping time.
+      lastConnectTMs_ = 0;
+      // Reset backoff delay.
+      connectBackoffMs_ = 0;
+
+      // Start the ping attempt.
+      ping();
+
+      // Look for a better AP.
+      roamCheck();
+    }
+      break;
+    case ApState::PINGING:break;
+    case ApState::PINGED: {
+      // Look for a better AP.
+      roamCheck();
+    }
+      break;
+  }
+}
+
+/// Attempts to make wifi connection.
+void CoBmecWifiStateMachine::connect() {
+  if (!driver_.connect()) {
+    log_w("WARNING: Attempted to connect to AP with no profile");
+    setApState(ApState::DISCONNECTED);
+    return;
+  }
+  setApState(ApState::CONNECTING);
+}
+
+/// Drops the wifi connection.
+void CoBmecWifiStateMachine::disconnect() {
+  setApState(ApState::DISCONNECTING);
+  driver_.disconnect();
+}
+
+/// Moves on to the next profile, e.g. after the active one was removed.
+/// Only an associated station waits in DISCONNECTING for the driver to report the drop, as
+/// no STA_DISCONNECTED may come otherwise. An attempt in progress is abandoned and a backoff
+/// cut short, so that the next step connects.
+void CoBmecWifiStateMachine::reconnect() {
+  switch (apState_) {
+    case ApState::CONNECTED:
+    case ApState::PINGING:
+    case ApState::PINGED: {
+      disconnect();
+    }
+      break;
+    case ApState::DISCONNECTING:break;
+    case ApState::CONNECTING: {
+      driver_.disconnect();
+    }
+      [[fallthrough]];
+    default: {
+      connectBackoffIndex_ = 0;
+      lastConnectTMs_ = 0;
+      connectBackoffMs_ = 0;
+      setApState(ApState::DISCONNECTED);
+    }
+      break;
+  }
+}
+
+/// Attempts to ping the internet.
+/// Prevents continuous calls with exponential backoff.
+void CoBmecWifiStateMachine::ping() {
+
+  // Return if delay has not expired.
+  if ((clock_.millis() - lastPingTMs_) < pingBackoffMs_) {
+    return;
+  }
+
+  // Set the state.
+  setApState(ApState::PINGING);
+
+  // Set the last ping.
+  lastPingTMs_ = clock_.millis();
+
+  // If ping fails set the state back to connected and delay before trying again.
+  if (driver_.ping()) {
+    // Set the state.
+    setApState(ApState::PINGED);
+
+    // Reset the backoff index.
+    pingBackoffIndex_ = 0;
+    // Reset the last ping time.
+    lastPingTMs_ = 0;
+    // Reset backoff delay.
+    pingBackoffMs_ = 0;
+
+  }
+  else {
+    // Set the state.
+    setApState(ApState::CONNECTED);
+
+    // Compute the backoff delay.
+    pingBackoffMs_ = backoffMs(pingBackoffIndex_);
+
+    // Log the delay.
+    log_w("Failed to ping google. Trying again after %lu ms",
+          (unsigned long) pingBackoffMs_);
+  }
+}
+
+/// Starts an asynchronous scan.
+/// @param roamScan true if the scan is looking for a better AP while connected.
+void CoBmecWifiStateMachine::scan(bool roamScan) {
+  roamScan_ = roamScan;
+  setScanState(ScanState::SCANNING);
+  driver_.scan();
+}
+
+/// If PINGED then return to CONNECTED to force ping test.
+void CoBmecWifiStateMachine::checkInternet() {
+  if (apState_ == ApState::PINGED) {
+    log_i("Internet check started...");
+    setApState(ApState::CONNECTED);
+  }
+  else {
+    log_w("Internet check requested but the AP is busy with a connection attempt or not connected.");
+  }
+}
+
+/// Sets the AP state and notifies the listener.
+void CoBmecWifiStateMachine::setApState(ApState apState) {
+
+  // Log state.
+  CO_BMEC_LOG_I(WIFI,
+                "ApState: %s",
+                AP_STATE_NAMES[int(apState)]);
+
+  // Set the state.
+  apState_ = apState;
+
+  listener_.onApState(apState);
+}
+
+/// Sets the scanning state and notifies the listener.
+void CoBmecWifiStateMachine::setScanState(ScanState scanState) {
+  // Log state.
+  CO_BMEC_LOG_I(WIFI,
+                "ScanState: %s",
+                SCAN_STATE_NAMES[int(scanState)]);
+
+  // Set the state.
+  scanState_ = scanState;
+
+  listener_.onScanState(scanState);
+}
+
+// Private methods.
+
+/// Computes an exponential backoff delay with jitter.
+/// The exponent is capped so the delay saturates at CONNECT_MAX_BACKOFF_MS however many attempts fail.
+/// @param backoffIndex attempt count, incremented up to the cap.
+/// @returns delay in ms.
+uint32_t CoBmecWifiStateMachine::backoffMs(uint8_t &backoffIndex) {
+  uint32_t delayMs = (uint32_t(BACKOFF_BASE_MS) << backoffIndex)
+      + clock_.random(BACKOFF_JITTER_MS);
+  if (backoffIndex < BACKOFF_MAX_EXPONENT) {
+    backoffIndex++;
+  }
+  return std::min(delayMs,
+                  uint32_t(CONNECT_MAX_BACKOFF_MS));
+}
+
+/// Samples the RSSI of the connected AP and starts a background scan
+/// when it stays below the roaming threshold.
+void CoBmecWifiStateMachine::roamCheck() {
+  // Return if the sample period has not expired.
+  if ((clock_.millis() - roamSampleTMs_) < ROAM_SAMPLE_MS) {
+    return;
+  }
+  roamSampleTMs_ = clock_.millis();
+
+  long rssiDbm = driver_.rssiDbm();
+  if (rssiDbm >= ROAM_RSSI_DBM) {
+    roamLowRssiCount_ = 0;
+    return;
+  }
+  if (++roamLowRssiCount_ < ROAM_LOW_RSSI_SAMPLES) {
+    return;
+  }
+  roamLowRssiCount_ = 0;
+
+  // Limit the rate of roaming scans.
+  if (scanState_ == ScanState::SCANNING
+      || (roamScanTMs_ && (clock_.millis() - roamScanTMs_) < ROAM_SCAN_INTERVAL_MS)) {
+    return;
+  }
+  roamScanTMs_ = clock_.millis();
+
+  log_i("RSSI %ld dBm is below the roaming threshold. Scanning for a better AP.",
+        rssiDbm);
+  scan(true);
+}
+
+/// @}
@@ -0,0 +1,198 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup wifi wifi
+/// @{
+
+/// @file co_bmec_wifi_state_machine.h
+/// @brief Platform independent AP and scan state machine of the wifi module.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstdint>
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// AP and scan state machine.
+/// The radio, time and outputs are reached through the Clock, Driver and Listener interfaces
+/// so that the state machine builds on the host with a simulated driver and a virtual clock.
+class CoBmecWifiStateMachine {
+ public:
+
+  enum class ApState {
+    UNDEFINED, ERROR, DISCONNECTING, DISCONNECTED, CONNECTING, CONNECTED, PINGING, PINGED,
+  };
+
+  enum class ScanState {
+    UNDEFINED, ERROR, SCANNING, SCANNED,
+  };
+
+  /// Driver events. Decoupled from WiFiEvent_t so that recorded traces replay on any platform.
+  /// PING_SUCCEEDED and PING_FAILED are never passed to onEvent; they are recorded in traces
+  /// so that replays answer pings as the device did.
+  enum class Event : uint8_t {
+    UNDEFINED,
+    WIFI_READY,
+    SCAN_DONE,
+    STA_START,
+    STA_STOP,
+    STA_CONNECTED,
+    STA_DISCONNECTED,
+    STA_AUTHMODE_CHANGE,
+    STA_GOT_IP,
+    STA_LOST_IP,
+    PING_SUCCEEDED,
+    PING_FAILED,
+  };
+
+  /// Outcome of processing a scan result.
+  enum class ScanResult {
+    FAILED,  ///< The scan failed.
+    NEXT,  ///< Part of a scan completed and the next part was started.
+    DONE,  ///< The scan completed.
+  };
+
+  /// Driver event and, for disconnections, the reason reported by the driver.
+  struct WifiEvent {
+    Event event = Event::UNDEFINED;
+    uint8_t reason = 0;
+  };
+
+  /// Time source.
+  class Clock {
+   public:
+    virtual ~Clock() = default;
+
+    /// @returns milliseconds since start.
+    virtual uint32_t millis() = 0;
+
+    /// @returns a random number in [0, max).
+    virtual uint32_t random(uint32_t max) = 0;
+  };
+
+  /// Radio and profile store.
+  class Driver {
+   public:
+    virtual ~Driver() = default;
+
+    /// Starts a connection attempt to the next profile.
+    /// @returns false if there is no profile to connect to.
+    virtual bool connect() = 0;
+
+    virtual void disconnect() = 0;
+
+    /// Pings the internet. May block.
+    /// @returns true on success.
+    virtual bool ping() = 0;
+
+    /// @returns the rssi of the connected AP in dBm.
+    virtual long rssiDbm() = 0;
+
+    /// @returns true if the profiles must be ranked by a scan before the next connection attempt.
+    virtual bool scanNeeded() = 0;
+
+    /// Starts an asynchronous scan.
+    virtual void scan() = 0;
+
+    /// Processes the results of a completed scan, which may be one part of a multi part scan.
+    /// @returns whether the scan failed, continues or is done.
+    virtual ScanResult scanDone() = 0;
+
+    /// @returns true if the last scan found an AP worth roaming to.
+    virtual bool betterApFound() = 0;
+
+    /// Called when an IP address is obtained.
+    virtual void onConnected() = 0;
+
+    /// Called when a connection attempt fails.
+    virtual void onConnectFailed() = 0;
+  };
+
+  /// State outputs.
+  class Listener {
+   public:
+    virtual ~Listener() = default;
+
+    virtual void onApState(ApState apState) = 0;
+
+    virtual void onScanState(ScanState scanState) = 0;
+  };
+
+  CoBmecWifiStateMachine(Clock &clock, Driver &driver, Listener &listener);
+
+  ApState getApState() const {
+    return apState_;
+  };
+
+  ScanState getScanState() const {
+    return scanState_;
+  };
+
+  void onEvent(const WifiEvent &wifiEvent);
+
+  void step();
+
+  void connect();
+
+  void disconnect();
+
+  void reconnect();
+
+  void ping();
+
+  void scan(bool roamScan = false);
+
+  void checkInternet();
+
+  void setApState(ApState apState);
+
+  void setScanState(ScanState scanState);
+
+ private:
+
+  Clock &clock_;
+  Driver &driver_;
+  Listener &listener_;
+
+  ApState apState_ = ApState::DISCONNECTED;
+  ScanState scanState_ = ScanState::UNDEFINED;
+
+  /// Connection backoff.
+  uint8_t connectBackoffIndex_ = 0;
+  uint32_t lastConnectTMs_ = 0;
+  uint32_t connectBackoffMs_ = 0;
+
+  /// Ping backoff.
+  uint8_t pingBackoffIndex_ = 0;
+  uint32_t lastPingTMs_ = 0;
+  uint32_t pingBackoffMs_ = 0;
+
+  /// Roaming.
+  bool roamScan_ = false;  ///< The running scan was started to look for a better AP.
+  uint8_t roamLowRssiCount_ = 0;  ///< Consecutive RSSI samples below the roaming threshold.
+  uint32_t roamSampleTMs_ = 0;
+  uint32_t roamScanTMs_ = 0;
+
+  uint32_t backoffMs(uint8_t &backoffIndex);
+
+  void roamCheck();
+
+};
+
+/// @}
@@ -0,0 +1,205 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup wifi wifi
+/// @{
+
+/// @file co_bmec_wifi_telemetry.cpp
+/// @brief Dwell time, recovery time and disconnect reason statistics of the wifi module.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include <cstdio>
+#include "co_bmec_wifi_telemetry.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define BUCKET_0_SHIFT          7  /// The first bucket holds durations below 128 ms.
+#define REASON_HIGH_BASE        200  /// ESP specific reasons start at 200.
+#define REASON_LOW_COUNT        64
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+// Public methods.
+
+/// Records the time spent in the previous AP state and the recovery time.
+/// @param tMs time of the transition.
+/// @param apState new state.
+void CoBmecWifiTelemetry::onApState(uint32_t tMs, CoBmecWifiStateMachine::ApState apState) {
+  using ApState = CoBmecWifiStateMachine::ApState;
+
+  auto previous = static_cast<ApState>(data_.apState);
+  uint32_t dwellMs = tMs - data_.apStateTMs;
+
+  switch (previous) {
+    case ApState::CONNECTING:record(Histogram::CONNECTING,
+                                    dwellMs);
+      break;
+    case ApState::CONNECTED:record(Histogram::CONNECTED,
+                                   dwellMs);
+      break;
+    case ApState::PINGING:record(Histogram::PINGING,
+                                 dwellMs);
+      break;
+    default:break;
+  }
+
+  // A connection with an IP address was lost.
+  if ((apState == ApState::DISCONNECTING || apState == ApState::DISCONNECTED)
+      && (previous == ApState::CONNECTED || previous == ApState::PINGING || previous == ApState::PINGED)) {
+    data_.disconnects = increment(data_.disconnects);
+    if (!recovering_) {
+      recovering_ = true;
+      disconnectTMs_ = tMs;
+    }
+  }
+
+  // Recovered.
+  if (apState == ApState::PINGED && recovering_) {
+    recovering_ = false;
+    record(Histogram::RECOVERY,
+           tMs - disconnectTMs_);
+  }
+
+  data_.apState = static_cast<uint8_t>(apState);
+  data_.apStateTMs = tMs;
+}
+
+/// Records the time spent scanning.
+/// @param tMs time of the transition.
+/// @param scanState new state.
+void CoBmecWifiTelemetry::onScanState(uint32_t tMs, CoBmecWifiStateMachine::ScanState scanState) {
+  using ScanState = CoBmecWifiStateMachine::ScanState;
+
+  // Repeated SCANNING states extend the same scan.
+  if (static_cast<ScanState>(data_.scanState) == ScanState::SCANNING) {
+    if (scanState == ScanState::SCANNING) {
+      return;
+    }
+    record(Histogram::SCANNING,
+           tMs - data_.scanStateTMs);
+  }
+
+  data_.scanState = static_cast<uint8_t>(scanState);
+  data_.scanStateTMs = tMs;
+}
+
+/// Counts the disconnect reasons.
+/// @param wifiEvent event.
+void CoBmecWifiTelemetry::onEvent(const CoBmecWifiStateMachine::WifiEvent &wifiEvent) {
+  if (wifiEvent.event == CoBmecWifiStateMachine::Event::STA_DISCONNECTED) {
+    uint8_t index = reasonIndex(wifiEvent.reason);
+    data_.reasons[index] = increment(data_.reasons[index]);
+  }
+}
+
+/// Formats the non-zero counters as text.
+/// @param buffer output.
+/// @param length length of the buffer.
+/// @returns number of characters written.
+size_t CoBmecWifiTelemetry::format(char *buffer, size_t length) const {
+  static const char *HISTOGRAM_NAMES[] = {
+      "connecting", "connected", "pinging", "scanning", "recovery",
+  };
+
+  size_t written = 0;
+  // Appends to the buffer, truncating when full.
+  auto append = [&](int count) {
+    if (count > 0) {
+      written = std::min(written + size_t(count),
+                         length ? length - 1 : 0);
+    }
+  };
+
+  append(snprintf(buffer + written,
+                  length - written,
+                  "ap %u scan %u disconnects %u\n",
+                  data_.apState,
+                  data_.scanState,
+                  data_.disconnects));
+
+  for (size_t histogram = 0; histogram < static_cast<size_t>(Histogram::COUNT); histogram++) {
+    append(snprintf(buffer + written,
+                    length - written,
+                    "%s:",
+                    HISTOGRAM_NAMES[histogram]));
+    for (uint8_t bucket = 0; bucket < CO_BMEC_WIFI_TELEMETRY_BUCKETS; bucket++) {
+      if (data_.histograms[histogram][bucket]) {
+        append(snprintf(buffer + written,
+                        length - written,
+                        " <%lums:%u",
+                        (unsigned long) bucketUpperMs(bucket),
+                        data_.histograms[histogram][bucket]));
+      }
+    }
+    append(snprintf(buffer + written,
+                    length - written,
+                    "\n"));
+  }
+
+  append(snprintf(buffer + written,
+                  length - written,
+                  "reasons:"));
+  for (uint8_t index = 0; index < CO_BMEC_WIFI_TELEMETRY_REASONS; index++) {
+    if (data_.reasons[index]) {
+      append(snprintf(buffer + written,
+                      length - written,
+                      " %u:%u",
+                      index < REASON_LOW_COUNT ? index : index - REASON_LOW_COUNT + REASON_HIGH_BASE,
+                      data_.reasons[index]));
+    }
+  }
+  append(snprintf(buffer + written,
+                  length - written,
+                  "\n"));
+
+  return written;
+}
+
+/// @param bucket bucket index.
+/// @returns the exclusive upper bound of the bucket in ms, UINT32_MAX for the last bucket.
+uint32_t CoBmecWifiTelemetry::bucketUpperMs(uint8_t bucket) {
+  return bucket < CO_BMEC_WIFI_TELEMETRY_BUCKETS - 1 ? uint32_t(1) << (bucket + BUCKET_0_SHIFT) : UINT32_MAX;
+}
+
+// Private methods.
+
+/// Adds a duration to a histogram.
+void CoBmecWifiTelemetry::record(Histogram histogram, uint32_t durationMs) {
+  uint8_t bucket = 0;
+  while (bucket < CO_BMEC_WIFI_TELEMETRY_BUCKETS - 1 && durationMs >= bucketUpperMs(bucket)) {
+    bucket++;
+  }
+  auto index = static_cast<size_t>(histogram);
+  data_.histograms[index][bucket] = increment(data_.histograms[index][bucket]);
+}
+
+/// Maps a disconnect reason to its counter.
+/// Reasons 0-63 map directly, 200-215 follow, anything else is counted as 0.
+uint8_t CoBmecWifiTelemetry::reasonIndex(uint8_t reason) {
+  if (reason < REASON_LOW_COUNT) {
+    return reason;
+  }
+  if (reason >= REASON_HIGH_BASE
+      && reason < REASON_HIGH_BASE + CO_BMEC_WIFI_TELEMETRY_REASONS - REASON_LOW_COUNT) {
+    return reason - REASON_HIGH_BASE + REASON_LOW_COUNT;
+  }
+  return 0;
+}
+
+/// Increments a counter, saturating at its maximum.
+/// @returns the incremented counter.
+uint16_t CoBmecWifiTelemetry::increment(uint16_t counter) {
+  return counter < UINT16_MAX ? counter + 1 : counter;
+}
+
+/// @}
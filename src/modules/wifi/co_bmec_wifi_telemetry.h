@@ -0,0 +1,90 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup wifi wifi
+/// @{
+
+/// @file co_bmec_wifi_telemetry.h
+/// @brief Dwell time, recovery time and disconnect reason statistics of the wifi module.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include "co_bmec_wifi_state_machine.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_WIFI_TELEMETRY_VERSION        1
+#define CO_BMEC_WIFI_TELEMETRY_BUCKETS        16  ///< Bucket i counts durations below 2^(i + 7) ms, the last is open.
+#define CO_BMEC_WIFI_TELEMETRY_REASONS        80  ///< Reasons 0-63 then 200-215, see reasonIndex().
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Timestamps the AP and scan state transitions and keeps fixed bucket histograms of the durations.
+/// The counters are kept in a packed struct so they are published without formatting.
+class CoBmecWifiTelemetry {
+ public:
+
+  enum class Histogram : uint8_t {
+    CONNECTING,  ///< Time spent connecting.
+    CONNECTED,  ///< Time spent connected before the ping.
+    PINGING,  ///< Time spent pinging.
+    SCANNING,  ///< Time spent scanning.
+    RECOVERY,  ///< Time from a disconnect to PINGED.
+    COUNT,
+  };
+
+  /// Counters as published. Counters saturate rather than wrap.
+  struct __attribute__((packed)) Data {
+    uint8_t version = CO_BMEC_WIFI_TELEMETRY_VERSION;
+    uint8_t apState = 0;
+    uint8_t scanState = 0;
+    uint32_t apStateTMs = 0;  ///< Time the current AP state was entered.
+    uint32_t scanStateTMs = 0;  ///< Time the current scan state was entered.
+    uint16_t disconnects = 0;  ///< Connections lost after an IP was obtained.
+    uint16_t histograms[static_cast<size_t>(Histogram::COUNT)][CO_BMEC_WIFI_TELEMETRY_BUCKETS]{};
+    uint16_t reasons[CO_BMEC_WIFI_TELEMETRY_REASONS]{};  ///< Disconnect reasons from WiFiEventInfo_t.
+  };
+
+  void onApState(uint32_t tMs, CoBmecWifiStateMachine::ApState apState);
+
+  void onScanState(uint32_t tMs, CoBmecWifiStateMachine::ScanState scanState);
+
+  void onEvent(const CoBmecWifiStateMachine::WifiEvent &wifiEvent);
+
+  const Data &getData() const {
+    return data_;
+  };
+
+  size_t format(char *buffer, size_t length) const;
+
+  static uint32_t bucketUpperMs(uint8_t bucket);
+
+ private:
+
+  Data data_;
+
+  bool recovering_ = false;  ///< A disconnect has not yet been recovered from.
+  uint32_t disconnectTMs_ = 0;
+
+  void record(Histogram histogram, uint32_t durationMs);
+
+  static uint8_t reasonIndex(uint8_t reason);
+
+  static uint16_t increment(uint16_t counter);
+};
+
+/// @}
@@ -0,0 +1,176 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup wifi wifi
+/// @{
+
+/// @file co_bmec_wifi_trace.cpp
+/// @brief Recording and deterministic replay of wifi driver event traces.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "co_bmec_wifi_trace.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+/// Adds a record, overwriting the oldest when full.
+/// @param tMs time of the event.
+/// @param wifiEvent event.
+void CoBmecWifiTrace::record(uint32_t tMs, const CoBmecWifiStateMachine::WifiEvent &wifiEvent) {
+  records_[head_].tMs = tMs;
+  records_[head_].wifiEvent = wifiEvent;
+  head_ = (head_ + 1) % CO_BMEC_WIFI_TRACE_LENGTH;
+  if (count_ < CO_BMEC_WIFI_TRACE_LENGTH) {
+    count_++;
+  }
+}
+
+/// Formats the records, oldest first, after a comment line.
+/// @param buffer output.
+/// @param length length of the buffer.
+/// @returns number of characters written.
+size_t CoBmecWifiTrace::format(char *buffer, size_t length) const {
+  size_t written = 0;
+  // Appends to the buffer, truncating when full.
+  auto append = [&](int count) {
+    if (count > 0) {
+      written = std::min(written + size_t(count),
+                         length ? length - 1 : 0);
+    }
+  };
+
+  append(snprintf(buffer,
+                  length,
+                  "# wifi trace: tMs event reason\n"));
+  for (size_t index = 0; index < count_; index++) {
+    const Record &record = (*this)[index];
+    append(snprintf(buffer + written,
+                    length - written,
+                    "%lu %u %u\n",
+                    (unsigned long) record.tMs,
+                    static_cast<uint8_t>(record.wifiEvent.event),
+                    record.wifiEvent.reason));
+  }
+  return written;
+}
+
+/// Records the lines of a formatted trace. Comment and malformed lines are skipped.
+/// @param text trace, as formatted.
+/// @returns number of records read.
+size_t CoBmecWifiTrace::parse(const char *text) {
+  size_t records = 0;
+  while (*text) {
+    const char *end = strchr(text,
+                             '\n');
+    size_t lineLength = end ? size_t(end - text) : strlen(text);
+
+    char line[CO_BMEC_WIFI_TRACE_LINE_LEN];
+    memcpy(line,
+           text,
+           std::min(lineLength,
+                    sizeof(line) - 1));
+    line[std::min(lineLength,
+                  sizeof(line) - 1)] = '\0';
+    text += end ? lineLength + 1 : lineLength;
+
+    unsigned long tMs;
+    unsigned int event;
+    unsigned int reason;
+    if (line[0] == '#' || lineLength >= sizeof(line)
+        || sscanf(line,
+                  "%lu %u %u",
+                  &tMs,
+                  &event,
+                  &reason) != 3
+        || event > static_cast<uint8_t>(CoBmecWifiStateMachine::Event::PING_FAILED)) {
+      continue;
+    }
+
+    CoBmecWifiStateMachine::WifiEvent wifiEvent;
+    wifiEvent.event = static_cast<CoBmecWifiStateMachine::Event>(event);
+    wifiEvent.reason = uint8_t(reason);
+    record(uint32_t(tMs),
+           wifiEvent);
+    records++;
+  }
+  return records;
+}
+
+/// Replays the trace through a state machine.
+/// The clock is stepped at CO_BMEC_WIFI_REPLAY_STEP_MS as the task loop would be,
+/// and each event is delivered at its recorded time.
+/// @param listener receives the state transitions.
+/// @param seed seed of the backoff jitter.
+/// @returns the driver with the action counts.
+CoBmecWifiReplayDriver CoBmecWifiTrace::replay(
+    CoBmecWifiStateMachine::Listener &listener, uint32_t seed) const {
+  CoBmecWifiVirtualClock clock(seed);
+  CoBmecWifiReplayDriver driver(*this);
+  CoBmecWifiStateMachine stateMachine(clock,
+                                      driver,
+                                      listener);
+
+  if (count_) {
+    clock.advance((*this)[0].tMs);
+  }
+
+  for (size_t index = 0; index < count_; index++) {
+    const Record &record = (*this)[index];
+
+    // Run the task loop up to the event.
+    while (clock.millis() + CO_BMEC_WIFI_REPLAY_STEP_MS <= record.tMs) {
+      clock.advance(CO_BMEC_WIFI_REPLAY_STEP_MS);
+      stateMachine.step();
+    }
+
+    // Ping results are answered by the driver.
+    if (record.wifiEvent.event == CoBmecWifiStateMachine::Event::PING_SUCCEEDED
+        || record.wifiEvent.event == CoBmecWifiStateMachine::Event::PING_FAILED) {
+      continue;
+    }
+
+    stateMachine.onEvent(record.wifiEvent);
+  }
+
+  return driver;
+}
+
+/// Xorshift generator, so replays are repeatable on any platform.
+/// @returns a random number in [0, max).
+uint32_t CoBmecWifiVirtualClock::random(uint32_t max) {
+  seed_ ^= seed_ << 13;
+  seed_ ^= seed_ >> 17;
+  seed_ ^= seed_ << 5;
+  return max ? seed_ % max : 0;
+}
+
+/// Answers with the next recorded ping result.
+/// @returns false if there are no more ping results.
+bool CoBmecWifiReplayDriver::ping() {
+  pingCount_++;
+  for (; pingIndex_ < trace_.size(); pingIndex_++) {
+    CoBmecWifiStateMachine::Event event = trace_[pingIndex_].wifiEvent.event;
+    if (event == CoBmecWifiStateMachine::Event::PING_SUCCEEDED
+        || event == CoBmecWifiStateMachine::Event::PING_FAILED) {
+      return trace_[pingIndex_++].wifiEvent.event
+          == CoBmecWifiStateMachine::Event::PING_SUCCEEDED;
+    }
+  }
+  return false;
+}
+
+/// @}
@@ -0,0 +1,161 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @ingroup wifi wifi
+/// @{
+
+/// @file co_bmec_wifi_trace.h
+/// @brief Recording and deterministic replay of wifi driver event traces.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include "co_bmec_wifi_state_machine.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define CO_BMEC_WIFI_TRACE_LENGTH          128  ///< Number of events kept, oldest are overwritten.
+#define CO_BMEC_WIFI_REPLAY_STEP_MS        100  ///< Task loop period simulated during replay.
+#define CO_BMEC_WIFI_TRACE_LINE_LEN        24  ///< Longest formatted record, see format().
+#define CO_BMEC_WIFI_TRACE_TEXT_LEN        (32 + CO_BMEC_WIFI_TRACE_LENGTH * CO_BMEC_WIFI_TRACE_LINE_LEN)
+
+//*********************************************************************
+// forward declarations.
+//*********************************************************************
+class CoBmecWifiReplayDriver;
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Fixed size ring buffer of driver events and ping results.
+///
+/// A trace is exported as text, one "tMs event reason" line per record, oldest first, and read
+/// back with parse() so that a trace recorded on a device replays on the host.
+class CoBmecWifiTrace {
+ public:
+
+  struct Record {
+    uint32_t tMs = 0;
+    CoBmecWifiStateMachine::WifiEvent wifiEvent;
+  };
+
+  void record(uint32_t tMs, const CoBmecWifiStateMachine::WifiEvent &wifiEvent);
+
+  /// @returns number of records held.
+  size_t size() const {
+    return count_;
+  };
+
+  /// @param index index from the oldest record.
+  /// @returns the record.
+  const Record &operator[](size_t index) const {
+    return records_[(head_ + CO_BMEC_WIFI_TRACE_LENGTH - count_ + index) % CO_BMEC_WIFI_TRACE_LENGTH];
+  };
+
+  void clear() {
+    head_ = 0;
+    count_ = 0;
+  };
+
+  size_t format(char *buffer, size_t length) const;
+
+  size_t parse(const char *text);
+
+  CoBmecWifiReplayDriver replay(CoBmecWifiStateMachine::Listener &listener,
+                                uint32_t seed = 1) const;
+
+ private:
+
+  Record records_[CO_BMEC_WIFI_TRACE_LENGTH];
+  size_t head_ = 0;  ///< Index of the next record to write.
+  size_t count_ = 0;
+};
+
+/// Clock driven by the caller with a deterministic random sequence.
+class CoBmecWifiVirtualClock : public CoBmecWifiStateMachine::Clock {
+ public:
+  explicit CoBmecWifiVirtualClock(uint32_t seed = 1)
+      : seed_(seed ? seed : 1) {};
+
+  uint32_t millis() override {
+    return tMs_;
+  };
+
+  uint32_t random(uint32_t max) override;
+
+  void advance(uint32_t ms) {
+    tMs_ += ms;
+  };
+
+ private:
+  uint32_t tMs_ = 0;
+  uint32_t seed_;
+};
+
+/// Driver that answers from a recorded trace.
+/// Pings return the next recorded ping result. Every other action is counted.
+class CoBmecWifiReplayDriver : public CoBmecWifiStateMachine::Driver {
+ public:
+  explicit CoBmecWifiReplayDriver(const CoBmecWifiTrace &trace)
+      : trace_(trace) {};
+
+  uint32_t connectCount_ = 0;
+  uint32_t disconnectCount_ = 0;
+  uint32_t pingCount_ = 0;
+  uint32_t scanCount_ = 0;
+  uint32_t connectedCount_ = 0;
+  uint32_t connectFailedCount_ = 0;
+
+  bool connect() override {
+    connectCount_++;
+    return true;
+  };
+
+  void disconnect() override {
+    disconnectCount_++;
+  };
+
+  bool ping() override;
+
+  long rssiDbm() override {
+    return 0;
+  };
+
+  bool scanNeeded() override {
+    return false;
+  };
+
+  void scan() override {
+    scanCount_++;
+  };
+
+  CoBmecWifiStateMachine::ScanResult scanDone() override {
+    return CoBmecWifiStateMachine::ScanResult::DONE;
+  };
+
+  bool betterApFound() override {
+    return false;
+  };
+
+  void onConnected() override {
+    connectedCount_++;
+  };
+
+  void onConnectFailed() override {
+    connectFailedCount_++;
+  };
+
+ private:
+  const CoBmecWifiTrace &trace_;
+  size_t pingIndex_ = 0;  ///< Next record to search for a ping result.
+};
+
+/// @}
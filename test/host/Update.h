@@ -0,0 +1,61 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @file Update.h
+/// @brief Host stand-in of the Arduino Update class, a flash sink that keeps what is written.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#ifndef log_e
+#define log_e(format, ...) printf("E " format "\n", ##__VA_ARGS__)
+#endif
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Collects the image written.
+class UpdateClass {
+ public:
+  std::vector<uint8_t> image_;
+  size_t capacity_ = SIZE_MAX;  ///< Writes past it fail, as a full partition.
+
+  size_t write(uint8_t *data, size_t length) {
+    if (image_.size() + length > capacity_) {
+      return 0;
+    }
+    image_.insert(image_.end(),
+                  data,
+                  data + length);
+    return length;
+  };
+
+  const char *errorString() {
+    return "partition full";
+  };
+
+  void clear() {
+    image_.clear();
+    capacity_ = SIZE_MAX;
+  };
+};
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+inline UpdateClass Update;
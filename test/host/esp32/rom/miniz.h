@@ -0,0 +1,111 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @file miniz.h
+/// @brief Host stand-in of the ROM miniz inflater, over zlib.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+///
+/// Only the streaming use of CoBmecOtaDecoder is covered: a zlib stream inflated into a
+/// wrapping TINFL_LZ_DICT_SIZE window. zlib keeps its own window, so the output may be
+/// written anywhere. The zlib state is allocated inside the decompressor, which the decoder
+/// releases with free().
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include <cstdint>
+#include <zlib.h>
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define TINFL_LZ_DICT_SIZE              32768
+#define TINFL_FLAG_PARSE_ZLIB_HEADER    1
+#define TINFL_FLAG_HAS_MORE_INPUT       2
+#define TINFL_ARENA_SIZE                (48 * 1024)  ///< zlib inflate state and window.
+
+#define tinfl_init(r) ((r)->started = false, (r)->arenaFill = 0)
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+enum tinfl_status {
+  TINFL_STATUS_BAD_PARAM = -3,
+  TINFL_STATUS_ADLER32_MISMATCH = -2,
+  TINFL_STATUS_FAILED = -1,
+  TINFL_STATUS_DONE = 0,
+  TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+  TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+};
+
+struct tinfl_decompressor {
+  bool started;
+  z_stream stream;
+  size_t arenaFill;
+  alignas(16) uint8_t arena[TINFL_ARENA_SIZE];
+};
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+/// Allocates from the arena of the decompressor, never freed.
+inline voidpf tinflAlloc(voidpf opaque, uInt items, uInt size) {
+  auto *r = static_cast<tinfl_decompressor *>(opaque);
+  size_t length = (size_t(items) * size + 15) & ~size_t(15);
+  if (length > sizeof(r->arena) - r->arenaFill) {
+    return Z_NULL;
+  }
+  voidpf memory = &r->arena[r->arenaFill];
+  r->arenaFill += length;
+  return memory;
+}
+
+inline void tinflFree(voidpf, voidpf) {}
+
+inline tinfl_status tinfl_decompress(tinfl_decompressor *r,
+                                     const uint8_t *pIn_buf_next,
+                                     size_t *pIn_buf_size,
+                                     uint8_t *,
+                                     uint8_t *pOut_buf_next,
+                                     size_t *pOut_buf_size,
+                                     const uint32_t decomp_flags) {
+  if (!(decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER)) {
+    return TINFL_STATUS_BAD_PARAM;
+  }
+  if (!r->started) {
+    r->stream = z_stream{};
+    r->stream.zalloc = tinflAlloc;
+    r->stream.zfree = tinflFree;
+    r->stream.opaque = r;
+    if (inflateInit(&r->stream) != Z_OK) {
+      return TINFL_STATUS_FAILED;
+    }
+    r->started = true;
+  }
+
+  r->stream.next_in = const_cast<Bytef *>(pIn_buf_next);
+  r->stream.avail_in = uInt(*pIn_buf_size);
+  r->stream.next_out = pOut_buf_next;
+  r->stream.avail_out = uInt(*pOut_buf_size);
+  int ret = inflate(&r->stream,
+                    Z_NO_FLUSH);
+  *pIn_buf_size -= r->stream.avail_in;
+  *pOut_buf_size -= r->stream.avail_out;
+
+  switch (ret) {
+    case Z_STREAM_END:
+      return TINFL_STATUS_DONE;
+    case Z_OK:
+    case Z_BUF_ERROR:
+      return r->stream.avail_out ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_HAS_MORE_OUTPUT;
+    default:
+      return TINFL_STATUS_FAILED;
+  }
+}
@@ -0,0 +1,30 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @file esp_ota_ops.h
+/// @brief Host stand-in of the ESP-IDF OTA API, the running image is set by the test.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include "esp_partition.h"
+
+//*********************************************************************
+// definitions.
+//*********************************************************************
+/// The running image, the base of a delta.
+inline esp_partition_t hostRunningPartition{nullptr, 0};
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+inline const esp_partition_t *esp_ota_get_running_partition() {
+  return hostRunningPartition.data ? &hostRunningPartition : nullptr;
+}
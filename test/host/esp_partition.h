@@ -0,0 +1,50 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @file esp_partition.h
+/// @brief Host stand-in of the ESP-IDF partition API, over a buffer.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+#pragma once
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define ESP_OK                      0
+#define ESP_FAIL                    (-1)
+#define ESP_ERR_INVALID_SIZE        0x104
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+using esp_err_t = int;
+
+/// A partition held in memory.
+struct esp_partition_t {
+  const uint8_t *data;
+  uint32_t size;
+};
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+inline esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size) {
+  if (offset > partition->size || size > partition->size - offset) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  memcpy(dst,
+         partition->data + offset,
+         size);
+  return ESP_OK;
+}
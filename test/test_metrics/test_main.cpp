@@ -0,0 +1,117 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @file test_main.cpp
+/// @brief Host tests of the Prometheus text formatted by the metrics registry.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstring>
+#include <string>
+#include <unity.h>
+#include "modules/metrics/co_bmec_metrics.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define TEST_BUFFER_SIZE             2048
+#define TEST_TRUNCATED_SIZE          40
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+/// The only metrics registered, the last registered is formatted first.
+static const uint32_t latencyBoundsMs[] = {10, 100, 1000};
+static CoBmecMetrics::Counter events("test_events_total",
+                                     "Events handled.");
+static CoBmecMetrics::Gauge temperature("test_temperature_celsius",
+                                        "Temperature.",
+                                        1000);
+static CoBmecMetrics::Gauge offset("test_offset",
+                                   "Sampled offset.",
+                                   1,
+                                   []() {
+                                     return int32_t(-7);
+                                   });
+static CoBmecMetrics::Histogram latency("test_latency_seconds",
+                                        "Request latency.",
+                                        latencyBoundsMs,
+                                        sizeof(latencyBoundsMs) / sizeof(latencyBoundsMs[0]),
+                                        1000);
+static CoBmecMetrics::GaugeFamily stacks("test_stack_free_bytes",
+                                         "Free stack per task.",
+                                         [](CoBmecMetrics::GaugeFamily::Samples &samples) {
+                                           samples.add("task=\"main\"",
+                                                       512);
+                                           samples.add("task=\"idle\",core=\"1\"",
+                                                       -3);
+                                         });
+
+static const char *expected =
+    "# HELP test_stack_free_bytes Free stack per task.\n"
+    "# TYPE test_stack_free_bytes gauge\n"
+    "test_stack_free_bytes{task=\"main\"} 512\n"
+    "test_stack_free_bytes{task=\"idle\",core=\"1\"} -3\n"
+    "# HELP test_latency_seconds Request latency.\n"
+    "# TYPE test_latency_seconds histogram\n"
+    "test_latency_seconds_bucket{le=\"0.01\"} 2\n"
+    "test_latency_seconds_bucket{le=\"0.1\"} 3\n"
+    "test_latency_seconds_bucket{le=\"1\"} 3\n"
+    "test_latency_seconds_bucket{le=\"+Inf\"} 4\n"
+    "test_latency_seconds_sum 2.065\n"
+    "test_latency_seconds_count 4\n"
+    "# HELP test_offset Sampled offset.\n"
+    "# TYPE test_offset gauge\n"
+    "test_offset -7\n"
+    "# HELP test_temperature_celsius Temperature.\n"
+    "# TYPE test_temperature_celsius gauge\n"
+    "test_temperature_celsius 21.5\n"
+    "# HELP test_events_total Events handled.\n"
+    "# TYPE test_events_total counter\n"
+    "test_events_total 4\n";
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_formats_prometheus_text(void) {
+  char buffer[TEST_BUFFER_SIZE];
+  size_t length = CoBmecMetrics::format(buffer,
+                                        sizeof(buffer));
+  TEST_ASSERT_EQUAL_STRING(expected,
+                           buffer);
+  TEST_ASSERT_EQUAL_size_t(strlen(expected),
+                           length);
+}
+
+void test_truncates_to_the_buffer(void) {
+  char buffer[TEST_TRUNCATED_SIZE];
+  size_t length = CoBmecMetrics::format(buffer,
+                                        sizeof(buffer));
+  TEST_ASSERT_EQUAL_size_t(sizeof(buffer) - 1,
+                           length);
+  TEST_ASSERT_EQUAL_STRING(std::string(expected,
+                                       sizeof(buffer) - 1).c_str(),
+                           buffer);
+}
+
+int main() {
+  events.add(3);
+  events.add();
+  temperature.set(21500);
+  latency.observe(5);
+  latency.observe(10);
+  latency.observe(50);
+  latency.observe(2000);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_formats_prometheus_text);
+  RUN_TEST(test_truncates_to_the_buffer);
+  return UNITY_END();
+}
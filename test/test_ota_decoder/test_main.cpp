@@ -0,0 +1,314 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @file test_main.cpp
+/// @brief Host tests decoding the payloads encoded by tools/ota_manifest.py.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+///
+/// The base image is the firmware named by CO_BMEC_OTA_TEST_BASE and the new image the one
+/// named by CO_BMEC_OTA_TEST_IMAGE, e.g. the firmware.bin of two releases. Without them the
+/// test executable stands in for the base, and the new image is the base with a patched
+/// function, an inserted block that shifts the rest and a changed tail.
+/// Needs python3 and openssl, as the tool does.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unity.h>
+#include <Update.h>
+#include <esp_ota_ops.h>
+#include "modules/ota/co_bmec_ota_decoder.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define TEST_CHUNK                   1021  ///< Odd feed size, so ops and the zlib stream split across chunks.
+#define TEST_PATCH_LEN               300
+#define TEST_INSERT_LEN              4096
+#define TEST_TAIL_LEN                1000
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Layout of CoBmecOta::Manifest, up to the signature.
+struct __attribute__((packed)) TestManifest {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t encoding;
+  uint8_t reserved[2];
+  uint32_t imageSize;
+  uint8_t sha256[CO_BMEC_OTA_SHA256_LEN];
+  uint32_t payloadSize;
+  uint32_t baseSize;
+  uint8_t baseSha256[CO_BMEC_OTA_SHA256_LEN];
+};
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+static std::string tool;
+static std::string directory;
+static std::vector<uint8_t> base;
+static std::vector<uint8_t> image;
+
+static bool readFile(const std::string &path, std::vector<uint8_t> &data) {
+  FILE *file = fopen(path.c_str(),
+                     "rb");
+  if (!file) {
+    return false;
+  }
+  data.clear();
+  uint8_t buffer[4096];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data.insert(data.end(),
+                buffer,
+                buffer + read);
+  }
+  fclose(file);
+  return true;
+}
+
+static bool writeFile(const std::string &path, const std::vector<uint8_t> &data) {
+  FILE *file = fopen(path.c_str(),
+                     "wb");
+  if (!file) {
+    return false;
+  }
+  bool written = fwrite(data.data(),
+                        1,
+                        data.size(),
+                        file) == data.size();
+  return fclose(file) == 0 && written;
+}
+
+/// Finds the tool next to the test sources, or from the project directory.
+static std::string findTool() {
+  std::string source = __FILE__;
+  std::string candidates[] = {
+      source.substr(0,
+                    source.rfind('/') + 1) + "../../tools/ota_manifest.py",
+      "tools/ota_manifest.py",
+  };
+  for (const auto &candidate : candidates) {
+    if (access(candidate.c_str(),
+               R_OK) == 0) {
+      return candidate;
+    }
+  }
+  return "";
+}
+
+/// Builds the new image from the base as a release would change it.
+static void editImage() {
+  uint32_t seed = 1;
+  auto random = [&seed]() {
+    seed = seed * 1664525 + 1013904223;
+    return uint8_t(seed >> 24);
+  };
+
+  size_t patchAt = base.size() / 3;
+  size_t insertAt = base.size() / 2;
+  size_t tailAt = base.size() - base.size() / 50;
+  image.assign(base.begin(),
+               base.begin() + tailAt);
+  for (size_t i = 0; i < TEST_PATCH_LEN; i++) {
+    image[patchAt + i] ^= random() | 1;
+  }
+  std::vector<uint8_t> block(TEST_INSERT_LEN);
+  for (auto &byte : block) {
+    byte = random();
+  }
+  image.insert(image.begin() + insertAt,
+               block.begin(),
+               block.end());
+  for (size_t i = 0; i < TEST_TAIL_LEN; i++) {
+    image.push_back(random());
+  }
+}
+
+/// Encodes the image with the tool.
+/// @param options encoding options of the tool.
+/// @param payload output, the payload to download.
+/// @param manifest output.
+/// @returns false if the tool failed.
+static bool encode(const std::string &options, std::vector<uint8_t> &payload, TestManifest &manifest) {
+  std::string command = "python3 " + tool + " " + directory + "/image.bin " + directory + "/key.pem "
+      + options + " -o " + directory + "/manifest > /dev/null";
+  std::vector<uint8_t> manifestData;
+  if (system(command.c_str()) != 0
+      || !readFile(directory + "/manifest",
+                   manifestData)
+      || manifestData.size() < sizeof(manifest)) {
+    return false;
+  }
+  memcpy(&manifest,
+         manifestData.data(),
+         sizeof(manifest));
+  return readFile(manifest.encoding ? directory + "/image.bin.ota" : directory + "/image.bin",
+                  payload);
+}
+
+/// Decodes the payload as the device does.
+/// @param running running image, the base of a delta.
+/// @param sha256 output, SHA-256 of the image written.
+/// @returns the first failure of the decoder.
+static CoBmecOtaDecoder::Result decode(const std::vector<uint8_t> &payload,
+                                       const TestManifest &manifest,
+                                       const std::vector<uint8_t> &running,
+                                       uint8_t *sha256) {
+  hostRunningPartition = {running.data(), uint32_t(running.size())};
+  CoBmecOtaDecoder decoder(manifest.encoding);
+  CoBmecOtaDecoder::Result result = decoder.begin(manifest.baseSize,
+                                                  manifest.baseSha256);
+  for (size_t offset = 0; result == CoBmecOtaDecoder::Result::OK && offset < payload.size(); offset += TEST_CHUNK) {
+    result = decoder.write(&payload[offset],
+                           std::min(size_t(TEST_CHUNK),
+                                    payload.size() - offset));
+  }
+  if (result == CoBmecOtaDecoder::Result::OK) {
+    result = decoder.end(sha256);
+  }
+  if (result == CoBmecOtaDecoder::Result::OK) {
+    TEST_ASSERT_EQUAL_UINT32(manifest.imageSize,
+                             decoder.getWritten());
+  }
+  return result;
+}
+
+/// Encodes with the options, decodes and checks the image against the manifest.
+static void roundTrip(const std::string &options, CoBmecOtaDecoder::Encoding encoding) {
+  if (tool.empty()) {
+    TEST_IGNORE_MESSAGE("tools/ota_manifest.py, python3 or openssl not found.");
+  }
+
+  std::vector<uint8_t> payload;
+  TestManifest manifest{};
+  TEST_ASSERT_TRUE(encode(options,
+                          payload,
+                          manifest));
+  TEST_ASSERT_EQUAL_UINT8(static_cast<uint8_t>(encoding),
+                          manifest.encoding);
+  TEST_ASSERT_EQUAL_UINT32(payload.size(),
+                           manifest.payloadSize);
+
+  uint8_t sha256[CO_BMEC_OTA_SHA256_LEN];
+  TEST_ASSERT_TRUE(decode(payload,
+                          manifest,
+                          base,
+                          sha256) == CoBmecOtaDecoder::Result::OK);
+  TEST_ASSERT_EQUAL_MEMORY(manifest.sha256,
+                           sha256,
+                           sizeof(sha256));
+  TEST_ASSERT_TRUE(Update.image_ == image);
+
+  char report[96];
+  snprintf(report,
+           sizeof(report),
+           "Payload %lu bytes for an image of %lu bytes",
+           (unsigned long) payload.size(),
+           (unsigned long) image.size());
+  TEST_MESSAGE(report);
+}
+
+void setUp(void) {
+  Update.clear();
+}
+
+void tearDown(void) {}
+
+void test_decodes_raw(void) {
+  roundTrip("",
+            CoBmecOtaDecoder::Encoding::RAW);
+}
+
+void test_decodes_deflate(void) {
+  roundTrip("--compress",
+            CoBmecOtaDecoder::Encoding::DEFLATE);
+}
+
+void test_decodes_delta(void) {
+  roundTrip("--base " + directory + "/base.bin",
+            CoBmecOtaDecoder::Encoding::DELTA);
+}
+
+void test_decodes_deflated_delta(void) {
+  roundTrip("--compress --base " + directory + "/base.bin",
+            static_cast<CoBmecOtaDecoder::Encoding>(static_cast<uint8_t>(CoBmecOtaDecoder::Encoding::DEFLATE)
+                                                    | static_cast<uint8_t>(CoBmecOtaDecoder::Encoding::DELTA)));
+}
+
+/// A device running another image rejects the delta before writing.
+void test_delta_rejects_other_base(void) {
+  if (tool.empty()) {
+    TEST_IGNORE_MESSAGE("tools/ota_manifest.py, python3 or openssl not found.");
+  }
+
+  std::vector<uint8_t> payload;
+  TestManifest manifest{};
+  TEST_ASSERT_TRUE(encode("--compress --base " + directory + "/base.bin",
+                          payload,
+                          manifest));
+  std::vector<uint8_t> other = base;
+  other[other.size() / 2] ^= 1;
+  uint8_t sha256[CO_BMEC_OTA_SHA256_LEN];
+  TEST_ASSERT_TRUE(decode(payload,
+                          manifest,
+                          other,
+                          sha256) == CoBmecOtaDecoder::Result::BAD_BASE);
+  TEST_ASSERT_EQUAL_size_t(0,
+                           Update.image_.size());
+}
+
+int main(int, char **argv) {
+  // The images, real firmware if given.
+  const char *basePath = getenv("CO_BMEC_OTA_TEST_BASE");
+  const char *imagePath = getenv("CO_BMEC_OTA_TEST_IMAGE");
+  bool loaded = basePath && imagePath ? readFile(basePath,
+                                                 base) && readFile(imagePath,
+                                                                   image)
+                                      : readFile(argv[0],
+                                                 base);
+  if (loaded && !(basePath && imagePath)) {
+    editImage();
+  }
+
+  // Scratch directory and signing key.
+  char scratch[] = "/tmp/test_ota_decoderXXXXXX";
+  directory = mkdtemp(scratch) ? scratch : "";
+  tool = findTool();
+  std::string keyCommand = "openssl ecparam -name prime256v1 -genkey -noout -out " + directory + "/key.pem";
+  if (!loaded || directory.empty() || tool.empty()
+      || !writeFile(directory + "/base.bin",
+                    base)
+      || !writeFile(directory + "/image.bin",
+                    image)
+      || system(keyCommand.c_str()) != 0) {
+    tool.clear();
+  }
+
+  UNITY_BEGIN();
+  RUN_TEST(test_decodes_raw);
+  RUN_TEST(test_decodes_deflate);
+  RUN_TEST(test_decodes_delta);
+  RUN_TEST(test_decodes_deflated_delta);
+  RUN_TEST(test_delta_rejects_other_base);
+  int failures = UNITY_END();
+
+  if (!directory.empty()) {
+    std::string cleanup = "rm -rf " + directory;
+    (void) system(cleanup.c_str());
+  }
+  return failures;
+}
@@ -0,0 +1,474 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @file test_main.cpp
+/// @brief Host tests of the resumable OTA download against a local HTTP server.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unity.h>
+#include <Update.h>
+#include "modules/ota/co_bmec_ota_download.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define TEST_PAYLOAD_SIZE            (80 * 1024)
+#define TEST_DROP_AFTER              20000  ///< Bytes sent before the server drops a connection.
+#define TEST_CHUNK                   512  ///< Throttled send size.
+#define TEST_CHUNK_DELAY_US          100  ///< Pause between throttled sends.
+#define TEST_STALL_MS                500  ///< Time the server holds a stalled connection.
+#define TEST_TIMEOUT_MS              100  ///< Download timeout, shorter than the stall.
+#define TEST_RETRY_MS                1
+#define TEST_SOCKET_TIMEOUT_MS       2000
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// What the server does with each request.
+struct Script {
+  size_t dropAfter = 0;  ///< Body bytes sent before closing, 0 for all.
+  size_t stallAfter = 0;  ///< Body bytes sent before going silent, 0 for never.
+  bool ignoreRange = false;  ///< Answer 200 with the whole payload.
+  bool closeAfterHeaders = false;  ///< Send the headers and close, no progress is made.
+  int status = 0;  ///< Status sent without a body, 0 to serve the payload.
+};
+
+/// Single threaded HTTP/1.1 server on the loopback interface, one request per connection.
+class TestServer {
+ public:
+  TestServer(const std::vector<uint8_t> &payload, const Script &script)
+      : payload_(payload),
+        script_(script) {
+    listenFd_ = socket(AF_INET,
+                       SOCK_STREAM,
+                       0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(listenFd_,
+         reinterpret_cast<sockaddr *>(&address),
+         sizeof(address));
+    listen(listenFd_,
+           4);
+    getsockname(listenFd_,
+                reinterpret_cast<sockaddr *>(&address),
+                &length);
+    port_ = ntohs(address.sin_port);
+    thread_ = std::thread([this]() {
+      serve();
+    });
+  };
+
+  ~TestServer() {
+    stopping_ = true;
+    shutdown(listenFd_,
+             SHUT_RDWR);
+    close(listenFd_);
+    thread_.join();
+  };
+
+  uint16_t port() const {
+    return port_;
+  };
+
+  /// @returns the offsets requested, 0 for a request without a Range.
+  std::vector<size_t> offsets() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return offsets_;
+  };
+
+ private:
+  const std::vector<uint8_t> &payload_;
+  Script script_;
+  int listenFd_;
+  uint16_t port_;
+  std::thread thread_;
+  std::atomic<bool> stopping_{false};
+  std::mutex mutex_;
+  std::vector<size_t> offsets_;
+
+  void serve() {
+    while (!stopping_) {
+      int fd = accept(listenFd_,
+                      nullptr,
+                      nullptr);
+      if (fd < 0) {
+        continue;
+      }
+      handle(fd);
+      close(fd);
+    }
+  };
+
+  void handle(int fd) {
+    std::string request;
+    char c;
+    while (request.find("\r\n\r\n") == std::string::npos && recv(fd, &c, 1, 0) == 1) {
+      request += c;
+    }
+
+    size_t offset = 0;
+    size_t range = request.find("Range: bytes=");
+    if (range != std::string::npos) {
+      offset = strtoul(request.c_str() + range + strlen("Range: bytes="),
+                       nullptr,
+                       10);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      offsets_.push_back(offset);
+    }
+
+    char headers[160];
+    if (script_.status) {
+      snprintf(headers,
+               sizeof(headers),
+               "HTTP/1.1 %d Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+               script_.status);
+      sendAll(fd,
+              headers,
+              strlen(headers));
+      return;
+    }
+
+    if (script_.ignoreRange) {
+      offset = 0;
+    }
+    snprintf(headers,
+             sizeof(headers),
+             "HTTP/1.1 %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+             offset ? "206 Partial Content" : "200 OK",
+             (unsigned long) (payload_.size() - offset));
+    sendAll(fd,
+            headers,
+            strlen(headers));
+    if (script_.closeAfterHeaders) {
+      return;
+    }
+
+    // Throttled body.
+    size_t sent = 0;
+    while (offset + sent < payload_.size()) {
+      if (script_.dropAfter && sent >= script_.dropAfter) {
+        return;
+      }
+      if (script_.stallAfter && sent >= script_.stallAfter) {
+        script_.stallAfter = 0;
+        std::this_thread::sleep_for(std::chrono::milliseconds(TEST_STALL_MS));
+        return;
+      }
+      size_t chunk = std::min({size_t(TEST_CHUNK),
+                               payload_.size() - offset - sent,
+                               (script_.dropAfter ? script_.dropAfter : SIZE_MAX) - sent,
+                               (script_.stallAfter ? script_.stallAfter : SIZE_MAX) - sent});
+      if (!sendAll(fd,
+                   &payload_[offset + sent],
+                   chunk)) {
+        return;
+      }
+      sent += chunk;
+      std::this_thread::sleep_for(std::chrono::microseconds(TEST_CHUNK_DELAY_US));
+    }
+  };
+
+  static bool sendAll(int fd, const void *data, size_t length) {
+    auto *bytes = static_cast<const uint8_t *>(data);
+    while (length) {
+      ssize_t sent = send(fd,
+                          bytes,
+                          length,
+                          MSG_NOSIGNAL);
+      if (sent <= 0) {
+        return false;
+      }
+      bytes += sent;
+      length -= sent;
+    }
+    return true;
+  };
+};
+
+/// Wall clock.
+class TestClock : public CoBmecOtaDownload::Clock {
+ public:
+  uint32_t millis() override {
+    return uint32_t(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+  };
+
+  void delay(uint32_t ms) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  };
+};
+
+/// Plain HTTP client over a blocking socket.
+class TestConnection : public CoBmecOtaDownload::Connection {
+ public:
+  explicit TestConnection(uint16_t port)
+      : port_(port) {};
+
+  ~TestConnection() override {
+    end();
+  };
+
+  int get(size_t offset, int &length) override {
+    fd_ = socket(AF_INET,
+                 SOCK_STREAM,
+                 0);
+    timeval timeout{TEST_SOCKET_TIMEOUT_MS / 1000, 0};
+    setsockopt(fd_,
+               SOL_SOCKET,
+               SO_RCVTIMEO,
+               &timeout,
+               sizeof(timeout));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port_);
+    if (connect(fd_,
+                reinterpret_cast<sockaddr *>(&address),
+                sizeof(address))) {
+      return 0;
+    }
+
+    char request[128];
+    int requestLength = snprintf(request,
+                                 sizeof(request),
+                                 offset ? "GET /fw.bin HTTP/1.1\r\nHost: localhost\r\nRange: bytes=%lu-\r\n\r\n"
+                                        : "GET /fw.bin HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                                 (unsigned long) offset);
+    if (send(fd_,
+             request,
+             requestLength,
+             MSG_NOSIGNAL) != requestLength) {
+      return -1;
+    }
+
+    // Headers, a byte at a time so that no body byte is consumed.
+    std::string headers;
+    char c;
+    while (headers.find("\r\n\r\n") == std::string::npos) {
+      if (recv(fd_, &c, 1, 0) != 1) {
+        return -1;
+      }
+      headers += c;
+    }
+    int status = 0;
+    if (sscanf(headers.c_str(),
+               "HTTP/1.1 %d",
+               &status) != 1) {
+      return -1;
+    }
+    size_t contentLength = headers.find("Content-Length: ");
+    length = contentLength == std::string::npos ? -1 : atoi(headers.c_str() + contentLength + strlen("Content-Length: "));
+    return status;
+  };
+
+  size_t available() override {
+    int available = 0;
+    return ioctl(fd_,
+                 FIONREAD,
+                 &available) == 0 ? size_t(available) : 0;
+  };
+
+  int read(uint8_t *data, size_t length) override {
+    return int(recv(fd_,
+                    data,
+                    length,
+                    0));
+  };
+
+  bool connected() override {
+    char c;
+    return recv(fd_,
+                &c,
+                1,
+                MSG_PEEK | MSG_DONTWAIT) != 0;
+  };
+
+  void end() override {
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+  };
+
+ private:
+  uint16_t port_;
+  int fd_ = -1;
+};
+
+/// Counts the retries.
+class TestListener : public CoBmecOtaDownload::Listener {
+ public:
+  uint32_t retries_ = 0;
+  size_t done_ = 0;
+
+  void onConnect(size_t) override {};
+
+  void onPoll() override {};
+
+  void onProgress(size_t done, size_t) override {
+    done_ = done;
+  };
+
+  void onRetry(uint8_t, size_t, uint32_t) override {
+    retries_++;
+  };
+};
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+static std::vector<uint8_t> payload;
+
+/// Downloads the payload, unencoded, from a server running the script.
+/// @param offsets output, the offsets requested.
+/// @returns the result.
+static CoBmecOtaDownload::Result download(const Script &script, std::vector<size_t> &offsets) {
+  TestServer server(payload,
+                    script);
+  TestClock clock;
+  TestConnection connection(server.port());
+  TestListener listener;
+  CoBmecOtaDownload download(clock,
+                             connection,
+                             listener,
+                             TEST_TIMEOUT_MS,
+                             TEST_RETRY_MS);
+  CoBmecOtaDecoder decoder(static_cast<uint8_t>(CoBmecOtaDecoder::Encoding::RAW));
+  TEST_ASSERT_TRUE(decoder.begin(0,
+                                 nullptr) == CoBmecOtaDecoder::Result::OK);
+
+  CoBmecOtaDownload::Result result = download.run(decoder,
+                                                  payload.size());
+  if (result == CoBmecOtaDownload::Result::OK) {
+    uint8_t sha256[CO_BMEC_OTA_SHA256_LEN];
+    TEST_ASSERT_TRUE(decoder.end(sha256) == CoBmecOtaDecoder::Result::OK);
+  }
+  offsets = server.offsets();
+  return result;
+}
+
+void setUp(void) {
+  Update.clear();
+}
+
+void tearDown(void) {}
+
+/// A throttled server that drops every connection resumes from the last byte received.
+void test_download_resumes_after_drops(void) {
+  Script script;
+  script.dropAfter = TEST_DROP_AFTER;
+  std::vector<size_t> offsets;
+  TEST_ASSERT_TRUE(download(script,
+                            offsets) == CoBmecOtaDownload::Result::OK);
+
+  std::vector<size_t> expected;
+  for (size_t offset = 0; offset < payload.size(); offset += TEST_DROP_AFTER) {
+    expected.push_back(offset);
+  }
+  TEST_ASSERT_TRUE(offsets == expected);
+  TEST_ASSERT_TRUE(Update.image_ == payload);
+}
+
+/// A connection that goes silent is given up after the timeout and resumed.
+void test_download_resumes_after_stall(void) {
+  Script script;
+  script.stallAfter = TEST_DROP_AFTER;
+  std::vector<size_t> offsets;
+  TEST_ASSERT_TRUE(download(script,
+                            offsets) == CoBmecOtaDownload::Result::OK);
+  TEST_ASSERT_EQUAL_UINT32(2,
+                           offsets.size());
+  TEST_ASSERT_EQUAL_UINT32(TEST_DROP_AFTER,
+                           offsets[1]);
+  TEST_ASSERT_TRUE(Update.image_ == payload);
+}
+
+/// A server ignoring the Range would restart the payload, which is not retried.
+void test_ignored_range_is_not_retried(void) {
+  Script script;
+  script.dropAfter = TEST_DROP_AFTER;
+  script.ignoreRange = true;
+  std::vector<size_t> offsets;
+  TEST_ASSERT_TRUE(download(script,
+                            offsets) == CoBmecOtaDownload::Result::HTTP_ERROR);
+  TEST_ASSERT_EQUAL_UINT32(2,
+                           offsets.size());
+}
+
+/// An error status is not retried.
+void test_not_found_is_not_retried(void) {
+  Script script;
+  script.status = 404;
+  std::vector<size_t> offsets;
+  TEST_ASSERT_TRUE(download(script,
+                            offsets) == CoBmecOtaDownload::Result::HTTP_ERROR);
+  TEST_ASSERT_EQUAL_UINT32(1,
+                           offsets.size());
+}
+
+/// Attempts that make no progress are retried CO_BMEC_OTA_MAX_RETRIES times.
+void test_download_gives_up_without_progress(void) {
+  Script script;
+  script.closeAfterHeaders = true;
+  std::vector<size_t> offsets;
+  TEST_ASSERT_TRUE(download(script,
+                            offsets) == CoBmecOtaDownload::Result::INTERRUPTED);
+  TEST_ASSERT_EQUAL_UINT32(CO_BMEC_OTA_MAX_RETRIES + 1,
+                           offsets.size());
+}
+
+/// A decoder failure, here a full partition, stops the download.
+void test_decoder_failure_is_not_retried(void) {
+  Update.capacity_ = TEST_DROP_AFTER;
+  Script script;
+  std::vector<size_t> offsets;
+  TEST_ASSERT_TRUE(download(script,
+                            offsets) == CoBmecOtaDownload::Result::DECODE_FAILED);
+  TEST_ASSERT_EQUAL_UINT32(1,
+                           offsets.size());
+}
+
+int main() {
+  uint32_t seed = 1;
+  payload.resize(TEST_PAYLOAD_SIZE);
+  for (auto &byte : payload) {
+    seed = seed * 1664525 + 1013904223;
+    byte = uint8_t(seed >> 24);
+  }
+
+  UNITY_BEGIN();
+  RUN_TEST(test_download_resumes_after_drops);
+  RUN_TEST(test_download_resumes_after_stall);
+  RUN_TEST(test_ignored_range_is_not_retried);
+  RUN_TEST(test_not_found_is_not_retried);
+  RUN_TEST(test_download_gives_up_without_progress);
+  RUN_TEST(test_decoder_failure_is_not_retried);
+  return UNITY_END();
+}
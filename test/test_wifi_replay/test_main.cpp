@@ -0,0 +1,216 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @file test_main.cpp
+/// @brief Host tests of the deterministic replay of recorded wifi traces.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+///
+/// The trace is the one named by CO_BMEC_WIFI_TEST_TRACE, e.g. the output of the 't' serial
+/// command saved from a device. Without it a trace of drops, failed attempts and pings is
+/// recorded here, longer than the ring so that the oldest records are overwritten.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unity.h>
+#include "modules/wifi/co_bmec_wifi_trace.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define TEST_RECORDS                 (CO_BMEC_WIFI_TRACE_LENGTH * 3 / 2)
+#define TEST_SEED                    0x5eed
+#define TEST_FAIL_ONE_IN             4  ///< Share of connection attempts that fail.
+#define TEST_PING_FAIL_ONE_IN        5
+
+#define DISCONNECT_REASON_BEACON_TIMEOUT   200
+#define DISCONNECT_REASON_NO_AP_FOUND      201
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Records the state transitions of a replay.
+class TransitionListener : public CoBmecWifiStateMachine::Listener {
+ public:
+
+  /// AP states as is, scan states offset past them.
+  std::vector<int> transitions_;
+
+  void onApState(CoBmecWifiStateMachine::ApState apState) override {
+    transitions_.push_back(static_cast<int>(apState));
+  };
+
+  void onScanState(CoBmecWifiStateMachine::ScanState scanState) override {
+    transitions_.push_back(static_cast<int>(CoBmecWifiStateMachine::ApState::PINGED) + 1
+                               + static_cast<int>(scanState));
+  };
+};
+
+/// Outcome of a replay.
+struct Replay {
+  std::vector<int> transitions;
+  uint32_t connectCount;
+  uint32_t disconnectCount;
+  uint32_t pingCount;
+  uint32_t connectedCount;
+  uint32_t connectFailedCount;
+};
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+static CoBmecWifiTrace trace;
+
+/// Records a device session: connection attempts, some failing, pings and drops.
+static void recordTrace() {
+  CoBmecWifiVirtualClock random(TEST_SEED);
+  uint32_t tMs = 0;
+  size_t records = 0;
+  auto record = [&](CoBmecWifiStateMachine::Event event, uint8_t reason = 0) {
+    trace.record(tMs,
+                 {event, reason});
+    records++;
+  };
+
+  record(CoBmecWifiStateMachine::Event::STA_START);
+  while (records < TEST_RECORDS) {
+    tMs += 100 + random.random(1000);
+    if (random.random(TEST_FAIL_ONE_IN) == 0) {
+      tMs += 3000;
+      record(CoBmecWifiStateMachine::Event::STA_DISCONNECTED,
+             DISCONNECT_REASON_NO_AP_FOUND);
+      continue;
+    }
+
+    record(CoBmecWifiStateMachine::Event::STA_CONNECTED);
+    tMs += 50 + random.random(500);
+    record(CoBmecWifiStateMachine::Event::STA_GOT_IP);
+    for (uint32_t pings = 1 + random.random(3); pings; pings--) {
+      tMs += 200;
+      record(random.random(TEST_PING_FAIL_ONE_IN) ? CoBmecWifiStateMachine::Event::PING_SUCCEEDED
+                                                  : CoBmecWifiStateMachine::Event::PING_FAILED);
+    }
+    tMs += 10000 + random.random(50000);
+    record(CoBmecWifiStateMachine::Event::STA_DISCONNECTED,
+           DISCONNECT_REASON_BEACON_TIMEOUT);
+  }
+}
+
+static Replay replay(const CoBmecWifiTrace &replayed) {
+  TransitionListener listener;
+  CoBmecWifiReplayDriver driver = replayed.replay(listener);
+  return {listener.transitions_,
+          driver.connectCount_,
+          driver.disconnectCount_,
+          driver.pingCount_,
+          driver.connectedCount_,
+          driver.connectFailedCount_};
+}
+
+static void assertEqual(const Replay &expected, const Replay &actual) {
+  TEST_ASSERT_EQUAL_size_t(expected.transitions.size(),
+                           actual.transitions.size());
+  TEST_ASSERT_TRUE(expected.transitions == actual.transitions);
+  TEST_ASSERT_EQUAL_UINT32(expected.connectCount,
+                           actual.connectCount);
+  TEST_ASSERT_EQUAL_UINT32(expected.disconnectCount,
+                           actual.disconnectCount);
+  TEST_ASSERT_EQUAL_UINT32(expected.pingCount,
+                           actual.pingCount);
+  TEST_ASSERT_EQUAL_UINT32(expected.connectedCount,
+                           actual.connectedCount);
+  TEST_ASSERT_EQUAL_UINT32(expected.connectFailedCount,
+                           actual.connectFailedCount);
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+/// Two replays of the same trace make the same transitions and driver calls.
+void test_replay_is_deterministic(void) {
+  Replay first = replay(trace);
+  Replay second = replay(trace);
+  assertEqual(first,
+              second);
+
+  // The replay follows the recorded session.
+  size_t gotIps = 0;
+  for (size_t index = 0; index < trace.size(); index++) {
+    gotIps += trace[index].wifiEvent.event == CoBmecWifiStateMachine::Event::STA_GOT_IP;
+  }
+  TEST_ASSERT_GREATER_THAN_UINT32(0,
+                                  first.connectedCount);
+  TEST_ASSERT_EQUAL_UINT32(gotIps,
+                           first.connectedCount);
+  TEST_ASSERT_GREATER_THAN_UINT32(0,
+                                  first.pingCount);
+
+  char report[128];
+  snprintf(report,
+           sizeof(report),
+           "%lu records, %lu transitions, %lu connections, %lu pings",
+           (unsigned long) trace.size(),
+           (unsigned long) first.transitions.size(),
+           (unsigned long) first.connectedCount,
+           (unsigned long) first.pingCount);
+  TEST_MESSAGE(report);
+}
+
+/// A trace exported as text replays as the recorded one.
+void test_exported_trace_replays(void) {
+  std::unique_ptr<char[]> text(new char[CO_BMEC_WIFI_TRACE_TEXT_LEN]);
+  size_t length = trace.format(text.get(),
+                               CO_BMEC_WIFI_TRACE_TEXT_LEN);
+  TEST_ASSERT_TRUE(length < CO_BMEC_WIFI_TRACE_TEXT_LEN - 1);
+
+  CoBmecWifiTrace exported;
+  TEST_ASSERT_EQUAL_size_t(trace.size(),
+                           exported.parse(text.get()));
+  for (size_t index = 0; index < trace.size(); index++) {
+    TEST_ASSERT_EQUAL_UINT32(trace[index].tMs,
+                             exported[index].tMs);
+    TEST_ASSERT_TRUE(trace[index].wifiEvent.event == exported[index].wifiEvent.event);
+    TEST_ASSERT_EQUAL_UINT8(trace[index].wifiEvent.reason,
+                            exported[index].wifiEvent.reason);
+  }
+  assertEqual(replay(trace),
+              replay(exported));
+}
+
+int main() {
+  // The trace, from a device if given.
+  const char *tracePath = getenv("CO_BMEC_WIFI_TEST_TRACE");
+  if (tracePath) {
+    std::string text;
+    FILE *file = fopen(tracePath,
+                       "r");
+    char buffer[256];
+    size_t read;
+    while (file && (read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      text.append(buffer,
+                  read);
+    }
+    if (file) {
+      fclose(file);
+    }
+    trace.parse(text.c_str());
+  }
+  else {
+    recordTrace();
+  }
+
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_is_deterministic);
+  RUN_TEST(test_exported_trace_replays);
+  return UNITY_END();
+}
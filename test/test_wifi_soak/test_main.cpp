@@ -0,0 +1,226 @@
+///   ___   _ _   ___   ___
+///  |___) | | | |___  |
+///  |___) |   | |___  |___
+///
+
+/// @file test_main.cpp
+/// @brief Host soak benchmark of the wifi reconnection latency.
+/// @author Raphael Smith.
+/// @copyright Copyright (c) 2021 BMEC Technologies. All rights reserved.
+
+//*********************************************************************
+// #includes.
+//*********************************************************************
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include <unity.h>
+#include "modules/wifi/co_bmec_wifi_state_machine.h"
+#include "modules/wifi/co_bmec_wifi_trace.h"
+
+//*********************************************************************
+// defines.
+//*********************************************************************
+#define SOAK_DISCONNECTS             10000
+#define SOAK_SEED                    0x5eed
+#define SOAK_UPTIME_MS               10000  ///< Minimum connected time between drops.
+#define SOAK_UPTIME_JITTER_MS        50000
+#define SOAK_ASSOCIATE_MS            100  ///< Minimum time to STA_CONNECTED.
+#define SOAK_ASSOCIATE_JITTER_MS     1000
+#define SOAK_DHCP_MS                 50  ///< Minimum time from STA_CONNECTED to STA_GOT_IP.
+#define SOAK_DHCP_JITTER_MS          500
+#define SOAK_FAIL_TIMEOUT_MS         3000  ///< Time for a failed attempt to report STA_DISCONNECTED.
+#define SOAK_FAIL_ONE_IN             4  ///< Share of connection attempts that fail.
+#define SOAK_PING_FAIL_ONE_IN        10  ///< Share of pings that fail.
+#define SOAK_P50_MAX_MS              2000  ///< Regression bounds on the reported percentiles.
+#define SOAK_P99_MAX_MS              16000
+
+#define DISCONNECT_REASON_BEACON_TIMEOUT   200
+#define DISCONNECT_REASON_NO_AP_FOUND      201
+
+//*********************************************************************
+// class declarations.
+//*********************************************************************
+/// Driver that answers connection attempts with scripted, randomly delayed driver events.
+/// The events are delivered by the soak loop once the virtual clock reaches them.
+class SoakDriver : public CoBmecWifiStateMachine::Driver {
+ public:
+  explicit SoakDriver(CoBmecWifiVirtualClock &clock)
+      : clock_(clock) {};
+
+  uint32_t connectCount_ = 0;
+  uint32_t connectFailedCount_ = 0;
+
+  /// Scripted driver event.
+  struct Pending {
+    uint32_t tMs;
+    CoBmecWifiStateMachine::WifiEvent wifiEvent;
+  };
+
+  std::vector<Pending> pending_;
+
+  bool connect() override {
+    connectCount_++;
+    uint32_t tMs = clock_.millis() + SOAK_ASSOCIATE_MS + clock_.random(SOAK_ASSOCIATE_JITTER_MS);
+    if (clock_.random(SOAK_FAIL_ONE_IN) == 0) {
+      pending_.push_back({clock_.millis() + SOAK_FAIL_TIMEOUT_MS,
+                          {CoBmecWifiStateMachine::Event::STA_DISCONNECTED, DISCONNECT_REASON_NO_AP_FOUND}});
+      return true;
+    }
+    pending_.push_back({tMs,
+                        {CoBmecWifiStateMachine::Event::STA_CONNECTED, 0}});
+    pending_.push_back({tMs + SOAK_DHCP_MS + clock_.random(SOAK_DHCP_JITTER_MS),
+                        {CoBmecWifiStateMachine::Event::STA_GOT_IP, 0}});
+    return true;
+  };
+
+  void disconnect() override {
+    pending_.clear();
+  };
+
+  bool ping() override {
+    return clock_.random(SOAK_PING_FAIL_ONE_IN) != 0;
+  };
+
+  long rssiDbm() override {
+    return -60;
+  };
+
+  bool scanNeeded() override {
+    return false;
+  };
+
+  void scan() override {};
+
+  CoBmecWifiStateMachine::ScanResult scanDone() override {
+    return CoBmecWifiStateMachine::ScanResult::DONE;
+  };
+
+  bool betterApFound() override {
+    return false;
+  };
+
+  void onConnected() override {};
+
+  void onConnectFailed() override {
+    connectFailedCount_++;
+  };
+
+  /// Removes and returns the earliest event due at the current time.
+  /// @returns false if no event is due.
+  bool due(CoBmecWifiStateMachine::WifiEvent &wifiEvent) {
+    auto next = std::min_element(pending_.begin(),
+                                 pending_.end(),
+                                 [](const Pending &a, const Pending &b) {
+                                   return a.tMs < b.tMs;
+                                 });
+    if (next == pending_.end() || next->tMs > clock_.millis()) {
+      return false;
+    }
+    wifiEvent = next->wifiEvent;
+    pending_.erase(next);
+    return true;
+  };
+
+ private:
+  CoBmecWifiVirtualClock &clock_;
+};
+
+/// Measures the time from a dropped connection to the next successful ping.
+class SoakListener : public CoBmecWifiStateMachine::Listener {
+ public:
+  explicit SoakListener(CoBmecWifiVirtualClock &clock)
+      : clock_(clock) {};
+
+  std::vector<uint32_t> latenciesMs_;
+  uint32_t disconnectTMs_ = 0;
+  bool reconnecting_ = false;
+
+  void onApState(CoBmecWifiStateMachine::ApState apState) override {
+    if (reconnecting_ && apState == CoBmecWifiStateMachine::ApState::PINGED) {
+      latenciesMs_.push_back(clock_.millis() - disconnectTMs_);
+      reconnecting_ = false;
+    }
+  };
+
+  void onScanState(CoBmecWifiStateMachine::ScanState) override {};
+
+ private:
+  CoBmecWifiVirtualClock &clock_;
+};
+
+//*********************************************************************
+// implementations.
+//*********************************************************************
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+/// Drops the connection SOAK_DISCONNECTS times at random and reports the reconnection latency
+/// percentiles, stepping the state machine at the wifi task period.
+void test_reconnect_latency(void) {
+  CoBmecWifiVirtualClock clock(SOAK_SEED);
+  SoakDriver driver(clock);
+  SoakListener listener(clock);
+  CoBmecWifiStateMachine stateMachine(clock,
+                                      driver,
+                                      listener);
+
+  stateMachine.onEvent({CoBmecWifiStateMachine::Event::STA_START, 0});
+  uint32_t dropTMs = 0;
+  uint32_t disconnects = 0;
+  while (disconnects < SOAK_DISCONNECTS || listener.reconnecting_) {
+    CoBmecWifiStateMachine::WifiEvent wifiEvent;
+    while (driver.due(wifiEvent)) {
+      stateMachine.onEvent(wifiEvent);
+    }
+
+    // Drop the connection a random time after it was established.
+    bool online = stateMachine.getApState() == CoBmecWifiStateMachine::ApState::PINGED;
+    if (online && !dropTMs) {
+      dropTMs = clock.millis() + SOAK_UPTIME_MS + clock.random(SOAK_UPTIME_JITTER_MS);
+    }
+    if (online && disconnects < SOAK_DISCONNECTS && clock.millis() >= dropTMs) {
+      dropTMs = 0;
+      disconnects++;
+      listener.disconnectTMs_ = clock.millis();
+      listener.reconnecting_ = true;
+      stateMachine.onEvent({CoBmecWifiStateMachine::Event::STA_DISCONNECTED, DISCONNECT_REASON_BEACON_TIMEOUT});
+    }
+
+    stateMachine.step();
+    clock.advance(CO_BMEC_WIFI_REPLAY_STEP_MS);
+  }
+
+  std::vector<uint32_t> &latenciesMs = listener.latenciesMs_;
+  TEST_ASSERT_EQUAL_UINT32(SOAK_DISCONNECTS,
+                           latenciesMs.size());
+  std::sort(latenciesMs.begin(),
+            latenciesMs.end());
+  uint32_t p50Ms = latenciesMs[latenciesMs.size() / 2];
+  uint32_t p99Ms = latenciesMs[latenciesMs.size() * 99 / 100];
+
+  char report[160];
+  snprintf(report,
+           sizeof(report),
+           "%lu disconnects, %lu attempts, %lu failed: reconnect p50 %lu ms, p99 %lu ms, max %lu ms",
+           (unsigned long) disconnects,
+           (unsigned long) driver.connectCount_,
+           (unsigned long) driver.connectFailedCount_,
+           (unsigned long) p50Ms,
+           (unsigned long) p99Ms,
+           (unsigned long) latenciesMs.back());
+  TEST_MESSAGE(report);
+
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(SOAK_P50_MAX_MS,
+                                   p50Ms);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(SOAK_P99_MAX_MS,
+                                   p99Ms);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_reconnect_latency);
+  return UNITY_END();
+}
@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+#   ___   _ _   ___   ___
+#  |___) | | | |___  |
+#  |___) |   | |___  |___
+#
+"""Decodes the binary log of CoBmecLog from a serial capture, using the ELF of the image
+running on the device to find the format strings.
+
+  pio device monitor --raw | tools/log_decode.py .pio/build/esp32dev/firmware.elf
+  tools/log_decode.py .pio/build/esp32dev/firmware.elf capture.bin
+
+The text around the frames, such as the boot messages and log_x output, is passed through.
+Needs pyelftools.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+from elftools.elf.constants import SH_FLAGS
+from elftools.elf.elffile import ELFFile
+
+FRAME_MAGIC = b"\xb5\x4c"
+FRAME_HEADER_LEN = 3  # Magic and record length.
+RECORD_HEADER = struct.Struct("<IIBB")  # Format address, time ms, module, level.
+
+# Order of CoBmecLog::Module.
+MODULES = ["app", "log", "wifi", "ble", "ota", "time", "display"]
+# Indexed by CoBmecLog::Level.
+LEVELS = ["N", "E", "W", "I", "D", "V"]
+
+# CoBmecLog::Tag.
+TAG_INT32 = 1
+TAG_INT64 = 2
+TAG_DOUBLE = 3
+TAG_STRING = 4
+TAG_STRING_ADDRESS = 5
+TAG_SECRET = 6
+
+CONVERSION = re.compile(r"%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|L|z|j|t)?([diouxXeEfgGcsp%])")
+
+
+class Image:
+    """Strings of the allocated sections of the ELF, by address."""
+
+    def __init__(self, path):
+        self.sections = []
+        with open(path, "rb") as elf_file:
+            for section in ELFFile(elf_file).iter_sections():
+                if section["sh_flags"] & SH_FLAGS.SHF_ALLOC and section["sh_type"] == "SHT_PROGBITS":
+                    self.sections.append((section["sh_addr"], section.data()))
+
+    def string(self, address):
+        for start, data in self.sections:
+            if start <= address < start + len(data):
+                end = data.find(b"\0", address - start)
+                return data[address - start:end if end >= 0 else len(data)].decode("utf-8", "replace")
+        return None
+
+
+def parse_args(image, payload):
+    """Returns the arguments of a record, a string for the strings and secrets."""
+    args = []
+    offset = 0
+    while offset < len(payload):
+        tag = payload[offset]
+        offset += 1
+        if tag == TAG_INT32:
+            args.append(("int", struct.unpack_from("<I", payload, offset)[0], 32))
+            offset += 4
+        elif tag == TAG_INT64:
+            args.append(("int", struct.unpack_from("<Q", payload, offset)[0], 64))
+            offset += 8
+        elif tag == TAG_DOUBLE:
+            args.append(("float", struct.unpack_from("<d", payload, offset)[0], 64))
+            offset += 8
+        elif tag == TAG_STRING:
+            length = payload[offset]
+            args.append(("str", payload[offset + 1:offset + 1 + length].decode("utf-8", "replace"), 0))
+            offset += 1 + length
+        elif tag == TAG_STRING_ADDRESS:
+            address = struct.unpack_from("<I", payload, offset)[0]
+            string = image.string(address)
+            args.append(("str", string if string is not None else "<0x%08x>" % address, 0))
+            offset += 4
+        elif tag == TAG_SECRET:
+            args.append(("str", "<secret>" if payload[offset] else "<empty>", 0))
+            offset += 1
+        else:
+            args.append(("str", "<tag %u>" % tag, 0))
+            break
+    return args
+
+
+def render(format_string, args):
+    """Formats the record as printf would, with the secrets and missing arguments marked."""
+    remaining = iter(args)
+
+    def convert(match):
+        flags, _, conversion = match.groups()
+        if conversion == "%":
+            return "%"
+        arg = next(remaining, None)
+        if arg is None:
+            return "<?>"
+        kind, value, bits = arg
+        if kind == "str" or conversion == "s":
+            return ("%" + flags + "s") % (value,)
+        if conversion == "p":
+            return "0x%08x" % int(value)
+        if kind == "int" and conversion in "di" and value >= 1 << (bits - 1):
+            value -= 1 << bits
+        if conversion == "c":
+            return chr(int(value) & 0xFF)
+        if conversion in "diouxX":
+            return ("%" + flags + conversion) % int(value)
+        return ("%" + flags + conversion) % float(value)
+
+    return CONVERSION.sub(convert, format_string)
+
+
+def decode_record(image, record):
+    format_address, time_ms, module, level = RECORD_HEADER.unpack_from(record)
+    format_string = image.string(format_address)
+    if format_string is None:
+        format_string = "<format 0x%08x, is this the ELF of the image?>" % format_address
+    message = render(format_string, parse_args(image, record[RECORD_HEADER.size:]))
+    return "%10u %s %-7s %s" % (time_ms,
+                                LEVELS[level] if level < len(LEVELS) else "?",
+                                MODULES[module] if module < len(MODULES) else "?",
+                                message)
+
+
+def decode(image, stream, out):
+    """Decodes the frames of the stream, passing the other bytes through."""
+    buffer = bytearray()
+
+    def process(final):
+        while True:
+            start = buffer.find(FRAME_MAGIC)
+            if start < 0:
+                # Keep a trailing first magic byte, the frame may start there.
+                keep = 1 if not final and buffer.endswith(FRAME_MAGIC[:1]) else 0
+                out.write(buffer[:len(buffer) - keep].decode("utf-8", "replace"))
+                del buffer[:len(buffer) - keep]
+                return
+            out.write(buffer[:start].decode("utf-8", "replace"))
+            del buffer[:start]
+
+            complete = len(buffer) >= FRAME_HEADER_LEN and len(buffer) >= FRAME_HEADER_LEN + buffer[2] + 1
+            if not complete and not final:
+                return
+            length = buffer[2] if len(buffer) >= FRAME_HEADER_LEN else 0
+            record = bytes(buffer[FRAME_HEADER_LEN:FRAME_HEADER_LEN + length])
+            if not complete or length < RECORD_HEADER.size or sum(record) & 0xFF != buffer[FRAME_HEADER_LEN + length]:
+                # Not a frame, or cut by other output. Resync after the magic.
+                out.write(buffer[:1].decode("utf-8", "replace"))
+                del buffer[:1]
+                continue
+            out.write(decode_record(image, record) + "\n")
+            del buffer[:FRAME_HEADER_LEN + length + 1]
+
+    while True:
+        chunk = stream.read1(4096) if hasattr(stream, "read1") else stream.read(4096)
+        if not chunk:
+            break
+        buffer.extend(chunk)
+        process(False)
+        out.flush()
+
+    process(True)
+    out.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="ELF of the image running on the device")
+    parser.add_argument("capture", nargs="?", help="serial capture, stdin if omitted")
+    args = parser.parse_args()
+
+    image = Image(args.elf)
+    if args.capture:
+        with open(args.capture, "rb") as capture:
+            decode(image, capture, sys.stdout)
+    else:
+        decode(image, sys.stdin.buffer, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+#   ___   _ _   ___   ___
+#  |___) | | | |___  |
+#  |___) |   | |___  |___
+#
+"""Builds and signs the OTA manifest of a firmware image, see CoBmecOta::Manifest.
+
+  openssl ecparam -name prime256v1 -genkey -noout -out ota_key.pem
+  tools/ota_manifest.py .pio/build/esp32dev/firmware.bin ota_key.pem
+
+Writes firmware.bin.manifest, to be served next to the image. The public key of
+ota_key.pem goes in src/modules/ota/co_bmec_ota_key.h.
+
+The image may be encoded to cut the download, see CoBmecOtaDecoder:
+
+  tools/ota_manifest.py firmware.bin ota_key.pem --compress --base previous.bin
+
+writes firmware.bin.ota and firmware.bin.ota.manifest. --base is the .bin running on the
+devices, a device running anything else rejects the delta before writing. The payload is
+decoded back and compared to the image before anything is written.
+"""
+
+import argparse
+import hashlib
+import struct
+import subprocess
+import sys
+import zlib
+
+MANIFEST_MAGIC = 0x41544F42  # "BOTA".
+MANIFEST_VERSION = 2
+MAX_SIGNATURE_LEN = 72
+
+ENCODING_DEFLATE = 1 << 0
+ENCODING_DELTA = 1 << 1
+
+OP_COPY = 0
+OP_INSERT = 1
+BLOCK_SIZE = 64  # Smallest run of the base worth a COPY.
+
+
+def delta(base, image):
+    """Returns the ops rebuilding the image from the base."""
+    blocks = {}
+    for offset in range(0, len(base) - BLOCK_SIZE + 1, BLOCK_SIZE):
+        blocks.setdefault(base[offset:offset + BLOCK_SIZE], offset)
+
+    ops = bytearray()
+    insert = bytearray()
+
+    def flush_insert():
+        if insert:
+            ops.extend(struct.pack("<BI", OP_INSERT, len(insert)))
+            ops.extend(insert)
+            insert.clear()
+
+    position = 0
+    while position < len(image):
+        source = blocks.get(image[position:position + BLOCK_SIZE])
+        if source is None:
+            insert.append(image[position])
+            position += 1
+            continue
+
+        # Extend the match past the block.
+        length = BLOCK_SIZE
+        while (position + length < len(image) and source + length < len(base)
+               and image[position + length] == base[source + length]):
+            length += 1
+
+        flush_insert()
+        ops.extend(struct.pack("<BII", OP_COPY, source, length))
+        position += length
+
+    flush_insert()
+    return bytes(ops)
+
+
+def patch(base, ops):
+    """Returns the image rebuilt from the base, as the device does."""
+    image = bytearray()
+    position = 0
+    while position < len(ops):
+        if ops[position] == OP_COPY:
+            source, length = struct.unpack_from("<II", ops, position + 1)
+            if source + length > len(base):
+                raise ValueError("COPY out of the base")
+            image.extend(base[source:source + length])
+            position += 9
+        elif ops[position] == OP_INSERT:
+            (length,) = struct.unpack_from("<I", ops, position + 1)
+            image.extend(ops[position + 5:position + 5 + length])
+            position += 5 + length
+        else:
+            raise ValueError("Unknown op")
+    return bytes(image)
+
+
+def encode(image, base, compress):
+    """Returns the encoding bits and the payload of an image."""
+    encoding = 0
+    payload = image
+    if base is not None:
+        encoding |= ENCODING_DELTA
+        payload = delta(base, payload)
+    if compress:
+        encoding |= ENCODING_DEFLATE
+        payload = zlib.compress(payload, 9)
+
+    # Decode as the device would.
+    decoded = payload
+    if encoding & ENCODING_DEFLATE:
+        decoded = zlib.decompress(decoded)
+    if encoding & ENCODING_DELTA:
+        decoded = patch(base, decoded)
+    if decoded != image:
+        sys.exit("The payload does not decode to the image.")
+
+    return encoding, payload
+
+
+def build(image, payload, encoding, base, key_path):
+    """Returns the signed manifest of an image."""
+    base = base or b""
+    signed = struct.pack("<IBB2xI32sII32s",
+                         MANIFEST_MAGIC,
+                         MANIFEST_VERSION,
+                         encoding,
+                         len(image),
+                         hashlib.sha256(image).digest(),
+                         len(payload),
+                         len(base),
+                         hashlib.sha256(base).digest() if base else bytes(32))
+
+    # DER encoded ECDSA signature over the SHA-256 of the signed fields.
+    signature = subprocess.run(["openssl", "dgst", "-sha256", "-sign", key_path],
+                               input=signed,
+                               capture_output=True,
+                               check=True).stdout
+    if len(signature) > MAX_SIGNATURE_LEN:
+        sys.exit("Signature too long, is the key P-256?")
+
+    return signed + struct.pack("<B72s", len(signature), signature)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image", help="firmware .bin")
+    parser.add_argument("key", help="ECDSA P-256 private key, PEM")
+    parser.add_argument("-c", "--compress", action="store_true", help="deflate the payload")
+    parser.add_argument("-b", "--base", help="firmware .bin running on the devices, for a delta")
+    parser.add_argument("-o", "--output", help="manifest, defaults to <payload>.manifest")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as file:
+        image = file.read()
+    base = None
+    if args.base:
+        with open(args.base, "rb") as file:
+            base = file.read()
+
+    encoding, payload = encode(image, base, args.compress)
+    payload_path = args.image
+    if encoding:
+        payload_path = args.image + ".ota"
+        with open(payload_path, "wb") as file:
+            file.write(payload)
+
+    output = args.output or payload_path + ".manifest"
+    with open(output, "wb") as file:
+        file.write(build(image, payload, encoding, base, args.key))
+    print(f"{output}: {len(image)} bytes, sha256 {hashlib.sha256(image).hexdigest()}")
+    print(f"{payload_path}: {len(payload)} bytes, {100 * len(payload) // max(len(image), 1)}% of the image")
+
+
+if __name__ == "__main__":
+    main()